@@ -0,0 +1,199 @@
+// async_client.cpp (C++20)
+// Implementation of the embeddable asynchronous client (see async_client.hpp).
+#include "async_client.hpp"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <sstream>
+
+#include "fd_passing.hpp"
+
+using namespace proto;
+
+AsyncClient::AsyncClient(aio::EventLoop& loop, size_t chunk_size)
+    : loop_(loop), buf_(chunk_size) {}
+
+bool AsyncClient::fail(const std::string& why) {
+    error_ = why;
+    return false;
+}
+
+aio::Task<bool> AsyncClient::connect(const std::string& host, int port) {
+    sock_ = co_await aio::async_connect(loop_, host, port);
+    if (!sock_.valid()) co_return fail("connect failed");
+    local_ = host.rfind("unix:", 0) == 0;
+    co_return true;
+}
+
+// Send one command line and expect "OK" (or the given reply) back.
+aio::Task<bool> AsyncClient::command(const std::string& line) {
+    if (!sock_.valid()) co_return fail("not connected");
+    bool ok = co_await sock_.send_line(line);
+    if (ok) ok = co_await sock_.recv_line(resp_);
+    if (!ok) {
+        sock_.close();
+        co_return fail("connection lost");
+    }
+    if (resp_ != "OK") co_return fail(resp_);
+    co_return true;
+}
+
+aio::Task<bool> AsyncClient::auth(const std::string& user, const std::string& pass) {
+    if (!sock_.valid()) co_return fail("not connected");
+    std::string line = "AUTH " + user + " " + pass;
+    bool ok = co_await sock_.send_line(line);
+    if (ok) ok = co_await sock_.recv_line(resp_);
+    if (!ok) {
+        sock_.close();
+        co_return fail("connection lost");
+    }
+    if (resp_ != "AUTH_OK") {
+        sock_.close();
+        co_return fail(resp_);
+    }
+    co_return true;
+}
+
+aio::Task<std::optional<std::vector<std::string>>> AsyncClient::list() {
+    bool ok = co_await command("LIST");
+    if (!ok) co_return std::nullopt;
+    ok = co_await sock_.recv_line(resp_);
+    if (!ok) {
+        sock_.close();
+        fail("connection lost");
+        co_return std::nullopt;
+    }
+    std::vector<std::string> names;
+    std::istringstream iss(resp_);
+    std::string n;
+    while (std::getline(iss, n)) {
+        if (!n.empty()) names.push_back(n);
+    }
+    co_return names;
+}
+
+aio::Task<bool> AsyncClient::get(const std::string& name, Sink sink) {
+    std::string line = "GET " + name;
+    bool ok = co_await command(line);
+    if (!ok) co_return false;
+
+    uint64_t size_be = 0;
+    ok = co_await sock_.recv_all(&size_be, sizeof(size_be));
+    if (!ok) {
+        sock_.close();
+        co_return fail("connection lost");
+    }
+    uint64_t left = be64_to_host(size_be);
+    while (left > 0) {
+        // hand over whatever arrived, no need to fill the whole buffer first
+        size_t want = (size_t)std::min<uint64_t>(buf_.size(), left);
+        ssize_t got = co_await sock_.recv_some(buf_.data(), want);
+        if (got <= 0) {
+            sock_.close();
+            co_return fail("connection lost");
+        }
+        xor_in_place(buf_.data(), (size_t)got);
+        if (!sink(buf_.data(), (size_t)got)) {
+            // the rest of the file is still in flight; the stream is unusable
+            sock_.close();
+            co_return fail("aborted by sink");
+        }
+        left -= (uint64_t)got;
+    }
+    co_return true;
+}
+
+aio::Task<bool> AsyncClient::put(const std::string& name, uint64_t size, Source source) {
+    std::string line = "PUT " + name + " " + std::to_string(size);
+    bool ok = co_await command(line);
+    if (!ok) co_return false;
+
+    uint64_t size_be = host_to_be64(size);
+    ok = co_await sock_.send_all(&size_be, sizeof(size_be));
+    if (!ok) {
+        sock_.close();
+        co_return fail("connection lost");
+    }
+    uint64_t left = size;
+    while (left > 0) {
+        size_t want = (size_t)std::min<uint64_t>(buf_.size(), left);
+        size_t got = source(buf_.data(), want);
+        if (got == 0) {
+            // the server expects exactly `size` bytes; nothing to recover
+            sock_.close();
+            co_return fail("source ended early");
+        }
+        got = std::min(got, want);
+        xor_in_place(buf_.data(), got);
+        ok = co_await sock_.send_all(buf_.data(), got);
+        if (!ok) {
+            sock_.close();
+            co_return fail("connection lost");
+        }
+        left -= got;
+    }
+    co_return true;
+}
+
+aio::Task<void> AsyncClient::quit() {
+    if (!sock_.valid()) co_return;
+    bool ok = co_await sock_.send_line("QUIT");
+    if (ok) co_await sock_.recv_line(resp_);
+    sock_.close();
+}
+
+aio::Task<int> AsyncClient::get_fd(const std::string& name) {
+    if (!sock_.valid()) {
+        fail("not connected");
+        co_return -1;
+    }
+    int fd = -1;
+    bool ok = co_await sock_.send_line("GETFD " + name);
+    if (ok) ok = co_await sock_.recv_line_fd(resp_, fd);
+    if (!ok) {
+        sock_.close();
+        fail("connection lost");
+        co_return -1;
+    }
+    if (resp_.rfind("OK ", 0) != 0 || fd < 0) {
+        if (fd >= 0) ::close(fd);
+        fail(resp_);
+        co_return -1;
+    }
+    co_return fd;
+}
+
+aio::Task<bool> AsyncClient::get_file(const std::string& name, const std::string& path) {
+    if (local_) {
+        int fd = co_await get_fd(name);
+        if (fd >= 0) {
+            bool ok = copy_fd_to_file(fd, path);
+            ::close(fd);
+            co_return ok || fail("cannot write " + path);
+        }
+        // anything but a refused fast path is final
+        if (error_ != "ERR NotLocal" && error_ != "ERR UnknownCmd") co_return false;
+    }
+    FILE* f = std::fopen(path.c_str(), "wb");
+    if (!f) co_return fail("cannot open " + path);
+    bool ok = co_await get(name, [f](const char* p, size_t n) {
+        return std::fwrite(p, 1, n, f) == n;
+    });
+    if (std::fclose(f) != 0 && ok) co_return fail("write error on " + path);
+    co_return ok;
+}
+
+aio::Task<bool> AsyncClient::put_file(const std::string& name, const std::string& path) {
+    FILE* f = std::fopen(path.c_str(), "rb");
+    if (!f) co_return fail("cannot open " + path);
+    std::fseek(f, 0, SEEK_END);
+    uint64_t size = (uint64_t)std::ftell(f);
+    std::fseek(f, 0, SEEK_SET);
+    bool ok = co_await put(name, size, [f](char* p, size_t cap) {
+        return std::fread(p, 1, cap, f);
+    });
+    std::fclose(f);
+    co_return ok;
+}
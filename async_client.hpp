@@ -0,0 +1,70 @@
+// async_client.hpp (C++20)
+// Embeddable asynchronous client for the file sharing server.
+// Every operation is a coroutine that runs on an aio::EventLoop, so one thread
+// can drive many clients (one per connection) at the same time:
+//
+//   aio::Task<void> fetch(aio::EventLoop& loop) {
+//       AsyncClient c(loop);
+//       bool ok = co_await c.connect("127.0.0.1", 8080);
+//       if (!ok) co_return;
+//       ok = co_await c.auth("alice", "alice123");
+//       if (!ok) co_return;
+//       co_await c.get("sample.txt", [](const char* p, size_t n) { ...; return true; });
+//       co_await c.quit();
+//   }
+//
+// Operations on one client must not overlap (the protocol is request/reply).
+// Keep co_await out of if/while conditions (see async_io.hpp).
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "async_io.hpp"
+#include "protocol.hpp"
+
+class AsyncClient {
+public:
+    // Receives decrypted file data straight from the socket buffer.
+    // Return false to abort the transfer (the connection is closed).
+    using Sink = std::function<bool(const char* data, size_t n)>;
+    // Fills buf with up to cap bytes of upload data; returns the count, 0 = EOF.
+    using Source = std::function<size_t(char* buf, size_t cap)>;
+
+    explicit AsyncClient(aio::EventLoop& loop, size_t chunk_size = proto::CHUNK_SIZE);
+
+    aio::Task<bool> connect(const std::string& host, int port);
+    aio::Task<bool> auth(const std::string& user, const std::string& pass);
+    aio::Task<std::optional<std::vector<std::string>>> list();
+    aio::Task<bool> get(const std::string& name, Sink sink);
+    aio::Task<bool> put(const std::string& name, uint64_t size, Source source);
+    aio::Task<void> quit();
+
+    // Same-host fast path (connected to a unix: endpoint): a read-only
+    // descriptor for the server's file, to copy or mmap; the caller closes
+    // it. -1 on failure, e.g. last_error() "ERR NotLocal" over TCP.
+    aio::Task<int> get_fd(const std::string& name);
+
+    // convenience wrappers around get()/put() for local files; get_file()
+    // copies through get_fd() when the server is on the same host
+    aio::Task<bool> get_file(const std::string& name, const std::string& path);
+    aio::Task<bool> put_file(const std::string& name, const std::string& path);
+
+    bool connected() const { return sock_.valid(); }
+    // Reason of the last failure ("ERR NotFound", "connection lost", ...).
+    const std::string& last_error() const { return error_; }
+
+private:
+    aio::Task<bool> command(const std::string& line);
+    bool fail(const std::string& why);
+
+    aio::EventLoop& loop_;
+    aio::AsyncSocket sock_;
+    bool local_ = false;   // connected over AF_UNIX
+    std::vector<char> buf_;
+    std::string resp_;
+    std::string error_;
+};
@@ -0,0 +1,414 @@
+// async_io.cpp (C++20)
+// epoll based implementation of the coroutine runtime (see async_io.hpp).
+#include "async_io.hpp"
+#include "fd_passing.hpp"
+#include "udp_transport.hpp"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+namespace aio {
+
+// ---- coroutine frames ----
+
+void* detail::PromiseBase::operator new(size_t n) {
+    FrameStats::bytes.fetch_add(n, std::memory_order_relaxed);
+    FrameStats::frames.fetch_add(1, std::memory_order_relaxed);
+    return ::operator new(n);
+}
+
+void detail::PromiseBase::operator delete(void* p, size_t n) {
+    FrameStats::bytes.fetch_sub(n, std::memory_order_relaxed);
+    FrameStats::frames.fetch_sub(1, std::memory_order_relaxed);
+    ::operator delete(p);
+}
+
+// ---- detached tasks ----
+
+struct EventLoop::Detached {
+    struct promise_type {
+        Detached get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+EventLoop::Detached EventLoop::run_detached(EventLoop* loop, Task<void> t) {
+    try {
+        co_await t;
+    } catch (const std::exception& e) {
+        std::cerr << "task failed: " << e.what() << "\n";
+    }
+    --loop->live_;
+}
+
+// ---- event loop ----
+
+EventLoop::EventLoop() {
+    epfd_ = epoll_create1(EPOLL_CLOEXEC);
+    wakefd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = wakefd_;
+    epoll_ctl(epfd_, EPOLL_CTL_ADD, wakefd_, &ev);
+}
+
+EventLoop::~EventLoop() {
+    if (wakefd_ >= 0) ::close(wakefd_);
+    if (epfd_ >= 0) ::close(epfd_);
+}
+
+void EventLoop::spawn(Task<void> t) {
+    ++live_;
+    run_detached(this, std::move(t));
+}
+
+void EventLoop::stop() {
+    post([this] { stopped_ = true; });
+}
+
+void EventLoop::post(std::function<void()> fn) {
+    {
+        std::lock_guard<std::mutex> lk(post_mu_);
+        posted_.push_back(std::move(fn));
+    }
+    uint64_t one = 1;
+    ssize_t r = ::write(wakefd_, &one, sizeof(one));
+    (void)r;
+}
+
+void EventLoop::drain_posted() {
+    uint64_t n;
+    while (::read(wakefd_, &n, sizeof(n)) > 0) {}
+    std::vector<std::function<void()>> fns;
+    {
+        std::lock_guard<std::mutex> lk(post_mu_);
+        fns.swap(posted_);
+    }
+    for (auto& fn : fns) fn();
+}
+
+bool EventLoop::watch(int fd) {
+    epoll_event ev{};
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.fd = fd;
+    if (epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev) < 0) return false;
+    waiters_[fd] = Waiters{};
+    return true;
+}
+
+void EventLoop::unwatch(int fd) {
+    epoll_ctl(epfd_, EPOLL_CTL_DEL, fd, nullptr);
+    waiters_.erase(fd);
+}
+
+void EventLoop::cancel(int fd) {
+    auto it = waiters_.find(fd);
+    if (it == waiters_.end()) return;
+    it->second.cancelled = true;
+    if (it->second.reader) schedule(std::exchange(it->second.reader, {}));
+    if (it->second.writer) schedule(std::exchange(it->second.writer, {}));
+}
+
+void EventLoop::IoAwaiter::await_suspend(std::coroutine_handle<> h) {
+    auto& w = loop->waiters_[fd];
+    (write ? w.writer : w.reader) = h;
+}
+
+void EventLoop::run() {
+    stopped_ = false;
+    epoll_event events[128];
+    while (!stopped_ && live_ > 0) {
+        // resume everything that is ready; new arrivals wait for the next round
+        for (size_t n = ready_.size(); n > 0; --n) {
+            auto h = ready_.front();
+            ready_.pop_front();
+            h.resume();
+        }
+        if (!deferred_.empty()) {
+            std::vector<std::function<void()>> fns;
+            fns.swap(deferred_);
+            for (auto& fn : fns) fn();
+        }
+        if (stopped_ || live_ == 0) break;
+
+        int timeout = -1;
+        if (!ready_.empty() || !deferred_.empty()) {
+            timeout = 0;
+        } else if (!timers_.empty() || !wheel_.empty()) {
+            auto next = Clock::time_point::max();
+            if (!timers_.empty()) next = timers_.begin()->first;
+            if (!wheel_.empty()) next = std::min(next, wheel_.next_tick());
+            auto ms = std::chrono::ceil<std::chrono::milliseconds>(next - Clock::now()).count();
+            timeout = ms < 0 ? 0 : (int)ms;
+        }
+
+        int n = epoll_wait(epfd_, events, 128, timeout);
+        if (n < 0 && errno != EINTR) { perror("epoll_wait"); break; }
+        for (int i = 0; i < n; ++i) {
+            int fd = events[i].data.fd;
+            if (fd == wakefd_) { drain_posted(); continue; }
+            auto it = waiters_.find(fd);
+            if (it == waiters_.end()) continue;
+            uint32_t e = events[i].events;
+            if ((e & (EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP)) && it->second.reader)
+                schedule(std::exchange(it->second.reader, {}));
+            if ((e & (EPOLLOUT | EPOLLERR | EPOLLHUP)) && it->second.writer)
+                schedule(std::exchange(it->second.writer, {}));
+        }
+
+        auto now = Clock::now();
+        while (!timers_.empty() && timers_.begin()->first <= now) {
+            schedule(timers_.begin()->second);
+            timers_.erase(timers_.begin());
+        }
+        wheel_.advance(now);
+    }
+}
+
+// ---- sockets ----
+
+AsyncSocket::AsyncSocket(EventLoop& loop, int fd) : loop_(&loop), fd_(fd) {
+    int fl = fcntl(fd_, F_GETFL, 0);
+    fcntl(fd_, F_SETFL, fl | O_NONBLOCK);
+    loop_->watch(fd_);
+}
+
+AsyncSocket::AsyncSocket(AsyncSocket&& o) noexcept
+    : loop_(o.loop_), fd_(std::exchange(o.fd_, -1)) {}
+
+AsyncSocket& AsyncSocket::operator=(AsyncSocket&& o) noexcept {
+    if (this != &o) {
+        close();
+        loop_ = o.loop_;
+        fd_ = std::exchange(o.fd_, -1);
+    }
+    return *this;
+}
+
+AsyncSocket::~AsyncSocket() { close(); }
+
+void AsyncSocket::close() {
+    if (fd_ < 0) return;
+    loop_->unwatch(fd_);
+    ::close(fd_);
+    fd_ = -1;
+}
+
+Task<bool> AsyncSocket::send_all(const void* data, size_t len) {
+    const char* p = (const char*)data;
+    while (len > 0) {
+        ssize_t s = ::send(fd_, p, len, MSG_NOSIGNAL);
+        if (s < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            bool ready = co_await loop_->writable(fd_);
+            if (!ready) { errno = ECANCELED; co_return false; }
+            continue;
+        }
+        if (s < 0 && errno == EINTR) continue;
+        if (s <= 0) co_return false;
+        p += s;
+        len -= (size_t)s;
+    }
+    co_return true;
+}
+
+Task<ssize_t> AsyncSocket::recv_some(void* data, size_t len) {
+    while (true) {
+        ssize_t r = ::recv(fd_, data, len, 0);
+        if (r >= 0) co_return r;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            bool ready = co_await loop_->readable(fd_);
+            if (!ready) { errno = ECANCELED; co_return -1; }
+            continue;
+        }
+        if (errno == EINTR) continue;
+        co_return -1;
+    }
+}
+
+Task<bool> AsyncSocket::recv_all(void* data, size_t len) {
+    char* p = (char*)data;
+    while (len > 0) {
+        ssize_t r = co_await recv_some(p, len);
+        if (r <= 0) co_return false;
+        p += r;
+        len -= (size_t)r;
+    }
+    co_return true;
+}
+
+Task<bool> AsyncSocket::send_line(const std::string& s) {
+    // header and payload in one sendmsg, without copying them into a frame
+    uint32_t n = htonl((uint32_t)s.size());
+    iovec iov[2] = {{&n, sizeof(n)}, {(void*)s.data(), s.size()}};
+    msghdr msg{};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    ssize_t sent = ::sendmsg(fd_, &msg, MSG_NOSIGNAL);
+    if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) co_return false;
+    // whatever did not fit (full socket buffer) goes the slow way
+    size_t done = sent > 0 ? (size_t)sent : 0;
+    if (done < sizeof(n)) {
+        bool ok = co_await send_all((const char*)&n + done, sizeof(n) - done);
+        if (!ok) co_return false;
+        done = sizeof(n);
+    }
+    done -= sizeof(n);
+    co_return co_await send_all(s.data() + done, s.size() - done);
+}
+
+Task<bool> AsyncSocket::recv_line(std::string& out, size_t max_len) {
+    uint32_t n = 0;
+    bool ok = co_await recv_all(&n, sizeof(n));
+    if (!ok) co_return false;
+    n = ntohl(n);
+    if (n > max_len) { errno = EMSGSIZE; co_return false; }
+    out.assign(n, '\0');
+    if (n == 0) co_return true;
+    co_return co_await recv_all(out.data(), n);
+}
+
+Task<bool> AsyncSocket::send_line_fd(const std::string& s, int fd) {
+    std::string frame(sizeof(uint32_t), '\0');
+    uint32_t n = htonl((uint32_t)s.size());
+    std::memcpy(frame.data(), &n, sizeof(n));
+    frame += s;
+    while (true) {
+        ssize_t sent = proto::sendmsg_fds(fd_, {fd}, frame.data(), frame.size());
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            bool ready = co_await loop_->writable(fd_);
+            if (!ready) { errno = ECANCELED; co_return false; }
+            continue;
+        }
+        if (sent <= 0) co_return false;
+        // the descriptor went with the first byte
+        co_return co_await send_all(frame.data() + sent, frame.size() - (size_t)sent);
+    }
+}
+
+Task<bool> AsyncSocket::recv_line_fd(std::string& out, int& fd, size_t max_len) {
+    fd = -1;
+    uint32_t n = 0;
+    std::vector<int> fds;
+    ssize_t got;
+    while (true) {
+        got = proto::recvmsg_fds(fd_, &n, sizeof(n), fds);
+        if (got >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) break;
+        bool ready = co_await loop_->readable(fd_);
+        if (!ready) { errno = ECANCELED; co_return false; }
+    }
+    bool ok = got > 0;
+    if (ok && got < (ssize_t)sizeof(n)) ok = co_await recv_all((char*)&n + got, sizeof(n) - (size_t)got);
+    if (ok) {
+        n = ntohl(n);
+        if (n > max_len) { errno = EMSGSIZE; ok = false; }
+    }
+    if (ok) {
+        out.assign(n, '\0');
+        if (n > 0) ok = co_await recv_all(out.data(), n);
+    }
+    for (size_t i = ok ? 1 : 0; i < fds.size(); ++i) ::close(fds[i]);
+    if (ok && !fds.empty()) fd = fds[0];
+    co_return ok;
+}
+
+Task<int> AsyncSocket::accept(sockaddr_storage* peer, socklen_t* len) {
+    sockaddr_storage tmp{};
+    socklen_t tmplen = sizeof(tmp);
+    if (!peer) { peer = &tmp; len = &tmplen; }
+    while (true) {
+        int cfd = ::accept4(fd_, (sockaddr*)peer, len, SOCK_CLOEXEC);
+        if (cfd >= 0) co_return cfd;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            bool ready = co_await loop_->readable(fd_);
+            if (!ready) { errno = ECANCELED; co_return -1; }
+            continue;
+        }
+        if (errno == EINTR || errno == ECONNABORTED) continue;
+        co_return -1;
+    }
+}
+
+// getaddrinfo for async_connect(). A numeric address resolves at once; a
+// name can take seconds (DNS), so it is looked up on a thread of its own,
+// which resumes the coroutine on its loop. Await a named Resolve: it is not
+// trivially destructible.
+struct Resolve {
+    EventLoop& loop;
+    std::string host, port;
+    addrinfo* res = nullptr;
+    int rc = 0;
+
+    static int lookup(const std::string& host, const std::string& port, int flags, addrinfo** res) {
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = flags;
+        return getaddrinfo(host.c_str(), port.c_str(), &hints, res);
+    }
+    bool await_ready() {
+        rc = lookup(host, port, AI_NUMERICHOST, &res);
+        return rc != EAI_NONAME;
+    }
+    void await_suspend(std::coroutine_handle<> h) {
+        std::thread([this, h] {
+            rc = lookup(host, port, 0, &res);
+            EventLoop* l = &loop;
+            l->post([l, h] { l->schedule(h); });
+        }).detach();
+    }
+    int await_resume() const noexcept { return rc; }
+};
+
+Task<AsyncSocket> async_connect(EventLoop& loop, const std::string& host, int port) {
+    if (host.rfind("unix:", 0) == 0) {
+        // a local connect completes (or fails) at once
+        int fd = proto::connect_unix(host.substr(5));
+        co_return fd < 0 ? AsyncSocket{} : AsyncSocket(loop, fd);
+    }
+    if (host.rfind("udp:", 0) == 0) {
+        // a stream over the UDP transport; its handshake runs in the background
+        int fd = udp::open_stream(host.substr(4), port);
+        co_return fd < 0 ? AsyncSocket{} : AsyncSocket(loop, fd);
+    }
+    Resolve resolve{loop, host, std::to_string(port)};
+    int rc = co_await resolve;
+    if (rc != 0) co_return AsyncSocket{};
+    addrinfo* res = resolve.res;
+    for (addrinfo* ai = res; ai; ai = ai->ai_next) {
+        int fd = ::socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd < 0) continue;
+        AsyncSocket sock(loop, fd);
+        if (::connect(fd, ai->ai_addr, ai->ai_addrlen) < 0) {
+            if (errno != EINPROGRESS) continue;
+            co_await loop.writable(fd);
+            int err = 0;
+            socklen_t elen = sizeof(err);
+            getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &elen);
+            if (err != 0) continue;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        freeaddrinfo(res);
+        co_return sock;
+    }
+    freeaddrinfo(res);
+    co_return AsyncSocket{};
+}
+
+} // namespace aio
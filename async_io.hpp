@@ -0,0 +1,279 @@
+// async_io.hpp (C++20)
+// Minimal coroutine runtime: Task<T>, a single-threaded epoll EventLoop and
+// non-blocking sockets whose operations can be co_await-ed.
+//
+//   aio::EventLoop loop;
+//   loop.spawn(my_coroutine(loop));   // Task<void>, runs until first suspension
+//   loop.run();                       // returns once every spawned task finished
+//
+// Everything except EventLoop::post() and EventLoop::stop() must be called on
+// the thread running the loop.
+//
+// Keep co_await out of if/while conditions: GCC 11/12 mis-compile a co_await
+// on a call with temporary arguments there. Bind the result to a local first.
+#pragma once
+
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "protocol.hpp"
+#include "timer_wheel.hpp"
+
+namespace aio {
+
+template <typename T = void> class Task;
+
+// Heap used by live coroutine frames (all threads), for memory accounting.
+struct FrameStats {
+    static inline std::atomic<size_t> bytes{0};
+    static inline std::atomic<size_t> frames{0};
+};
+
+namespace detail {
+
+struct PromiseBase {
+    // counted in FrameStats; defined out of line in async_io.cpp
+    static void* operator new(size_t n);
+    static void operator delete(void* p, size_t n);
+
+    std::coroutine_handle<> continuation = std::noop_coroutine();
+    std::exception_ptr error;
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    // hand control back to whoever co_await-ed us
+    struct FinalAwaiter {
+        bool await_ready() noexcept { return false; }
+        template <typename P>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+            return h.promise().continuation;
+        }
+        void await_resume() noexcept {}
+    };
+    FinalAwaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() { error = std::current_exception(); }
+};
+
+} // namespace detail
+
+// Lazily started coroutine; starts when co_await-ed (or spawned on a loop).
+template <typename T>
+class Task {
+public:
+    struct promise_type : detail::PromiseBase {
+        std::optional<T> value;
+        Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        template <typename U>
+        void return_value(U&& v) { value.emplace(std::forward<U>(v)); }
+    };
+
+    Task(Task&& o) noexcept : h_(std::exchange(o.h_, {})) {}
+    Task& operator=(Task&& o) noexcept {
+        if (this != &o) { if (h_) h_.destroy(); h_ = std::exchange(o.h_, {}); }
+        return *this;
+    }
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+    ~Task() { if (h_) h_.destroy(); }
+
+    bool await_ready() const noexcept { return !h_ || h_.done(); }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept {
+        h_.promise().continuation = caller;
+        return h_;
+    }
+    T await_resume() {
+        if (h_.promise().error) std::rethrow_exception(h_.promise().error);
+        return std::move(*h_.promise().value);
+    }
+
+private:
+    explicit Task(std::coroutine_handle<promise_type> h) : h_(h) {}
+    std::coroutine_handle<promise_type> h_;
+};
+
+template <>
+class Task<void> {
+public:
+    struct promise_type : detail::PromiseBase {
+        Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        void return_void() {}
+    };
+
+    Task(Task&& o) noexcept : h_(std::exchange(o.h_, {})) {}
+    Task& operator=(Task&& o) noexcept {
+        if (this != &o) { if (h_) h_.destroy(); h_ = std::exchange(o.h_, {}); }
+        return *this;
+    }
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+    ~Task() { if (h_) h_.destroy(); }
+
+    bool await_ready() const noexcept { return !h_ || h_.done(); }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept {
+        h_.promise().continuation = caller;
+        return h_;
+    }
+    void await_resume() {
+        if (h_.promise().error) std::rethrow_exception(h_.promise().error);
+    }
+
+private:
+    explicit Task(std::coroutine_handle<promise_type> h) : h_(h) {}
+    std::coroutine_handle<promise_type> h_;
+};
+
+class EventLoop {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    EventLoop();
+    ~EventLoop();
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    // Start a detached task. It runs until its first suspension right away
+    // and its frame is freed when it finishes.
+    void spawn(Task<void> t);
+
+    // Run until stop() is called or no spawned task is left.
+    void run();
+    void stop();                                // thread-safe
+    void post(std::function<void()> fn);        // thread-safe, runs fn on the loop
+
+    // Resume h on the next loop iteration.
+    void schedule(std::coroutine_handle<> h) { ready_.push_back(h); }
+    // Run fn once on the next loop iteration, after the ready coroutines.
+    void defer(std::function<void()> fn) { deferred_.push_back(std::move(fn)); }
+
+    // fd registration (edge triggered); AsyncSocket does this for you
+    bool watch(int fd);
+    void unwatch(int fd);
+    // Wake whoever waits on fd and make every further wait on it fail, until
+    // unwatch(). AsyncSocket operations on a cancelled fd return false/-1
+    // with errno = ECANCELED; the socket itself is left untouched.
+    void cancel(int fd);
+
+    // co_await yields false if the fd was cancelled instead of becoming ready
+    struct IoAwaiter {
+        EventLoop* loop; int fd; bool write;
+        bool await_ready() const noexcept { return loop->cancelled(fd); }
+        void await_suspend(std::coroutine_handle<> h);
+        bool await_resume() const noexcept { return !loop->cancelled(fd); }
+    };
+    IoAwaiter readable(int fd) { return {this, fd, false}; }
+    IoAwaiter writable(int fd) { return {this, fd, true}; }
+
+    struct SleepAwaiter {
+        EventLoop* loop; Clock::time_point when;
+        bool await_ready() const noexcept { return when <= Clock::now(); }
+        void await_suspend(std::coroutine_handle<> h) { loop->timers_.emplace(when, h); }
+        void await_resume() const noexcept {}
+    };
+    SleepAwaiter sleep_for(Clock::duration d) { return {this, Clock::now() + d}; }
+
+    struct YieldAwaiter {
+        EventLoop* loop;
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> h) { loop->schedule(h); }
+        void await_resume() const noexcept {}
+    };
+    YieldAwaiter yield() { return {this}; }
+
+    // Deadlines that fire a callback instead of resuming a coroutine, cheap
+    // enough for one or two per connection. Armed timers do not keep run()
+    // going.
+    TimerWheel& wheel() { return wheel_; }
+
+    size_t live_tasks() const { return live_; }
+
+private:
+    struct Waiters {
+        std::coroutine_handle<> reader;
+        std::coroutine_handle<> writer;
+        bool cancelled = false;
+    };
+
+    bool cancelled(int fd) const {
+        auto it = waiters_.find(fd);
+        return it != waiters_.end() && it->second.cancelled;
+    }
+
+    struct Detached;
+    static Detached run_detached(EventLoop* loop, Task<void> t);
+
+    void drain_posted();
+
+    int epfd_ = -1;
+    int wakefd_ = -1;
+    bool stopped_ = false;
+    size_t live_ = 0;
+    std::deque<std::coroutine_handle<>> ready_;
+    std::vector<std::function<void()>> deferred_;
+    std::multimap<Clock::time_point, std::coroutine_handle<>> timers_;
+    TimerWheel wheel_;
+    std::unordered_map<int, Waiters> waiters_;
+
+    std::mutex post_mu_;
+    std::vector<std::function<void()>> posted_;
+};
+
+// Non-blocking socket owned by one EventLoop. Closes the fd on destruction.
+class AsyncSocket {
+public:
+    AsyncSocket() = default;
+    AsyncSocket(EventLoop& loop, int fd);
+    AsyncSocket(AsyncSocket&& o) noexcept;
+    AsyncSocket& operator=(AsyncSocket&& o) noexcept;
+    AsyncSocket(const AsyncSocket&) = delete;
+    AsyncSocket& operator=(const AsyncSocket&) = delete;
+    ~AsyncSocket();
+
+    int fd() const { return fd_; }
+    bool valid() const { return fd_ >= 0; }
+    EventLoop& loop() const { return *loop_; }
+    void close();
+
+    // Same contracts as the blocking helpers in protocol.hpp.
+    Task<bool> send_all(const void* data, size_t len);
+    Task<bool> recv_all(void* data, size_t len);
+    Task<ssize_t> recv_some(void* data, size_t len);   // 0 = EOF, -1 = error
+    Task<bool> send_line(const std::string& s);
+    // Reuses out's capacity, so a buffer reserved up front is never
+    // reallocated; an over-long line fails with errno = EMSGSIZE.
+    Task<bool> recv_line(std::string& out, size_t max_len = proto::MAX_LINE);
+
+    // AF_UNIX sockets only: a line with one descriptor attached (GETFD
+    // replies); recv_line_fd() sets fd to -1 when none came with the line.
+    Task<bool> send_line_fd(const std::string& s, int fd);
+    Task<bool> recv_line_fd(std::string& out, int& fd, size_t max_len = proto::MAX_LINE);
+
+    // Listening sockets only: returns the accepted fd or -1.
+    Task<int> accept(sockaddr_storage* peer = nullptr, socklen_t* len = nullptr);
+
+private:
+    EventLoop* loop_ = nullptr;
+    int fd_ = -1;
+};
+
+// Resolve host (name or address) and connect without blocking the loop: a
+// name is looked up on a short-lived thread. host may also be "unix:/path"
+// or "udp:HOST". Returns a connected socket, or an invalid one on failure.
+Task<AsyncSocket> async_connect(EventLoop& loop, const std::string& host, int port);
+
+} // namespace aio
@@ -0,0 +1,61 @@
+// bounded_queue.hpp (C++17)
+// Fixed-capacity multi-producer / multi-consumer queue.
+// Producers never block (try_push fails when full), consumers wait in pop().
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : ring_(capacity ? capacity : 1) {}
+
+    // false when the queue is full or closed
+    bool try_push(T v) {
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            if (closed_ || count_ == ring_.size()) return false;
+            ring_[(head_ + count_) % ring_.size()] = std::move(v);
+            ++count_;
+        }
+        not_empty_.notify_one();
+        return true;
+    }
+
+    // blocks until an item is available; nullopt once closed and drained
+    std::optional<T> pop() {
+        std::unique_lock<std::mutex> lk(mu_);
+        not_empty_.wait(lk, [this] { return count_ > 0 || closed_; });
+        if (count_ == 0) return std::nullopt;
+        T v = std::move(ring_[head_]);
+        head_ = (head_ + 1) % ring_.size();
+        --count_;
+        return v;
+    }
+
+    void close() {
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            closed_ = true;
+        }
+        not_empty_.notify_all();
+    }
+
+    size_t size() const {
+        std::lock_guard<std::mutex> lk(mu_);
+        return count_;
+    }
+    size_t capacity() const { return ring_.size(); }
+
+private:
+    mutable std::mutex mu_;
+    std::condition_variable not_empty_;
+    std::vector<T> ring_;
+    size_t head_ = 0;
+    size_t count_ = 0;
+    bool closed_ = false;
+};
@@ -1,13 +1,16 @@
-// client.cpp (C++17)
+// client.cpp (C++20)
 // Network File Sharing Client with simple XOR "encryption"
-// Build: g++ -std=c++17 -O2 -Wall client.cpp -o client
+// Build: see README.md (links libfileshare)
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include <algorithm>
+#include <cerrno>
 #include <cstdint>
+#include <cstdlib>
 #include <cstring>
 #include <fstream>
 #include <iostream>
@@ -15,120 +18,28 @@
 #include <string>
 #include <vector>
 
-static const uint8_t XOR_KEY = 0x5A;
+#include "endpoint.hpp"
+#include "fd_passing.hpp"
+#include "protocol.hpp"
+#include "push.hpp"
+#include "swarm.hpp"
 
-bool send_all(int fd, const void* data, size_t len) {
-    const char* p = (const char*)data;
-    while (len > 0) {
-        ssize_t s = send(fd, p, len, 0);
-        if (s <= 0) return false;
-        p += s;
-        len -= (size_t)s;
-    }
-    return true;
-}
-
-bool recv_all(int fd, void* data, size_t len) {
-    char* p = (char*)data;
-    while (len > 0) {
-        ssize_t r = recv(fd, p, len, 0);
-        if (r <= 0) return false;
-        p += r;
-        len -= (size_t)r;
-    }
-    return true;
-}
-
-bool send_line(int fd, const std::string& s) {
-    uint32_t n = htonl((uint32_t)s.size());
-    if (!send_all(fd, &n, sizeof(n))) return false;
-    if (!send_all(fd, s.data(), s.size())) return false;
-    return true;
-}
-
-bool recv_line(int fd, std::string& out) {
-    uint32_t n = 0;
-    if (!recv_all(fd, &n, sizeof(n))) return false;
-    n = ntohl(n);
-    out.assign(n, '\0');
-    if (n == 0) return true;
-    if (!recv_all(fd, out.data(), n)) return false;
-    return true;
-}
-
-void xor_in_place(std::vector<char>& buf, size_t n) {
-    for (size_t i = 0; i < n; ++i) buf[i] ^= XOR_KEY;
-}
+using namespace proto;
 
-// byte order helpers (portable 64-bit conversions)
-uint64_t host_to_be64(uint64_t host) {
-    uint32_t hi = htonl((uint32_t)(host >> 32));
-    uint32_t lo = htonl((uint32_t)(host & 0xFFFFFFFFULL));
-    return ( (uint64_t)lo << 32 ) | hi;
-}
-uint64_t be64_to_host(uint64_t be) {
-    uint32_t lo = ntohl((uint32_t)(be >> 32));
-    uint32_t hi = ntohl((uint32_t)(be & 0xFFFFFFFFULL));
-    return ( (uint64_t)hi << 32 ) | lo;
-}
-
-bool recv_file_encrypted(int fd, const std::string& path) {
-    uint64_t size_be = 0;
-    if (!recv_all(fd, &size_be, sizeof(size_be))) return false;
-    uint64_t size = be64_to_host(size_be);
-
-    std::ofstream out(path, std::ios::binary | std::ios::trunc);
-    if (!out) return false;
-
-    std::vector<char> buf(64 * 1024);
-    uint64_t left = size;
-    uint64_t done = 0;
-
-    while (left > 0) {
-        size_t chunk = (size_t)std::min<uint64_t>(buf.size(), left);
-        if (!recv_all(fd, buf.data(), chunk)) return false;
-        xor_in_place(buf, chunk);
-        out.write(buf.data(), (std::streamsize)chunk);
-        left -= chunk;
-        done += chunk;
-        std::cout << "\rDownloaded " << done << " / " << size << " bytes" << std::flush;
-    }
-    std::cout << "\n";
-    return true;
-}
-
-bool send_file_encrypted(int fd, const std::string& path) {
-    std::ifstream in(path, std::ios::binary);
-    if (!in) return false;
-
-    in.seekg(0, std::ios::end);
-    uint64_t size = (uint64_t)in.tellg();
-    in.seekg(0, std::ios::beg);
-
-    uint64_t size_be = host_to_be64(size);
-    if (!send_all(fd, &size_be, sizeof(size_be))) return false;
-
-    std::vector<char> buf(64 * 1024);
-    uint64_t done = 0;
-
-    while (in) {
-        in.read(buf.data(), (std::streamsize)buf.size());
-        std::streamsize got = in.gcount();
-        if (got <= 0) break;
-        xor_in_place(buf, (size_t)got);
-        if (!send_all(fd, buf.data(), (size_t)got)) return false;
-        done += (uint64_t)got;
-        std::cout << "\rUploaded " << done << " / " << size << " bytes" << std::flush;
-    }
-    std::cout << "\n";
-    return true;
+// progress line printed while a transfer runs
+static ProgressFn progress_printer(const char* verb) {
+    return [verb](uint64_t done, uint64_t total) {
+        std::cout << "\r" << verb << " " << done << " / " << total << " bytes" << std::flush;
+    };
 }
 
 int main() {
     std::string server_ip = "file_server"; // default for Docker Compose
     int port = 8080;
 
-    std::cout << "Server IP [" << server_ip << "]: ";
+    // a host name, an IPv4/IPv6 address, unix:/path for a local server or
+    // udp:HOST for the UDP transport
+    std::cout << "Server [" << server_ip << "]: ";
     std::string ip_in; std::getline(std::cin, ip_in);
     if (!ip_in.empty()) server_ip = ip_in;
 
@@ -136,21 +47,13 @@ int main() {
     std::string port_in; std::getline(std::cin, port_in);
     if (!port_in.empty()) port = std::stoi(port_in);
 
-    int cfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (cfd < 0) { perror("socket"); return 1; }
-
-    sockaddr_in srv{};
-    srv.sin_family = AF_INET;
-    srv.sin_port = htons(port);
-    if (inet_pton(AF_INET, server_ip.c_str(), &srv.sin_addr) <= 0) {
-        std::cerr << "Invalid IP or hostname resolution failed.\n";
+    int cfd = connect_endpoint(server_ip, port);
+    bool local = server_ip.rfind("unix:", 0) == 0;   // GETs use the GETFD fast path
+    if (cfd < 0) {
+        std::cerr << "Cannot connect to " << server_ip << ": " << std::strerror(errno) << "\n";
         return 1;
     }
 
-    if (connect(cfd, (sockaddr*)&srv, sizeof(srv)) < 0) {
-        perror("connect"); return 1;
-    }
-
     // ---- AUTH ----
     std::string user, pass;
     std::cout << "Login: "; std::getline(std::cin, user);
@@ -162,18 +65,29 @@ int main() {
 
     std::string resp;
     if (!recv_line(cfd, resp)) { std::cerr << "No auth response\n"; return 1; }
+    if (resp.rfind("BUSY", 0) == 0) {
+        // "BUSY retry-after <seconds>": server is at capacity
+        std::string retry = resp.size() > 17 ? resp.substr(17) : "a few";
+        std::cerr << "Server busy, try again in " << retry << " second(s).\n"; return 1;
+    }
     if (resp != "AUTH_OK") {
-        std::cerr << "Authentication failed.\n"; return 1;
+        // "AUTH_FAIL [reason]", e.g. TooManySessions
+        std::string reason = resp.size() > 10 ? " (" + resp.substr(10) + ")" : "";
+        std::cerr << "Authentication failed" << reason << ".\n"; return 1;
     }
     std::cout << "Authentication successful.\n";
 
     // ---- Menu loop ----
+    swarm::Seeder seeder;   // started by the first swarm download
     while (true) {
         std::cout <<
             "\n1) List server files\n"
             "2) Download (GET)\n"
             "3) Upload (PUT)\n"
             "4) Quit\n"
+            "5) Swarm download (shares the file with other clients until you quit)\n"
+            "6) Wait for a pushed file\n"
+            "7) Push a server file to everyone waiting\n"
             "Choose: ";
         std::string ch; std::getline(std::cin, ch);
 
@@ -190,6 +104,25 @@ int main() {
             std::getline(std::cin, fname);
             if (fname.empty()) continue;
 
+            if (local) {
+                // same host: ask for the file itself instead of its bytes
+                int fd = -1;
+                if (!send_line(cfd, "GETFD " + fname)) { std::cerr << "send error\n"; break; }
+                if (!recv_line_fd(cfd, resp, fd)) { std::cerr << "recv error\n"; break; }
+                if (resp.rfind("OK ", 0) == 0 && fd >= 0) {
+                    bool ok = copy_fd_to_file(fd, fname);
+                    close(fd);
+                    if (ok) std::cout << "Copied " << resp.substr(3) << " bytes to '" << fname << "' (local fast path).\n";
+                    else std::cerr << "Local copy failed: " << std::strerror(errno) << "\n";
+                    continue;
+                }
+                if (fd >= 0) close(fd);
+                // older server or not a local session: fall back to GET
+                if (resp != "ERR NotLocal" && resp != "ERR UnknownCmd") {
+                    std::cerr << "Server: " << resp << "\n"; continue;
+                }
+            }
+
             std::ostringstream cmd; cmd << "GET " << fname;
             if (!send_line(cfd, cmd.str())) { std::cerr << "send error\n"; break; }
             if (!recv_line(cfd, resp)) { std::cerr << "recv error\n"; break; }
@@ -199,7 +132,11 @@ int main() {
             }
             std::string outpath = fname; // save locally with same name
             std::cout << "Downloading to '" << outpath << "'...\n";
-            if (!recv_file_encrypted(cfd, outpath)) {
+            TransferOptions opt;
+            opt.progress = progress_printer("Downloaded");
+            bool ok = recv_file_encrypted(cfd, outpath, opt);
+            std::cout << "\n";
+            if (!ok) {
                 std::cerr << "Download failed.\n"; break;
             }
             std::cout << "Download complete.\n";
@@ -215,18 +152,82 @@ int main() {
             auto pos = fname.find_last_of("/\\");
             if (pos != std::string::npos) fname = fname.substr(pos + 1);
 
-            std::ostringstream cmd; cmd << "PUT " << fname;
+            // the size lets the server check our quota before we send anything
+            struct stat st{};
+            if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+                std::cerr << "Cannot read '" << path << "'\n"; continue;
+            }
+            std::ostringstream cmd; cmd << "PUT " << fname << " " << (uint64_t)st.st_size;
             if (!send_line(cfd, cmd.str())) { std::cerr << "send error\n"; break; }
             if (!recv_line(cfd, resp)) { std::cerr << "recv error\n"; break; }
             if (resp != "OK") { std::cerr << "Server: " << resp << "\n"; continue; }
 
             std::cout << "Uploading '" << fname << "'...\n";
-            if (!send_file_encrypted(cfd, path)) {
+            TransferOptions opt;
+            opt.progress = progress_printer("Uploaded");
+            bool ok = send_file_encrypted(cfd, path, opt);
+            std::cout << "\n";
+            if (!ok) {
                 std::cerr << "Upload failed.\n"; break;
             }
             std::cout << "Upload complete.\n";
         }
+        else if (ch == "5") {
+            std::string fname;
+            std::cout << "Enter filename to download: ";
+            std::getline(std::cin, fname);
+            if (fname.empty()) continue;
+            // other clients fetch chunks from us on this port; by default the
+            // server tells them the address it sees us at
+            if (!seeder.port() && !seeder.start()) {
+                std::cerr << "Cannot listen for peers: " << std::strerror(errno) << "\n"; continue;
+            }
+            const char* host = std::getenv("FILESHARE_SWARM_HOST");
+            swarm::Stats stats;
+            std::string err;
+            if (!swarm::download(cfd, fname, fname, seeder, 4, host ? host : "", stats, err)) {
+                std::cerr << "Swarm download failed: " << err << "\n";
+                if (err == "connection lost") break;
+                continue;
+            }
+            std::cout << "Downloaded '" << fname << "': " << stats.from_peers << " chunks from peers, "
+                      << stats.from_server << " from the server (" << stats.retried << " retried).\n"
+                      << "Sharing it on port " << seeder.port() << " until you quit.\n";
+        }
+        else if (ch == "6") {
+            push::Group group;
+            std::string iface, err, name;
+            if (!push::subscribe(cfd, group, iface, err)) {
+                std::cerr << "Server: " << err << "\n";
+                if (err == "connection lost") break;
+                continue;
+            }
+            // join on the interface the server sends from when that is
+            // loopback (same host); else let the kernel pick one
+            const char* env = std::getenv("FILESHARE_PUSH_IFACE");
+            std::string join = env ? env : iface.rfind("127.", 0) == 0 ? iface : "";
+            std::cout << "Waiting for a push on " << group.addr << ":" << group.port << "...\n";
+            push::ReceiveStats stats;
+            if (!push::receive(cfd, group, join, ".", name, stats, err)) {
+                std::cerr << "Push failed: " << err << "\n";
+                if (err == "connection lost") break;
+                continue;
+            }
+            std::cout << "Received '" << name << "': " << stats.packets << " packets, " << stats.nacked
+                      << " asked for again in " << stats.rounds << " NACKs.\n";
+        }
+        else if (ch == "7") {
+            std::string fname;
+            std::cout << "Enter filename to push: ";
+            std::getline(std::cin, fname);
+            if (fname.empty()) continue;
+            if (!send_line(cfd, "PUSH SEND " + fname)) { std::cerr << "send error\n"; break; }
+            if (!recv_line(cfd, resp)) { std::cerr << "recv error\n"; break; }
+            if (resp.rfind("OK ", 0) != 0) { std::cerr << "Server: " << resp << "\n"; continue; }
+            std::cout << "Pushing '" << fname << "' (push " << resp.substr(3) << ").\n";
+        }
         else if (ch == "4") {
+            if (seeder.port()) std::cout << "Served " << seeder.chunks_served() << " chunks to peers.\n";
             send_line(cfd, "QUIT");
             if (recv_line(cfd, resp) && resp == "BYE") {
                 std::cout << "Goodbye!\n";
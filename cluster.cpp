@@ -0,0 +1,178 @@
+// cluster.cpp (C++17)
+// Handing files over to their owners in cluster mode (see cluster.hpp).
+#include "cluster.hpp"
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "endpoint.hpp"
+#include "protocol.hpp"
+#include "replica.hpp"
+#include "storage.hpp"
+
+namespace cluster {
+
+using namespace proto;
+
+static const int MAX_BACKOFF_S = 30;
+
+static void set_timeout(int fd, int seconds) {
+    timeval tv{seconds, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+Handoff::Handoff(const Storage& storage, std::shared_ptr<const Membership> mem, std::string user,
+                 std::string password)
+    : storage_(storage), mem_(std::move(mem)), user_(std::move(user)), password_(std::move(password)) {}
+
+Handoff::~Handoff() { stop(); }
+
+void Handoff::start() {
+    thread_ = std::thread([this] { run(); });
+}
+
+void Handoff::stop() {
+    stop_ = true;
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        for (auto& [owner, fd] : fds_)
+            if (fd >= 0) ::shutdown(fd, SHUT_RDWR);   // wakes a transfer in progress
+    }
+    if (thread_.joinable()) thread_.join();
+    close_sessions();
+}
+
+int Handoff::open_session(const std::string& owner, std::string& err) const {
+    Endpoint ep;
+    parse_endpoint(owner, ep);   // checked by the config
+    int fd = connect_endpoint(ep.host, ep.port);
+    if (fd < 0) {
+        err = "cannot connect: " + std::string(std::strerror(errno));
+        return -1;
+    }
+    set_timeout(fd, 30);
+    std::string resp;
+    if (!send_line(fd, "AUTH " + user_ + " " + password_) || !recv_line(fd, resp) || resp != "AUTH_OK") {
+        err = resp.empty() ? "connection lost during AUTH" : resp;
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void Handoff::close_sessions() {
+    std::lock_guard<std::mutex> lock(mu_);
+    for (auto& [owner, fd] : fds_)
+        if (fd >= 0) ::close(fd);
+    fds_.clear();
+}
+
+// size bytes of in from offset, framed as a file transfer.
+static bool send_range(int fd, int in, uint64_t offset, uint64_t size) {
+    uint64_t size_be = host_to_be64(size);
+    if (!send_all(fd, &size_be, sizeof(size_be))) return false;
+    std::vector<char> buf(CHUNK_SIZE);
+    while (size > 0) {
+        ssize_t got = ::pread(in, buf.data(), (size_t)std::min<uint64_t>(buf.size(), size), (off_t)offset);
+        if (got <= 0) return false;
+        xor_in_place(buf.data(), (size_t)got);
+        if (!send_all(fd, buf.data(), (size_t)got)) return false;
+        offset += (uint64_t)got;
+        size -= (uint64_t)got;
+    }
+    return true;
+}
+
+// One file (or packed upload) to its owner; the local copy goes once the
+// owner has it, unless it changed in the meantime.
+bool Handoff::send(const std::string& owner, bool upload, const std::string& name, std::string& err) {
+    Storage::Opened file;
+    if (!storage_.open_file(name, upload, file)) return true;   // gone already
+    struct Closer {
+        int fd;
+        ~Closer() { ::close(fd); }
+    } closer{file.fd};
+    int fd;
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        auto it = fds_.find(owner);
+        fd = it == fds_.end() ? -1 : it->second;
+    }
+    if (fd < 0) {
+        fd = open_session(owner, err);
+        if (fd < 0) return false;
+        std::lock_guard<std::mutex> lock(mu_);
+        fds_[owner] = fd;
+    }
+    std::string resp;
+    bool ok = send_line(fd, "CLUSTER TAKE " + std::string(upload ? "uploads" : "root") + " " + name + " " +
+                                std::to_string(file.mtime) + " " + std::to_string(file.size)) &&
+              recv_line(fd, resp);
+    if (ok && resp == "OK") ok = send_range(fd, file.fd, file.offset, file.size) && recv_line(fd, resp);
+    if (!ok) {
+        // the session is out of step now
+        err = "connection lost";
+        std::lock_guard<std::mutex> lock(mu_);
+        ::close(fd);
+        fds_[owner] = -1;
+        return false;
+    }
+    if (resp != "OK") {
+        err = resp;   // e.g. WrongNode: its list is not the same yet
+        return false;
+    }
+    const auto& shard = storage_.shards()[file.shard];
+    bool gone = false;
+    if (file.packed) {
+        gone = shard.packs->remove(name, file.mtime);
+    } else {
+        std::string path = (upload ? shard.upload : shard.root) + "/" + name;
+        uint64_t size = 0;
+        int64_t mtime = 0;
+        gone = replica::stat_file(path, size, mtime) && size == file.size && mtime == file.mtime &&
+               ::unlink(path.c_str()) == 0;
+    }
+    if (gone && storage_.meta()) storage_.meta()->remove(upload, name);
+    return true;
+}
+
+void Handoff::run() {
+    int backoff = 1;
+    while (!stop_) {
+        size_t moved = 0, failed = 0;
+        std::map<std::string, std::string> errors;   // owner -> first failure this pass
+        for (auto& f : replica::snapshot(storage_, 0)) {
+            if (stop_) break;
+            if (mem_->owns(f.name)) continue;
+            const std::string& owner = mem_->owner(f.name);
+            if (errors.count(owner)) {
+                ++failed;   // not reachable this pass
+                continue;
+            }
+            std::string err;
+            if (send(owner, f.upload, f.name, err)) {
+                ++moved;
+            } else {
+                ++failed;
+                errors[owner] = err;
+            }
+        }
+        close_sessions();
+        if (moved) std::cout << "Cluster: handed " << moved << " files to their owners\n";
+        if (!failed || stop_) break;
+        for (auto& [owner, err] : errors) std::cout << "Cluster: " << owner << ": " << err << "\n";
+        std::cout << "Cluster: " << failed << " files left to hand over, retrying in " << backoff << " s\n";
+        for (int i = 0; i < backoff * 10 && !stop_; ++i) std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        backoff = std::min(backoff * 2, MAX_BACKOFF_S);
+    }
+}
+
+} // namespace cluster
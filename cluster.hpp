@@ -0,0 +1,75 @@
+// cluster.hpp (C++17)
+// Cluster mode: several servers split the files between them. Every node is
+// started with the same --cluster list of "host:port" ids and owns the names
+// that consistent hashing (hash_ring.hpp) maps to its own id; PUT of any
+// other name is answered with "ERR WrongNode <owner>". Clients connect to
+// cluster_router, which sends each command to the owning node.
+//
+// When the list changes (SIGHUP after editing it on every node), each node
+// hands the files it no longer owns to their new owners, one session per
+// owner:
+//   CLUSTER TAKE <root|uploads> <name> <mtime_ns> <size>
+//     -> OK, then the file as in PUT, then OK once it is in place
+// and deletes its copy after the second OK. The owner keeps whichever copy is
+// newer. Nodes that cannot be reached are retried with backoff.
+#pragma once
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "hash_ring.hpp"
+
+class Storage;
+
+namespace cluster {
+
+// Who owns what, for one version of the node list. Immutable.
+class Membership {
+public:
+    Membership() = default;
+    Membership(std::vector<std::string> nodes, std::string self)
+        : nodes_(std::move(nodes)), self_(std::move(self)), ring_(nodes_) {}
+
+    bool enabled() const { return !nodes_.empty(); }
+    const std::vector<std::string>& nodes() const { return nodes_; }
+    const std::string& owner(const std::string& name) const { return nodes_[ring_.owner(name)]; }
+    // Always true outside a cluster.
+    bool owns(const std::string& name) const { return !enabled() || owner(name) == self_; }
+
+private:
+    std::vector<std::string> nodes_;
+    std::string self_;
+    HashRing ring_;
+};
+
+// A thread that moves the files of storage that mem says belong elsewhere,
+// until none is left or stop() is called.
+class Handoff {
+public:
+    Handoff(const Storage& storage, std::shared_ptr<const Membership> mem, std::string user, std::string password);
+    ~Handoff();
+
+    void start();
+    void stop();
+
+private:
+    void run();
+    bool send(const std::string& owner, bool upload, const std::string& name, std::string& err);
+    int open_session(const std::string& owner, std::string& err) const;
+    void close_sessions();
+
+    const Storage& storage_;
+    std::shared_ptr<const Membership> mem_;
+    std::string user_, password_;
+    std::atomic<bool> stop_{false};
+    std::thread thread_;
+    std::mutex mu_;
+    std::map<std::string, int> fds_;   // owner -> session; stop() shuts them down
+};
+
+} // namespace cluster
@@ -0,0 +1,309 @@
+// cluster_router.cpp (C++20)
+// Front end of a cluster (cluster.hpp): clients connect here as to a single
+// server, and each command goes to the node that owns the file name, over
+// sessions kept open per node and account. LIST asks every node and merges
+// the answers; a GET or STAT the owner cannot answer goes to the other
+// nodes, so files still on their way to a new owner stay readable.
+// Usage: ./cluster_router <listen> <node>[,<node>...] [--pool N] [--pool-idle S]
+// listen is an endpoint as in --listen; the nodes are written exactly as in
+// the nodes' --cluster, since the ring is built from those strings.
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "async_io.hpp"
+#include "endpoint.hpp"
+#include "hash_ring.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+struct Node {
+    std::string id;   // as in --cluster
+    std::string host;
+    int port = 0;
+};
+
+std::vector<Node> nodes;
+HashRing ring;
+size_t pool_max = 8;                     // idle sessions kept per node and account
+Clock::duration pool_idle = std::chrono::seconds(60);   // below the nodes' --idle-timeout
+
+const size_t MAX_LINE = 64 * 1024;
+
+// A session to a node, logged in as the client it serves.
+struct Upstream {
+    aio::AsyncSocket sock;
+    Clock::time_point idle_since;
+    bool reused = false;   // came from the pool, so it may have been closed meanwhile
+};
+
+// Idle sessions by node and "user pass".
+std::map<std::pair<size_t, std::string>, std::vector<Upstream>> pool;
+
+// A pooled session to node n if there is a fresh one, else a new one; reply
+// is AUTH_OK, or on failure (an invalid socket) the node's refusal or ERR
+// NodeDown.
+aio::Task<Upstream> lease(aio::EventLoop& loop, size_t n, const std::string& cred, std::string& reply) {
+    auto& idle = pool[{n, cred}];
+    while (!idle.empty()) {
+        Upstream u = std::move(idle.back());
+        idle.pop_back();
+        if (Clock::now() - u.idle_since < pool_idle) {
+            u.reused = true;
+            reply = "AUTH_OK";
+            co_return u;
+        }
+    }
+    Upstream u;
+    u.sock = co_await aio::async_connect(loop, nodes[n].host, nodes[n].port);
+    if (!u.sock.valid()) {
+        reply = "ERR NodeDown";
+        co_return u;
+    }
+    int one = 1;
+    setsockopt(u.sock.fd(), IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    std::string line = "AUTH " + cred;
+    bool ok = co_await u.sock.send_line(line);
+    if (ok) ok = co_await u.sock.recv_line(reply, MAX_LINE);
+    if (!ok) reply = "ERR NodeDown";
+    if (!ok || reply != "AUTH_OK") u.sock.close();
+    co_return u;
+}
+
+// Back into the pool, unless it broke or the pool is full.
+void release(size_t n, const std::string& cred, Upstream& u) {
+    if (!u.sock.valid()) return;
+    auto& idle = pool[{n, cred}];
+    if (idle.size() >= pool_max) {
+        u.sock.close();
+        return;
+    }
+    u.idle_since = Clock::now();
+    u.reused = false;
+    idle.push_back(std::move(u));
+}
+
+// Sends a command to node n and reads the first line of the reply. A pooled
+// session the node has closed is replaced by a new one; nothing has been
+// relayed at that point, so the retry is safe. False: the node is down or
+// refused the login (reply says which).
+aio::Task<bool> ask(aio::EventLoop& loop, size_t n, const std::string& cred, const std::string& line, Upstream& u,
+                    std::string& reply) {
+    while (true) {
+        u = co_await lease(loop, n, cred, reply);
+        if (!u.sock.valid()) co_return false;
+        bool ok = co_await u.sock.send_line(line);
+        if (ok) ok = co_await u.sock.recv_line(reply, MAX_LINE);
+        if (ok) co_return true;
+        u.sock.close();
+        if (!u.reused) {
+            reply = "ERR NodeDown";
+            co_return false;
+        }
+    }
+}
+
+// Copies n bytes from one socket to the other as they arrive.
+aio::Task<bool> relay(aio::AsyncSocket& from, aio::AsyncSocket& to, uint64_t n, std::vector<char>& buf) {
+    while (n > 0) {
+        size_t want = (size_t)std::min<uint64_t>(buf.size(), n);
+        ssize_t got = co_await from.recv_some(buf.data(), want);
+        if (got <= 0) co_return false;
+        bool ok = co_await to.send_all(buf.data(), (size_t)got);
+        if (!ok) co_return false;
+        n -= (uint64_t)got;
+    }
+    co_return true;
+}
+
+// The 8-byte size of a file transfer, then the file.
+aio::Task<bool> relay_file(aio::AsyncSocket& from, aio::AsyncSocket& to, std::vector<char>& buf) {
+    uint64_t size_be = 0;
+    bool ok = co_await from.recv_all(&size_be, sizeof(size_be));
+    if (ok) ok = co_await to.send_all(&size_be, sizeof(size_be));
+    if (ok) ok = co_await relay(from, to, proto::be64_to_host(size_be), buf);
+    co_return ok;
+}
+
+aio::Task<void> session(aio::EventLoop& loop, aio::AsyncSocket client) {
+    std::string line, reply, cmd, user, pass;
+    std::vector<char> buf(proto::CHUNK_SIZE);
+
+    // AUTH, checked by the first node that answers
+    bool ok = co_await client.recv_line(line, MAX_LINE);
+    if (!ok) co_return;
+    {
+        std::istringstream iss(line);
+        iss >> cmd >> user >> pass;
+    }
+    if (cmd != "AUTH" || user.empty() || pass.empty()) {
+        co_await client.send_line("AUTH_FAIL");
+        co_return;
+    }
+    std::string cred = user + " " + pass;
+    reply = "AUTH_FAIL NodeDown";
+    for (size_t n = 0; n < nodes.size(); ++n) {
+        Upstream u = co_await lease(loop, n, cred, reply);
+        if (u.sock.valid()) {
+            release(n, cred, u);
+            break;
+        }
+        if (reply != "ERR NodeDown") break;   // refused: same users.txt everywhere
+        reply = "AUTH_FAIL NodeDown";
+    }
+    ok = co_await client.send_line(reply);
+    if (reply != "AUTH_OK") co_return;
+
+    while (ok) {
+        ok = co_await client.recv_line(line, MAX_LINE);
+        if (!ok) break;
+        std::istringstream iss(line);
+        std::string fname;
+        iss >> cmd >> fname;
+
+        if (cmd == "LIST") {
+            std::set<std::string> names;
+            size_t answered = 0;
+            for (size_t n = 0; n < nodes.size(); ++n) {
+                Upstream u;
+                bool got = co_await ask(loop, n, cred, line, u, reply);
+                if (got) got = reply == "OK";
+                if (got) got = co_await u.sock.recv_line(reply, proto::MAX_LINE);
+                if (!got) {
+                    std::cerr << "LIST: " << nodes[n].id << ": " << reply << "\n";
+                    continue;
+                }
+                ++answered;
+                std::istringstream lines(reply);
+                for (std::string name; std::getline(lines, name);)
+                    if (!name.empty()) names.insert(name);
+                release(n, cred, u);
+            }
+            std::string data;
+            for (auto& name : names) data += name + "\n";
+            if (!answered) {
+                ok = co_await client.send_line("ERR NodeDown");
+                continue;
+            }
+            ok = co_await client.send_line("OK");
+            if (ok) ok = co_await client.send_line(data);
+        }
+        else if (cmd == "GET" || cmd == "GETRANGE" || cmd == "STAT") {
+            // the owner first, then the others: a file may not have moved yet.
+            // STAT's reply is the one line ("OK <size> ..."), not "OK" and a file
+            size_t own = ring.owner(fname);
+            bool owner_down = false;
+            Upstream u;
+            size_t n = own;
+            for (size_t k = 0; k < nodes.size(); ++k) {
+                n = (own + k) % nodes.size();
+                bool got = co_await ask(loop, n, cred, line, u, reply);
+                if (!got) {
+                    owner_down = owner_down || k == 0;
+                    continue;
+                }
+                if (reply != "ERR NotFound") break;
+                release(n, cred, u);
+            }
+            // nobody had it; if the owner did not answer, it may well have it
+            if (!u.sock.valid()) reply = owner_down ? "ERR NodeDown" : "ERR NotFound";
+            ok = co_await client.send_line(reply);
+            if (ok && reply == "OK") ok = co_await relay_file(u.sock, client, buf);
+            if (!ok) break;
+            release(n, cred, u);
+        }
+        else if (cmd == "PUT") {
+            size_t n = ring.owner(fname);
+            Upstream u;
+            co_await ask(loop, n, cred, line, u, reply);
+            ok = co_await client.send_line(reply);
+            if (ok && reply == "OK") ok = co_await relay_file(client, u.sock, buf);
+            if (!ok) break;
+            release(n, cred, u);
+        }
+        else if (cmd == "QUIT") {
+            co_await client.send_line("BYE");
+            break;
+        }
+        else {
+            ok = co_await client.send_line("ERR UnknownCmd");
+        }
+    }
+}
+
+aio::Task<void> accept_loop(aio::EventLoop& loop, aio::AsyncSocket& listener) {
+    while (true) {
+        sockaddr_storage peer{};
+        socklen_t len = sizeof(peer);
+        int fd = co_await listener.accept(&peer, &len);
+        if (fd < 0) {
+            perror("accept");
+            co_await loop.sleep_for(std::chrono::milliseconds(100));
+            continue;
+        }
+        if (peer.ss_family != AF_UNIX) {
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        }
+        loop.spawn(session(loop, aio::AsyncSocket(loop, fd)));
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " <listen> <node>[,<node>...] [--pool N] [--pool-idle S]\n";
+        return 1;
+    }
+    std::vector<std::string> ids;
+    std::string list = argv[2];
+    for (size_t pos = 0; pos <= list.size();) {
+        size_t comma = list.find(',', pos);
+        if (comma == std::string::npos) comma = list.size();
+        Node node;
+        node.id = list.substr(pos, comma - pos);
+        proto::Endpoint ep;
+        if (!proto::parse_endpoint(node.id, ep) || ep.is_unix || ep.is_udp || ep.host.empty()) {
+            std::cerr << "Bad node " << node.id << " (HOST:PORT)\n";
+            return 1;
+        }
+        node.host = ep.host;
+        node.port = ep.port;
+        ids.push_back(node.id);
+        nodes.push_back(node);
+        pos = comma + 1;
+    }
+    for (int i = 3; i + 1 < argc; i += 2) {
+        std::string flag = argv[i];
+        if (flag == "--pool") pool_max = (size_t)std::max(0, std::stoi(argv[i + 1]));
+        else if (flag == "--pool-idle") pool_idle = std::chrono::seconds(std::max(1, std::stoi(argv[i + 1])));
+        else {
+            std::cerr << "Unknown option " << flag << "\n";
+            return 1;
+        }
+    }
+    ring = HashRing(ids);
+
+    int lfd = proto::listen_endpoint(argv[1]);
+    if (lfd < 0) { perror(argv[1]); return 1; }
+    signal(SIGPIPE, SIG_IGN);
+    std::cout << "Routing " << argv[1] << " to " << nodes.size() << " nodes\n";
+    aio::EventLoop loop;
+    aio::AsyncSocket listener(loop, lfd);
+    loop.spawn(accept_loop(loop, listener));
+    loop.run();
+    return 0;
+}
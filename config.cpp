@@ -0,0 +1,274 @@
+// config.cpp (C++17)
+// Config file and command line parsing (see config.hpp).
+#include "config.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+
+#include "endpoint.hpp"
+#include "fd_passing.hpp"
+#include "push.hpp"
+#include "rate_limit.hpp"
+#include "udp_transport.hpp"
+
+namespace {
+
+std::string trim(const std::string& s) {
+    size_t b = s.find_first_not_of(" \t\r");
+    if (b == std::string::npos) return "";
+    size_t e = s.find_last_not_of(" \t\r");
+    return s.substr(b, e - b + 1);
+}
+
+bool load_file(const std::string& path, bool must_exist, ServerOptions& o, std::string& err) {
+    std::ifstream in(path);
+    if (!in) {
+        if (!must_exist) return true;
+        err = "cannot open " + path;
+        return false;
+    }
+    std::string line;
+    for (int lineno = 1; std::getline(in, line); ++lineno) {
+        auto hash = line.find('#');
+        if (hash != std::string::npos) line.resize(hash);
+        line = trim(line);
+        if (line.empty()) continue;
+        auto eq = line.find('=');
+        std::string key = eq == std::string::npos ? line : trim(line.substr(0, eq));
+        std::string val = eq == std::string::npos ? "" : trim(line.substr(eq + 1));
+        if (eq == std::string::npos || !apply_option(o, key, val)) {
+            err = path + ":" + std::to_string(lineno) + ": bad setting \"" + line + "\"";
+            return false;
+        }
+    }
+    return true;
+}
+
+// "8080, unix:/run/fs.sock" -> endpoints; false if any is malformed.
+bool parse_listen(const std::string& val, std::vector<std::string>& out) {
+    std::vector<std::string> list;
+    size_t pos = 0;
+    while (pos <= val.size()) {
+        size_t comma = val.find(',', pos);
+        if (comma == std::string::npos) comma = val.size();
+        std::string spec = trim(val.substr(pos, comma - pos));
+        proto::Endpoint ep;
+        if (!proto::parse_endpoint(spec, ep)) return false;
+        list.push_back(spec);
+        pos = comma + 1;
+    }
+    // every listener travels in one message on a hot upgrade
+    if (list.size() > proto::MAX_PASSED_FDS) return false;
+    out = list;
+    return true;
+}
+
+// "/disk1/files, /disk2/files" -> directories; "" or "off" = none.
+bool parse_shards(const std::string& val, std::vector<std::string>& out) {
+    std::vector<std::string> list;
+    if (val != "off") {
+        size_t pos = 0;
+        while (pos < val.size()) {
+            size_t comma = val.find(',', pos);
+            if (comma == std::string::npos) comma = val.size();
+            std::string dir = trim(val.substr(pos, comma - pos));
+            while (dir.size() > 1 && dir.back() == '/') dir.pop_back();
+            if (dir.empty() || std::find(list.begin(), list.end(), dir) != list.end()) return false;
+            list.push_back(dir);
+            pos = comma + 1;
+        }
+    }
+    out = list;
+    return true;
+}
+
+// "10.0.0.1:8080, 10.0.0.2:8080" -> cluster nodes; "off" = none. Each must
+// name a host and a TCP port, since the ring is built from these strings.
+bool parse_nodes(const std::string& val, std::vector<std::string>& out) {
+    std::vector<std::string> list;
+    if (val != "off") {
+        size_t pos = 0;
+        while (pos <= val.size()) {
+            size_t comma = val.find(',', pos);
+            if (comma == std::string::npos) comma = val.size();
+            std::string id = trim(val.substr(pos, comma - pos));
+            proto::Endpoint ep;
+            if (!proto::parse_endpoint(id, ep) || ep.is_unix || ep.is_udp || ep.host.empty()) return false;
+            if (std::find(list.begin(), list.end(), id) != list.end()) return false;
+            list.push_back(id);
+            pos = comma + 1;
+        }
+    }
+    out = list;
+    return true;
+}
+
+// Put the startup value back into next, noting the key if it differed.
+template <typename T>
+void keep(T& next, const T& cur, const char* key, std::vector<std::string>& changed) {
+    if (next != cur) {
+        changed.push_back(key);
+        next = cur;
+    }
+}
+
+} // namespace
+
+bool apply_option(ServerOptions& o, const std::string& key, const std::string& val) {
+    udp::FecConfig fec;
+    push::Group group;
+    proto::Endpoint ep;
+    try {
+        if (key == "port") {
+            int p = std::stoi(val);
+            if (p < 1 || p > 65535) return false;
+            o.port = p;
+        }
+        else if (key == "listen") return parse_listen(val, o.listen);
+        else if (key == "root-dir" && !val.empty()) o.root_dir = val;
+        else if (key == "upload-dir" && !val.empty()) o.upload_dir = val;
+        else if (key == "users-file" && !val.empty()) o.users_file = val;
+        else if (key == "usage-file" && !val.empty()) o.usage_file = val;
+        else if (key == "shards") return parse_shards(val, o.shards);
+        else if (key == "io-threads") o.io_threads = std::clamp(std::stoi(val), 0, 64);
+        else if (key == "meta" && (val == "on" || val == "off")) o.meta = val == "on";
+        else if (key == "mode" && (val == "async" || val == "pool")) o.mode = val;
+        else if (key == "workers") o.workers = std::max(1, std::stoi(val));
+        else if (key == "queue") o.queue_size = (size_t)std::max(1, std::stoi(val));
+        else if (key == "reactors") o.reactors = std::max(1, std::stoi(val));
+        else if (key == "cipher-workers") o.cipher_workers = std::max(0, std::stoi(val));
+        else if (key == "upgrade-socket" && !val.empty()) o.upgrade_socket = val;
+        else if (key == "takeover" && !val.empty()) o.takeover = val;
+        else if (key == "follow" && (val == "off" || proto::parse_endpoint(val, ep)))
+            o.follow = val == "off" ? "" : val;
+        else if (key == "follow-user") o.follow_user = val;
+        else if (key == "follow-password") o.follow_password = val;
+        else if (key == "follow-parallel") o.follow_parallel = std::clamp(std::stoi(val), 1, 64);
+        else if (key == "follow-chunk" && parse_rate(val) >= 4096 && parse_rate(val) <= (64u << 20))
+            o.follow_chunk = parse_rate(val);
+        else if (key == "cluster") return parse_nodes(val, o.cluster);
+        else if (key == "cluster-self") o.cluster_self = val;
+        else if (key == "cluster-user") o.cluster_user = val;
+        else if (key == "cluster-password") o.cluster_password = val;
+        else if (key == "buffer-size" && parse_rate(val) >= 4096 && parse_rate(val) <= (64u << 20))
+            o.buffer_size = (size_t)parse_rate(val);
+        else if (key == "max-sessions") o.max_sessions = (size_t)std::max(1, std::stoi(val));
+        else if (key == "retry-after") o.retry_after = std::max(0, std::stoi(val));
+        else if (key == "rate-global" && (val == "0" || parse_rate(val))) o.rate_global = parse_rate(val);
+        else if (key == "rate-conn" && (val == "0" || parse_rate(val))) o.rate_conn = parse_rate(val);
+        else if (key == "fair" && (val == "on" || val == "off")) o.fair = val == "on";
+        else if (key == "small-file") o.small_file = parse_rate(val);
+        else if (key == "auth-timeout") o.auth_timeout = std::max(0, std::stoi(val));
+        else if (key == "idle-timeout") o.idle_timeout = std::max(0, std::stoi(val));
+        else if (key == "min-rate" && (val == "0" || parse_rate(val))) o.min_rate = parse_rate(val);
+        else if (key == "max-line" && parse_rate(val) >= 64) o.max_line = (size_t)parse_rate(val);
+        else if (key == "max-file" && (val == "0" || parse_rate(val))) o.max_file = parse_rate(val);
+        else if (key == "pack-small" && (val == "0" || val == "off" || (parse_rate(val) && parse_rate(val) <= (16u << 20))))
+            o.pack_small = val == "off" ? 0 : parse_rate(val);
+        else if (key == "meta-rescan") o.meta_rescan = std::max(0, std::stoi(val));
+        else if (key == "drain-timeout") o.drain_timeout = std::max(0, std::stoi(val));
+        else if (key == "udp-fec" && udp::parse_fec(val, fec)) o.udp_fec = val;
+        else if (key == "swarm" && (val == "on" || val == "off")) o.swarm = val == "on";
+        else if (key == "swarm-chunk" && parse_rate(val) >= 4096 && parse_rate(val) <= (64u << 20))
+            o.swarm_chunk = parse_rate(val);
+        else if (key == "push-group" && (val == "off" || push::parse_group(val, group)))
+            o.push_group = val == "off" ? "" : val;
+        else if (key == "push-iface") o.push_iface = val;
+        else if (key == "push-rate" && parse_rate(val)) o.push_rate = parse_rate(val);
+        else if (key == "push-ttl" && std::stoi(val) >= 1 && std::stoi(val) <= 255) o.push_ttl = std::stoi(val);
+        else if (key == "repl-backlog") o.repl_backlog = (size_t)std::max(1, std::stoi(val));
+        else if (key == "repl-user") o.repl_user = val;
+        else return false;
+    } catch (const std::exception&) {
+        return false;
+    }
+    return true;
+}
+
+bool parse_command_line(int argc, char** argv, std::string& config_path, OptionList& flags) {
+    config_path.clear();
+    for (int i = 1; i < argc; ++i) {
+        std::string key = argv[i], val;
+        if (key.rfind("--", 0) != 0) return false;
+        auto eq = key.find('=');
+        if (eq != std::string::npos) { val = key.substr(eq + 1); key.resize(eq); }
+        else if (i + 1 < argc) val = argv[++i];
+        else return false;
+        key.erase(0, 2);
+        if (key == "config") config_path = val;
+        else flags.emplace_back(key, val);
+    }
+    return true;
+}
+
+bool load_options(const std::string& config_path, bool must_exist, const OptionList& flags,
+                  ServerOptions& out, std::string& err) {
+    ServerOptions o;
+    if (!load_file(config_path, must_exist, o, err)) return false;
+    for (auto& [key, val] : flags) {
+        if (!apply_option(o, key, val)) {
+            err = "bad option --" + key + " " + val;
+            return false;
+        }
+    }
+    if (!o.cluster.empty() &&
+        std::find(o.cluster.begin(), o.cluster.end(), o.cluster_self) == o.cluster.end()) {
+        err = "--cluster-self must be one of the --cluster nodes";
+        return false;
+    }
+    if (!o.cluster.empty() && o.cluster_user.empty()) {
+        err = "--cluster needs --cluster-user";
+        return false;
+    }
+    out = o;
+    return true;
+}
+
+std::vector<std::string> keep_startup_options(ServerOptions& next, const ServerOptions& cur) {
+    std::vector<std::string> changed;
+    keep(next.port, cur.port, "port", changed);
+    keep(next.listen, cur.listen, "listen", changed);
+    keep(next.root_dir, cur.root_dir, "root-dir", changed);
+    keep(next.upload_dir, cur.upload_dir, "upload-dir", changed);
+    keep(next.usage_file, cur.usage_file, "usage-file", changed);
+    keep(next.shards, cur.shards, "shards", changed);
+    keep(next.io_threads, cur.io_threads, "io-threads", changed);
+    keep(next.meta, cur.meta, "meta", changed);
+    keep(next.mode, cur.mode, "mode", changed);
+    keep(next.workers, cur.workers, "workers", changed);
+    keep(next.queue_size, cur.queue_size, "queue", changed);
+    keep(next.reactors, cur.reactors, "reactors", changed);
+    keep(next.cipher_workers, cur.cipher_workers, "cipher-workers", changed);
+    keep(next.upgrade_socket, cur.upgrade_socket, "upgrade-socket", changed);
+    keep(next.takeover, cur.takeover, "takeover", changed);
+    keep(next.follow, cur.follow, "follow", changed);
+    keep(next.follow_user, cur.follow_user, "follow-user", changed);
+    keep(next.follow_password, cur.follow_password, "follow-password", changed);
+    keep(next.follow_parallel, cur.follow_parallel, "follow-parallel", changed);
+    keep(next.follow_chunk, cur.follow_chunk, "follow-chunk", changed);
+    keep(next.cluster_self, cur.cluster_self, "cluster-self", changed);
+    return changed;
+}
+
+const char* options_help() {
+    return "  --config PATH          settings file (default server.conf, may be missing)\n"
+           "restart:\n"
+           "  --listen ENDPOINT[,ENDPOINT...]  (PORT, HOST:PORT, [V6]:PORT, unix:PATH or udp:PORT)\n"
+           "  --port N  --root-dir DIR  --upload-dir DIR  --usage-file PATH\n"
+           "  --shards off|DIR[,DIR...]  --io-threads N  --meta on|off\n"
+           "  --mode async|pool  --workers N  --queue N  --reactors N  --cipher-workers N\n"
+           "  --upgrade-socket PATH  --takeover PATH\n"
+           "  --follow off|ENDPOINT  --follow-user NAME  --follow-password PASS\n"
+           "  --follow-parallel N  --follow-chunk SIZE  --cluster-self HOST:PORT\n"
+           "reloadable (SIGHUP):\n"
+           "  --users-file PATH  --buffer-size SIZE  --max-sessions N  --retry-after SECONDS\n"
+           "  --rate-global RATE  --rate-conn RATE  --fair on|off  --small-file SIZE\n"
+           "  --auth-timeout SECONDS  --idle-timeout SECONDS  --min-rate RATE\n"
+           "  --max-line SIZE  --max-file SIZE  --drain-timeout SECONDS  --udp-fec off|K+R\n"
+           "  --pack-small off|SIZE  --meta-rescan SECONDS\n"
+           "  --swarm on|off  --swarm-chunk SIZE\n"
+           "  --push-group off|ADDR:PORT  --push-iface ADDR  --push-rate RATE  --push-ttl N\n"
+           "  --repl-backlog N  --repl-user NAME\n"
+           "  --cluster off|HOST:PORT[,HOST:PORT...]  --cluster-user NAME  --cluster-password PASS\n";
+}
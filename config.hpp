@@ -0,0 +1,97 @@
+// config.hpp (C++17)
+// Server settings: built-in defaults, then a config file, then command line
+// flags. The file has one "key = value" per line with '#' comments; keys are
+// the command line flags without the leading "--", e.g.
+//   listen = 8080, unix:/run/fileshare-local.sock
+//   reactors = 4
+//   rate-global = 50M
+// On SIGHUP the server reads the file again (re-applying the same command line
+// flags on top) and publishes the result; the keys marked "restart" in
+// options_help() keep their startup value until the next start.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+struct ServerOptions {
+    // listeners and files (restart)
+    int port = 8080;
+    std::vector<std::string> listen;   // endpoints (endpoint.hpp); empty = all addresses on port
+    std::string root_dir = "server_files";
+    std::string upload_dir = "server_files/uploads";
+    std::string users_file = "users.txt";   // re-read on every AUTH anyway
+    std::string usage_file = "usage.db";    // per-user upload ownership
+    std::vector<std::string> shards;   // root dirs files are spread over (uploads in DIR/uploads); empty = root_dir
+    int io_threads = 2;           // disk I/O threads per device, 0 = on the event loop
+    bool meta = false;            // LIST/STAT from the metadata store (meta_store.hpp)
+    // threads and backend (restart)
+    std::string mode = "async";   // async: --reactors event loops, pool: worker threads
+    int workers = 4;              // pool mode threads
+    size_t queue_size = 64;       // pool mode: accepted sockets waiting for a worker
+    int reactors = 1;             // async mode event loop threads
+    int cipher_workers = 0;       // work-stealing cipher threads, 0 = XOR inline
+    std::string upgrade_socket;   // AF_UNIX path a new binary takes the listener from
+    std::string takeover;         // take the listener from a running server at this path
+    // replication (restart)
+    std::string follow;           // endpoint of the server to mirror, "" = none
+    std::string follow_user, follow_password;   // an account on that server
+    int follow_parallel = 4;      // sessions fetching at once
+    uint64_t follow_chunk = 4 << 20;   // bytes per GETRANGE
+    // cluster mode (cluster.hpp); cluster_self is restart-only
+    std::vector<std::string> cluster;   // "host:port" of every node, "" = not clustered
+    std::string cluster_self;     // this node's entry in cluster
+    std::string cluster_user, cluster_password;   // account nodes hand files over with
+    // tunables (reloadable)
+    size_t buffer_size = 64 * 1024;   // transfer chunk (8x that with --cipher-workers)
+    size_t max_sessions = 1024;   // admitted sessions (running + queued)
+    int retry_after = 1;          // seconds suggested in the BUSY reply
+    uint64_t rate_global = 0;     // bytes/s over all sessions, 0 = unlimited
+    uint64_t rate_conn = 0;       // bytes/s per connection, 0 = unlimited
+    bool fair = true;             // async mode: DRR between bulk transfers
+    uint64_t small_file = 256 * 1024;   // transfers up to this size skip the DRR queue
+    int auth_timeout = 10;        // seconds to send AUTH, 0 = none
+    int idle_timeout = 300;       // seconds between commands, 0 = none
+    uint64_t min_rate = 1024;     // bytes/s a transfer must keep up, 0 = none
+    size_t max_line = 4096;       // longest command line a client may send
+    uint64_t max_file = 0;        // largest upload in bytes, 0 = no limit
+    uint64_t pack_small = 0;      // uploads up to this size go into pack files, 0 = off
+    int meta_rescan = 300;        // seconds between metadata store rescans, 0 = at startup only
+    int drain_timeout = 30;       // seconds running transfers get on shutdown
+    std::string udp_fec = "off";  // UDP repair packets, "K+R" (udp::parse_fec)
+    bool swarm = false;           // track SWARM downloads (clients fetch from each other)
+    uint64_t swarm_chunk = 1 << 20;   // chunk size of swarms started from now on
+    std::string push_group;       // multicast "ADDR:PORT" for PUSH, "" = off
+    std::string push_iface;       // address of the interface pushes leave from, "" = any
+    uint64_t push_rate = 10 << 20;    // bytes/s of a push (incl. repairs)
+    int push_ttl = 1;             // multicast hops
+    size_t repl_backlog = 10000;  // changes kept for followers that fall behind
+    std::string repl_user;        // account followers log in with, "" = no followers
+};
+
+// Read when --config is not given; may be missing.
+inline const char* const DEFAULT_CONFIG = "server.conf";
+
+using OptionList = std::vector<std::pair<std::string, std::string>>;   // key, value
+
+// Set one option from its text form; false on an unknown key or bad value.
+bool apply_option(ServerOptions& o, const std::string& key, const std::string& val);
+
+// Split argv into the config file path (--config PATH, empty if not given)
+// and the remaining "--key value" / "--key=value" flags. False on a dangling
+// flag.
+bool parse_command_line(int argc, char** argv, std::string& config_path, OptionList& flags);
+
+// Defaults, then config_path (a missing file is only an error when
+// must_exist), then flags. On failure err names the offending line or flag.
+bool load_options(const std::string& config_path, bool must_exist, const OptionList& flags,
+                  ServerOptions& out, std::string& err);
+
+// Copy the restart-only settings of cur into next; returns the keys whose
+// new value was discarded that way.
+std::vector<std::string> keep_startup_options(ServerOptions& next, const ServerOptions& cur);
+
+// Key list for --help.
+const char* options_help();
@@ -0,0 +1,147 @@
+// endpoint.cpp (C++17)
+// Endpoint parsing, listening and connecting (see endpoint.hpp).
+#include "endpoint.hpp"
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+#include "fd_passing.hpp"
+#include "udp_transport.hpp"
+
+namespace proto {
+
+static bool parse_port(const std::string& s, int& port) {
+    if (s.empty() || s.size() > 5 || s.find_first_not_of("0123456789") != std::string::npos) return false;
+    port = std::stoi(s);
+    return port >= 1 && port <= 65535;
+}
+
+bool parse_endpoint(const std::string& spec, Endpoint& ep) {
+    ep = Endpoint{};
+    errno = EINVAL;
+    if (spec.rfind("unix:", 0) == 0) {
+        ep.is_unix = true;
+        ep.path = spec.substr(5);
+        return !ep.path.empty();
+    }
+    if (spec.rfind("udp:", 0) == 0) {
+        if (!parse_endpoint(spec.substr(4), ep) || ep.is_unix) return false;
+        ep.is_udp = true;
+        return true;
+    }
+    auto colon = spec.rfind(':');
+    if (colon == std::string::npos) return parse_port(spec, ep.port);
+    std::string host = spec.substr(0, colon);
+    if (!parse_port(spec.substr(colon + 1), ep.port)) return false;
+    if (!host.empty() && host.front() == '[') {
+        if (host.size() < 3 || host.back() != ']') return false;
+        host = host.substr(1, host.size() - 2);
+    } else if (host.find(':') != std::string::npos) {
+        return false;   // bare IPv6 address needs brackets
+    }
+    ep.host = host == "*" ? "" : host;
+    return true;
+}
+
+// backlog < 0: a bound UDP socket
+static int bind_listen(int family, const sockaddr* addr, socklen_t len, int v6only, int backlog) {
+    int fd = ::socket(family, (backlog < 0 ? SOCK_DGRAM : SOCK_STREAM) | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (family == AF_INET6) setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only));
+    if (::bind(fd, addr, len) < 0 || (backlog >= 0 && ::listen(fd, backlog) < 0)) {
+        int e = errno;
+        ::close(fd);
+        errno = e;
+        return -1;
+    }
+    return fd;
+}
+
+int listen_endpoint(const std::string& spec, int backlog) {
+    Endpoint ep;
+    if (!parse_endpoint(spec, ep)) return -1;
+    if (ep.is_unix) return listen_unix(ep.path, backlog);
+    if (ep.is_udp) backlog = -1;
+
+    if (ep.host.empty()) {
+        // all addresses: one dual-stack IPv6 socket, or IPv4 on hosts without IPv6
+        sockaddr_in6 a6{};
+        a6.sin6_family = AF_INET6;
+        a6.sin6_addr = in6addr_any;
+        a6.sin6_port = htons((uint16_t)ep.port);
+        int fd = bind_listen(AF_INET6, (sockaddr*)&a6, sizeof(a6), 0, backlog);
+        if (fd >= 0 || errno != EAFNOSUPPORT) return fd;
+        sockaddr_in a4{};
+        a4.sin_family = AF_INET;
+        a4.sin_addr.s_addr = INADDR_ANY;
+        a4.sin_port = htons((uint16_t)ep.port);
+        return bind_listen(AF_INET, (sockaddr*)&a4, sizeof(a4), 0, backlog);
+    }
+
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = ep.is_udp ? SOCK_DGRAM : SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+    addrinfo* res = nullptr;
+    int rc = getaddrinfo(ep.host.c_str(), std::to_string(ep.port).c_str(), &hints, &res);
+    if (rc != 0) { errno = rc == EAI_SYSTEM ? errno : EADDRNOTAVAIL; return -1; }
+    // an explicit IPv6 address means IPv6 only, so "0.0.0.0:P" and "[::]:P"
+    // can be listed side by side
+    int fd = bind_listen(res->ai_family, res->ai_addr, res->ai_addrlen, 1, backlog);
+    freeaddrinfo(res);
+    return fd;
+}
+
+int connect_endpoint(const std::string& host, int port) {
+    if (host.rfind("unix:", 0) == 0) return connect_unix(host.substr(5));
+    if (host.rfind("udp:", 0) == 0) return udp::open_stream(host.substr(4), port);
+
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_ADDRCONFIG | AI_NUMERICSERV;
+    addrinfo* res = nullptr;
+    int rc = getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &res);
+    if (rc != 0) { errno = rc == EAI_SYSTEM ? errno : EHOSTUNREACH; return -1; }
+    int fd = -1;
+    for (addrinfo* ai = res; ai; ai = ai->ai_next) {
+        fd = ::socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd < 0) continue;
+        if (::connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) break;
+        int e = errno;
+        ::close(fd);
+        fd = -1;
+        errno = e;
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+std::string sockaddr_name(const sockaddr_storage& ss) {
+    char ip[INET6_ADDRSTRLEN] = "?";
+    if (ss.ss_family == AF_INET) {
+        auto* sin = (const sockaddr_in*)&ss;
+        inet_ntop(AF_INET, &sin->sin_addr, ip, sizeof(ip));
+        return std::string(ip) + ":" + std::to_string(ntohs(sin->sin_port));
+    }
+    if (ss.ss_family == AF_INET6) {
+        auto* sin6 = (const sockaddr_in6*)&ss;
+        if (IN6_IS_ADDR_V4MAPPED(&sin6->sin6_addr)) {
+            inet_ntop(AF_INET, &sin6->sin6_addr.s6_addr[12], ip, sizeof(ip));
+            return std::string(ip) + ":" + std::to_string(ntohs(sin6->sin6_port));
+        }
+        inet_ntop(AF_INET6, &sin6->sin6_addr, ip, sizeof(ip));
+        return "[" + std::string(ip) + "]:" + std::to_string(ntohs(sin6->sin6_port));
+    }
+    if (ss.ss_family == AF_UNIX) return "unix";
+    return "?";
+}
+
+} // namespace proto
@@ -0,0 +1,46 @@
+// endpoint.hpp (C++17)
+// Listening and connecting by address string. Part of libfileshare.
+//
+// An endpoint is one of
+//   8080  or  *:8080        all addresses: IPv6 dual-stack (IPv4 clients
+//                           arrive as ::ffff:a.b.c.d), plain IPv4 without IPv6
+//   0.0.0.0:8080            IPv4 only
+//   [::]:8080  [::1]:8080   IPv6 only
+//   localhost:8080          whatever the name resolves to (first address)
+//   unix:/run/fs.sock       AF_UNIX stream socket, for clients on the same host
+//   udp:8080  udp:HOST:8080 UDP socket for the reliable UDP transport
+//                           (udp_transport.hpp); HOST as above
+#pragma once
+
+#include <sys/socket.h>
+
+#include <string>
+
+namespace proto {
+
+struct Endpoint {
+    bool is_unix = false;
+    bool is_udp = false;
+    std::string host;   // "" = all addresses; brackets stripped
+    int port = 0;
+    std::string path;   // AF_UNIX
+};
+
+// False (errno = EINVAL) on a malformed spec.
+bool parse_endpoint(const std::string& spec, Endpoint& ep);
+
+// Bound, listening, close-on-exec socket for spec; -1 with errno on failure.
+// A unix: endpoint replaces a stale socket file at its path; a udp: endpoint
+// gives a bound datagram socket for udp::Server.
+int listen_endpoint(const std::string& spec, int backlog = SOMAXCONN);
+
+// Blocking connect to host:port, trying every address getaddrinfo() returns
+// (IPv6 and IPv4); host may also be "unix:/path", or "udp:HOST" for a stream
+// over the UDP transport. -1 with errno on failure.
+int connect_endpoint(const std::string& host, int port);
+
+// "1.2.3.4:5", "[::1]:5" or "unix" for log lines; IPv4-mapped IPv6
+// addresses print as IPv4.
+std::string sockaddr_name(const sockaddr_storage& ss);
+
+} // namespace proto
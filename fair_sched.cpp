@@ -0,0 +1,41 @@
+// fair_sched.cpp (C++20)
+// Deficit round robin dispatcher (see fair_sched.hpp).
+#include "fair_sched.hpp"
+
+#include <utility>
+
+FairScheduler::FairScheduler(aio::EventLoop& loop, size_t quantum, size_t round_budget)
+    : loop_(loop), quantum_(quantum ? quantum : 1), round_budget_(round_budget ? round_budget : 1) {}
+
+void FairScheduler::enqueue(Flow& f, size_t n, std::coroutine_handle<> h) {
+    f.want = n;
+    f.waiter = h;
+    active_.push_back(&f);
+    if (!dispatch_pending_) {
+        dispatch_pending_ = true;
+        loop_.defer([this] { dispatch(); });
+    }
+}
+
+void FairScheduler::dispatch() {
+    dispatch_pending_ = false;
+    size_t budget = round_budget_;
+    // visit every waiting flow at most once; granted flows leave the queue
+    // and come back with their next chunk
+    for (size_t visits = active_.size(); visits > 0 && budget > 0; --visits) {
+        Flow* f = active_.front();
+        active_.pop_front();
+        f->deficit += quantum_;
+        if (f->deficit < f->want) {
+            active_.push_back(f);   // keeps its credit for the next round
+            continue;
+        }
+        f->deficit -= f->want;
+        budget = f->want >= budget ? 0 : budget - f->want;
+        loop_.schedule(std::exchange(f->waiter, {}));
+    }
+    if (!active_.empty()) {
+        dispatch_pending_ = true;
+        loop_.defer([this] { dispatch(); });
+    }
+}
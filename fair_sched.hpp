@@ -0,0 +1,52 @@
+// fair_sched.hpp (C++20)
+// Deficit round robin between the bulk transfers of one event loop.
+//
+// A bulk transfer co_awaits grant() before every chunk. Grants are handed out
+// once per loop iteration: each waiting flow earns `quantum` bytes of credit
+// per round and sends when its credit covers the chunk, and at most
+// `round_budget` bytes are granted per iteration. The loop therefore returns
+// to epoll between rounds, and control commands, LIST and small files (the
+// latency class, which never wait here) are served between bulk chunks
+// instead of queueing behind them.
+#pragma once
+
+#include <coroutine>
+#include <cstddef>
+#include <deque>
+
+#include "async_io.hpp"
+
+class FairScheduler {
+public:
+    // Per-session state; must outlive any grant() it is passed to.
+    struct Flow {
+        size_t deficit = 0;
+        size_t want = 0;
+        std::coroutine_handle<> waiter;
+    };
+
+    FairScheduler(aio::EventLoop& loop, size_t quantum, size_t round_budget);
+
+    struct GrantAwaiter {
+        FairScheduler* sched;
+        Flow* flow;
+        size_t n;
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> h) { sched->enqueue(*flow, n, h); }
+        void await_resume() const noexcept {}
+    };
+    // Resumes once `flow` may move the next n bytes.
+    GrantAwaiter grant(Flow& flow, size_t n) { return {this, &flow, n}; }
+
+    size_t waiting() const { return active_.size(); }
+
+private:
+    void enqueue(Flow& f, size_t n, std::coroutine_handle<> h);
+    void dispatch();
+
+    aio::EventLoop& loop_;
+    size_t quantum_;
+    size_t round_budget_;
+    bool dispatch_pending_ = false;
+    std::deque<Flow*> active_;   // flows waiting for credit, in round robin order
+};
@@ -0,0 +1,198 @@
+// fd_passing.cpp (C++17)
+// SCM_RIGHTS helpers and the GETFD copy (see fd_passing.hpp).
+#include "fd_passing.hpp"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+namespace proto {
+
+static void close_fds(std::vector<int>& fds) {
+    for (int fd : fds) ::close(fd);
+    fds.clear();
+}
+
+static bool write_all(int fd, const char* p, size_t n) {
+    while (n > 0) {
+        ssize_t w = ::write(fd, p, n);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return false;
+        p += w;
+        n -= (size_t)w;
+    }
+    return true;
+}
+
+static bool fill_addr(const std::string& path, sockaddr_un& addr) {
+    if (path.empty() || path.size() >= sizeof(addr.sun_path)) { errno = ENAMETOOLONG; return false; }
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+ssize_t sendmsg_fds(int sock, const std::vector<int>& fds, const void* data, size_t len) {
+    if (len == 0 || fds.size() > MAX_PASSED_FDS) { errno = EINVAL; return -1; }
+    iovec iov{(void*)data, len};
+    alignas(cmsghdr) char ctrl[CMSG_SPACE(sizeof(int) * MAX_PASSED_FDS)] = {};
+    msghdr mh{};
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    if (!fds.empty()) {
+        mh.msg_control = ctrl;
+        mh.msg_controllen = CMSG_SPACE(sizeof(int) * fds.size());
+        cmsghdr* cm = CMSG_FIRSTHDR(&mh);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+        std::memcpy(CMSG_DATA(cm), fds.data(), sizeof(int) * fds.size());
+    }
+    ssize_t n;
+    do {
+        n = ::sendmsg(sock, &mh, MSG_NOSIGNAL);
+    } while (n < 0 && errno == EINTR);
+    return n;
+}
+
+ssize_t recvmsg_fds(int sock, void* data, size_t len, std::vector<int>& fds) {
+    iovec iov{data, len};
+    alignas(cmsghdr) char ctrl[CMSG_SPACE(sizeof(int) * MAX_PASSED_FDS)] = {};
+    msghdr mh{};
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = ctrl;
+    mh.msg_controllen = sizeof(ctrl);
+    ssize_t n;
+    do {
+        n = ::recvmsg(sock, &mh, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) return -1;
+    for (cmsghdr* cm = CMSG_FIRSTHDR(&mh); cm; cm = CMSG_NXTHDR(&mh, cm)) {
+        if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS) continue;
+        size_t count = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        const unsigned char* p = CMSG_DATA(cm);
+        for (size_t i = 0; i < count; ++i) {
+            int fd;
+            std::memcpy(&fd, p + i * sizeof(int), sizeof(int));
+            fds.push_back(fd);
+        }
+    }
+    if (mh.msg_flags & MSG_CTRUNC) {
+        // more descriptors than we take: the kernel dropped some already
+        close_fds(fds);
+        errno = EMSGSIZE;
+        return -1;
+    }
+    return n;
+}
+
+bool send_fds(int sock, const std::vector<int>& fds, const std::string& msg) {
+    if (msg.empty() || msg.size() > 4096) { errno = EINVAL; return false; }
+    ssize_t n = sendmsg_fds(sock, fds, msg.data(), msg.size());
+    if (n <= 0) return false;
+    // the fds travel with the first byte; finish the text the normal way
+    size_t done = (size_t)n;
+    while (done < msg.size()) {
+        n = ::send(sock, msg.data() + done, msg.size() - done, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        done += (size_t)n;
+    }
+    return true;
+}
+
+bool recv_fds(int sock, std::vector<int>& fds, std::string& msg, bool require_fds) {
+    fds.clear();
+    msg.assign(4096, '\0');
+    ssize_t n = recvmsg_fds(sock, msg.data(), msg.size(), fds);
+    if (n <= 0 || (require_fds && fds.empty())) {
+        close_fds(fds);
+        msg.clear();
+        return false;
+    }
+    msg.resize((size_t)n);
+    return true;
+}
+
+bool recv_line_fd(int sock, std::string& out, int& fd, size_t max_len) {
+    fd = -1;
+    uint32_t n = 0;
+    std::vector<int> fds;
+    ssize_t got = recvmsg_fds(sock, &n, sizeof(n), fds);   // fds come with the first byte
+    if (got <= 0 || (got < (ssize_t)sizeof(n) && !recv_all(sock, (char*)&n + got, sizeof(n) - got))) {
+        close_fds(fds);
+        return false;
+    }
+    n = ntohl(n);
+    if (n > max_len) { close_fds(fds); errno = EMSGSIZE; return false; }
+    out.assign(n, '\0');
+    if (n > 0 && !recv_all(sock, out.data(), n)) { close_fds(fds); return false; }
+    for (size_t i = 1; i < fds.size(); ++i) ::close(fds[i]);
+    if (!fds.empty()) fd = fds[0];
+    return true;
+}
+
+bool copy_fd_to_file(int fd, const std::string& path) {
+    struct stat st{};
+    if (::fstat(fd, &st) != 0) return false;
+    int out = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (out < 0) return false;
+    off_t off = 0;
+    bool in_kernel = true;
+    std::vector<char> buf;
+    while (off < st.st_size) {
+        ssize_t n;
+        if (in_kernel) {
+            n = ::copy_file_range(fd, &off, out, nullptr, (size_t)(st.st_size - off), 0);
+            if (n < 0 && (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP)) {
+                in_kernel = false;   // e.g. across filesystems on older kernels
+                continue;
+            }
+        } else {
+            if (buf.empty()) buf.resize(CHUNK_SIZE);
+            n = ::pread(fd, buf.data(), buf.size(), off);
+            if (n > 0 && !write_all(out, buf.data(), (size_t)n)) n = -1;
+            if (n > 0) off += n;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;   // error, or the file shrank
+    }
+    bool ok = off >= st.st_size;
+    if (::close(out) != 0) ok = false;
+    return ok;
+}
+
+int connect_unix(const std::string& path) {
+    sockaddr_un addr;
+    if (!fill_addr(path, addr)) return -1;
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    if (::connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int listen_unix(const std::string& path, int backlog) {
+    sockaddr_un addr;
+    if (!fill_addr(path, addr)) return -1;
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    struct stat st{};
+    if (::lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) ::unlink(path.c_str());
+    if (::bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0 || ::listen(fd, backlog) < 0) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+} // namespace proto
@@ -0,0 +1,50 @@
+// fd_passing.hpp (C++17)
+// Passing open file descriptors between processes over an AF_UNIX stream
+// socket (SCM_RIGHTS), together with a short text message: listeners on a
+// hot upgrade, files for same-host GETFD clients. Part of libfileshare.
+#pragma once
+
+#include <sys/types.h>
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "protocol.hpp"
+
+namespace proto {
+
+inline constexpr size_t MAX_PASSED_FDS = 16;
+
+// Sends msg (1..4096 bytes) with up to MAX_PASSED_FDS descriptors attached.
+// The caller keeps its own copies of the fds.
+bool send_fds(int sock, const std::vector<int>& fds, const std::string& msg);
+
+// Receives one send_fds() message. Received descriptors are close-on-exec.
+// Returns false on EOF/error or a message without descriptors when
+// require_fds is set; any descriptors received with a failed message are
+// closed.
+bool recv_fds(int sock, std::vector<int>& fds, std::string& msg, bool require_fds = true);
+
+// Reply line (framed like proto::send_line) with at most one descriptor
+// attached, as the server answers GETFD. fd is -1 when the line came alone.
+bool recv_line_fd(int sock, std::string& out, int& fd, size_t max_len = MAX_LINE);
+
+// Copy the whole file behind fd (e.g. from GETFD) to path, inside the kernel
+// where possible (copy_file_range; a reflink on filesystems that share
+// extents). Reads with pread, so fd's offset is left alone.
+bool copy_fd_to_file(int fd, const std::string& path);
+
+// Single sendmsg()/recvmsg() with descriptors attached to the first byte
+// (EINTR is retried); for callers with their own framing such as
+// aio::AsyncSocket. recvmsg_fds() appends what arrived to fds and fails with
+// EMSGSIZE when the kernel had to drop some.
+ssize_t sendmsg_fds(int sock, const std::vector<int>& fds, const void* data, size_t len);
+ssize_t recvmsg_fds(int sock, void* data, size_t len, std::vector<int>& fds);
+
+// Connect to / listen on a filesystem AF_UNIX path; -1 on error.
+// listen_unix() replaces a stale socket file at path.
+int connect_unix(const std::string& path);
+int listen_unix(const std::string& path, int backlog = 16);
+
+} // namespace proto
@@ -0,0 +1,220 @@
+// fec.cpp (C++17)
+// Reed-Solomon erasure code (see fec.hpp).
+#include "fec.hpp"
+
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FEC_X86 1
+#endif
+
+namespace fec {
+
+namespace {
+
+// GF(2^8) with the polynomial x^8 + x^4 + x^3 + x^2 + 1 (0x11d), generator 2
+struct Tables {
+    uint8_t exp[512];
+    uint8_t log[256];
+    uint8_t mul[256][256];
+
+    Tables() {
+        unsigned x = 1;
+        for (int i = 0; i < 255; ++i) {
+            exp[i] = exp[i + 255] = (uint8_t)x;
+            log[x] = (uint8_t)i;
+            x <<= 1;
+            if (x & 0x100) x ^= 0x11d;
+        }
+        exp[510] = exp[511] = exp[0];
+        log[0] = 0;
+        for (int a = 0; a < 256; ++a)
+            for (int b = 0; b < 256; ++b)
+                mul[a][b] = (a && b) ? exp[log[a] + log[b]] : 0;
+    }
+};
+
+const Tables& gf() {
+    static const Tables t;
+    return t;
+}
+
+uint8_t gf_inv(uint8_t a) { return gf().exp[255 - gf().log[a]]; }
+
+// generator row j (parity j) against data shard i
+uint8_t cauchy(int k, int j, int i) { return gf_inv((uint8_t)((k + j) ^ i)); }
+
+void mul_add_scalar(uint8_t* dst, const uint8_t* src, uint8_t c, size_t n) {
+    const uint8_t* row = gf().mul[c];
+    for (size_t i = 0; i < n; ++i) dst[i] ^= row[src[i]];
+}
+
+#ifdef FEC_X86
+// c * x = c * (x & 15) ^ c * (x & 240): two 16-entry tables, looked up 16 or
+// 32 bytes at a time with pshufb
+void nibble_tables(uint8_t c, uint8_t* lo, uint8_t* hi) {
+    const uint8_t* row = gf().mul[c];
+    for (int i = 0; i < 16; ++i) {
+        lo[i] = row[i];
+        hi[i] = row[i << 4];
+    }
+}
+
+__attribute__((target("ssse3")))
+void mul_add_ssse3(uint8_t* dst, const uint8_t* src, uint8_t c, size_t n) {
+    alignas(16) uint8_t lo[16], hi[16];
+    nibble_tables(c, lo, hi);
+    const __m128i tlo = _mm_load_si128((const __m128i*)lo);
+    const __m128i thi = _mm_load_si128((const __m128i*)hi);
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i p = _mm_xor_si128(_mm_shuffle_epi8(tlo, _mm_and_si128(s, mask)),
+                                  _mm_shuffle_epi8(thi, _mm_and_si128(_mm_srli_epi64(s, 4), mask)));
+        __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_xor_si128(d, p));
+    }
+    mul_add_scalar(dst + i, src + i, c, n - i);
+}
+
+__attribute__((target("avx2")))
+void mul_add_avx2(uint8_t* dst, const uint8_t* src, uint8_t c, size_t n) {
+    alignas(16) uint8_t lo[16], hi[16];
+    nibble_tables(c, lo, hi);
+    const __m256i tlo = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*)lo));
+    const __m256i thi = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*)hi));
+    const __m256i mask = _mm256_set1_epi8(0x0f);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i s = _mm256_loadu_si256((const __m256i*)(src + i));
+        __m256i p = _mm256_xor_si256(_mm256_shuffle_epi8(tlo, _mm256_and_si256(s, mask)),
+                                     _mm256_shuffle_epi8(thi, _mm256_and_si256(_mm256_srli_epi64(s, 4), mask)));
+        __m256i d = _mm256_loadu_si256((const __m256i*)(dst + i));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_xor_si256(d, p));
+    }
+    mul_add_scalar(dst + i, src + i, c, n - i);
+}
+#endif
+
+using Kernel = void (*)(uint8_t*, const uint8_t*, uint8_t, size_t);
+
+struct Choice {
+    Kernel fn;
+    const char* name;
+};
+
+bool supported(const char* name) {
+    if (std::strcmp(name, "scalar") == 0) return true;
+#ifdef FEC_X86
+    if (std::strcmp(name, "ssse3") == 0) return __builtin_cpu_supports("ssse3");
+    if (std::strcmp(name, "avx2") == 0) return __builtin_cpu_supports("avx2");
+#endif
+    return false;
+}
+
+Choice kernel_for(const char* name) {
+#ifdef FEC_X86
+    if (std::strcmp(name, "avx2") == 0) return {mul_add_avx2, "avx2"};
+    if (std::strcmp(name, "ssse3") == 0) return {mul_add_ssse3, "ssse3"};
+#endif
+    return {mul_add_scalar, "scalar"};
+}
+
+Choice& kernel() {
+    static Choice k = supported("avx2") ? kernel_for("avx2")
+                    : supported("ssse3") ? kernel_for("ssse3")
+                    : kernel_for("scalar");
+    return k;
+}
+
+// Invert the n x n matrix m (row major) in place; false if singular.
+bool invert(std::vector<uint8_t>& m, int n) {
+    const Tables& t = gf();
+    std::vector<uint8_t> inv(n * n, 0);
+    for (int i = 0; i < n; ++i) inv[i * n + i] = 1;
+    for (int col = 0; col < n; ++col) {
+        int pivot = col;
+        while (pivot < n && m[pivot * n + col] == 0) ++pivot;
+        if (pivot == n) return false;
+        if (pivot != col) {
+            for (int x = 0; x < n; ++x) {
+                std::swap(m[pivot * n + x], m[col * n + x]);
+                std::swap(inv[pivot * n + x], inv[col * n + x]);
+            }
+        }
+        uint8_t scale = gf_inv(m[col * n + col]);
+        for (int x = 0; x < n; ++x) {
+            m[col * n + x] = t.mul[scale][m[col * n + x]];
+            inv[col * n + x] = t.mul[scale][inv[col * n + x]];
+        }
+        for (int row = 0; row < n; ++row) {
+            uint8_t f = m[row * n + col];
+            if (row == col || f == 0) continue;
+            for (int x = 0; x < n; ++x) {
+                m[row * n + x] ^= t.mul[f][m[col * n + x]];
+                inv[row * n + x] ^= t.mul[f][inv[col * n + x]];
+            }
+        }
+    }
+    m.swap(inv);
+    return true;
+}
+
+} // namespace
+
+bool valid(int k, int r) { return k >= 1 && r >= 0 && k + r <= MAX_SHARDS; }
+
+void mul_add(uint8_t* dst, const uint8_t* src, uint8_t c, size_t n) {
+    if (c == 0) return;
+    kernel().fn(dst, src, c, n);
+}
+
+const char* kernel_name() { return kernel().name; }
+
+bool set_kernel(const char* name) {
+    if (!supported(name)) return false;
+    kernel() = kernel_for(name);
+    return true;
+}
+
+void encode(int k, int r, size_t len, const uint8_t* const* data, uint8_t* const* parity) {
+    for (int j = 0; j < r; ++j) {
+        std::memset(parity[j], 0, len);
+        for (int i = 0; i < k; ++i) mul_add(parity[j], data[i], cauchy(k, j, i), len);
+    }
+}
+
+bool reconstruct(int k, int r, size_t len, uint8_t* const* shards, const bool* present) {
+    std::vector<int> missing, parity;
+    for (int i = 0; i < k; ++i)
+        if (!present[i]) missing.push_back(i);
+    if (missing.empty()) return true;
+    for (int j = 0; j < r && parity.size() < missing.size(); ++j)
+        if (present[k + j]) parity.push_back(j);
+    if (parity.size() < missing.size()) return false;
+
+    // each chosen parity shard minus the data that did arrive leaves a
+    // combination of the missing shards only: solve that m x m system
+    int m = (int)missing.size();
+    std::vector<std::vector<uint8_t>> rhs(m, std::vector<uint8_t>(len));
+    std::vector<uint8_t> a(m * m);
+    for (int t = 0; t < m; ++t) {
+        int j = parity[t];
+        std::memcpy(rhs[t].data(), shards[k + j], len);
+        for (int i = 0; i < k; ++i)
+            if (present[i]) mul_add(rhs[t].data(), shards[i], cauchy(k, j, i), len);
+        for (int u = 0; u < m; ++u) a[t * m + u] = cauchy(k, j, missing[u]);
+    }
+    if (!invert(a, m)) return false;   // cannot happen for a Cauchy matrix
+    for (int u = 0; u < m; ++u) {
+        uint8_t* out = shards[missing[u]];
+        std::memset(out, 0, len);
+        for (int t = 0; t < m; ++t) mul_add(out, rhs[t].data(), a[u * m + t], len);
+    }
+    return true;
+}
+
+} // namespace fec
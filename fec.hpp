@@ -0,0 +1,40 @@
+// fec.hpp (C++17)
+// Reed-Solomon erasure code over GF(2^8) for forward error correction. Part of
+// libfileshare; the UDP transport uses it to repair lost packets without a
+// retransmission round trip.
+//
+// k equal-sized data shards get r parity shards, and any k of the k + r
+// shards rebuild the data. The code is systematic (data shards are sent
+// unchanged) with a Cauchy generator matrix, so every choice of k shards is
+// solvable. The inner loop, dst ^= c * src, uses 4-bit lookup tables in
+// AVX2 or SSSE3 registers when the CPU has them, chosen at run time.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace fec {
+
+inline constexpr int MAX_SHARDS = 255;   // k + r
+
+// 1 <= k, 0 <= r, k + r <= MAX_SHARDS
+bool valid(int k, int r);
+
+// parity[j] = sum over i of C[j][i] * data[i]; every shard is len bytes.
+void encode(int k, int r, size_t len, const uint8_t* const* data, uint8_t* const* parity);
+
+// shards holds k data then r parity buffers of len bytes, present[] says which
+// arrived. Missing data shards are rebuilt in place (their buffers must
+// exist); missing parity shards are left alone. False if fewer than k shards
+// are present.
+bool reconstruct(int k, int r, size_t len, uint8_t* const* shards, const bool* present);
+
+// dst ^= c * src over GF(2^8)
+void mul_add(uint8_t* dst, const uint8_t* src, uint8_t c, size_t n);
+
+// The mul_add kernel in use: "avx2", "ssse3" or "scalar". set_kernel() picks
+// another one for benchmarks; false if the CPU lacks it.
+const char* kernel_name();
+bool set_kernel(const char* name);
+
+} // namespace fec
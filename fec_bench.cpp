@@ -0,0 +1,231 @@
+// fec_bench.cpp (C++20)
+// Benchmark for forward error correction on the UDP transport: GETs one file
+// through a local proxy that drops (and optionally delays) datagrams with
+// wan_proxy's link model (wan_link.hpp), for every combination of loss rate
+// and FEC setting, and prints the goodput.
+// Usage: ./fec_bench <host> <port> <user> <pass> <file>
+//            [--loss 0,0.01,0.05,0.1] [--fec off,16+2,16+4,16+8] [--delay MS]
+// host:port is the server's udp: listener.
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "endpoint.hpp"
+#include "fec.hpp"
+#include "protocol.hpp"
+#include "udp_transport.hpp"
+#include "wan_link.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+// Forwards datagrams between one client and the server through the link
+// model of wan_proxy (wan_link.hpp), one link each way.
+class LossProxy {
+public:
+    LossProxy(const sockaddr_storage& server, socklen_t len, const wan::Impairment& imp)
+        : imp_(imp), up_(imp_, imp_.seed), down_(imp_, imp_.seed + 1) {
+        front_ = ::socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        sockaddr_in a{};
+        a.sin_family = AF_INET;
+        a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        ::bind(front_, (sockaddr*)&a, sizeof(a));
+        socklen_t alen = sizeof(a);
+        getsockname(front_, (sockaddr*)&a, &alen);
+        port_ = ntohs(a.sin_port);
+        back_ = ::socket(server.ss_family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        ::connect(back_, (const sockaddr*)&server, len);
+        int buf = 4 << 20;
+        for (int fd : {front_, back_}) {
+            setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buf, sizeof(buf));
+            setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &buf, sizeof(buf));
+        }
+        thread_ = std::thread([this] { run(); });
+    }
+    ~LossProxy() {
+        stop_ = true;
+        thread_.join();
+        ::close(front_);
+        ::close(back_);
+    }
+    int port() const { return port_; }
+
+private:
+    struct Held {
+        bool to_server;
+        std::string bytes;
+    };
+
+    void run() {
+        char buf[65536];
+        while (!stop_) {
+            int timeout = 20;
+            if (!held_.empty()) {
+                auto ms = std::chrono::ceil<std::chrono::milliseconds>(held_.begin()->first - Clock::now()).count();
+                timeout = (int)std::clamp<int64_t>(ms, 0, 20);
+            }
+            pollfd p[2] = {{front_, POLLIN, 0}, {back_, POLLIN, 0}};
+            poll(p, 2, timeout);
+            for (int side = 0; side < 2; ++side) {
+                if (!(p[side].revents & POLLIN)) continue;
+                while (true) {
+                    sockaddr_storage from{};
+                    socklen_t flen = sizeof(from);
+                    ssize_t n = ::recvfrom(p[side].fd, buf, sizeof(buf), MSG_DONTWAIT, (sockaddr*)&from, &flen);
+                    if (n < 0) break;
+                    if (side == 0) {
+                        client_ = from;
+                        client_len_ = flen;
+                    }
+                    wan::Link& link = side == 0 ? up_ : down_;
+                    Clock::time_point due;
+                    if (link.lost() || !link.schedule((size_t)n, Clock::now(), due)) continue;
+                    held_.emplace(due, Held{side == 0, std::string(buf, (size_t)n)});
+                }
+            }
+            auto now = Clock::now();
+            while (!held_.empty() && held_.begin()->first <= now) {
+                auto& h = held_.begin()->second;
+                if (h.to_server) ::send(back_, h.bytes.data(), h.bytes.size(), 0);
+                else if (client_len_) ::sendto(front_, h.bytes.data(), h.bytes.size(), 0, (sockaddr*)&client_, client_len_);
+                held_.erase(held_.begin());
+            }
+        }
+    }
+
+    wan::Impairment imp_;
+    wan::Link up_, down_;   // to the server, to the client
+    int front_ = -1, back_ = -1, port_ = 0;
+    sockaddr_storage client_{};
+    socklen_t client_len_ = 0;
+    std::multimap<Clock::time_point, Held> held_;   // by arrival; jitter may reorder
+    std::atomic<bool> stop_{false};
+    std::thread thread_;
+};
+
+static std::vector<std::string> split(const std::string& s) {
+    std::vector<std::string> out;
+    std::stringstream ss(s);
+    for (std::string item; std::getline(ss, item, ',');) out.push_back(item);
+    return out;
+}
+
+// Encode speed of every kernel the CPU has, for k + r shards of one packet.
+static void kernel_table(int k, int r) {
+    const size_t len = 1216;
+    std::vector<std::vector<uint8_t>> shards(k + r, std::vector<uint8_t>(len, 0x5A));
+    std::vector<const uint8_t*> data;
+    std::vector<uint8_t*> parity;
+    for (int i = 0; i < k; ++i) data.push_back(shards[i].data());
+    for (int j = 0; j < r; ++j) parity.push_back(shards[k + j].data());
+    std::string chosen = fec::kernel_name();
+    std::cout << "Encode " << k << "+" << r << " (" << len << "-byte shards):";
+    for (const char* name : {"scalar", "ssse3", "avx2"}) {
+        if (!fec::set_kernel(name)) continue;
+        const int groups = 20000;
+        auto start = Clock::now();
+        for (int g = 0; g < groups; ++g) fec::encode(k, r, len, data.data(), parity.data());
+        double secs = std::chrono::duration<double>(Clock::now() - start).count();
+        std::cout << "  " << name << " " << (int)(groups * k * len / secs / (1024 * 1024)) << " MiB/s";
+    }
+    fec::set_kernel(chosen.c_str());
+    std::cout << " (using " << chosen << ")\n";
+}
+
+// Seconds for one GET through the proxy, or -1.
+static double timed_get(int port, const std::string& user, const std::string& pass, const std::string& file,
+                        uint64_t& bytes) {
+    int fd = proto::connect_endpoint("udp:127.0.0.1", port);
+    if (fd < 0) return -1;
+    timeval tv{60, 0};   // a stalled run fails instead of hanging the table
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    std::string resp;
+    double secs = -1;
+    if (proto::send_line(fd, "AUTH " + user + " " + pass) && proto::recv_line(fd, resp) && resp == "AUTH_OK") {
+        auto start = Clock::now();
+        uint64_t size_be = 0;
+        if (proto::send_line(fd, "GET " + file) && proto::recv_line(fd, resp) && resp == "OK" &&
+            proto::recv_all(fd, &size_be, sizeof(size_be))) {
+            uint64_t left = proto::be64_to_host(size_be);
+            bytes = left;
+            std::vector<char> buf(1 << 20);
+            while (left > 0) {
+                ssize_t n = ::read(fd, buf.data(), std::min<uint64_t>(left, buf.size()));
+                if (n <= 0) break;
+                left -= (uint64_t)n;
+            }
+            if (left == 0) secs = std::chrono::duration<double>(Clock::now() - start).count();
+        }
+        proto::send_line(fd, "QUIT");
+    }
+    ::close(fd);
+    return secs;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 6) {
+        std::cerr << "Usage: " << argv[0] << " <host> <port> <user> <pass> <file>"
+                  << " [--loss 0,0.01,0.05,0.1] [--fec off,16+2,16+4,16+8] [--delay MS]\n";
+        return 1;
+    }
+    std::vector<std::string> losses = {"0", "0.01", "0.02", "0.05", "0.1"};
+    std::vector<std::string> fecs = {"off", "16+2", "16+4", "16+8"};
+    int delay_ms = 0;
+    for (int i = 6; i + 1 < argc; i += 2) {
+        std::string flag = argv[i];
+        if (flag == "--loss") losses = split(argv[i + 1]);
+        else if (flag == "--fec") fecs = split(argv[i + 1]);
+        else if (flag == "--delay") delay_ms = std::stoi(argv[i + 1]);
+        else { std::cerr << "Unknown flag " << flag << "\n"; return 1; }
+    }
+
+    addrinfo hints{};
+    hints.ai_socktype = SOCK_DGRAM;
+    addrinfo* res = nullptr;
+    if (getaddrinfo(argv[1], argv[2], &hints, &res) != 0) { std::cerr << "Cannot resolve " << argv[1] << "\n"; return 1; }
+    sockaddr_storage server{};
+    std::memcpy(&server, res->ai_addr, res->ai_addrlen);
+    socklen_t server_len = res->ai_addrlen;
+    freeaddrinfo(res);
+
+    kernel_table(16, 4);
+    std::cout << "Loss each way, " << delay_ms << " ms delay each way; goodput in MiB/s\n";
+    std::cout << std::setw(8) << "loss";
+    for (auto& f : fecs) std::cout << std::setw(12) << f;
+    std::cout << "\n";
+    int failures = 0;
+    for (auto& loss : losses) {
+        std::cout << std::setw(8) << loss << std::flush;
+        for (auto& f : fecs) {
+            udp::FecConfig fec;
+            if (!udp::parse_fec(f, fec)) { std::cerr << "\nBad FEC setting " << f << "\n"; return 1; }
+            udp::set_client_fec(fec);
+            wan::Impairment imp;
+            imp.loss = std::stod(loss);
+            imp.delay = std::chrono::milliseconds(delay_ms);
+            imp.seed = 12345;
+            LossProxy proxy(server, server_len, imp);
+            uint64_t bytes = 0;
+            double secs = timed_get(proxy.port(), argv[3], argv[4], argv[5], bytes);
+            std::ostringstream cell;
+            if (secs > 0) cell << std::fixed << std::setprecision(1) << bytes / secs / (1024 * 1024);
+            else { cell << "failed"; ++failures; }
+            std::cout << std::setw(12) << cell.str() << std::flush;
+        }
+        std::cout << "\n";
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,59 @@
+// hash_ring.hpp (C++17)
+// Consistent hashing: maps file names to one of several members (storage
+// shards, cluster nodes) so that adding or removing a member only moves the
+// names of about 1/N of the namespace.
+//
+// Each member is placed at VNODES points on a 64-bit ring, derived from its
+// id string (a directory path, "host:port"), so placement does not depend on
+// the order members are listed in. A name belongs to the first point at or
+// after its own hash.
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+class HashRing {
+public:
+    static constexpr int VNODES = 128;
+
+    // FNV-1a with a splitmix64 finish, so similar names spread evenly.
+    // Stable across processes and builds: placement is persistent.
+    static uint64_t hash(const std::string& s) {
+        uint64_t h = 14695981039346656037ULL;
+        for (unsigned char c : s) {
+            h ^= c;
+            h *= 1099511628211ULL;
+        }
+        h ^= h >> 30;
+        h *= 0xbf58476d1ce4e5b9ULL;
+        h ^= h >> 27;
+        h *= 0x94d049bb133111ebULL;
+        h ^= h >> 31;
+        return h;
+    }
+
+    HashRing() = default;
+    explicit HashRing(const std::vector<std::string>& ids) {
+        for (size_t m = 0; m < ids.size(); ++m)
+            for (int v = 0; v < VNODES; ++v)
+                points_.emplace_back(hash(ids[m] + "#" + std::to_string(v)), m);
+        std::sort(points_.begin(), points_.end());
+    }
+
+    bool empty() const { return points_.empty(); }
+
+    // Index (into the ids given) of the member that owns name.
+    size_t owner(const std::string& name) const { return owner_of_hash(hash(name)); }
+
+    size_t owner_of_hash(uint64_t h) const {
+        auto it = std::lower_bound(points_.begin(), points_.end(), std::make_pair(h, (size_t)0));
+        if (it == points_.end()) it = points_.begin();
+        return it->second;
+    }
+
+private:
+    std::vector<std::pair<uint64_t, size_t>> points_;   // (position, member)
+};
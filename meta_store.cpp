@@ -0,0 +1,479 @@
+// meta_store.cpp (C++17)
+// Memtable, wal and mmap'd sorted segments of file metadata (see meta_store.hpp).
+#include "meta_store.hpp"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <string_view>
+
+static const char MAGIC[8] = {'F', 'S', 'M', 'E', 'T', 'A', '0', '1'};
+static const size_t HEADER_BYTES = 8 + 8 + 8 + 4;
+
+static bool write_all(int fd, const char* p, size_t n) {
+    while (n > 0) {
+        ssize_t w = ::write(fd, p, n);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return false;
+        p += w;
+        n -= (size_t)w;
+    }
+    return true;
+}
+
+template <typename T>
+static T load(const char* p) {
+    T v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+template <typename T>
+static void store(std::string& out, T v) {
+    out.append(reinterpret_cast<const char*>(&v), sizeof(v));
+}
+
+static std::string key_of(bool upload, const std::string& name) { return (upload ? "u/" : "r/") + name; }
+
+// ---- segments ----
+
+struct MetaStore::Segment {
+    uint32_t id = 0;
+    uint32_t first_id = 0;   // oldest segment this one replaces
+    std::string path;
+    const char* base = nullptr;
+    size_t len = 0;
+    uint64_t count = 0;
+    const char* index = nullptr;
+
+    Segment() = default;
+    Segment(const Segment&) = delete;
+    Segment& operator=(const Segment&) = delete;
+    ~Segment() {
+        if (base) munmap(const_cast<char*>(base), len);
+    }
+
+    // Maps path; records are checked as they are read, so opening a segment
+    // of millions of entries touches only its header.
+    bool map(const std::string& p, uint32_t seg_id) {
+        id = seg_id;
+        path = p;
+        int fd = ::open(p.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st{};
+        if (fd < 0 || fstat(fd, &st) != 0 || (size_t)st.st_size < HEADER_BYTES) {
+            if (fd >= 0) ::close(fd);
+            return false;
+        }
+        len = (size_t)st.st_size;
+        void* m = mmap(nullptr, len, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (m == MAP_FAILED) return false;
+        base = static_cast<const char*>(m);
+        if (std::memcmp(base, MAGIC, sizeof(MAGIC)) != 0) return false;
+        count = load<uint64_t>(base + 8);
+        uint64_t at = load<uint64_t>(base + 16);
+        first_id = load<uint32_t>(base + 24);
+        if (at < HEADER_BYTES || at > len || count > (len - at) / 8) return false;
+        index = base + at;
+        return true;
+    }
+
+    uint64_t offset(uint64_t i) const { return load<uint64_t>(index + i * 8); }
+
+    // Whether record i lies wholly before the index.
+    bool valid(uint64_t i) const {
+        size_t end = (size_t)(index - base);
+        size_t p = (size_t)offset(i);
+        if (p < HEADER_BYTES || p + 2 > end) return false;
+        p += 2 + load<uint16_t>(base + p) + 1 + 8 + 8 + 8 + 4 + 1;
+        return p + 2 <= end && p + 2 + load<uint16_t>(base + p) <= end;
+    }
+
+    // "" for a damaged record, which then matches no name.
+    std::string_view key(uint64_t i) const {
+        if (!valid(i)) return {};
+        const char* p = base + offset(i);
+        return {p + 2, load<uint16_t>(p)};
+    }
+
+    Entry entry(uint64_t i) const {
+        const char* p = base + offset(i);
+        p += 2 + load<uint16_t>(p);
+        Entry e;
+        e.deleted = *p++ != 0;
+        e.rec.size = load<uint64_t>(p);
+        e.rec.mtime = load<int64_t>(p + 8);
+        e.rec.hash = load<uint64_t>(p + 16);
+        e.rec.shard = load<uint32_t>(p + 24);
+        e.rec.packed = p[28] != 0;
+        p += 29;
+        e.rec.owner.assign(p + 2, load<uint16_t>(p));
+        return e;
+    }
+
+    // First index whose key is not less than k.
+    uint64_t lower_bound(std::string_view k) const {
+        uint64_t lo = 0, hi = count;
+        while (lo < hi) {
+            uint64_t mid = lo + (hi - lo) / 2;
+            if (key(mid) < k) lo = mid + 1;
+            else hi = mid;
+        }
+        return lo;
+    }
+};
+
+// Writes a segment in key order: to a temp file, renamed into place by finish().
+class MetaStore::Writer {
+public:
+    Writer(std::string path, uint32_t first_id) : path_(std::move(path)), tmp_(path_ + ".tmp") {
+        fd_ = ::open(tmp_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        std::string head(MAGIC, sizeof(MAGIC));
+        store<uint64_t>(head, 0);
+        store<uint64_t>(head, 0);
+        store<uint32_t>(head, first_id);
+        ok_ = fd_ >= 0 && write_all(fd_, head.data(), head.size());
+        written_ = head.size();
+    }
+    ~Writer() {
+        if (fd_ >= 0) ::close(fd_);
+        if (!done_) ::unlink(tmp_.c_str());
+    }
+
+    void add(std::string_view key, const Entry& e) {
+        if (key.size() > UINT16_MAX || e.rec.owner.size() > UINT16_MAX) return;
+        offsets_.push_back(written_ + buf_.size());
+        store<uint16_t>(buf_, (uint16_t)key.size());
+        buf_.append(key);
+        buf_.push_back(e.deleted ? 1 : 0);
+        store<uint64_t>(buf_, e.rec.size);
+        store<int64_t>(buf_, e.rec.mtime);
+        store<uint64_t>(buf_, e.rec.hash);
+        store<uint32_t>(buf_, e.rec.shard);
+        buf_.push_back(e.rec.packed ? 1 : 0);
+        store<uint16_t>(buf_, (uint16_t)e.rec.owner.size());
+        buf_ += e.rec.owner;
+        if (buf_.size() >= (1 << 20)) drain();
+    }
+
+    bool finish() {
+        drain();
+        std::string idx;
+        idx.reserve(offsets_.size() * 8);
+        for (uint64_t off : offsets_) store<uint64_t>(idx, off);
+        std::string fix;
+        store<uint64_t>(fix, offsets_.size());
+        store<uint64_t>(fix, written_);
+        ok_ = ok_ && write_all(fd_, idx.data(), idx.size()) &&
+              pwrite(fd_, fix.data(), fix.size(), 8) == (ssize_t)fix.size() && fsync(fd_) == 0;
+        if (fd_ >= 0) ::close(fd_);
+        fd_ = -1;
+        done_ = ok_ && std::rename(tmp_.c_str(), path_.c_str()) == 0;
+        return done_;
+    }
+
+private:
+    void drain() {
+        ok_ = ok_ && write_all(fd_, buf_.data(), buf_.size());
+        written_ += buf_.size();
+        buf_.clear();
+    }
+
+    std::string path_, tmp_;
+    int fd_ = -1;
+    bool ok_ = false, done_ = false;
+    uint64_t written_ = 0;   // bytes in the file, buf_ follows them
+    std::string buf_;
+    std::vector<uint64_t> offsets_;
+};
+
+// ---- MetaStore ----
+
+MetaStore::~MetaStore() {
+    if (wal_fd_ >= 0) ::close(wal_fd_);
+}
+
+std::string MetaStore::segment_path(uint32_t id) const {
+    char name[32];
+    std::snprintf(name, sizeof(name), "/seg-%06u.dat", id);
+    return dir_ + name;
+}
+
+bool MetaStore::open(const std::string& dir, std::string& err) {
+    std::lock_guard<std::mutex> lock(mu_);
+    dir_ = dir;
+    if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+        err = "cannot create " + dir + ": " + std::strerror(errno);
+        return false;
+    }
+    std::set<uint32_t> ids;
+    DIR* d = opendir(dir.c_str());
+    if (!d) {
+        err = "cannot open " + dir + ": " + std::strerror(errno);
+        return false;
+    }
+    while (dirent* de = readdir(d)) {
+        unsigned id = 0;
+        char tail = 0;
+        if (std::strstr(de->d_name, ".tmp")) ::unlink((dir + "/" + de->d_name).c_str());   // a flush cut short
+        else if (std::sscanf(de->d_name, "seg-%u.da%c", &id, &tail) == 2 && tail == 't' && id > 0) ids.insert(id);
+    }
+    closedir(d);
+
+    segs_.clear();
+    for (uint32_t id : ids) {
+        auto seg = std::make_shared<Segment>();
+        if (!seg->map(segment_path(id), id)) {
+            err = segment_path(id) + " is damaged; delete " + dir + " to rebuild it";
+            return false;
+        }
+        segs_.push_back(std::move(seg));
+        next_seg_ = id + 1;
+    }
+    // a merge that crashed before deleting the segments it replaced
+    std::set<uint32_t> stale;
+    for (auto& s : segs_)
+        for (uint32_t id = s->first_id; id < s->id; ++id) stale.insert(id);
+    segs_.erase(std::remove_if(segs_.begin(), segs_.end(),
+                               [&](const std::shared_ptr<const Segment>& s) {
+                                   if (!stale.count(s->id)) return false;
+                                   ::unlink(s->path.c_str());
+                                   return true;
+                               }),
+                segs_.end());
+
+    mem_.clear();
+    std::ifstream in(dir + "/wal");
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream ls(line);
+        std::string op, ns, name, owner;
+        Entry e;
+        if (!(ls >> op >> ns >> name) || (ns != "r" && ns != "u")) continue;   // torn by a crash
+        if (op == "del") {
+            e.deleted = true;
+        } else if (op == "put" && (ls >> e.rec.size >> e.rec.mtime >> e.rec.hash >> e.rec.shard >> e.rec.packed >> owner)) {
+            e.rec.owner = owner == "-" ? "" : owner;
+        } else {
+            continue;
+        }
+        mem_[ns + "/" + name] = e;
+    }
+    wal_fd_ = ::open((dir + "/wal").c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (wal_fd_ < 0) {
+        err = "cannot open " + dir + "/wal: " + std::strerror(errno);
+        return false;
+    }
+    complete_ = access((dir + "/complete").c_str(), F_OK) == 0;
+    clean_ = access((dir + "/clean").c_str(), F_OK) == 0;
+    ::unlink((dir + "/clean").c_str());
+    if (mem_.size() >= MEMTABLE_MAX) flush();
+    return true;
+}
+
+// Called with mu_ held.
+bool MetaStore::apply(const std::string& key, const Entry& e, const std::string& line) {
+    if (released_ || !write_all(wal_fd_, line.data(), line.size())) return false;
+    mem_[key] = e;
+    if (mem_.size() >= MEMTABLE_MAX) flush();
+    return true;
+}
+
+// The memtable into a new segment, then an empty wal. Called with mu_ held.
+bool MetaStore::flush() {
+    uint32_t id = next_seg_;
+    {
+        Writer w(segment_path(id), id);
+        for (auto& [key, e] : mem_) w.add(key, e);
+        if (!w.finish()) return false;   // stays in the wal; tried again on the next change
+    }
+    auto seg = std::make_shared<Segment>();
+    if (!seg->map(segment_path(id), id)) return false;
+    segs_.push_back(std::move(seg));
+    ++next_seg_;
+    mem_.clear();
+    // a crash before this replays the wal onto the same values
+    if (ftruncate(wal_fd_, 0) != 0) return false;
+    return true;
+}
+
+bool MetaStore::put(bool upload, const std::string& name, const Record& r) {
+    Entry e;
+    e.rec = r;
+    std::string line = "put " + std::string(upload ? "u " : "r ") + name + " " + std::to_string(r.size) + " " +
+                       std::to_string(r.mtime) + " " + std::to_string(r.hash) + " " + std::to_string(r.shard) + " " +
+                       (r.packed ? "1 " : "0 ") + (r.owner.empty() ? "-" : r.owner) + "\n";
+    std::lock_guard<std::mutex> lock(mu_);
+    return apply(key_of(upload, name), e, line);
+}
+
+bool MetaStore::remove(bool upload, const std::string& name) {
+    Entry e;
+    e.deleted = true;
+    std::string line = "del " + std::string(upload ? "u " : "r ") + name + "\n";
+    std::lock_guard<std::mutex> lock(mu_);
+    return apply(key_of(upload, name), e, line);
+}
+
+bool MetaStore::get(bool upload, const std::string& name, Record& r) const {
+    std::string key = key_of(upload, name);
+    Segments segs;
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        auto it = mem_.find(key);
+        if (it != mem_.end()) {
+            r = it->second.rec;
+            return !it->second.deleted;
+        }
+        segs = segs_;
+    }
+    for (size_t i = segs.size(); i-- > 0;) {
+        uint64_t at = segs[i]->lower_bound(key);
+        if (at < segs[i]->count && segs[i]->key(at) == key) {
+            Entry e = segs[i]->entry(at);
+            r = e.rec;
+            return !e.deleted;
+        }
+    }
+    return false;
+}
+
+template <typename Fn>
+void MetaStore::merge(const Memtable* mem, const Segments& segs, const std::string& prefix, Fn fn) {
+    // one cursor per source, the memtable (newest) last
+    struct Cursor {
+        const Segment* seg = nullptr;
+        uint64_t at = 0;
+        Memtable::const_iterator it, end;
+    };
+    std::vector<Cursor> cur;
+    for (auto& s : segs) cur.push_back({s.get(), s->lower_bound(prefix), {}, {}});
+    if (mem) cur.push_back({nullptr, 0, mem->lower_bound(prefix), mem->end()});
+    auto key = [&](const Cursor& c, std::string_view& k) {
+        if (c.seg) {
+            if (c.at >= c.seg->count) return false;
+            k = c.seg->key(c.at);
+        } else {
+            if (c.it == c.end) return false;
+            k = c.it->first;
+        }
+        return k.compare(0, prefix.size(), prefix) == 0;
+    };
+    while (true) {
+        // the least key; of its versions the one from the newest source
+        std::string_view least;
+        size_t newest = cur.size();
+        for (size_t i = 0; i < cur.size(); ++i) {
+            std::string_view k;
+            if (!key(cur[i], k)) continue;
+            if (newest == cur.size() || k <= least) {
+                least = k;
+                newest = i;
+            }
+        }
+        if (newest == cur.size()) return;
+        std::string k(least);
+        const Cursor& c = cur[newest];
+        fn(k, c.seg ? c.seg->entry(c.at) : c.it->second);
+        for (auto& x : cur) {
+            std::string_view xk;
+            if (!key(x, xk) || xk != k) continue;
+            if (x.seg) ++x.at;
+            else ++x.it;
+        }
+    }
+}
+
+std::vector<std::pair<std::string, MetaStore::Record>> MetaStore::scan(bool upload) const {
+    std::string prefix = key_of(upload, "");
+    Memtable mem;
+    Segments segs;
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        for (auto it = mem_.lower_bound(prefix); it != mem_.end() && it->first.compare(0, 2, prefix) == 0; ++it)
+            mem.insert(*it);
+        segs = segs_;
+    }
+    std::vector<std::pair<std::string, Record>> out;
+    merge(&mem, segs, prefix, [&](const std::string& key, const Entry& e) {
+        if (!e.deleted) out.emplace_back(key.substr(2), e.rec);
+    });
+    return out;
+}
+
+std::vector<std::string> MetaStore::list(bool upload) const {
+    std::vector<std::string> out;
+    for (auto& [name, rec] : scan(upload)) out.push_back(name);
+    return out;
+}
+
+bool MetaStore::complete() const {
+    std::lock_guard<std::mutex> lock(mu_);
+    return complete_;
+}
+
+void MetaStore::mark_complete() {
+    std::lock_guard<std::mutex> lock(mu_);
+    if (complete_ || released_) return;
+    int fd = ::open((dir_ + "/complete").c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (fd >= 0) ::close(fd);
+    complete_ = true;
+}
+
+void MetaStore::shutdown() {
+    std::lock_guard<std::mutex> lock(mu_);
+    if (released_ || wal_fd_ < 0 || fsync(wal_fd_) != 0) return;
+    int fd = ::open((dir_ + "/clean").c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) return;
+    fsync(fd);
+    ::close(fd);
+}
+
+void MetaStore::release() {
+    std::lock_guard<std::mutex> lock(mu_);
+    if (wal_fd_ >= 0) {
+        fsync(wal_fd_);
+        ::close(wal_fd_);
+    }
+    wal_fd_ = -1;
+    released_ = true;
+}
+
+// Only one compact() may run at a time; changes and lookups may go on.
+size_t MetaStore::compact() {
+    Segments old;
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        if (released_ || segs_.size() <= MAX_SEGMENTS) return 0;
+        old = segs_;
+    }
+    // every older version is in the merge, so tombstones have nothing left to hide
+    uint32_t id = old.back()->id;
+    {
+        Writer w(segment_path(id), old.front()->id);
+        merge(nullptr, old, "", [&](const std::string& key, const Entry& e) {
+            if (!e.deleted) w.add(key, e);
+        });
+        if (!w.finish()) return 0;
+    }
+    auto merged = std::make_shared<Segment>();
+    if (!merged->map(segment_path(id), id)) return 0;
+    std::lock_guard<std::mutex> lock(mu_);
+    // segments flushed meanwhile are newer and stay after it
+    Segments next{merged};
+    next.insert(next.end(), segs_.begin() + (long)old.size(), segs_.end());
+    segs_ = std::move(next);
+    for (auto& s : old)
+        if (s->id != id) ::unlink(s->path.c_str());   // mapped until the last reader lets go
+    return old.size();
+}
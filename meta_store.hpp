@@ -0,0 +1,112 @@
+// meta_store.hpp (C++17)
+// Log-structured store of file metadata, so LIST and STAT need not read
+// directories. Keys are the served names and the upload names; each maps to
+// a Record. In its directory:
+//
+//   wal               recent changes, one line each, replayed into the
+//                     memtable on open:
+//                       put <r|u> <name> <size> <mtime_ns> <hash> <shard> <packed> <owner|->
+//                       del <r|u> <name>
+//   seg-000001.dat    immutable sorted segments, each a flushed memtable,
+//   ...               mapped with mmap on open and searched in place
+//
+// A lookup tries the memtable, then the segments newest first; a "del" is
+// kept as a tombstone until compact() merges all segments into one. The
+// merged segment takes the number of the newest one it replaces and records
+// the oldest, so after a crash half way the leftovers are recognised.
+// The store can always be rebuilt from the directories, so the wal is not
+// synced on every change; shutdown() syncs it and leaves a "clean" marker.
+//
+// Segment layout (host byte order; segments are not moved between hosts):
+//   "FSMETA01" u64 count u64 index_offset u32 first_id
+//   records:  u16 key_len key u8 deleted u64 size i64 mtime u64 hash
+//             u32 shard u8 packed u16 owner_len owner
+//   index:    count u64 offsets of the records, in key order
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+class MetaStore {
+public:
+    static constexpr size_t MEMTABLE_MAX = 64 * 1024;   // entries before a flush
+    static constexpr size_t MAX_SEGMENTS = 8;           // compact() merges beyond this
+
+    struct Record {
+        uint64_t size = 0;
+        int64_t mtime = 0;       // ns since the epoch
+        uint64_t hash = 0;       // FNV-1a of the contents, 0 = not known
+        std::string owner;       // account that uploaded it, "" = none
+        uint32_t shard = 0;      // where it is stored
+        bool packed = false;     // in the shard's pack store
+    };
+
+    MetaStore() = default;
+    MetaStore(const MetaStore&) = delete;
+    MetaStore& operator=(const MetaStore&) = delete;
+    ~MetaStore();
+
+    // Maps the segments of dir and replays its wal; dir is created if needed.
+    bool open(const std::string& dir, std::string& err);
+
+    bool put(bool upload, const std::string& name, const Record& r);
+    bool remove(bool upload, const std::string& name);
+    bool get(bool upload, const std::string& name, Record& r) const;
+
+    // Every live entry of one namespace, sorted by name.
+    std::vector<std::pair<std::string, Record>> scan(bool upload) const;
+    std::vector<std::string> list(bool upload) const;
+
+    // Whether a full scan of the directories has been recorded since the
+    // store was created; until then it may miss files. Persistent.
+    bool complete() const;
+    void mark_complete();
+
+    // Whether the last run ended in shutdown(), so the wal and segments hold
+    // every change the server made. Cleared by open(): a crash after it
+    // leaves the store untrusted again.
+    bool clean() const { return clean_; }
+    // Syncs the wal and records a clean shutdown; no changes may follow.
+    void shutdown();
+    // Hot upgrade: the store now belongs to the new server. Syncs and closes
+    // the wal; every later change (and compact()) is refused, lookups go on.
+    void release();
+
+    // Merges the segments into one once there are more than MAX_SEGMENTS,
+    // dropping tombstones. Returns the number of segments merged.
+    size_t compact();
+
+private:
+    struct Entry {
+        Record rec;
+        bool deleted = false;
+    };
+    struct Segment;
+    class Writer;
+    using Memtable = std::map<std::string, Entry>;
+    using Segments = std::vector<std::shared_ptr<const Segment>>;
+
+    bool apply(const std::string& key, const Entry& e, const std::string& line);
+    bool flush();
+    std::string segment_path(uint32_t id) const;
+    // Calls fn(key, entry) for every key starting with prefix, in order,
+    // newest version only; tombstones too.
+    template <typename Fn>
+    static void merge(const Memtable* mem, const Segments& segs, const std::string& prefix, Fn fn);
+
+    mutable std::mutex mu_;
+    std::string dir_;
+    Memtable mem_;
+    std::vector<std::shared_ptr<const Segment>> segs_;   // oldest first
+    uint32_t next_seg_ = 1;
+    int wal_fd_ = -1;
+    bool complete_ = false;
+    bool clean_ = false;
+    bool released_ = false;
+};
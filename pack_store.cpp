@@ -0,0 +1,490 @@
+// pack_store.cpp (C++17)
+// Append-only pack files for small uploads (see pack_store.hpp).
+#include "pack_store.hpp"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <string_view>
+#include <vector>
+
+static bool write_all(int fd, const char* p, size_t n, off_t at = -1) {
+    while (n > 0) {
+        ssize_t w = at < 0 ? ::write(fd, p, n) : ::pwrite(fd, p, n, at);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return false;
+        p += w;
+        n -= (size_t)w;
+        if (at >= 0) at += w;
+    }
+    return true;
+}
+
+static bool read_all(int fd, char* p, size_t n, off_t at) {
+    while (n > 0) {
+        ssize_t r = ::pread(fd, p, n, at);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return false;
+        p += r;
+        n -= (size_t)r;
+        at += r;
+    }
+    return true;
+}
+
+template <typename T>
+static T load(const char* p) {
+    T v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+template <typename T>
+static void store(std::string& out, T v) {
+    out.append(reinterpret_cast<const char*>(&v), sizeof(v));
+}
+
+static const char MAGIC[8] = {'F', 'S', 'P', 'A', 'C', 'K', '0', '1'};
+static const size_t HEADER_BYTES = 8 + 8 + 8 + 4;
+static const size_t PACK_ROW_BYTES = 4 + 8;
+static const size_t RECORD_BYTES = 4 + 8 + 8 + 8;   // after the name
+
+static std::string put_line(const std::string& name, const PackStore::Entry& e) {
+    return "put " + name + " " + std::to_string(e.pack) + " " + std::to_string(e.offset) + " " +
+           std::to_string(e.size) + " " + std::to_string(e.mtime) + "\n";
+}
+
+// ---- snapshot ----
+
+struct PackStore::Snapshot {
+    const char* base = nullptr;
+    size_t len = 0;
+    uint64_t count = 0;
+    const char* index = nullptr;
+    std::map<uint32_t, uint64_t> live;   // pack -> bytes of its entries
+
+    Snapshot() = default;
+    Snapshot(const Snapshot&) = delete;
+    Snapshot& operator=(const Snapshot&) = delete;
+    ~Snapshot() {
+        if (base) munmap(const_cast<char*>(base), len);
+    }
+
+    // Maps path, reading only the header; records are checked as they are
+    // read. False if it cannot be read (errno set) or is damaged (errno 0).
+    bool map(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st{};
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            if (fd >= 0) ::close(fd);
+            return false;
+        }
+        errno = 0;
+        len = (size_t)st.st_size;
+        void* m = len >= HEADER_BYTES ? mmap(nullptr, len, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+        ::close(fd);
+        if (m == MAP_FAILED) return false;
+        base = static_cast<const char*>(m);
+        if (std::memcmp(base, MAGIC, sizeof(MAGIC)) != 0) return false;
+        count = load<uint64_t>(base + 8);
+        uint64_t at = load<uint64_t>(base + 16);
+        uint32_t packs = load<uint32_t>(base + 24);
+        size_t records = HEADER_BYTES + (size_t)packs * PACK_ROW_BYTES;
+        if (records > len || at < records || at > len || count > (len - at) / 8) return false;
+        for (uint32_t i = 0; i < packs; ++i) {
+            const char* p = base + HEADER_BYTES + i * PACK_ROW_BYTES;
+            live[load<uint32_t>(p)] = load<uint64_t>(p + 4);
+        }
+        index = base + at;
+        return true;
+    }
+
+    uint64_t offset(uint64_t i) const { return load<uint64_t>(index + i * 8); }
+
+    // "" for a damaged record, which then matches no name.
+    std::string_view name(uint64_t i) const {
+        size_t end = (size_t)(index - base);
+        size_t p = (size_t)offset(i);
+        if (p < HEADER_BYTES || p + 2 > end || p + 2 + load<uint16_t>(base + p) + RECORD_BYTES > end) return {};
+        return {base + p + 2, load<uint16_t>(base + p)};
+    }
+
+    Entry entry(uint64_t i) const {
+        const char* p = base + offset(i);
+        p += 2 + load<uint16_t>(p);
+        Entry e;
+        e.pack = load<uint32_t>(p);
+        e.offset = load<uint64_t>(p + 4);
+        e.size = load<uint64_t>(p + 12);
+        e.mtime = load<int64_t>(p + 20);
+        return e;
+    }
+
+    bool find(std::string_view n, Entry& e) const {
+        uint64_t lo = 0, hi = count;
+        while (lo < hi) {
+            uint64_t mid = lo + (hi - lo) / 2;
+            if (name(mid) < n) lo = mid + 1;
+            else hi = mid;
+        }
+        if (lo == count || name(lo) != n || n.empty()) return false;
+        e = entry(lo);
+        return true;
+    }
+};
+
+// ---- PackStore ----
+
+PackStore::~PackStore() {
+    if (cur_fd_ >= 0) ::close(cur_fd_);
+    if (index_fd_ >= 0) ::close(index_fd_);
+}
+
+std::string PackStore::pack_path(uint32_t id) const {
+    char name[32];
+    std::snprintf(name, sizeof(name), "/pack-%06u.dat", id);
+    return dir_ + name;
+}
+
+bool PackStore::open(const std::string& dir, std::string& err) {
+    std::lock_guard<std::mutex> lock(mu_);
+    dir_ = dir;
+    snap_.reset();
+    changes_.clear();
+    count_ = 0;
+    packs_.clear();
+    live_.clear();
+    index_lines_ = 0;
+
+    DIR* d = opendir(dir.c_str());
+    if (!d) {
+        if (errno == ENOENT) return true;   // nothing packed yet
+        err = "cannot open " + dir + ": " + std::strerror(errno);
+        return false;
+    }
+    while (dirent* de = readdir(d)) {
+        unsigned id = 0;
+        char tail = 0;
+        if (std::sscanf(de->d_name, "pack-%u.da%c", &id, &tail) != 2 || tail != 't' || id == 0) continue;
+        struct stat st{};
+        if (stat(pack_path(id).c_str(), &st) == 0) packs_[id] = (uint64_t)st.st_size;
+    }
+    closedir(d);
+
+    ::unlink((dir + "/index.snap.tmp").c_str());   // a checkpoint cut short
+    auto snap = std::make_shared<Snapshot>();
+    if (snap->map(dir + "/index.snap")) {
+        count_ = (size_t)snap->count;
+        live_ = snap->live;
+        snap_ = std::move(snap);
+    } else if (errno != ENOENT) {
+        err = dir + "/index.snap is damaged";
+        return false;
+    }
+
+    // replayed onto the snapshot; a crash between a checkpoint and the
+    // journal being emptied replays lines it already holds, to the same end
+    std::ifstream in(dir + "/index");
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream ls(line);
+        std::string op, name;
+        Entry e;
+        ++index_lines_;
+        if (!(ls >> op >> name)) continue;   // torn by a crash
+        if (op == "del") {
+            erase(name);
+        } else if (op == "put" && (ls >> e.pack >> e.offset >> e.size >> e.mtime)) {
+            auto p = packs_.find(e.pack);
+            // the pack lost the tail this line describes: keep the older version
+            if (p != packs_.end() && e.offset + e.size <= p->second) set(name, e);
+        }
+    }
+    if (!packs_.empty() && packs_.rbegin()->second < PACK_BYTES) cur_ = packs_.rbegin()->first;
+    return true;
+}
+
+// Seals the pack appended to; the next append starts a new one.
+void PackStore::seal() {
+    if (cur_fd_ >= 0) {
+        fdatasync(cur_fd_);   // compaction relies on sealed packs being on disk
+        ::close(cur_fd_);
+    }
+    cur_fd_ = -1;
+    cur_ = 0;
+}
+
+// Opens the index and the pack to append to, starting a new pack when the
+// current one is full. Called with mu_ held.
+bool PackStore::ensure_open() {
+    if (index_fd_ < 0) {
+        if (mkdir(dir_.c_str(), 0755) != 0 && errno != EEXIST) return false;
+        index_fd_ = ::open((dir_ + "/index").c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (index_fd_ < 0) return false;
+    }
+    if (cur_ && packs_[cur_] >= PACK_BYTES) seal();
+    if (cur_ == 0) cur_ = packs_.empty() ? 1 : packs_.rbegin()->first + 1;
+    if (cur_fd_ < 0) {
+        cur_fd_ = ::open(pack_path(cur_).c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+        if (cur_fd_ < 0) return false;
+        packs_.emplace(cur_, 0);
+    }
+    return true;
+}
+
+bool PackStore::log(const std::string& line) {
+    if (!write_all(index_fd_, line.data(), line.size())) return false;
+    ++index_lines_;
+    return true;
+}
+
+// The current version of name, from the changes or the snapshot. Called
+// with mu_ held.
+bool PackStore::lookup(const std::string& name, Entry& e) const {
+    auto it = changes_.find(name);
+    if (it != changes_.end()) {
+        if (it->second.deleted) return false;
+        e = it->second.e;
+        return true;
+    }
+    return snap_ && snap_->find(name, e);
+}
+
+// Called with mu_ held.
+void PackStore::set(const std::string& name, const Entry& e) {
+    Entry old;
+    if (lookup(name, old)) live_[old.pack] -= old.size;
+    else ++count_;
+    changes_[name] = Change{e, false};
+    live_[e.pack] += e.size;
+}
+
+// Called with mu_ held.
+void PackStore::erase(const std::string& name) {
+    Entry old;
+    if (!lookup(name, old)) return;
+    live_[old.pack] -= old.size;
+    --count_;
+    if (snap_ && snap_->find(name, old)) changes_[name] = Change{Entry{}, true};
+    else changes_.erase(name);
+}
+
+template <typename Fn>
+void PackStore::for_each(Fn fn) const {
+    for (uint64_t i = 0; snap_ && i < snap_->count; ++i) {
+        std::string name(snap_->name(i));
+        if (!name.empty() && !changes_.count(name)) fn(name, snap_->entry(i));
+    }
+    for (auto& [name, c] : changes_)
+        if (!c.deleted) fn(name, c.e);
+}
+
+// Called with mu_ held.
+bool PackStore::append(const std::string& name, const char* data, size_t n, int64_t mtime) {
+    if (released_ || !ensure_open()) return false;
+    // a file never straddles two packs; a pack holds at least one file
+    if (packs_[cur_] > 0 && packs_[cur_] + n > PACK_BYTES) {
+        seal();
+        if (!ensure_open()) return false;
+    }
+    Entry e;
+    e.pack = cur_;
+    e.offset = packs_[cur_];
+    e.size = n;
+    e.mtime = mtime;
+    if (!write_all(cur_fd_, data, n, (off_t)e.offset)) return false;
+    packs_[cur_] += n;
+    if (!log(put_line(name, e))) return false;
+    set(name, e);
+    return true;
+}
+
+bool PackStore::put(const std::string& name, const char* data, size_t n, int64_t mtime, bool replace) {
+    std::lock_guard<std::mutex> lock(mu_);
+    Entry e;
+    if (!replace && lookup(name, e)) return false;
+    return append(name, data, n, mtime);
+}
+
+bool PackStore::remove(const std::string& name, int64_t mtime) {
+    std::lock_guard<std::mutex> lock(mu_);
+    Entry e;
+    if (released_ || !lookup(name, e) || (mtime >= 0 && e.mtime != mtime)) return false;
+    if (!ensure_open() || !log("del " + name + "\n")) return false;
+    erase(name);
+    return true;
+}
+
+bool PackStore::get(const std::string& name, Entry& e) const {
+    std::lock_guard<std::mutex> lock(mu_);
+    return lookup(name, e);
+}
+
+int PackStore::open_entry(const std::string& name, Entry& e) const {
+    std::lock_guard<std::mutex> lock(mu_);
+    if (!lookup(name, e)) return -1;
+    return ::open(pack_path(e.pack).c_str(), O_RDONLY | O_CLOEXEC);
+}
+
+std::vector<std::pair<std::string, PackStore::Entry>> PackStore::list() const {
+    std::vector<std::pair<std::string, Entry>> out;
+    std::lock_guard<std::mutex> lock(mu_);
+    out.reserve(count_);
+    for_each([&](const std::string& name, const Entry& e) { out.emplace_back(name, e); });
+    return out;
+}
+
+size_t PackStore::size() const {
+    std::lock_guard<std::mutex> lock(mu_);
+    return count_;
+}
+
+// The changes merged into the snapshot, written beside it and renamed over
+// it, then an empty journal. Called with mu_ held and the packs synced.
+bool PackStore::write_snapshot() {
+    std::vector<std::pair<std::string, Entry>> changed;
+    for (auto& [name, c] : changes_)
+        if (!c.deleted) changed.emplace_back(name, c.e);
+    std::sort(changed.begin(), changed.end(),
+              [](const auto& a, const auto& b) { return a.first < b.first; });
+
+    std::string tmp = dir_ + "/index.snap.tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return false;
+    std::string out(MAGIC, sizeof(MAGIC));
+    store<uint64_t>(out, 0);   // count and index_offset, filled in below
+    store<uint64_t>(out, 0);
+    store<uint32_t>(out, (uint32_t)live_.size());
+    for (auto& [id, bytes] : live_) {
+        store<uint32_t>(out, id);
+        store<uint64_t>(out, bytes);
+    }
+    std::vector<uint64_t> offsets;
+    offsets.reserve(count_);
+    uint64_t written = 0;
+    bool ok = true;
+    auto add = [&](std::string_view name, const Entry& e) {
+        if (name.size() > UINT16_MAX) return;
+        offsets.push_back(written + out.size());
+        store<uint16_t>(out, (uint16_t)name.size());
+        out.append(name);
+        store<uint32_t>(out, e.pack);
+        store<uint64_t>(out, e.offset);
+        store<uint64_t>(out, e.size);
+        store<int64_t>(out, e.mtime);
+        if (out.size() >= (1 << 20)) {
+            ok = ok && write_all(fd, out.data(), out.size());
+            written += out.size();
+            out.clear();
+        }
+    };
+    // both sorted: a merge, the changed version winning
+    auto c = changed.begin();
+    for (uint64_t i = 0; snap_ && i < snap_->count; ++i) {
+        std::string_view name = snap_->name(i);
+        if (name.empty()) continue;
+        for (; c != changed.end() && c->first < name; ++c) add(c->first, c->second);
+        if (!changes_.count(std::string(name))) add(name, snap_->entry(i));
+    }
+    for (; c != changed.end(); ++c) add(c->first, c->second);
+    for (uint64_t off : offsets) store<uint64_t>(out, off);
+    uint64_t index_at = written + out.size() - offsets.size() * 8;
+    std::string fix;
+    store<uint64_t>(fix, offsets.size());
+    store<uint64_t>(fix, index_at);
+    ok = ok && write_all(fd, out.data(), out.size()) && write_all(fd, fix.data(), fix.size(), 8) && fsync(fd) == 0;
+    ::close(fd);
+    auto snap = std::make_shared<Snapshot>();
+    if (!ok || std::rename(tmp.c_str(), (dir_ + "/index.snap").c_str()) != 0 || !snap->map(dir_ + "/index.snap")) {
+        ::unlink(tmp.c_str());
+        return false;
+    }
+    snap_ = std::move(snap);
+    changes_.clear();
+    count_ = (size_t)snap_->count;
+    // a crash before this replays the journal onto the same values
+    if (::truncate((dir_ + "/index").c_str(), 0) != 0 && errno != ENOENT) return false;
+    index_lines_ = 0;
+    return true;
+}
+
+bool PackStore::checkpoint() {
+    std::lock_guard<std::mutex> lock(mu_);
+    if (released_ || index_lines_ == 0) return true;
+    if (cur_fd_ >= 0) fdatasync(cur_fd_);   // the snapshot is trusted on open
+    return write_snapshot();
+}
+
+// Only one compact() may run at a time; put() and readers may go on.
+uint64_t PackStore::compact() {
+    std::set<uint32_t> victims;
+    std::vector<std::pair<std::string, Entry>> moving;
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        if (released_) return 0;
+        for (auto& [id, bytes] : packs_)
+            if (id != cur_ && live_[id] * 2 < std::max<uint64_t>(bytes, 1)) victims.insert(id);
+        for_each([&](const std::string& name, const Entry& e) {
+            if (victims.count(e.pack)) moving.emplace_back(name, e);
+        });
+        if (victims.empty() && index_lines_ < JOURNAL_MAX) return 0;
+    }
+
+    // the victims are sealed, so their bytes can be read without the lock
+    std::map<uint32_t, int> fds;
+    std::vector<char> buf;
+    bool ok = true;
+    for (auto& [name, e] : moving) {
+        auto f = fds.find(e.pack);
+        if (f == fds.end()) f = fds.emplace(e.pack, ::open(pack_path(e.pack).c_str(), O_RDONLY | O_CLOEXEC)).first;
+        int fd = f->second;
+        buf.resize(e.size);
+        if (fd < 0 || !read_all(fd, buf.data(), buf.size(), (off_t)e.offset)) {
+            ok = false;
+            continue;
+        }
+        std::lock_guard<std::mutex> lock(mu_);
+        Entry now;
+        if (!lookup(name, now) || now.pack != e.pack || now.offset != e.offset) continue;   // replaced meanwhile
+        ok = append(name, buf.data(), buf.size(), e.mtime) && ok;
+    }
+    for (auto& [id, fd] : fds)
+        if (fd >= 0) ::close(fd);
+
+    uint64_t reclaimed = 0;
+    std::lock_guard<std::mutex> lock(mu_);
+    if (!ok || released_) return 0;   // keep the victims; the next pass tries again
+    // the copies must be on disk before the only other ones go
+    if (cur_fd_ >= 0) fdatasync(cur_fd_);
+    if (index_fd_ >= 0) fsync(index_fd_);
+    for (uint32_t id : victims) {
+        if (live_[id] != 0) continue;
+        reclaimed += packs_[id];
+        ::unlink(pack_path(id).c_str());
+        packs_.erase(id);
+        live_.erase(id);
+    }
+    if (index_lines_ >= JOURNAL_MAX) write_snapshot();
+    return reclaimed;
+}
+
+void PackStore::release() {
+    std::lock_guard<std::mutex> lock(mu_);
+    seal();
+    if (index_fd_ >= 0) {
+        fsync(index_fd_);
+        ::close(index_fd_);
+    }
+    index_fd_ = -1;
+    released_ = true;
+}
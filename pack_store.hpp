@@ -0,0 +1,119 @@
+// pack_store.hpp (C++17)
+// Small uploads packed into large append-only files, so a store of millions
+// of tiny files does not need an inode (and a directory entry to scan) for
+// each of them. One PackStore per upload directory, in its .packs/:
+//
+//   pack-000001.dat ...  the files' bytes back to back; a pack is sealed
+//                        once it reaches PACK_BYTES and never changed after
+//   index.snap           the whole index as of the last checkpoint(), sorted
+//                        by name; mapped with mmap on open and searched in
+//                        place, so opening it reads only its header
+//   index                one line per change since, replayed on open:
+//                          put <name> <pack> <offset> <size> <mtime_ns>
+//                          del <name>
+//
+// A new version of a name is appended and the old bytes become garbage;
+// compact() copies the live files out of sealed packs that are mostly
+// garbage and deletes those packs. Packs are read with pread on a descriptor
+// opened under the store's lock, so a reader is not disturbed when
+// compaction deletes the pack it is reading.
+//
+// Snapshot layout (host byte order):
+//   "FSPACK01" u64 count u64 index_offset u32 packs
+//   packs:    u32 pack u64 live_bytes, for each pack
+//   records:  u16 name_len name u32 pack u64 offset u64 size i64 mtime
+//   index:    count u64 offsets of the records, in name order
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+class PackStore {
+public:
+    static constexpr uint64_t PACK_BYTES = 256ull << 20;
+    static constexpr size_t JOURNAL_MAX = 64 * 1024;   // index lines before compact() checkpoints
+
+    struct Entry {
+        uint32_t pack = 0;
+        uint64_t offset = 0;
+        uint64_t size = 0;
+        int64_t mtime = 0;   // ns since the epoch
+    };
+
+    PackStore() = default;
+    PackStore(const PackStore&) = delete;
+    PackStore& operator=(const PackStore&) = delete;
+    ~PackStore();
+
+    // Maps dir's snapshot and replays the changes since; dir is created by
+    // the first put(). Entries whose bytes did not all reach their pack (a
+    // crash) are dropped.
+    bool open(const std::string& dir, std::string& err);
+
+    // Stores data as name, replacing any earlier version; without replace,
+    // false if there is one.
+    bool put(const std::string& name, const char* data, size_t n, int64_t mtime, bool replace = true);
+    // Forgets name; with mtime >= 0 only if that is still its version.
+    bool remove(const std::string& name, int64_t mtime = -1);
+
+    bool get(const std::string& name, Entry& e) const;
+    // Read-only descriptor of the pack holding name (the caller closes it),
+    // with e set to where in it; -1 if name is not here.
+    int open_entry(const std::string& name, Entry& e) const;
+    std::vector<std::pair<std::string, Entry>> list() const;
+    size_t size() const;
+
+    // Rewrites sealed packs with less than half their bytes live, and
+    // checkpoints once the index has JOURNAL_MAX lines. Returns the bytes
+    // reclaimed.
+    uint64_t compact();
+
+    // Writes the whole index to a new snapshot and empties the journal, so
+    // the next open() replays nothing.
+    bool checkpoint();
+
+    // Hot upgrade: the directory now belongs to the new server. Syncs and
+    // closes the pack and journal; every later change (and compact() and
+    // checkpoint()) is refused, lookups go on from memory.
+    void release();
+
+private:
+    struct Snapshot;
+    struct Change {
+        Entry e;
+        bool deleted = false;   // a name in the snapshot, removed since
+    };
+
+    std::string pack_path(uint32_t id) const;
+    void seal();
+    bool ensure_open();
+    bool append(const std::string& name, const char* data, size_t n, int64_t mtime);
+    bool log(const std::string& line);
+    bool lookup(const std::string& name, Entry& e) const;
+    void set(const std::string& name, const Entry& e);
+    void erase(const std::string& name);
+    // Calls fn(name, entry) for every entry, snapshot first.
+    template <typename Fn>
+    void for_each(Fn fn) const;
+    bool write_snapshot();
+
+    mutable std::mutex mu_;
+    std::string dir_;
+    std::shared_ptr<const Snapshot> snap_;             // nullptr = none yet
+    std::unordered_map<std::string, Change> changes_;  // since the snapshot
+    size_t count_ = 0;
+    std::map<uint32_t, uint64_t> packs_;   // pack -> bytes written
+    std::map<uint32_t, uint64_t> live_;    // pack -> bytes still referenced
+    uint32_t cur_ = 0;        // pack appended to, 0 = none yet
+    int cur_fd_ = -1;
+    int index_fd_ = -1;
+    size_t index_lines_ = 0;  // in the journal
+    bool released_ = false;
+};
@@ -0,0 +1,130 @@
+// protocol.cpp (C++17)
+// Implementation of the shared wire protocol (see protocol.hpp).
+#include "protocol.hpp"
+
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+
+namespace proto {
+
+uint64_t host_to_be64(uint64_t host) {
+    uint32_t hi = htonl((uint32_t)(host >> 32));
+    uint32_t lo = htonl((uint32_t)(host & 0xFFFFFFFFULL));
+    return ( (uint64_t)lo << 32 ) | hi;
+}
+
+uint64_t be64_to_host(uint64_t be) {
+    uint32_t lo = ntohl((uint32_t)(be >> 32));
+    uint32_t hi = ntohl((uint32_t)(be & 0xFFFFFFFFULL));
+    return ( (uint64_t)hi << 32 ) | lo;
+}
+
+void xor_in_place(char* buf, size_t n, uint8_t key) {
+    // 8 bytes at a time, then the tail
+    const uint64_t key8 = 0x0101010101010101ULL * key;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t w;
+        std::memcpy(&w, buf + i, 8);
+        w ^= key8;
+        std::memcpy(buf + i, &w, 8);
+    }
+    for (; i < n; ++i) buf[i] ^= (char)key;
+}
+
+bool send_all(int fd, const void* data, size_t len) {
+    const char* p = (const char*)data;
+    while (len > 0) {
+        ssize_t s = send(fd, p, len, MSG_NOSIGNAL);
+        if (s <= 0) return false;
+        p += s;
+        len -= (size_t)s;
+    }
+    return true;
+}
+
+bool recv_all(int fd, void* data, size_t len) {
+    char* p = (char*)data;
+    while (len > 0) {
+        ssize_t r = recv(fd, p, len, 0);
+        if (r <= 0) return false;
+        p += r;
+        len -= (size_t)r;
+    }
+    return true;
+}
+
+bool send_line(int fd, const std::string& s) {
+    uint32_t n = htonl((uint32_t)s.size());
+    if (!send_all(fd, &n, sizeof(n))) return false;
+    if (!send_all(fd, s.data(), s.size())) return false;
+    return true;
+}
+
+bool recv_line(int fd, std::string& out, size_t max_len) {
+    uint32_t n = 0;
+    if (!recv_all(fd, &n, sizeof(n))) return false;
+    n = ntohl(n);
+    if (n > max_len) { errno = EMSGSIZE; return false; }
+    out.assign(n, '\0');
+    if (n == 0) return true;
+    if (!recv_all(fd, out.data(), n)) return false;
+    return true;
+}
+
+bool send_file_encrypted(int fd, const std::string& path, const TransferOptions& opt) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return false;
+
+    // get size
+    in.seekg(0, std::ios::end);
+    uint64_t size = (uint64_t)in.tellg();
+    in.seekg(0, std::ios::beg);
+
+    uint64_t size_be = host_to_be64(size);
+    if (!send_all(fd, &size_be, sizeof(size_be))) return false;
+
+    std::vector<char> buf(opt.chunk_size);
+    uint64_t done = 0;
+    while (in) {
+        in.read(buf.data(), (std::streamsize)buf.size());
+        std::streamsize got = in.gcount();
+        if (got <= 0) break;
+        xor_in_place(buf.data(), (size_t)got, opt.key);
+        if (!send_all(fd, buf.data(), (size_t)got)) return false;
+        done += (uint64_t)got;
+        if (opt.progress) opt.progress(done, size);
+    }
+    return true;
+}
+
+bool recv_file_encrypted(int fd, const std::string& path, const TransferOptions& opt) {
+    uint64_t size_be = 0;
+    if (!recv_all(fd, &size_be, sizeof(size_be))) return false;
+    uint64_t size = be64_to_host(size_be);
+    if (opt.max_size && size > opt.max_size) { errno = EFBIG; return false; }
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) return false;
+
+    std::vector<char> buf(opt.chunk_size);
+    uint64_t left = size;
+    uint64_t done = 0;
+    while (left > 0) {
+        size_t chunk = (size_t)std::min<uint64_t>(buf.size(), left);
+        if (!recv_all(fd, buf.data(), chunk)) return false;
+        xor_in_place(buf.data(), chunk, opt.key);
+        out.write(buf.data(), (std::streamsize)chunk);
+        left -= chunk;
+        done += chunk;
+        if (opt.progress) opt.progress(done, size);
+    }
+    return true;
+}
+
+} // namespace proto
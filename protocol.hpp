@@ -0,0 +1,52 @@
+// protocol.hpp (C++17)
+// Shared wire protocol for the file sharing server and client:
+// framing (length-prefixed lines), file transfer and the XOR "cipher".
+// Built as libfileshare (static + shared), see Dockerfile.server.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace proto {
+
+inline constexpr uint8_t XOR_KEY = 0x5A;          // Simple XOR "encryption"
+inline constexpr size_t CHUNK_SIZE = 64 * 1024;   // file transfer buffer
+inline constexpr size_t MAX_LINE = 16 * 1024 * 1024;   // default cap on a received line
+
+// ---- byte order helpers (portable 64-bit conversions without <endian.h>) ----
+uint64_t host_to_be64(uint64_t host);
+uint64_t be64_to_host(uint64_t be);
+
+// ---- cipher ----
+void xor_in_place(char* buf, size_t n, uint8_t key = XOR_KEY);
+inline void xor_in_place(std::vector<char>& buf, size_t n, uint8_t key = XOR_KEY) {
+    xor_in_place(buf.data(), n, key);
+}
+
+// ---- raw socket I/O (blocking, loops until done) ----
+bool send_all(int fd, const void* data, size_t len);
+bool recv_all(int fd, void* data, size_t len);
+
+// ---- line protocol: uint32 length (network order) + bytes ----
+bool send_line(int fd, const std::string& s);
+// Fails with errno = EMSGSIZE, before allocating, when the announced length
+// exceeds max_len; the rest of the line is still unread, so close the socket.
+bool recv_line(int fd, std::string& out, size_t max_len = MAX_LINE);
+
+// ---- file transfer: uint64 size (big endian) + XORed file bytes ----
+using ProgressFn = std::function<void(uint64_t done, uint64_t total)>;
+
+struct TransferOptions {
+    size_t chunk_size = CHUNK_SIZE;
+    uint8_t key = XOR_KEY;
+    ProgressFn progress;   // called after every chunk, optional
+    uint64_t max_size = 0; // recv: refuse a larger announced size (EFBIG), 0 = any
+};
+
+bool send_file_encrypted(int fd, const std::string& path, const TransferOptions& opt = {});
+bool recv_file_encrypted(int fd, const std::string& path, const TransferOptions& opt = {});
+
+} // namespace proto
@@ -0,0 +1,392 @@
+// push.cpp (C++17)
+// Multicast file push and NACK repair (see push.hpp).
+#include "push.hpp"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <sstream>
+#include <thread>
+
+#include "protocol.hpp"
+
+namespace push {
+
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+constexpr char MAGIC[4] = {'F', 'S', 'P', '1'};
+enum Type : uint8_t { ANNOUNCE = 1, DATA = 2, END = 3 };
+constexpr size_t HEADER = 12;
+constexpr size_t MAX_DATAGRAM = HEADER + 12 + PAYLOAD;
+constexpr size_t BLOCK = proto::CHUNK_SIZE / PAYLOAD;   // packets per file read, as in send_file_encrypted
+
+void put16(std::vector<char>& b, uint16_t v) { v = htons(v); b.insert(b.end(), (char*)&v, (char*)&v + 2); }
+void put32(std::vector<char>& b, uint32_t v) { v = htonl(v); b.insert(b.end(), (char*)&v, (char*)&v + 4); }
+void put64(std::vector<char>& b, uint64_t v) { v = proto::host_to_be64(v); b.insert(b.end(), (char*)&v, (char*)&v + 8); }
+uint16_t get16(const char* p) { uint16_t v; std::memcpy(&v, p, 2); return ntohs(v); }
+uint32_t get32(const char* p) { uint32_t v; std::memcpy(&v, p, 4); return ntohl(v); }
+uint64_t get64(const char* p) { uint64_t v; std::memcpy(&v, p, 8); return proto::be64_to_host(v); }
+
+bool parse_addr(const std::string& s, in_addr& a) { return inet_pton(AF_INET, s.c_str(), &a) == 1; }
+
+} // namespace
+
+bool parse_group(const std::string& spec, Group& g) {
+    auto colon = spec.rfind(':');
+    if (colon == std::string::npos) return false;
+    in_addr a{};
+    if (!parse_addr(spec.substr(0, colon), a) || !IN_MULTICAST(ntohl(a.s_addr))) return false;
+    std::string port = spec.substr(colon + 1);
+    if (port.empty() || port.size() > 5 || port.find_first_not_of("0123456789") != std::string::npos) return false;
+    g.addr = spec.substr(0, colon);
+    g.port = std::stoi(port);
+    return g.port >= 1 && g.port <= 65535;
+}
+
+std::string format_ranges(const std::vector<uint32_t>& missing, size_t max_len, size_t* count) {
+    std::string out;
+    if (count) *count = 0;
+    for (size_t i = 0; i < missing.size();) {
+        size_t j = i;
+        while (j + 1 < missing.size() && missing[j + 1] == missing[j] + 1) ++j;
+        std::string r = std::to_string(missing[i]);
+        if (j > i) r += "-" + std::to_string(missing[j]);
+        if (out.size() + r.size() + 1 > max_len) break;
+        if (!out.empty()) out += ",";
+        out += r;
+        if (count) *count += j - i + 1;
+        i = j + 1;
+    }
+    return out;
+}
+
+bool parse_ranges(const std::string& s, uint32_t packets, std::set<uint32_t>& out) {
+    std::stringstream ss(s);
+    for (std::string item; std::getline(ss, item, ',');) {
+        char* end = nullptr;
+        unsigned long a = std::strtoul(item.c_str(), &end, 10), b = a;
+        if (end == item.c_str()) return false;
+        if (*end == '-') b = std::strtoul(end + 1, &end, 10);
+        if (*end || a > b || b >= packets) return false;
+        for (unsigned long x = a; x <= b; ++x) out.insert((uint32_t)x);
+    }
+    return true;
+}
+
+// ---- Sender ----
+
+Sender::Sender(uint32_t id, std::string name, std::string path, uint64_t rate)
+    : id_(id), name_(std::move(name)), path_(std::move(path)), rate_(rate) {}
+
+Sender::~Sender() {
+    if (sock_ >= 0) ::close(sock_);
+    if (fd_ >= 0) ::close(fd_);
+}
+
+bool Sender::open(const Group& g, const std::string& iface, int ttl) {
+    fd_ = ::open(path_.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st{};
+    if (fd_ < 0 || fstat(fd_, &st) != 0) return false;
+    size_ = (uint64_t)st.st_size;
+    packets_ = (uint32_t)((size_ + PAYLOAD - 1) / PAYLOAD);
+    sock_ = ::socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (sock_ < 0) return false;
+    unsigned char t = (unsigned char)ttl, loop = 1;
+    setsockopt(sock_, IPPROTO_IP, IP_MULTICAST_TTL, &t, sizeof(t));
+    setsockopt(sock_, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));   // receivers on this host
+    if (!iface.empty()) {
+        in_addr a{};
+        if (!parse_addr(iface, a) || setsockopt(sock_, IPPROTO_IP, IP_MULTICAST_IF, &a, sizeof(a)) < 0) return false;
+    }
+    int buf = 4 << 20;
+    setsockopt(sock_, SOL_SOCKET, SO_SNDBUF, &buf, sizeof(buf));
+    sockaddr_in dst{};
+    dst.sin_family = AF_INET;
+    dst.sin_port = htons((uint16_t)g.port);
+    parse_addr(g.addr, dst.sin_addr);
+    return ::connect(sock_, (sockaddr*)&dst, sizeof(dst)) == 0;
+}
+
+void Sender::expect(uint64_t receiver) {
+    std::lock_guard<std::mutex> lock(mu_);
+    expected_.insert(receiver);
+}
+
+void Sender::done(uint64_t receiver) {
+    std::lock_guard<std::mutex> lock(mu_);
+    done_.insert(receiver);
+    cv_.notify_one();
+}
+
+void Sender::gone(uint64_t receiver) {
+    std::lock_guard<std::mutex> lock(mu_);
+    if (done_.count(receiver)) return;   // finished, then quit
+    expected_.erase(receiver);
+    cv_.notify_one();
+}
+
+void Sender::nack(const std::set<uint32_t>& seqs) {
+    std::lock_guard<std::mutex> lock(mu_);
+    wanted_.insert(seqs.begin(), seqs.end());
+    cv_.notify_one();
+}
+
+size_t Sender::receivers_done() const {
+    std::lock_guard<std::mutex> lock(mu_);
+    return done_.size();
+}
+
+size_t Sender::receivers() const {
+    std::lock_guard<std::mutex> lock(mu_);
+    return expected_.size();
+}
+
+std::vector<char> Sender::header(uint8_t type) const {
+    std::vector<char> b(MAGIC, MAGIC + 4);
+    b.push_back((char)type);
+    b.insert(b.end(), 3, 0);
+    put32(b, id_);
+    return b;
+}
+
+// Paced to rate_: a multicast group has no congestion control of its own.
+void Sender::send_packet(const std::vector<char>& pkt) {
+    auto now = Clock::now();
+    if (next_send_ > now) std::this_thread::sleep_until(next_send_);
+    else next_send_ = now;
+    if (rate_) next_send_ += std::chrono::nanoseconds(pkt.size() * 1000000000ULL / rate_);
+    while (::send(sock_, pkt.data(), pkt.size(), 0) < 0 && (errno == ENOBUFS || errno == EAGAIN))
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    ++sent_;
+}
+
+// DATA for seqs (ascending), read BLOCK packets at a time like the TCP path
+// reads CHUNK_SIZE.
+bool Sender::send_range(const std::vector<uint32_t>& seqs) {
+    std::vector<char> block(BLOCK * PAYLOAD);
+    uint64_t block_start = UINT64_MAX;
+    size_t block_len = 0;
+    for (uint32_t seq : seqs) {
+        uint64_t off = (uint64_t)seq * PAYLOAD;
+        uint64_t first = off - off % block.size();
+        if (first != block_start) {
+            ssize_t n = ::pread(fd_, block.data(), (size_t)std::min<uint64_t>(block.size(), size_ - first), (off_t)first);
+            if (n <= 0) return false;
+            block_len = (size_t)n;
+            proto::xor_in_place(block.data(), block_len);
+            block_start = first;
+        }
+        size_t at = (size_t)(off - first);
+        if (at >= block_len) return false;   // the file shrank
+        size_t len = std::min(PAYLOAD, block_len - at);
+        std::vector<char> pkt = header(DATA);
+        put64(pkt, size_);
+        put32(pkt, seq);
+        pkt.insert(pkt.end(), block.data() + at, block.data() + at + len);
+        send_packet(pkt);
+    }
+    return true;
+}
+
+bool Sender::run(std::chrono::milliseconds idle) {
+    std::vector<char> announce = header(ANNOUNCE);
+    put64(announce, size_);
+    put32(announce, packets_);
+    put16(announce, (uint16_t)name_.size());
+    announce.insert(announce.end(), name_.begin(), name_.end());
+    for (int i = 0; i < 3; ++i) send_packet(announce);
+
+    std::vector<uint32_t> seqs(packets_);
+    for (uint32_t i = 0; i < packets_; ++i) seqs[i] = i;
+    bool ok = send_range(seqs);
+    auto last_nack = Clock::now();
+    for (uint32_t round = 0; ok; ++round) {
+        std::vector<char> end = header(END);
+        put32(end, packets_);
+        put32(end, round);
+        put16(end, (uint16_t)name_.size());
+        end.insert(end.end(), name_.begin(), name_.end());
+        send_packet(end);
+
+        // give every receiver a moment to NACK, so one repair round covers
+        // what several of them missed
+        std::unique_lock<std::mutex> lock(mu_);
+        auto all_done = [&] {
+            return std::includes(done_.begin(), done_.end(), expected_.begin(), expected_.end());
+        };
+        cv_.wait_for(lock, std::chrono::milliseconds(100), [&] { return all_done() && wanted_.empty(); });
+        if (all_done() && wanted_.empty()) break;
+        if (wanted_.empty()) {
+            if (Clock::now() - last_nack > idle) break;   // the rest stopped answering
+            continue;
+        }
+        seqs.assign(wanted_.begin(), wanted_.end());
+        wanted_.clear();
+        lock.unlock();
+        last_nack = Clock::now();
+        repaired_ += seqs.size();
+        ok = send_range(seqs);
+    }
+    return ok;
+}
+
+// ---- receiving ----
+
+bool subscribe(int ctl_fd, Group& g, std::string& iface, std::string& err) {
+    std::string resp, ok, group;
+    if (!proto::send_line(ctl_fd, "PUSH SUB") || !proto::recv_line(ctl_fd, resp)) { err = "connection lost"; return false; }
+    std::istringstream iss(resp);
+    iss >> ok >> g.addr >> g.port >> iface;
+    if (ok != "OK" || g.port <= 0) { err = resp; return false; }
+    if (iface == "-") iface.clear();
+    return true;
+}
+
+// One request on the session; false with err set if the connection is gone
+// or the push is over.
+static bool request(int ctl_fd, const std::string& line, std::string& err) {
+    std::string resp;
+    if (!proto::send_line(ctl_fd, line) || !proto::recv_line(ctl_fd, resp)) { err = "connection lost"; return false; }
+    if (resp != "OK") { err = resp; return false; }
+    return true;
+}
+
+bool receive(int ctl_fd, const Group& g, const std::string& iface, const std::string& dir, std::string& name,
+             ReceiveStats& stats, std::string& err, std::chrono::seconds timeout) {
+    int s = ::socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    int one = 1, buf = 8 << 20;
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));   // several receivers per host
+    setsockopt(s, SOL_SOCKET, SO_RCVBUF, &buf, sizeof(buf));
+    sockaddr_in a{};
+    a.sin_family = AF_INET;
+    a.sin_port = htons((uint16_t)g.port);
+    parse_addr(g.addr, a.sin_addr);
+    ip_mreq mreq{};
+    mreq.imr_multiaddr = a.sin_addr;
+    if (!iface.empty() && !parse_addr(iface, mreq.imr_interface)) { err = "bad interface " + iface; ::close(s); return false; }
+    if (::bind(s, (sockaddr*)&a, sizeof(a)) < 0 ||
+        setsockopt(s, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+        err = std::string("cannot join ") + g.addr + ": " + std::strerror(errno);
+        ::close(s);
+        return false;
+    }
+
+    // FILESHARE_PUSH_LOSS=0.05 drops that fraction of what arrives, for tests
+    const char* loss_env = std::getenv("FILESHARE_PUSH_LOSS");
+    double loss = loss_env ? std::atof(loss_env) : 0;
+    std::mt19937 rng{std::random_device{}()};
+    std::uniform_real_distribution<double> unit(0, 1);
+
+    uint32_t id = 0, packets = 0, have = 0;
+    uint64_t size = 0;
+    std::vector<bool> got;
+    std::string part;
+    int out = -1;
+    bool finished = false, ok = true;
+    auto last_packet = Clock::now();
+    auto give_up = Clock::now() + timeout;
+    char pkt[MAX_DATAGRAM + 256];
+    const size_t max_nack = 3000;   // fits the server's default --max-line
+
+    auto start = [&](uint32_t pid, uint64_t psize) {
+        id = pid;
+        size = psize;
+        packets = (uint32_t)((size + PAYLOAD - 1) / PAYLOAD);
+        got.assign(packets, false);
+        part = dir + "/.push-" + std::to_string(id) + ".part";
+        out = ::open(part.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (out < 0 || ::ftruncate(out, (off_t)size) < 0) { err = "cannot write " + part; return false; }
+        return true;
+    };
+    // after an END, or when the packets stop: ask for the gaps, or finish
+    auto report = [&] {
+        if (have == packets) {
+            finished = true;
+            return request(ctl_fd, "PUSH DONE " + std::to_string(id), err);
+        }
+        std::vector<uint32_t> missing;
+        for (uint32_t i = 0; i < packets; ++i)
+            if (!got[i]) missing.push_back(i);
+        size_t count = 0;
+        std::string ranges = format_ranges(missing, max_nack, &count);
+        ++stats.rounds;
+        stats.nacked += (uint32_t)count;
+        return request(ctl_fd, "PUSH NACK " + std::to_string(id) + " " + ranges, err);
+    };
+
+    while (ok && !finished) {
+        auto now = Clock::now();
+        if (now > give_up) { err = "timed out"; ok = false; break; }
+        pollfd p{s, POLLIN, 0};
+        int r = poll(&p, 1, 100);
+        if (r <= 0) {
+            // END lost, or the sender waits for us: NACK again
+            if (id && !name.empty() && Clock::now() - last_packet > std::chrono::milliseconds(300)) {
+                last_packet = Clock::now();
+                ok = report();
+            }
+            continue;
+        }
+        ssize_t n = ::recv(s, pkt, sizeof(pkt), 0);
+        if (n < (ssize_t)HEADER || std::memcmp(pkt, MAGIC, 4) != 0) continue;
+        if (loss > 0 && unit(rng) < loss) continue;
+        uint8_t type = (uint8_t)pkt[4];
+        uint32_t pid = get32(pkt + 8);
+        const char* body = pkt + HEADER;
+        size_t blen = (size_t)n - HEADER;
+        if (id && pid != id) continue;   // another push
+        last_packet = Clock::now();
+        give_up = last_packet + timeout;
+
+        if (type == ANNOUNCE && blen >= 14) {
+            uint16_t nl = get16(body + 12);
+            if (blen < 14u + nl) continue;
+            if (!id && !start(pid, get64(body))) { ok = false; break; }
+            name.assign(body + 14, nl);
+            if (have == packets) ok = report();   // empty file
+        } else if (type == DATA && blen >= 12) {
+            if (!id && !start(pid, get64(body))) { ok = false; break; }
+            uint32_t seq = get32(body + 8);
+            if (seq >= packets || got[seq]) continue;
+            size_t len = blen - 12;
+            uint64_t off = (uint64_t)seq * PAYLOAD;
+            if (len != std::min<uint64_t>(PAYLOAD, size - off)) continue;
+            proto::xor_in_place((char*)body + 12, len);
+            if (::pwrite(out, body + 12, len, (off_t)off) != (ssize_t)len) { err = "write failed"; ok = false; break; }
+            got[seq] = true;
+            ++have;
+            ++stats.packets;
+            if (have == packets && !name.empty()) ok = report();
+        } else if (type == END && blen >= 10 && id) {
+            uint16_t nl = get16(body + 8);
+            if (blen < 10u + nl) continue;
+            name.assign(body + 10, nl);
+            ok = report();
+        }
+    }
+    ::close(s);
+    if (out >= 0) ::close(out);
+    // the name comes from the network: keep it inside dir
+    if (ok && (name.empty() || name.find('/') != std::string::npos || name == "." || name == "..")) {
+        err = "bad file name";
+        ok = false;
+    }
+    if (ok && std::rename(part.c_str(), (dir + "/" + name).c_str()) != 0) { err = "cannot rename " + part; ok = false; }
+    if (!ok && !part.empty()) ::unlink(part.c_str());
+    return ok;
+}
+
+} // namespace push
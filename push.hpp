@@ -0,0 +1,115 @@
+// push.hpp (C++17)
+// Multicast push of one file to many receivers. Part of libfileshare.
+//
+// The sender streams the file once to a UDP multicast group, in the XOR
+// cipher of the TCP transfers, paced to a fixed rate. Receivers ask for what
+// they missed with NACKs on their ordinary (TCP) server session, and the
+// sender multicasts those packets again, so a packet lost by several
+// receivers is repaired once for all of them. Egress is about one copy of the
+// file plus the repairs, however many receivers there are.
+//
+// Datagrams (big endian) start with "FSP1", a type byte, three zero bytes and
+// the push id (u32):
+//   ANNOUNCE  size u64, packets u32, name length u16, name
+//   DATA      size u64, seq u32, payload (PAYLOAD bytes, the last one shorter)
+//   END       packets u32, round u32, name length u16, name
+// END follows the first pass and every repair round.
+//
+// Session commands (server side in server.cpp):
+//   PUSH SUB               -> OK <group> <port> <iface>
+//   PUSH SEND <name>       -> OK <id>
+//   PUSH NACK <id> <ranges> -> OK   (ranges: "3-10,15,20-25")
+//   PUSH DONE <id>         -> OK
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace push {
+
+inline constexpr size_t PAYLOAD = 1200;   // file bytes per DATA packet
+
+struct Group {
+    std::string addr;   // IPv4 multicast address
+    int port = 0;
+};
+
+// "239.255.0.1:9500"; false unless addr is an IPv4 multicast address.
+bool parse_group(const std::string& spec, Group& g);
+
+// "3-10,15" style list of packet ranges for NACKs, cut off at max_len
+// characters (count: packets listed); and back (false on malformed input).
+std::string format_ranges(const std::vector<uint32_t>& missing, size_t max_len, size_t* count = nullptr);
+bool parse_ranges(const std::string& s, uint32_t packets, std::set<uint32_t>& out);
+
+// One push. run() does the sending on the calling thread; the other methods
+// may be called from any thread while it runs.
+class Sender {
+public:
+    Sender(uint32_t id, std::string name, std::string path, uint64_t rate);
+    ~Sender();
+
+    // Opens the file, and a socket towards group sending from the interface
+    // with address iface ("" = the kernel's choice).
+    bool open(const Group& g, const std::string& iface, int ttl);
+
+    // Receivers that should get the file; run() ends once they all said done
+    // or left, or after idle without a NACK.
+    void expect(uint64_t receiver);
+    void done(uint64_t receiver);
+    void gone(uint64_t receiver);
+    void nack(const std::set<uint32_t>& seqs);
+
+    // False if the file could not be read to the end.
+    bool run(std::chrono::milliseconds idle = std::chrono::seconds(3));
+
+    uint32_t id() const { return id_; }
+    uint32_t packets() const { return packets_; }
+    uint64_t sent() const { return sent_; }
+    uint64_t repaired() const { return repaired_; }
+    size_t receivers_done() const;
+    size_t receivers() const;
+
+private:
+    void send_packet(const std::vector<char>& pkt);
+    bool send_range(const std::vector<uint32_t>& seqs);
+    std::vector<char> header(uint8_t type) const;
+
+    uint32_t id_;
+    std::string name_, path_;
+    uint64_t rate_;
+    uint64_t size_ = 0;
+    uint32_t packets_ = 0;
+    int sock_ = -1, fd_ = -1;
+    std::chrono::steady_clock::time_point next_send_{};
+    uint64_t sent_ = 0, repaired_ = 0;
+
+    mutable std::mutex mu_;
+    std::condition_variable cv_;
+    std::set<uint64_t> expected_, done_;
+    std::set<uint32_t> wanted_;
+};
+
+struct ReceiveStats {
+    uint32_t packets = 0;
+    uint32_t nacked = 0;     // packets asked for again
+    uint32_t rounds = 0;     // NACKs sent
+};
+
+// PUSH SUB on ctl_fd, an authenticated session: the group to join, and the
+// interface the server sends from ("" = its kernel's choice).
+bool subscribe(int ctl_fd, Group& g, std::string& iface, std::string& err);
+
+// Joins group on the interface with address iface ("" = the kernel's choice).
+// Receives the next push (or the one running) into dir, sending NACKs and
+// DONE on ctl_fd, the session that subscribed. False with err set on
+// failure or when nothing arrives for timeout.
+bool receive(int ctl_fd, const Group& g, const std::string& iface, const std::string& dir, std::string& name,
+             ReceiveStats& stats, std::string& err, std::chrono::seconds timeout = std::chrono::seconds(60));
+
+} // namespace push
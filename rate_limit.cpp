@@ -0,0 +1,93 @@
+// rate_limit.cpp (C++17)
+// Implementation of the token buckets (see rate_limit.hpp).
+#include "rate_limit.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <mutex>
+#include <unordered_map>
+
+static int64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        TokenBucket::Clock::now().time_since_epoch()).count();
+}
+
+void TokenBucket::set_rate(uint64_t rate, uint64_t burst) {
+    rate_.store(rate, std::memory_order_relaxed);
+    int64_t burst_ns = 250'000'000;   // default: a quarter second of traffic
+    if (rate > 0 && burst > 0) burst_ns = (int64_t)(burst * 1'000'000'000.0 / (double)rate);
+    burst_ns_.store(burst_ns, std::memory_order_relaxed);
+}
+
+TokenBucket::Clock::duration TokenBucket::consume(uint64_t n) {
+    uint64_t rate = rate_.load(std::memory_order_relaxed);
+    if (rate == 0 || n == 0) return Clock::duration::zero();
+
+    // GCRA: every byte pushes the theoretical arrival time forward by 1/rate;
+    // we may run ahead of it by at most the burst tolerance.
+    int64_t now = now_ns();
+    int64_t cost = (int64_t)((double)n * 1'000'000'000.0 / (double)rate);
+    int64_t burst = burst_ns_.load(std::memory_order_relaxed);
+    int64_t tat = tat_ns_.load(std::memory_order_relaxed);
+    int64_t next;
+    do {
+        next = std::max(tat, now) + cost;
+    } while (!tat_ns_.compare_exchange_weak(tat, next, std::memory_order_relaxed));
+
+    int64_t wait = next - burst - now;
+    return wait > 0 ? std::chrono::nanoseconds(wait) : Clock::duration::zero();
+}
+
+void RateLimiter::add(std::shared_ptr<TokenBucket> bucket) {
+    if (bucket) buckets_.push_back(std::move(bucket));
+}
+
+TokenBucket::Clock::duration RateLimiter::consume(uint64_t n) {
+    auto wait = TokenBucket::Clock::duration::zero();
+    for (auto& b : buckets_) wait = std::max(wait, b->consume(n));
+    return wait;
+}
+
+uint64_t RateLimiter::tightest_rate() const {
+    uint64_t r = 0;
+    for (auto& b : buckets_) {
+        uint64_t br = b->rate();
+        if (br > 0 && (r == 0 || br < r)) r = br;
+    }
+    return r;
+}
+
+std::shared_ptr<TokenBucket> user_bucket(const std::string& user, uint64_t rate) {
+    if (rate == 0) return nullptr;
+    // only touched at login; the buckets themselves are lock-free
+    static std::mutex mu;
+    static std::unordered_map<std::string, std::weak_ptr<TokenBucket>> buckets;
+    std::lock_guard<std::mutex> lk(mu);
+    auto b = buckets[user].lock();
+    if (!b) {
+        b = std::make_shared<TokenBucket>(rate);
+        buckets[user] = b;
+    } else if (b->rate() != rate) {
+        b->set_rate(rate);   // users.txt changed since the bucket was made
+    }
+    return b;
+}
+
+uint64_t parse_rate(const std::string& s) {
+    if (s.empty() || !std::isdigit((unsigned char)s[0])) return 0;
+    size_t pos = 0;
+    uint64_t v = 0;
+    try {
+        v = std::stoull(s, &pos);
+    } catch (const std::exception&) {
+        return 0;
+    }
+    std::string unit = s.substr(pos);
+    if (unit.empty() || unit == "B") return v;
+    switch (std::toupper((unsigned char)unit[0])) {
+        case 'K': return v << 10;
+        case 'M': return v << 20;
+        case 'G': return v << 30;
+        default: return 0;
+    }
+}
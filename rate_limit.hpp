@@ -0,0 +1,57 @@
+// rate_limit.hpp (C++17)
+// Token-bucket bandwidth shaping for transfers.
+// Buckets are lock-free (GCRA: one atomic "theoretical arrival time"), refill
+// lazily from the clock and never need a timer of their own. A transfer asks
+// its RateLimiter how long to wait before sending the next chunk.
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+class TokenBucket {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // rate in bytes per second (0 = unlimited); burst in bytes (0 = 1/4 s worth)
+    explicit TokenBucket(uint64_t rate = 0, uint64_t burst = 0) { set_rate(rate, burst); }
+
+    void set_rate(uint64_t rate, uint64_t burst = 0);
+    uint64_t rate() const { return rate_.load(std::memory_order_relaxed); }
+
+    // Take n bytes; returns how long the caller must wait before using them.
+    Clock::duration consume(uint64_t n);
+
+private:
+    std::atomic<uint64_t> rate_{0};
+    std::atomic<int64_t> burst_ns_{0};
+    std::atomic<int64_t> tat_ns_{0};   // when the bucket would be full again
+};
+
+// The buckets one transfer has to pass (global, per-user, per-connection).
+// A bucket at rate 0 is kept: it lets everything through until a reload
+// gives it a rate.
+class RateLimiter {
+public:
+    void add(std::shared_ptr<TokenBucket> bucket);
+    // False while every bucket is unlimited (the transfer need not ask).
+    bool limited() const { return tightest_rate() > 0; }
+
+    // Charges n bytes to every bucket; the wait is the longest of them.
+    TokenBucket::Clock::duration consume(uint64_t n);
+
+    // Lowest configured rate, 0 when unlimited (for SO_MAX_PACING_RATE).
+    uint64_t tightest_rate() const;
+
+private:
+    std::vector<std::shared_ptr<TokenBucket>> buckets_;
+};
+
+// Shared bucket for all sessions of one user, created on first use.
+std::shared_ptr<TokenBucket> user_bucket(const std::string& user, uint64_t rate);
+
+// "512K", "10M", "1G" (powers of 1024) or plain bytes; 0 on bad input.
+uint64_t parse_rate(const std::string& s);
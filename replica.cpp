@@ -0,0 +1,525 @@
+// replica.cpp (C++17)
+// Change log and follower for server-to-server replication (see replica.hpp).
+#include "replica.hpp"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <tuple>
+
+#include "endpoint.hpp"
+#include "protocol.hpp"
+#include "storage.hpp"
+
+namespace replica {
+
+using namespace proto;
+using Clock = std::chrono::steady_clock;
+
+static const int POLL_MS = 5000;              // REPL CHANGES long-poll
+static const int MAX_BACKOFF_S = 30;
+
+// ---- leader ----
+
+ChangeLog::ChangeLog() {
+    std::random_device rd;
+    do epoch_ = ((uint64_t)rd() << 32) | rd();
+    while (epoch_ == 0);   // 0 is what a new follower sends
+}
+
+uint64_t ChangeLog::last() const {
+    std::lock_guard<std::mutex> lock(mu_);
+    return last_;
+}
+
+uint64_t ChangeLog::record(bool upload, const std::string& name, uint64_t size, int64_t mtime, size_t keep) {
+    std::lock_guard<std::mutex> lock(mu_);
+    Change c;
+    c.seq = ++last_;
+    c.upload = upload;
+    c.size = size;
+    c.mtime = mtime;
+    c.name = name;
+    log_.push_back(std::move(c));
+    while (log_.size() > std::max<size_t>(keep, 1)) log_.pop_front();
+    return last_;
+}
+
+bool ChangeLog::since(uint64_t epoch, uint64_t after, size_t max, std::vector<Change>& out) const {
+    std::lock_guard<std::mutex> lock(mu_);
+    out.clear();
+    if (epoch != epoch_ || after > last_) return false;
+    if (after == last_) return true;
+    if (log_.empty() || log_.front().seq > after + 1) return false;   // fell behind
+    for (size_t i = (size_t)(after + 1 - log_.front().seq); i < log_.size() && out.size() < max; ++i)
+        out.push_back(log_[i]);
+    return true;
+}
+
+bool stat_file(const std::string& path, uint64_t& size, int64_t& mtime) {
+    struct stat st{};
+    if (::stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) return false;
+    size = (uint64_t)st.st_size;
+    mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    return true;
+}
+
+// A file the snapshot may list; dir files are stat'ed only when their page
+// is sent, so paging through a large store reads each directory per page but
+// stats every file once.
+struct Candidate {
+    bool upload = false;
+    std::string name, path;   // path empty: size and mtime are known
+    uint64_t size = 0;
+    int64_t mtime = 0;
+};
+
+static void list_dir(const std::string& dir, bool upload, std::vector<Candidate>& out) {
+    DIR* d = opendir(dir.c_str());
+    if (!d) return;
+    while (dirent* de = readdir(d)) {
+        std::string n = de->d_name;
+        if (n[0] == '.' || is_partial_upload(n)) continue;
+        Candidate c;
+        c.upload = upload;
+        c.name = n;
+        c.path = dir + "/" + n;
+        out.push_back(std::move(c));
+    }
+    closedir(d);
+}
+
+std::vector<Change> snapshot(const Storage& storage, uint64_t seq, const Cursor& after, size_t max, Cursor& next) {
+    std::vector<Candidate> all;
+    // a leader restart resets every follower: with a complete metadata
+    // store, that need not read every directory
+    if (MetaStore* meta = storage.meta(); meta && meta->complete()) {
+        for (bool upload : {false, true}) {
+            for (auto& [name, r] : meta->scan(upload)) {
+                Candidate c;
+                c.upload = upload;
+                c.name = name;
+                c.size = r.size;
+                c.mtime = r.mtime;
+                all.push_back(std::move(c));
+            }
+        }
+    } else {
+        for (auto& shard : storage.shards()) {
+            list_dir(shard.root, false, all);
+            list_dir(shard.upload, true, all);
+            for (auto& [name, e] : shard.packs->list()) {
+                Candidate c;
+                c.upload = true;
+                c.name = name;
+                c.size = e.size;
+                c.mtime = e.mtime;
+                all.push_back(std::move(c));
+            }
+        }
+    }
+
+    // the page: the first `max` files after the cursor, root before uploads
+    auto key = [](const Candidate& c) { return std::tie(c.upload, c.name); };
+    auto past = std::remove_if(all.begin(), all.end(), [&](const Candidate& c) {
+        return !after.name.empty() && key(c) <= std::tie(after.upload, after.name);
+    });
+    all.erase(past, all.end());
+    std::sort(all.begin(), all.end(), [&](const Candidate& a, const Candidate& b) { return key(a) < key(b); });
+    // a name left in an old shard, or both packed and in a directory, once
+    all.erase(std::unique(all.begin(), all.end(), [&](const Candidate& a, const Candidate& b) { return key(a) == key(b); }),
+              all.end());
+    next = Cursor{};
+    if (all.size() > max) {
+        all.resize(max);
+        next.upload = all.back().upload;
+        next.name = all.back().name;
+    }
+
+    std::vector<Change> out;
+    for (auto& cand : all) {
+        Change c;
+        if (!cand.path.empty() && !stat_file(cand.path, c.size, c.mtime)) continue;   // directories, vanished files
+        if (cand.path.empty()) {
+            c.size = cand.size;
+            c.mtime = cand.mtime;
+        }
+        c.seq = seq;
+        c.upload = cand.upload;
+        c.name = std::move(cand.name);
+        out.push_back(std::move(c));
+    }
+    return out;
+}
+
+std::vector<Change> snapshot(const Storage& storage, uint64_t seq) {
+    Cursor next;
+    return snapshot(storage, seq, Cursor{}, SIZE_MAX, next);
+}
+
+std::string format_changes(const std::vector<Change>& changes) {
+    std::ostringstream oss;
+    for (auto& c : changes)
+        oss << c.seq << ' ' << (c.upload ? "uploads" : "root") << ' ' << c.size << ' ' << c.mtime << ' ' << c.name << '\n';
+    return oss.str();
+}
+
+bool parse_changes(const std::string& text, std::vector<Change>& out) {
+    out.clear();
+    std::istringstream iss(text);
+    std::string line;
+    while (std::getline(iss, line)) {
+        std::istringstream ls(line);
+        Change c;
+        std::string dir;
+        if (!(ls >> c.seq >> dir >> c.size >> c.mtime >> c.name) || (dir != "root" && dir != "uploads")) return false;
+        c.upload = dir == "uploads";
+        out.push_back(std::move(c));
+    }
+    return true;
+}
+
+// ---- follower ----
+
+// A file of the batch being fetched into part, then renamed to dest.
+struct Follower::File {
+    Change c;
+    std::string dest, part;
+    std::mutex mu;                    // guards opening fd
+    int fd = -1;                      // from its first chunk until it is done
+    std::atomic<size_t> left{0};      // chunks not fetched yet
+    std::atomic<bool> stale{false};   // changed on the leader meanwhile; its next change brings it
+    bool placed = false;              // renamed to dest
+};
+
+static void set_timeout(int fd, int seconds) {
+    timeval tv{seconds, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+static bool safe_name(const std::string& n) {
+    return !n.empty() && n[0] != '.' && n.find('/') == std::string::npos && n.find('\\') == std::string::npos;
+}
+
+Follower::Follower(FollowConfig c) : c_(std::move(c)) {
+    c_.parallel = std::max(c_.parallel, 1);
+    c_.chunk = std::max<uint64_t>(c_.chunk, 4096);
+    fetch_fds_.assign((size_t)c_.parallel, -1);
+}
+
+Follower::~Follower() { stop(); }
+
+void Follower::start() {
+    load_state();
+    thread_ = std::thread([this] { run(); });
+}
+
+void Follower::stop() {
+    stop_ = true;
+    {
+        std::lock_guard<std::mutex> lock(ctl_mu_);
+        if (ctl_fd_ >= 0) ::shutdown(ctl_fd_, SHUT_RDWR);   // wakes the long poll
+    }
+    if (thread_.joinable()) thread_.join();
+    for (int& fd : fetch_fds_) {
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+    }
+}
+
+int Follower::open_session(std::string& err) const {
+    int fd = connect_endpoint(c_.host, c_.port);
+    if (fd < 0) {
+        err = "cannot connect: " + std::string(std::strerror(errno));
+        return -1;
+    }
+    set_timeout(fd, 30);
+    std::string resp;
+    if (!send_line(fd, "AUTH " + c_.user + " " + c_.password) || !recv_line(fd, resp) || resp != "AUTH_OK") {
+        err = resp.empty() ? "connection lost during AUTH" : resp;
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void Follower::close_control() {
+    std::lock_guard<std::mutex> lock(ctl_mu_);
+    if (ctl_fd_ >= 0) ::close(ctl_fd_);
+    ctl_fd_ = -1;
+}
+
+// "<epoch> <seq>" of the last batch applied, so a restart resumes there
+void Follower::load_state() {
+    std::ifstream in(c_.state_dir + "/.replica-state");
+    uint64_t e = 0, s = 0;
+    if (in >> e >> s) {
+        epoch_ = e;
+        seq_ = s;
+    }
+}
+
+void Follower::save_state() const {
+    std::string path = c_.state_dir + "/.replica-state";
+    {
+        std::ofstream out(path + ".tmp", std::ios::trunc);
+        out << epoch_ << " " << seq_ << "\n";
+        if (!out) return;
+    }
+    std::rename((path + ".tmp").c_str(), path.c_str());
+}
+
+// Creates f.part at its final size, once; the first chunk of f calls this.
+bool Follower::open_part(File& f, std::string& err) {
+    std::lock_guard<std::mutex> lock(f.mu);
+    if (f.fd >= 0) return true;
+    f.fd = ::open(f.part.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (f.fd < 0 || ::ftruncate(f.fd, (off_t)f.c.size) < 0) {
+        err = "cannot write " + f.part + ": " + std::strerror(errno);
+        if (f.fd >= 0) ::close(f.fd);
+        f.fd = -1;
+        ::unlink(f.part.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Every chunk of f is in, or it went stale: moves it to dest with the
+// leader's mtime, or drops it.
+void Follower::finish(File& f) {
+    std::string why;
+    bool keep = !f.stale && open_part(f, why);   // an empty file has no chunk
+    if (keep) {
+        timespec times[2];
+        times[0].tv_sec = times[1].tv_sec = (time_t)(f.c.mtime / 1000000000);
+        times[0].tv_nsec = times[1].tv_nsec = (long)(f.c.mtime % 1000000000);
+        keep = ::futimens(f.fd, times) == 0;
+    }
+    if (f.fd >= 0) ::close(f.fd);
+    f.fd = -1;
+    if (keep && std::rename(f.part.c_str(), f.dest.c_str()) == 0) {
+        f.placed = true;
+        if (c_.on_apply) c_.on_apply(f.c);
+        return;
+    }
+    ::unlink(f.part.c_str());
+}
+
+// One GETRANGE into f.part; false (err set) only when the session broke.
+bool Follower::fetch(File& f, uint64_t off, uint64_t len, int& fd, std::vector<char>& buf, std::string& err) {
+    if (fd < 0) fd = open_session(err);
+    if (fd < 0) return false;
+    std::string resp;
+    std::string req = "GETRANGE " + f.c.name + " " + std::to_string(off) + " " + std::to_string(len) +
+                      (f.c.upload ? " uploads" : "");
+    uint64_t size_be = 0;
+    if (!send_line(fd, req) || !recv_line(fd, resp)) { err = "connection lost"; return false; }
+    if (resp == "ERR NotFound" || resp == "ERR BadRange") {
+        f.stale = true;   // gone or shorter now
+        return true;
+    }
+    if (resp != "OK") { err = resp; return false; }
+    if (!recv_all(fd, &size_be, sizeof(size_be))) { err = "connection lost"; return false; }
+    uint64_t got = be64_to_host(size_be);
+    buf.resize((size_t)got);
+    if (!recv_all(fd, buf.data(), buf.size())) { err = "connection lost"; return false; }
+    if (got != len) {
+        f.stale = true;
+        return true;
+    }
+    xor_in_place(buf.data(), buf.size());
+    if (!open_part(f, err)) return false;
+    if (::pwrite(f.fd, buf.data(), buf.size(), (off_t)off) != (ssize_t)buf.size()) {
+        err = "cannot write " + f.part + ": " + std::strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+bool Follower::apply(const std::vector<Change>& batch, std::string& err) {
+    auto start = Clock::now();
+    // a file changed several times in the batch is fetched once, as it is now
+    std::map<std::pair<bool, std::string>, Change> latest;
+    for (auto& c : batch)
+        if (safe_name(c.name)) latest[{c.upload, c.name}] = c;
+
+    std::vector<std::unique_ptr<File>> files;
+    size_t unchanged = 0;
+    for (auto& [key, c] : latest) {
+        std::string dest = c_.place(c.upload, c.name);
+        uint64_t size = 0;
+        int64_t mtime = 0;
+        if (stat_file(dest, size, mtime) && size == c.size && mtime == c.mtime) { ++unchanged; continue; }
+        auto f = std::make_unique<File>();
+        f->c = c;
+        f->dest = dest;
+        f->part = dest.substr(0, dest.rfind('/') + 1) + ".repl-" + c.name + ".part";   // same filesystem
+        files.push_back(std::move(f));
+    }
+
+    // every chunk of every file is one task; up to `parallel` sessions take
+    // them in order, so small files go out side by side and big ones split.
+    // A part file is open from its first chunk to its last, so with tasks
+    // taken in order at most parallel + 1 are open at once, however big the
+    // batch
+    struct Task { File* f; uint64_t off, len; };
+    std::vector<Task> tasks;
+    uint64_t bytes = 0;
+    for (auto& f : files) {
+        for (uint64_t off = 0; off < f->c.size; off += c_.chunk)
+            tasks.push_back({f.get(), off, std::min(c_.chunk, f->c.size - off)});
+        f->left = (f->c.size + c_.chunk - 1) / c_.chunk;
+        bytes += f->c.size;
+        if (!f->left && !stop_) finish(*f);
+    }
+    std::atomic<size_t> next{0};
+    std::atomic<bool> failed{false};
+    std::mutex err_mu;
+    auto worker = [&](size_t slot) {
+        std::vector<char> buf;
+        std::string why;
+        while (!failed && !stop_) {
+            size_t i = next++;
+            if (i >= tasks.size()) return;
+            Task& t = tasks[i];
+            if (!t.f->stale && !fetch(*t.f, t.off, t.len, fetch_fds_[slot], buf, why)) {
+                if (fetch_fds_[slot] >= 0) ::close(fetch_fds_[slot]);
+                fetch_fds_[slot] = -1;
+                std::lock_guard<std::mutex> lock(err_mu);
+                if (!failed.exchange(true)) err = why;
+                return;
+            }
+            if (t.f->left.fetch_sub(1) == 1) finish(*t.f);
+        }
+    };
+    std::vector<std::thread> workers;
+    size_t n = std::min(tasks.size(), fetch_fds_.size());
+    for (size_t i = 0; i < n; ++i) workers.emplace_back(worker, i);
+    for (auto& t : workers) t.join();
+    if (stop_ && !failed) { failed = true; err = "stopped"; }
+
+    // files left unfinished by a failure are fetched again on the retry
+    size_t placed = 0, stale = 0;
+    for (auto& f : files) {
+        if (f->placed) ++placed;
+        else if (f->left) {
+            if (f->fd >= 0) ::close(f->fd);
+            ::unlink(f->part.c_str());
+        } else ++stale;
+    }
+    if (failed) return false;
+    if (!latest.empty()) {
+        double secs = std::chrono::duration<double>(Clock::now() - start).count();
+        std::cout << "Replica: applied " << placed << " files (" << bytes << " bytes) in " << secs
+                  << " s, " << unchanged << " unchanged, " << stale << " changed again on the leader\n";
+    }
+    return true;
+}
+
+// An OK or RESET reply on the control session.
+struct Reply {
+    std::string kind;
+    uint64_t epoch = 0, last = 0;
+    Cursor next;   // RESET: where the next page starts, empty on the last one
+    std::vector<Change> batch;
+};
+
+static bool request(int fd, const std::string& req, Reply& r, std::string& err) {
+    std::string head, body, dir;
+    size_t count = 0;
+    if (!send_line(fd, req) || !recv_line(fd, head)) {
+        err = "connection lost";
+        return false;
+    }
+    std::istringstream iss(head);
+    iss >> r.kind >> r.epoch >> r.last >> count;
+    r.next = Cursor{};
+    if (r.kind == "RESET" && iss >> dir >> r.next.name) r.next.upload = dir == "uploads";
+    if ((r.kind == "OK" || r.kind == "RESET") && recv_line(fd, body) && parse_changes(body, r.batch) &&
+        r.batch.size() == count)
+        return true;
+    err = head.rfind("ERR", 0) == 0 ? head : "bad REPL reply";
+    return false;
+}
+
+void Follower::run() {
+    std::string target = c_.host + (c_.port ? ":" + std::to_string(c_.port) : "");
+    int backoff = 1;
+    auto pause = [&] {
+        for (int i = 0; i < backoff * 10 && !stop_; ++i) std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        backoff = std::min(backoff * 2, MAX_BACKOFF_S);
+    };
+    while (!stop_) {
+        std::string err;
+        int fd;
+        {
+            std::lock_guard<std::mutex> lock(ctl_mu_);
+            fd = ctl_fd_;
+        }
+        if (fd < 0) {
+            fd = open_session(err);
+            if (fd < 0) {
+                std::cout << "Replica: " << target << ": " << err << ", retrying in " << backoff << " s\n";
+                pause();
+                continue;
+            }
+            set_timeout(fd, POLL_MS / 1000 + 30);
+            std::lock_guard<std::mutex> lock(ctl_mu_);
+            ctl_fd_ = fd;
+            std::cout << "Replica: following " << target << " from change " << seq_ << "\n";
+        }
+
+        Reply r;
+        std::string req = "REPL CHANGES " + std::to_string(epoch_) + " " + std::to_string(seq_) + " " +
+                          std::to_string(POLL_MS);
+        bool ok = request(fd, req, r, err);
+        if (ok && r.kind == "RESET") std::cout << "Replica: full sync at change " << r.last << "\n";
+        if (ok) ok = apply(r.batch, err);
+        // the rest of a RESET, one page at a time; a failure starts it over,
+        // and the files already in place are skipped then
+        while (ok && r.kind == "RESET" && !r.next.name.empty()) {
+            uint64_t epoch = r.epoch, last = r.last;
+            req = "REPL SNAPSHOT " + std::to_string(epoch) + " " + std::to_string(last) + " " +
+                  (r.next.upload ? "uploads " : "root ") + r.next.name;
+            ok = request(fd, req, r, err);
+            if (ok && (r.kind != "RESET" || r.epoch != epoch || r.last != last)) {
+                ok = false;
+                err = "bad REPL SNAPSHOT reply";
+            }
+            if (ok) ok = apply(r.batch, err);
+        }
+        if (!ok) {
+            if (stop_) break;
+            std::cout << "Replica: " << target << ": " << err << ", retrying in " << backoff << " s\n";
+            close_control();
+            pause();
+            continue;
+        }
+        backoff = 1;
+        bool moved = r.epoch != epoch_ || r.kind == "RESET" || !r.batch.empty();
+        epoch_ = r.epoch;
+        if (r.kind == "RESET") seq_ = r.last;
+        else if (!r.batch.empty()) seq_ = r.batch.back().seq;
+        if (moved) save_state();
+    }
+    close_control();
+}
+
+} // namespace replica
@@ -0,0 +1,135 @@
+// replica.hpp (C++17)
+// Server-to-server replication: a follower server mirrors the file store of
+// the server it follows, so reads can be served by the nearest copy.
+//
+// The leader numbers every committed PUT in a change log (the last
+// --repl-backlog of them are kept in memory). A follower, logged in as the
+// leader's --repl-user, long-polls
+//   REPL CHANGES <epoch> <after> <wait_ms>
+// and gets either the changes after sequence number `after`:
+//   OK <epoch> <last> <count>    + one line, "seq dir size mtime name\n" each
+// or, when it is new, the leader restarted (the epoch changed) or it fell
+// behind the backlog, the whole store at sequence `last`, one page at a time:
+//   RESET <epoch> <last> <count> [<dir> <name>] + the same line format
+// A page that ends with a cursor has more after it; the follower asks for
+//   REPL SNAPSHOT <epoch> <last> <dir> <name>
+// and gets the next page, until one comes without a cursor.
+// dir is "root" (the files GET serves) or "uploads" (where PUT lands).
+// The follower fetches the files of a batch as GETRANGE chunks over
+// several sessions at once, writes them beside the target and renames them in
+// place with the leader's mtime; a file whose size and mtime already match is
+// skipped, so a RESET after a short outage moves little data.
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class Storage;
+
+namespace replica {
+
+struct Change {
+    uint64_t seq = 0;
+    bool upload = false;   // an upload directory, else a root directory
+    uint64_t size = 0;
+    int64_t mtime = 0;
+    std::string name;
+};
+
+// Leader side. Shared by all sessions behind a mutex.
+class ChangeLog {
+public:
+    ChangeLog();
+
+    // Random per process: sequence numbers restart from 1 with it.
+    uint64_t epoch() const { return epoch_; }
+    uint64_t last() const;
+
+    // Appends a change, keeping the last `keep` of them.
+    uint64_t record(bool upload, const std::string& name, uint64_t size, int64_t mtime, size_t keep);
+
+    // Up to max changes after `after`; false when the caller must resync
+    // (other epoch, or `after` is older than the log).
+    bool since(uint64_t epoch, uint64_t after, size_t max, std::vector<Change>& out) const;
+
+private:
+    uint64_t epoch_;
+    mutable std::mutex mu_;
+    std::deque<Change> log_;
+    uint64_t last_ = 0;
+};
+
+// Size and mtime (ns) of a regular file; false if there is none.
+bool stat_file(const std::string& path, uint64_t& size, int64_t& mtime);
+
+// Position in a snapshot: files sort by directory (root first), then name.
+// An empty name is the start (or, returned as next, the end).
+struct Cursor {
+    bool upload = false;
+    std::string name;
+};
+
+// One page of every file of every shard, packed uploads included: up to max
+// files after `after`, as changes numbered seq; next is where the following
+// page starts. Hidden files and uploads in progress are left out. Read from
+// the metadata store when it is complete.
+std::vector<Change> snapshot(const Storage& storage, uint64_t seq, const Cursor& after, size_t max, Cursor& next);
+
+// Every file in one list.
+std::vector<Change> snapshot(const Storage& storage, uint64_t seq);
+
+std::string format_changes(const std::vector<Change>& changes);
+bool parse_changes(const std::string& text, std::vector<Change>& out);
+
+struct FollowConfig {
+    std::string host;   // connect_endpoint() form
+    int port = 0;
+    std::string user, password;
+    std::string state_dir;   // holds .replica-state
+    std::function<std::string(bool upload, const std::string& name)> place;   // where a file goes
+    int parallel = 4;            // sessions fetching chunks at once
+    uint64_t chunk = 4 << 20;    // bytes per GETRANGE
+    std::function<void(const Change&)> on_apply;   // after each file is in place
+};
+
+// Follower side: a thread that keeps the local directories in step with the
+// leader, reconnecting with backoff when it goes away.
+class Follower {
+public:
+    explicit Follower(FollowConfig c);
+    ~Follower();
+
+    void start();
+    void stop();
+
+    uint64_t applied_seq() const { return seq_; }
+
+private:
+    struct File;
+    void run();
+    bool apply(const std::vector<Change>& batch, std::string& err);
+    bool fetch(File& f, uint64_t off, uint64_t len, int& fd, std::vector<char>& buf, std::string& err);
+    bool open_part(File& f, std::string& err);
+    void finish(File& f);
+    int open_session(std::string& err) const;
+    void close_control();
+    void load_state();
+    void save_state() const;
+
+    FollowConfig c_;
+    std::atomic<bool> stop_{false};
+    std::thread thread_;
+    std::mutex ctl_mu_;
+    int ctl_fd_ = -1;              // the REPL CHANGES session; stop() shuts it down
+    std::vector<int> fetch_fds_;   // one session per fetch thread, -1 = not connected
+    uint64_t epoch_ = 0;
+    std::atomic<uint64_t> seq_{0};
+};
+
+} // namespace replica
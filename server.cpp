@@ -1,276 +1,1730 @@
-// server.cpp (C++17)
+// server.cpp (C++20)
 // Network File Sharing Server with simple XOR "encryption"
-// Build: g++ -std=c++17 -O2 -Wall server.cpp -o server
+// Build: see README.md (links libfileshare)
 #include <arpa/inet.h>
 #include <dirent.h>
 #include <fcntl.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/un.h>
 #include <unistd.h>
 
 #include <algorithm>
+#include <atomic>
 #include <cerrno>
+#include <chrono>
 #include <csignal>
+#include <cstdio>
 #include <cstring>
 #include <fstream>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <unordered_set>
 #include <vector>
 #include <cstdint>
 
-static const int PORT = 8080;
-static const uint8_t XOR_KEY = 0x5A;           // Simple XOR "encryption"
-static const std::string ROOT_DIR = "server_files";
-static const std::string UPLOAD_DIR = "server_files/uploads";
-static const std::string USERS_FILE = "users.txt";
+#include "async_io.hpp"
+#include "cluster.hpp"
+#include "bounded_queue.hpp"
+#include "config.hpp"
+#include "endpoint.hpp"
+#include "fair_sched.hpp"
+#include "fd_passing.hpp"
+#include "protocol.hpp"
+#include "push.hpp"
+#include "rate_limit.hpp"
+#include "replica.hpp"
+#include "storage.hpp"
+#include "swarm.hpp"
+#include "swarm_tracker.hpp"
+#include "udp_transport.hpp"
+#include "user_limits.hpp"
+#include "users.hpp"
+#include "work_stealing.hpp"
 
-int listen_fd = -1;
+using namespace proto;
 
-void handle_sigint(int) {
-    if (listen_fd != -1) close(listen_fd);
-    std::cerr << "\nServer shutting down...\n";
-    std::_Exit(0);
-}
+// A shared_ptr one thread replaces while others read it. A mutex rather than
+// std::atomic<std::shared_ptr>, which g++ 11 (the Docker images) lacks; the
+// lock is held only to copy the pointer.
+template <typename T>
+class Published {
+public:
+    explicit Published(std::shared_ptr<const T> p = nullptr) : p_(std::move(p)) {}
+    std::shared_ptr<const T> load() const {
+        std::lock_guard<std::mutex> lk(mu_);
+        return p_;
+    }
+    void store(std::shared_ptr<const T> p) {
+        std::lock_guard<std::mutex> lk(mu_);
+        p_.swap(p);   // the old one is released after the lock
+    }
 
-// ---- byte order helpers (portable 64-bit conversions without <endian.h>) ----
-uint64_t host_to_be64(uint64_t host) {
-    uint32_t hi = htonl((uint32_t)(host >> 32));
-    uint32_t lo = htonl((uint32_t)(host & 0xFFFFFFFFULL));
-    return ( (uint64_t)lo << 32 ) | hi;
-}
-uint64_t be64_to_host(uint64_t be) {
-    uint32_t lo = ntohl((uint32_t)(be >> 32));
-    uint32_t hi = ntohl((uint32_t)(be & 0xFFFFFFFFULL));
-    return ( (uint64_t)hi << 32 ) | lo;
+private:
+    mutable std::mutex mu_;
+    std::shared_ptr<const T> p_;
+};
+
+// Settings live behind a published pointer: the control thread publishes a
+// new snapshot on SIGHUP, and sessions take one when they start (and each
+// transfer when it starts), so a reload never changes a value mid-operation.
+static Published<ServerOptions> live_options;
+
+static std::shared_ptr<const ServerOptions> options() {
+    return live_options.load();
 }
 
+static std::vector<int> listen_fds;   // TCP and AF_UNIX listeners
+static std::vector<std::string> listen_paths;   // socket files of the AF_UNIX ones
+static std::vector<int> udp_fds;      // udp: endpoints, served by udp_servers
+static std::vector<std::unique_ptr<udp::Server>> udp_servers;
+
 // ---- small helpers ----
-bool ensure_dirs() {
-    // make sure ROOT_DIR and UPLOAD_DIR exist
-    if (mkdir(ROOT_DIR.c_str(), 0755) && errno != EEXIST) return false;
-    if (mkdir(UPLOAD_DIR.c_str(), 0755) && errno != EEXIST) return false;
+static Storage storage;   // --root-dir/--upload-dir, or the --shards (storage.hpp)
+static const auto COMPACT_INTERVAL = std::chrono::seconds(60);   // packs and metadata segments
+static const int STORE_LOCK_WAIT_S = 60;   // hot upgrade: for the old server to release the stores
+
+bool ensure_dirs(const ServerOptions& o, int lock_wait) {
+    // make sure the root and upload directories of every shard exist
+    std::vector<Storage::Shard> shards;
+    if (o.shards.empty()) shards.push_back({o.root_dir, o.upload_dir});
+    for (auto& dir : o.shards) shards.push_back({dir, dir + "/uploads"});
+    std::string err;
+    if (!storage.open(shards, o.io_threads, lock_wait, err) || (o.meta && !storage.open_meta(err))) {
+        std::cerr << err << "\n";
+        return false;
+    }
     return true;
 }
 
-void xor_in_place(std::vector<char>& buf, size_t n) {
-    for (size_t i = 0; i < n; ++i) buf[i] ^= XOR_KEY;
+// very basic filename sanitizer: reject path traversal and slashes
+bool safe_filename(const std::string& name) {
+    return !name.empty() &&
+           name.find("..") == std::string::npos &&
+           name.find('/') == std::string::npos &&
+           name.find('\\') == std::string::npos;
 }
 
-bool send_all(int fd, const void* data, size_t len) {
-    const char* p = (const char*)data;
-    while (len > 0) {
-        ssize_t s = send(fd, p, len, 0);
-        if (s <= 0) return false;
-        p += s;
-        len -= (size_t)s;
-    }
-    return true;
+// With --meta on, LIST and STAT read the metadata store once it has seen
+// every file, instead of the directories.
+static MetaStore* meta_ready() {
+    MetaStore* meta = storage.meta();
+    return meta && meta->complete() ? meta : nullptr;
 }
 
-bool recv_all(int fd, void* data, size_t len) {
-    char* p = (char*)data;
-    while (len > 0) {
-        ssize_t r = recv(fd, p, len, 0);
-        if (r <= 0) return false;
-        p += r;
-        len -= (size_t)r;
-    }
+// hash 0 and owner "" when not known.
+static bool file_info(const std::string& name, bool upload, MetaStore::Record& r) {
+    if (MetaStore* meta = meta_ready()) return meta->get(upload, name, r);
+    Storage::Opened f;
+    if (!storage.open_file(name, upload, f)) return false;
+    close(f.fd);
+    r.size = f.size;
+    r.mtime = f.mtime;
+    r.shard = (uint32_t)f.shard;
+    r.packed = f.packed;
     return true;
 }
 
-// Line protocol: uint32 length (network order) + bytes
-bool send_line(int fd, const std::string& s) {
-    uint32_t n = htonl((uint32_t)s.size());
-    if (!send_all(fd, &n, sizeof(n))) return false;
-    if (!send_all(fd, s.data(), s.size())) return false;
-    return true;
+// ---- cipher stage ----
+// With --cipher-workers, transfers move CIPHER_BATCH buffers per step and XOR
+// them as --buffer-size jobs on a work-stealing pool, so one session's big GET
+// is spread over all cores while its reactor keeps serving other sessions.
+static const size_t CIPHER_BATCH = 8;
+static std::unique_ptr<WorkStealingPool> cipher_pool;
+static thread_local unsigned reactor_id = 0;   // home deque for this thread's jobs
+
+struct CipherAwaiter {
+    aio::EventLoop& loop;
+    char* buf;
+    size_t n;
+    size_t job;   // bytes per pool job
+    std::atomic<size_t> left{0};
+
+    // small buffers (or no pool) are XORed inline without suspending
+    bool await_ready() {
+        if (cipher_pool && n > job) return false;
+        xor_in_place(buf, n);
+        return true;
+    }
+    void await_suspend(std::coroutine_handle<> h) {
+        left = (n + job - 1) / job;
+        for (size_t off = 0; off < n; off += job) {
+            size_t len = std::min(job, n - off);
+            cipher_pool->submit([this, h, off, len] {
+                xor_in_place(buf + off, len);
+                if (left.fetch_sub(1) == 1) {
+                    aio::EventLoop* l = &loop;
+                    l->post([l, h] { l->schedule(h); });
+                }
+            }, reactor_id);
+        }
+    }
+    void await_resume() const noexcept {}
+};
+
+static size_t transfer_buffer_size(const ServerOptions& o) {
+    return cipher_pool ? CIPHER_BATCH * o.buffer_size : o.buffer_size;
 }
 
-bool recv_line(int fd, std::string& out) {
-    uint32_t n = 0;
-    if (!recv_all(fd, &n, sizeof(n))) return false;
-    n = ntohl(n);
-    out.assign(n, '\0');
-    if (n == 0) return true;
-    if (!recv_all(fd, out.data(), n)) return false;
-    return true;
+// ---- fair scheduling ----
+// Each async reactor interleaves the chunks of its bulk transfers by deficit
+// round robin (fair_sched.hpp). Files up to --small-file bytes, LIST and the
+// other control replies form the latency class and never wait for a grant.
+static const size_t FAIR_ROUND_BUDGET = 16 * CHUNK_SIZE;   // bulk bytes per loop iteration
+static thread_local FairScheduler* fair_sched = nullptr;
+
+static bool is_bulk(const ServerOptions& o, uint64_t size) {
+    return fair_sched && o.fair && size > o.small_file;
 }
 
-// very basic filename sanitizer: reject path traversal and slashes
-bool safe_filename(const std::string& name) {
-    return !name.empty() &&
-           name.find("..") == std::string::npos &&
-           name.find('/') == std::string::npos &&
-           name.find('\\') == std::string::npos;
+// ---- deadlines ----
+// Auth, idle and minimum-rate deadlines live on the loop's timer wheel. On
+// expiry the socket is shut down, which wakes whatever the session is waiting
+// on with EOF/EPIPE and lets it unwind through its normal error path.
+static const auto MIN_RATE_WINDOW = std::chrono::seconds(10);
+
+static void expire_connection(int fd, const char* why) {
+    std::cout << "Closing connection: " << why << "\n";
+    shutdown(fd, SHUT_RDWR);
 }
 
-bool check_auth(const std::string& user, const std::string& pass) {
-    std::ifstream in(USERS_FILE);
-    if (!in) return false;
-    std::string line;
-    while (std::getline(in, line)) {
-        auto pos = line.find(':');
-        if (pos == std::string::npos) continue;
-        std::string u = line.substr(0, pos);
-        std::string p = line.substr(pos + 1);
-        if (u == user && p == pass) return true;
+// Drops a transfer that moves fewer than --min-rate bytes/s over a window,
+// i.e. a client that trickles data or stops reading. A server-side rate limit
+// below --min-rate lowers the floor to half that limit (read every window:
+// a reload may change --rate-global mid-transfer).
+class RateWatchdog {
+public:
+    RateWatchdog(aio::AsyncSocket& sock, const RateLimiter& limiter, uint64_t min_rate)
+        : wheel_(sock.loop().wheel()), fd_(sock.fd()), limiter_(limiter), min_rate_(min_rate),
+          timer_([this] { check(); }) {
+        if (min_rate_ > 0) wheel_.schedule(timer_, MIN_RATE_WINDOW);
     }
-    return false;
+    void moved(uint64_t n) { moved_ += n; }
+
+private:
+    void check() {
+        uint64_t rate = min_rate_;
+        uint64_t limit = limiter_.tightest_rate();
+        if (limit > 0) rate = std::min(rate, limit / 2);
+        uint64_t min_bytes = rate * (uint64_t)std::chrono::seconds(MIN_RATE_WINDOW).count();
+        if (moved_ < min_bytes) { expire_connection(fd_, "transfer below --min-rate"); return; }
+        moved_ = 0;
+        wheel_.schedule(timer_, MIN_RATE_WINDOW);
+    }
+
+    aio::TimerWheel& wheel_;
+    int fd_;
+    const RateLimiter& limiter_;
+    uint64_t min_rate_;
+    uint64_t moved_ = 0;
+    aio::TimerWheel::Timer timer_;
+};
+
+// ---- async transfers (coroutine versions of the protocol.hpp helpers) ----
+// Every chunk is charged to the session's token buckets first; an over-rate
+// session sleeps on its loop timer instead of holding the uplink.
+static aio::Task<void> throttle(aio::AsyncSocket& sock, RateLimiter& limiter, size_t n) {
+    auto wait = limiter.consume(n);
+    if (wait > std::chrono::steady_clock::duration::zero()) co_await sock.loop().sleep_for(wait);
 }
 
-std::string list_files() {
-    std::ostringstream oss;
-    DIR* dir = opendir(ROOT_DIR.c_str());
-    if (!dir) return "ERR: cannot open server_files\n";
-    struct dirent* de;
-    while ((de = readdir(dir)) != nullptr) {
-        std::string n = de->d_name;
-        if (n == "." || n == ".." || n == "uploads") continue;
-        oss << n << "\n";
-    }
-    closedir(dir);
-    return oss.str();
+// ---- disk I/O ----
+// The blocking reads and writes of a transfer run on the I/O queue of the
+// device holding the file (storage.hpp); the session waits for them like for
+// the cipher pool.
+// fn is a lambda with reference captures, not a std::function: g++ 12
+// destroys non-trivial temporaries of a co_await expression twice.
+template <typename Fn>
+struct IoAwaiter {
+    aio::EventLoop& loop;
+    IoQueue* queue;   // nullptr: run inline
+    Fn fn;
+
+    bool await_ready() {
+        if (queue) return false;
+        fn();
+        return true;
+    }
+    void await_suspend(std::coroutine_handle<> h) {
+        queue->submit([this, h] {
+            fn();
+            aio::EventLoop* l = &loop;
+            l->post([l, h] { l->schedule(h); });
+        });
+    }
+    void await_resume() const noexcept {}
+};
+
+// Lookups of a file (stat, open) run on its owner's queue, like its transfers.
+static IoQueue* owner_io(const std::string& name) { return storage.shards()[storage.owner(name)].io; }
+
+// Reads every shard's root directory at once, each on its device's queue;
+// the last job to finish resumes the session, which merges the lists. Await
+// a named ListAwaiter: it is not trivially destructible (see IoAwaiter).
+struct ListAwaiter {
+    aio::EventLoop& loop;
+    std::vector<std::vector<std::string>> parts;
+    std::atomic<size_t> left{0};
+
+    // without I/O queues the directories are read inline
+    bool await_ready() {
+        parts.resize(storage.shards().size());
+        if (storage.shards()[0].io) return false;
+        for (size_t i = 0; i < parts.size(); ++i) parts[i] = storage.list_shard(i);
+        return true;
+    }
+    void await_suspend(std::coroutine_handle<> h) {
+        left = parts.size();
+        for (size_t i = 0; i < parts.size(); ++i) {
+            storage.shards()[i].io->submit([this, h, i] {
+                parts[i] = storage.list_shard(i);
+                if (left.fetch_sub(1) == 1) {
+                    aio::EventLoop* l = &loop;
+                    l->post([l, h] { l->schedule(h); });
+                }
+            });
+        }
+    }
+    void await_resume() const noexcept {}
+};
+
+// The reply to LIST: one name per line.
+static aio::Task<std::string> list_files(aio::EventLoop& loop) {
+    std::vector<std::string> names;
+    if (MetaStore* meta = meta_ready()) {
+        names = meta->list(false);
+    } else {
+        ListAwaiter lister{loop, {}};
+        co_await lister;
+        names = Storage::merge_lists(lister.parts);
+    }
+    std::string out;
+    for (auto& n : names) {
+        out += n;
+        out += '\n';
+    }
+    co_return out;
 }
 
-bool send_file_encrypted(int fd, const std::string& path) {
-    std::ifstream in(path, std::ios::binary);
-    if (!in) return false;
+// Closes the descriptor when a transfer ends, however it ends.
+struct FdGuard {
+    int fd;
+    explicit FdGuard(int f) : fd(f) {}
+    FdGuard(const FdGuard&) = delete;
+    FdGuard& operator=(const FdGuard&) = delete;
+    ~FdGuard() { if (fd >= 0) close(fd); }
+};
 
-    // get size
-    in.seekg(0, std::ios::end);
-    uint64_t size = (uint64_t)in.tellg();
-    in.seekg(0, std::ios::beg);
+// The whole file, or length bytes from offset (GETRANGE; clipped to the
+// file). file is a whole file or a packed upload (Storage::open_file()).
+aio::Task<bool> send_file_encrypted(aio::AsyncSocket& sock, const Storage::Opened& file, RateLimiter& limiter,
+                                    uint64_t offset = 0, uint64_t length = UINT64_MAX) {
+    auto conf = options();
+    uint64_t size = file.size;
+    if (offset > size) co_return false;
+    size = std::min(length, size - offset);
 
     uint64_t size_be = host_to_be64(size);
-    if (!send_all(fd, &size_be, sizeof(size_be))) return false;
+    bool ok = co_await sock.send_all(&size_be, sizeof(size_be));
+    if (!ok) co_return false;
 
-    std::vector<char> buf(64 * 1024);
-    while (in) {
-        in.read(buf.data(), (std::streamsize)buf.size());
-        std::streamsize got = in.gcount();
-        if (got <= 0) break;
-        xor_in_place(buf, (size_t)got);
-        if (!send_all(fd, buf.data(), (size_t)got)) return false;
+    std::vector<char> buf(transfer_buffer_size(*conf));
+    FairScheduler::Flow flow;
+    bool bulk = is_bulk(*conf, size);
+    RateWatchdog watchdog(sock, limiter, conf->min_rate);
+    uint64_t left = size;
+    uint64_t pos = file.offset + offset;
+    while (left > 0) {
+        ssize_t got = 0;
+        size_t want = (size_t)std::min<uint64_t>(buf.size(), left);
+        co_await IoAwaiter{sock.loop(), file.io, [&] { got = pread(file.fd, buf.data(), want, (off_t)pos); }};
+        if (got <= 0) co_return false;   // the file shrank under us
+        pos += (uint64_t)got;
+        left -= (uint64_t)got;
+        if (bulk) co_await fair_sched->grant(flow, (size_t)got);
+        if (limiter.limited()) co_await throttle(sock, limiter, (size_t)got);
+        co_await CipherAwaiter{sock.loop(), buf.data(), (size_t)got, conf->buffer_size};
+        ok = co_await sock.send_all(buf.data(), (size_t)got);
+        if (!ok) co_return false;
+        watchdog.moved((uint64_t)got);
     }
-    return true;
+    co_return true;
 }
 
-bool recv_file_encrypted(int fd, const std::string& path) {
+// ---- per-user limits ----
+// Sessions, transfers and stored bytes are counted per user in a lock-free
+// table (user_limits.hpp) against the sessions=/transfers=/quota= keys of
+// users.txt.
+static UsageTable usage_table;
+
+static std::atomic<uint64_t> part_seq{0};   // numbers the .partN files transfers land in
+
+// Quota held by one PUT; whatever is still held when it goes out of scope
+// (failed upload) is given back.
+struct QuotaHold {
+    UserUsage* user;
+    uint64_t quota;
+    uint64_t held = 0;
+
+    QuotaHold(UserUsage* u, uint64_t q) : user(u), quota(q) {}
+    QuotaHold(const QuotaHold&) = delete;
+    QuotaHold& operator=(const QuotaHold&) = delete;
+    ~QuotaHold() { if (held) usage_table.release(user, held); }
+
+    // Hold exactly `size` bytes.
+    bool cover(uint64_t size) {
+        if (size > held) {
+            if (!usage_table.reserve(user, size - held, quota)) return false;
+        } else {
+            usage_table.release(user, held - size);
+        }
+        held = size;
+        return true;
+    }
+};
+
+// Into path, or with into set into memory (a small upload headed for a pack;
+// a file bigger than into_max drops the connection as for --max-file).
+aio::Task<bool> recv_file_encrypted(aio::AsyncSocket& sock, const std::string& path, IoQueue* io,
+                                    RateLimiter& limiter, QuotaHold& hold, std::string* into = nullptr,
+                                    uint64_t into_max = 0) {
     uint64_t size_be = 0;
-    if (!recv_all(fd, &size_be, sizeof(size_be))) return false;
+    bool ok = co_await sock.recv_all(&size_be, sizeof(size_be));
+    if (!ok) co_return false;
     uint64_t size = be64_to_host(size_be);
+    auto conf = options();
+    // the client announced less than it sends (or nothing at all); the data
+    // is already on its way, so all we can do is drop the connection
+    if (conf->max_file && size > conf->max_file) {
+        std::cout << "Upload of " << size << " bytes exceeds --max-file\n";
+        co_return false;
+    }
+    if (into && size > into_max) {
+        std::cout << "Upload of " << size << " bytes exceeds its announced size\n";
+        co_return false;
+    }
+    if (!hold.cover(size)) {
+        std::cout << "Upload of " << size << " bytes exceeds quota of " << hold.user->name << "\n";
+        co_return false;
+    }
 
-    std::ofstream out(path, std::ios::binary | std::ios::trunc);
-    if (!out) return false;
+    int fd = -1;
+    if (!into) co_await IoAwaiter{sock.loop(), io, [&] { fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644); }};
+    FdGuard out(fd);
+    if (!into && out.fd < 0) co_return false;
+    if (into) into->resize((size_t)size);
 
-    std::vector<char> buf(64 * 1024);
+    std::vector<char> buf(transfer_buffer_size(*conf));
+    FairScheduler::Flow flow;
+    bool bulk = is_bulk(*conf, size);
+    RateWatchdog watchdog(sock, limiter, conf->min_rate);
     uint64_t left = size;
     while (left > 0) {
         size_t chunk = (size_t)std::min<uint64_t>(buf.size(), left);
-        if (!recv_all(fd, buf.data(), chunk)) return false;
-        xor_in_place(buf, chunk);
-        out.write(buf.data(), (std::streamsize)chunk);
+        if (bulk) co_await fair_sched->grant(flow, chunk);
+        ok = co_await sock.recv_all(buf.data(), chunk);
+        if (!ok) co_return false;
+        co_await CipherAwaiter{sock.loop(), buf.data(), chunk, conf->buffer_size};
+        bool written = false;
+        uint64_t pos = size - left;
+        if (into) {
+            std::memcpy(&(*into)[(size_t)pos], buf.data(), chunk);
+            written = true;
+        } else {
+            co_await IoAwaiter{sock.loop(), io, [&] { written = pwrite(out.fd, buf.data(), chunk, (off_t)pos) == (ssize_t)chunk; }};
+        }
+        if (!written) co_return false;
+        watchdog.moved(chunk);
+        if (limiter.limited()) co_await throttle(sock, limiter, chunk);
         left -= chunk;
     }
+    co_return true;
+}
+
+// ---- swarm mode ----
+// With --swarm on, clients that SWARM JOIN a file fetch its chunks from each
+// other as the tracker directs (swarm_tracker.hpp, protocol in swarm.hpp);
+// the server serves a chunk with GETRANGE only when no peer has it yet.
+static SwarmTracker swarm_tracker;
+static std::atomic<uint64_t> next_session_id{1};   // sessions that joined a swarm or push
+
+// Address peers reach a client at: the session's address without the port.
+static std::string peer_host(const std::string& peer) {
+    std::string p = peer.rfind("udp:", 0) == 0 ? peer.substr(4) : peer;
+    if (p == "unix") return "localhost";
+    if (!p.empty() && p.front() == '[') return p.substr(1, p.find(']') - 1);
+    return p.substr(0, p.rfind(':'));
+}
+
+// Blocking disk I/O: runs on the file's I/O queue.
+static bool hash_chunk(const std::string& path, uint64_t offset, uint64_t length, uint64_t& hash) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    std::vector<char> buf(length);
+    ssize_t n = pread(fd, buf.data(), length, (off_t)offset);
+    close(fd);
+    if (n != (ssize_t)length) return false;
+    hash = swarm::chunk_hash(buf.data(), length);
     return true;
 }
 
-void handle_client(int cfd, sockaddr_in cliaddr) {
-    char ip[64];
-    inet_ntop(AF_INET, &cliaddr.sin_addr, ip, sizeof(ip));
-    std::cout << "Client connected from " << ip << ":" << ntohs(cliaddr.sin_port) << "\n";
+// One SWARM subcommand; the reply is a single line. session is assigned on
+// the first JOIN.
+static aio::Task<bool> swarm_command(aio::AsyncSocket& sock, std::istringstream& iss, const std::string& peer,
+                                     const ServerOptions& conf, uint64_t& session) {
+    std::string sub, fname;
+    iss >> sub >> fname;
+    if (!conf.swarm) co_return co_await sock.send_line("ERR SwarmOff");
+    if (!safe_filename(fname)) co_return co_await sock.send_line("ERR BadName");
+    IoQueue* io = nullptr;
+    std::string path;
+    struct stat st{};
+    bool found = false;
+    if (sub == "JOIN" || sub == "NEXT") {
+        co_await IoAwaiter{sock.loop(), owner_io(fname), [&] {
+            path = storage.find(fname, false, &io);
+            found = !path.empty() && stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+        }};
+    }
+
+    if (sub == "JOIN") {
+        // "SWARM JOIN <name> <port> [host]"
+        int port = 0;
+        std::string host;
+        iss >> port >> host;
+        if (port < 1 || port > 65535) co_return co_await sock.send_line("ERR BadPort");
+        if (!found) co_return co_await sock.send_line("ERR NotFound");
+        if (!session) session = next_session_id++;
+        if (host.empty()) host = peer_host(peer);
+        uint64_t chunk = swarm_tracker.join(session, fname, (uint64_t)st.st_size, (int64_t)st.st_mtime,
+                                            conf.swarm_chunk, host, port);
+        std::cout << "Swarm " << fname << ": " << host << ":" << port << " joined\n";
+        co_return co_await sock.send_line("OK " + std::to_string(st.st_size) + " " + std::to_string(chunk));
+    }
+    if (sub == "NEXT") {
+        SwarmTracker::Assignment a;
+        if (!session || !swarm_tracker.next(session, fname, a)) co_return co_await sock.send_line("ERR NotJoined");
+        if (a.kind == SwarmTracker::Assignment::DONE) co_return co_await sock.send_line("DONE");
+        if (a.kind == SwarmTracker::Assignment::WAIT) co_return co_await sock.send_line("WAIT");
+        if (!a.hash_known) {
+            // first time this chunk leaves the server: remember what it must hash to
+            bool hashed = false;
+            co_await IoAwaiter{sock.loop(), io, [&] { hashed = hash_chunk(path, a.offset, a.length, a.hash); }};
+            if (!hashed) {
+                swarm_tracker.miss(session, fname, a.index);
+                co_return co_await sock.send_line("ERR NotFound");
+            }
+            swarm_tracker.set_hash(fname, a.generation, a.index, a.hash);
+        }
+        char hex[17];
+        std::snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)a.hash);
+        std::string reply = "CHUNK " + std::to_string(a.index) + " " + hex + " ";
+        reply += a.seed ? std::string("seed") : a.host + " " + std::to_string(a.port);
+        co_return co_await sock.send_line(reply);
+    }
+    if (sub == "HAVE" || sub == "MISS") {
+        uint32_t index = 0;
+        iss >> index;
+        bool known = session && (sub == "HAVE" ? swarm_tracker.have(session, fname, index)
+                                               : swarm_tracker.miss(session, fname, index));
+        co_return co_await sock.send_line(known ? "OK" : "ERR NotAssigned");
+    }
+    if (sub == "LEAVE") {
+        if (session) swarm_tracker.leave(session, fname);
+        co_return co_await sock.send_line("OK");
+    }
+    co_return co_await sock.send_line("ERR UnknownCmd");
+}
+
+// ---- multicast push ----
+// With --push-group, PUSH SEND streams a file once to that multicast group
+// for every session that sent PUSH SUB, and repairs what they NACK
+// (push.hpp). Each push runs on its own thread; sessions only hand it NACKs.
+static std::mutex push_mu;
+static std::set<uint64_t> push_subscribers;
+static std::map<uint32_t, std::shared_ptr<push::Sender>> active_pushes;
+static uint32_t next_push_id = (uint32_t)time(nullptr);   // receivers ignore older pushes' packets
+
+static void push_unsubscribe(uint64_t session) {
+    std::lock_guard<std::mutex> lock(push_mu);
+    push_subscribers.erase(session);
+    for (auto& [id, sender] : active_pushes) sender->gone(session);
+}
+
+static std::shared_ptr<push::Sender> find_push(uint32_t id) {
+    std::lock_guard<std::mutex> lock(push_mu);
+    auto it = active_pushes.find(id);
+    return it == active_pushes.end() ? nullptr : it->second;
+}
+
+static aio::Task<bool> push_command(aio::AsyncSocket& sock, std::istringstream& iss, const ServerOptions& conf,
+                                    uint64_t& session) {
+    std::string sub;
+    iss >> sub;
+    push::Group group;
+    if (!push::parse_group(conf.push_group, group)) co_return co_await sock.send_line("ERR PushOff");
+    if (sub == "SUB") {
+        if (!session) session = next_session_id++;
+        {
+            std::lock_guard<std::mutex> lock(push_mu);
+            push_subscribers.insert(session);
+        }
+        std::string reply = "OK " + group.addr + " " + std::to_string(group.port) + " " +
+                            (conf.push_iface.empty() ? "-" : conf.push_iface);
+        co_return co_await sock.send_line(reply);
+    }
+    if (sub == "SEND") {
+        std::string fname;
+        iss >> fname;
+        if (!safe_filename(fname)) co_return co_await sock.send_line("ERR BadName");
+        std::string path;
+        bool found = false;
+        std::shared_ptr<push::Sender> sender;
+        // the lookup and Sender::open() touch the disk: on the file's queue
+        co_await IoAwaiter{sock.loop(), owner_io(fname), [&] {
+            path = storage.find(fname, false);
+            struct stat st{};
+            found = !path.empty() && stat(path.c_str(), &st) == 0;
+            if (!found) return;
+            std::lock_guard<std::mutex> lock(push_mu);
+            sender = std::make_shared<push::Sender>(next_push_id++, fname, path, conf.push_rate);
+            if (sender->open(group, conf.push_iface, conf.push_ttl)) {
+                for (uint64_t s : push_subscribers) sender->expect(s);
+                active_pushes[sender->id()] = sender;
+            } else {
+                sender.reset();
+            }
+        }};
+        if (!found) co_return co_await sock.send_line("ERR NotFound");
+        if (!sender) co_return co_await sock.send_line("ERR PushFailed");
+        std::cout << "Push " << sender->id() << ": " << fname << " to " << sender->receivers() << " subscribers\n";
+        std::thread([sender] {
+            auto start = std::chrono::steady_clock::now();
+            bool ok = sender->run();
+            double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            std::cout << "Push " << sender->id() << (ok ? " finished" : " failed") << " in " << secs << " s: "
+                      << sender->packets() << " packets, " << sender->repaired() << " repaired, "
+                      << sender->receivers_done() << "/" << sender->receivers() << " receivers done\n";
+            std::lock_guard<std::mutex> lock(push_mu);
+            active_pushes.erase(sender->id());
+        }).detach();
+        std::string reply = "OK " + std::to_string(sender->id());
+        co_return co_await sock.send_line(reply);
+    }
+    if (sub == "NACK" || sub == "DONE") {
+        uint32_t id = 0;
+        std::string ranges;
+        iss >> id >> ranges;
+        auto sender = find_push(id);
+        if (!sender) co_return co_await sock.send_line("ERR NoPush");
+        if (sub == "DONE") {
+            if (session) sender->done(session);
+            co_return co_await sock.send_line("OK");
+        }
+        std::set<uint32_t> seqs;
+        if (!push::parse_ranges(ranges, sender->packets(), seqs)) co_return co_await sock.send_line("ERR BadRange");
+        sender->nack(seqs);
+        co_return co_await sock.send_line("OK");
+    }
+    co_return co_await sock.send_line("ERR UnknownCmd");
+}
+
+// ---- sessions ----
+// Each client is a coroutine on an event loop. While it waits for the next
+// command it costs one small chain of coroutine frames instead of a thread.
+static std::atomic<size_t> active_sessions{0};   // running handle_client()
+static std::atomic<size_t> admitted_sessions{0}; // running + waiting in the pool queue
+
+static std::string session_stats() {
+    std::ostringstream oss;
+    size_t n = active_sessions.load(std::memory_order_relaxed);
+    size_t bytes = aio::FrameStats::bytes.load(std::memory_order_relaxed);
+    oss << "sessions: " << n << ", coroutine frames: " << bytes << " bytes";
+    if (n > 0) oss << " (~" << bytes / n << " per session)";
+    if (cipher_pool) oss << ", cipher steals: " << cipher_pool->steals();
+    return oss.str();
+}
+
+
+// ---- bandwidth shaping ----
+// --rate-global, all sessions; a reload changes its rate in place, for
+// running sessions too (each holds it even while it is unlimited)
+static const auto global_bucket = std::make_shared<TokenBucket>();
+
+// Global, per-user (users.txt rate=) and per-connection (--rate-conn) buckets.
+// The tightest rate is also handed to the kernel as SO_MAX_PACING_RATE so the
+// socket paces packets instead of bursting a whole chunk at once.
+static void setup_rate_limits(int fd, const UserInfo& account, uint64_t rate_conn, RateLimiter& limiter) {
+    limiter.add(global_bucket);
+    limiter.add(user_bucket(account.name, account.rate));
+    if (rate_conn > 0) limiter.add(std::make_shared<TokenBucket>(rate_conn));
+
+    uint64_t pace = limiter.tightest_rate();
+    if (pace > 0) {
+        unsigned int rate = (unsigned int)std::min<uint64_t>(pace, 0xFFFFFFFEu);
+        setsockopt(fd, SOL_SOCKET, SO_MAX_PACING_RATE, &rate, sizeof(rate));  // best effort
+    }
+}
+
+// ---- graceful drain ----
+// On SIGINT/SIGTERM or a hot upgrade the server stops accepting at once, lets
+// running transfers finish, and after a short grace (for commands already in
+// flight) ends sessions that sit between commands. Every event loop registers
+// here so the drain can reach it.
+static std::atomic<bool> draining{false};
+static const auto DRAIN_IDLE_GRACE = std::chrono::seconds(2);
+
+struct Reactor {
+    Reactor(aio::EventLoop& l, std::vector<int> lfds) : loop(&l), listen_fds(std::move(lfds)) {}
+
+    aio::EventLoop* loop;
+    std::vector<int> listen_fds;     // empty for pool workers
+    int inbox_fd = -1;               // eventfd: UDP streams waiting in inbox
+    std::mutex inbox_mu;
+    std::vector<std::pair<int, sockaddr_storage>> inbox;
+    std::unordered_set<int> idle;    // sessions waiting for a command
+    bool closing_idle = false;       // grace is over: idle sessions end
+    aio::TimerWheel::Timer grace{[this] {
+        closing_idle = true;
+        for (int fd : idle) loop->cancel(fd);
+    }};
+};
+
+static std::mutex reactors_mu;
+static std::vector<Reactor*> reactors;
+static thread_local Reactor* this_reactor = nullptr;
+
+class ReactorRegistration {
+public:
+    explicit ReactorRegistration(Reactor& r) : r_(r) {
+        std::lock_guard<std::mutex> lk(reactors_mu);
+        reactors.push_back(&r_);
+        this_reactor = &r_;
+    }
+    ~ReactorRegistration() {
+        std::lock_guard<std::mutex> lk(reactors_mu);
+        reactors.erase(std::find(reactors.begin(), reactors.end(), &r_));
+        this_reactor = nullptr;
+    }
+
+private:
+    Reactor& r_;
+};
+
+// While a session waits for its next command a drain may cancel the wait.
+struct IdleMark {
+    int fd;
+    explicit IdleMark(int fd) : fd(fd) { if (this_reactor) this_reactor->idle.insert(fd); }
+    ~IdleMark() { if (this_reactor) this_reactor->idle.erase(fd); }
+};
+
+// ---- replication ----
+// Committed PUTs go into change_log; a server started with --follow mirrors
+// another one by reading its log with REPL CHANGES and fetching the files with
+// GETRANGE (replica.hpp). What a follower applies goes into its own log, so
+// followers can be chained.
+static replica::ChangeLog change_log;
+static std::unique_ptr<replica::Follower> follower;
+static const size_t REPL_BATCH = 1000;   // changes per reply
+static const int REPL_MAX_WAIT_MS = 30000;
+
+// A committed change, for followers and, with --meta on, the metadata store.
+// Writes the store (which now and then flushes a segment with fsync), so a
+// session calls it on the shard's IoQueue, not on its event loop.
+static void record_change(bool upload, const std::string& name, const MetaStore::Record& r) {
+    change_log.record(upload, name, r.size, r.mtime, options()->repl_backlog);
+    if (MetaStore* meta = storage.meta()) meta->put(upload, name, r);
+}
+
+// A file just put in place at path, in its owner's shard.
+static void record_change(bool upload, const std::string& path, const std::string& name,
+                          const std::string& owner = "") {
+    MetaStore::Record r;
+    if (!replica::stat_file(path, r.size, r.mtime)) return;
+    r.owner = owner;
+    r.shard = (uint32_t)storage.owner(name);
+    record_change(upload, name, r);
+}
+
+// A small upload just packed (Storage::put_packed()); hashed while it is in
+// memory anyway, when there is a metadata store to keep the hash.
+static MetaStore::Record packed_record(const std::string& name, const std::string& data, int64_t mtime,
+                                       const std::string& owner) {
+    MetaStore::Record r;
+    r.size = data.size();
+    r.mtime = mtime;
+    if (storage.meta()) r.hash = swarm::chunk_hash(data.data(), data.size());
+    r.owner = owner;
+    r.shard = (uint32_t)storage.owner(name);
+    r.packed = true;
+    return r;
+}
+
+// The --repl-user account: followers, which may list and read every upload.
+static bool is_repl_user(const ServerOptions& conf, const UserInfo& account) {
+    return !conf.repl_user.empty() && account.name == conf.repl_user;
+}
+
+// "REPL CHANGES <epoch> <after> <wait_ms>": waits up to wait_ms for a change
+// after `after`, then replies with the changes or the first page of a RESET
+// snapshot; "REPL SNAPSHOT <epoch> <last> <dir> <name>" sends the page after
+// that file. Only the --repl-user account may do this.
+static aio::Task<bool> repl_command(aio::AsyncSocket& sock, std::istringstream& iss, const ServerOptions& conf,
+                                    const UserInfo& account) {
+    std::string sub, dir;
+    uint64_t epoch = 0, after = 0, last = 0;
+    int wait_ms = 0;
+    replica::Cursor from;
+    iss >> sub;
+    if (sub == "CHANGES") iss >> epoch >> after >> wait_ms;
+    else if (sub == "SNAPSHOT") iss >> epoch >> last >> dir >> from.name;
+    bool bad = !iss || (sub != "CHANGES" && sub != "SNAPSHOT") || (sub == "SNAPSHOT" && dir != "root" && dir != "uploads");
+    if (bad) co_return co_await sock.send_line("ERR BadRequest");
+    if (!is_repl_user(conf, account)) co_return co_await sock.send_line("ERR NotAllowed");
+    from.upload = dir == "uploads";
+    // a restart in the middle of a RESET: the follower starts over
+    if (sub == "SNAPSHOT" && epoch != change_log.epoch()) co_return co_await sock.send_line("ERR Resync");
+    wait_ms = std::clamp(wait_ms, 0, REPL_MAX_WAIT_MS);
+    for (int waited = 0; waited < wait_ms && epoch == change_log.epoch() && change_log.last() <= after && !draining;
+         waited += 50)
+        co_await sock.loop().sleep_for(std::chrono::milliseconds(50));
+
+    std::vector<replica::Change> changes;
+    std::string kind = "OK";
+    replica::Cursor next;
+    if (sub == "CHANGES") last = change_log.last();
+    if (sub == "SNAPSHOT" || !change_log.since(epoch, after, REPL_BATCH, changes)) {
+        kind = "RESET";
+        // walks every directory: off the event loop, on the first shard's queue
+        co_await IoAwaiter{sock.loop(), storage.shards()[0].io,
+                           [&] { changes = replica::snapshot(storage, last, from, REPL_BATCH, next); }};
+    }
+    std::string head = kind + " " + std::to_string(change_log.epoch()) + " " + std::to_string(last) + " " +
+                       std::to_string(changes.size());
+    if (!next.name.empty()) head += (next.upload ? " uploads " : " root ") + next.name;
+    std::string body = replica::format_changes(changes);
+    bool ok = co_await sock.send_line(head);
+    if (ok) ok = co_await sock.send_line(body);
+    co_return ok;
+}
+
+static void start_follower(const ServerOptions& o) {
+    proto::Endpoint ep;
+    proto::parse_endpoint(o.follow, ep);   // checked by apply_option
+    replica::FollowConfig c;
+    c.host = ep.is_unix ? "unix:" + ep.path : ep.is_udp ? "udp:" + ep.host : ep.host;
+    c.port = ep.port;
+    c.user = o.follow_user;
+    c.password = o.follow_password;
+    c.state_dir = storage.shards()[0].upload;
+    c.place = [](bool upload, const std::string& name) { return storage.place(name, upload); };
+    c.parallel = o.follow_parallel;
+    c.chunk = o.follow_chunk;
+    c.on_apply = [](const replica::Change& ch) {
+        if (ch.upload) storage.drop_packed(ch.name);   // replaced by the file just placed
+        record_change(ch.upload, storage.place(ch.name, ch.upload), ch.name);
+    };
+    follower = std::make_unique<replica::Follower>(c);
+    follower->start();
+}
+
+// ---- cluster mode ----
+// With --cluster this node stores only the names it owns (cluster.hpp).
+// membership follows the node list of the current settings; when a reload
+// changes it, a handoff moves the files that now belong elsewhere.
+static Published<cluster::Membership> membership{std::make_shared<const cluster::Membership>()};
+static std::unique_ptr<cluster::Handoff> handoff;   // control thread only
+
+static void update_cluster(const ServerOptions& o) {
+    if (membership.load()->nodes() == o.cluster) return;
+    if (!o.cluster.empty() && std::find(o.cluster.begin(), o.cluster.end(), o.cluster_self) == o.cluster.end()) {
+        // cluster-self kept its startup value on a reload
+        std::cerr << "Cluster: " << o.cluster_self << " is not in the new node list, keeping the old one\n";
+        return;
+    }
+    auto next = std::make_shared<const cluster::Membership>(o.cluster, o.cluster_self);
+    membership.store(next);
+    if (handoff) handoff->stop();
+    handoff.reset();
+    if (!next->enabled()) return;
+    std::cout << "Cluster: node " << o.cluster_self << " of " << o.cluster.size() << "\n";
+    handoff = std::make_unique<cluster::Handoff>(storage, next, o.cluster_user, o.cluster_password);
+    handoff->start();
+}
+
+// "CLUSTER TAKE <root|uploads> <name> <mtime_ns> [size]": another node hands
+// over a file this one owns now. The file follows as in PUT; the second OK
+// tells the sender it may delete its copy. Only the --cluster-user account
+// may do this. A small upload of announced size goes into a pack.
+static aio::Task<bool> cluster_command(aio::AsyncSocket& sock, std::istringstream& iss, const ServerOptions& conf,
+                                       const UserInfo& account, UserUsage* usage, RateLimiter& limiter,
+                                       aio::TimerWheel::Timer& deadline) {
+    std::string sub, dir, fname;
+    int64_t mtime = 0;
+    iss >> sub >> dir >> fname >> mtime;
+    if (sub != "TAKE" || !iss || (dir != "root" && dir != "uploads")) co_return co_await sock.send_line("ERR BadRequest");
+    if (conf.cluster.empty() || account.name != conf.cluster_user) co_return co_await sock.send_line("ERR NotAllowed");
+    if (!safe_filename(fname)) co_return co_await sock.send_line("ERR BadName");
+    auto mem = membership.load();
+    if (!mem->owns(fname)) {
+        std::string reply = "ERR WrongNode " + mem->owner(fname);
+        co_return co_await sock.send_line(reply);
+    }
+
+    uint64_t size = 0;
+    bool upload = dir == "uploads";
+    bool small = upload && (iss >> size) && conf.pack_small && size <= conf.pack_small;
+    IoQueue* io = nullptr;
+    std::string path = storage.place(fname, upload, &io);
+    std::string part = path + ".part" + std::to_string(part_seq.fetch_add(1));
+    std::string data;
+    co_await sock.send_line("OK");
+    sock.loop().wheel().cancel(deadline);
+    QuotaHold hold(usage, 0);   // billed on the node it was uploaded to
+    bool ok = co_await recv_file_encrypted(sock, part, io, limiter, hold, small ? &data : nullptr, size);
+    if (!ok) {
+        co_await IoAwaiter{sock.loop(), io, [&] { unlink(part.c_str()); }};
+        co_return false;
+    }
+    // a copy already here that is at least as new wins
+    Storage::Opened existing;
+    bool newer_here = false;
+    co_await IoAwaiter{sock.loop(), io, [&] {
+        newer_here = storage.open_file(fname, upload, existing) && existing.mtime >= mtime;
+        if (existing.fd >= 0) close(existing.fd);
+        if (newer_here) unlink(part.c_str());
+    }};
+    if (newer_here) {
+        co_return co_await sock.send_line("OK");
+    }
+    bool stored = false;
+    if (small) {
+        co_await IoAwaiter{sock.loop(), io, [&] {
+            stored = storage.put_packed(fname, data, mtime);
+            if (stored) record_change(true, fname, packed_record(fname, data, mtime, ""));
+        }};
+    } else {
+        timespec times[2] = {{0, UTIME_OMIT}, {(time_t)(mtime / 1000000000), (long)(mtime % 1000000000)}};
+        co_await IoAwaiter{sock.loop(), io, [&] {
+            stored = utimensat(AT_FDCWD, part.c_str(), times, 0) == 0 && std::rename(part.c_str(), path.c_str()) == 0;
+            if (stored && upload) storage.drop_packed(fname);
+            if (stored) record_change(upload, path, fname);
+        }};
+    }
+    if (!stored) {
+        co_await IoAwaiter{sock.loop(), io, [&] { unlink(part.c_str()); }};
+        co_return co_await sock.send_line("ERR WriteFailed");
+    }
+    co_return co_await sock.send_line("OK");
+}
+
+// ---- message limits ----
+// A command line is read into a buffer reserved once per session with
+// --max-line bytes; a longer length prefix is refused before anything is
+// allocated, so a session never holds more than that plus one transfer buffer.
+static aio::Task<bool> recv_command(aio::AsyncSocket& sock, std::string& line, size_t max_line) {
+    if (this_reactor && this_reactor->closing_idle) co_return false;
+    IdleMark idle(sock.fd());
+    bool ok = co_await sock.recv_line(line, max_line);
+    if (!ok && errno == EMSGSIZE) {
+        std::cout << "Dropping client: command longer than " << max_line << " bytes\n";
+        co_await sock.send_line("ERR LineTooLong");   // the rest is unread, so no way to resync
+    }
+    co_return ok;
+}
+
+// local: the client is on this host (AF_UNIX listener), so GETFD may pass it
+// a file descriptor
+aio::Task<void> handle_client(aio::AsyncSocket sock, std::string peer, bool local) {
+    ++active_sessions;
+    std::cout << "Client connected from " << peer << " (" << session_stats() << ")\n";
+    auto conf = options();
 
     // 1) AUTH
     // Expect: "AUTH <user> <pass>"
+    // one timer, re-armed for whatever the session is waiting for
+    const char* waiting_for = "auth timeout";
+    aio::TimerWheel::Timer deadline([fd = sock.fd(), &waiting_for] { expire_connection(fd, waiting_for); });
+    if (conf->auth_timeout > 0) sock.loop().wheel().schedule(deadline, std::chrono::seconds(conf->auth_timeout));
+
     std::string line;
-    if (!recv_line(cfd, line)) { close(cfd); return; }
+    line.reserve(conf->max_line);
+    bool ok = co_await recv_command(sock, line, conf->max_line);
+    RateLimiter limiter;
+    std::optional<UserInfo> account;
+    UserUsage* usage = nullptr;
+    CounterGuard session_slot;
+    uint64_t session_id = 0;   // set by SWARM JOIN or PUSH SUB
 
-    {
+    if (ok) {
         std::istringstream iss(line);
         std::string cmd, user, pass;
         iss >> cmd >> user >> pass;
-        if (cmd != "AUTH" || user.empty() || pass.empty() || !check_auth(user, pass)) {
-            send_line(cfd, "AUTH_FAIL");
-            close(cfd);
+        if (cmd == "AUTH" && !user.empty() && !pass.empty()) account = check_auth(conf->users_file, user, pass);
+        if (account) usage = usage_table.get(account->name);
+        if (!account) {
+            co_await sock.send_line("AUTH_FAIL");
             std::cout << "Auth failed for client.\n";
-            return;
+            ok = false;
+        } else if (!usage) {
+            co_await sock.send_line("AUTH_FAIL TooManyUsers");
+            std::cout << "Auth refused for " << user << ": usage table full\n";
+            ok = false;
+        } else if (!try_acquire(usage->sessions, account->max_sessions)) {
+            co_await sock.send_line("AUTH_FAIL TooManySessions");
+            std::cout << "Auth refused for " << user << ": " << account->max_sessions << " sessions open\n";
+            ok = false;
+        } else {
+            session_slot = CounterGuard(&usage->sessions);
+            setup_rate_limits(sock.fd(), *account, conf->rate_conn, limiter);
+            ok = co_await sock.send_line("AUTH_OK");
+            std::cout << "Auth OK for user: " << user << "\n";
         }
-        send_line(cfd, "AUTH_OK");
-        std::cout << "Auth OK for user: " << user << "\n";
     }
 
     // Command loop
-    while (true) {
-        if (!recv_line(cfd, line)) break;
+    // the idle deadline also covers sending the reply; only file transfers
+    // trade it for their RateWatchdog
+    waiting_for = "idle timeout";
+    while (ok) {
+        if (conf->idle_timeout > 0) sock.loop().wheel().schedule(deadline, std::chrono::seconds(conf->idle_timeout));
+        else sock.loop().wheel().cancel(deadline);
+        ok = co_await recv_command(sock, line, conf->max_line);
+        if (!ok) break;
         std::istringstream iss(line);
         std::string cmd;
         iss >> cmd;
 
         if (cmd == "LIST") {
-            auto data = list_files();
-            send_line(cfd, "OK");
-            send_line(cfd, data); // newline-separated list
+            std::string data = co_await list_files(sock.loop());
+            co_await sock.send_line("OK");
+            ok = co_await sock.send_line(data); // newline-separated list
         }
         else if (cmd == "GET") {
             std::string fname; iss >> fname;
-            if (!safe_filename(fname)) { send_line(cfd, "ERR BadName"); continue; }
-            std::string path = ROOT_DIR + "/" + fname;
-            std::ifstream test(path, std::ios::binary);
-            if (!test.good()) { send_line(cfd, "ERR NotFound"); continue; }
-            send_line(cfd, "OK");
-            if (!send_file_encrypted(cfd, path)) { break; }
+            if (!safe_filename(fname)) { ok = co_await sock.send_line("ERR BadName"); continue; }
+            Storage::Opened file;
+            bool found = false;
+            co_await IoAwaiter{sock.loop(), owner_io(fname), [&] { found = storage.open_file(fname, false, file); }};
+            if (!found) { ok = co_await sock.send_line("ERR NotFound"); continue; }
+            FdGuard in(file.fd);
+            if (!try_acquire(usage->transfers, account->max_transfers)) {
+                ok = co_await sock.send_line("ERR TooManyTransfers");
+                continue;
+            }
+            CounterGuard transfer(&usage->transfers);
+            co_await sock.send_line("OK");
+            sock.loop().wheel().cancel(deadline);
+            ok = co_await send_file_encrypted(sock, file, limiter);
+        }
+        else if (cmd == "GETRANGE") {
+            // "GETRANGE <name> <offset> <length> [uploads]": part of a file,
+            // framed as for GET (swarm chunks, replication); "uploads" reads
+            // from the upload directory, for the --repl-user account only
+            std::string fname, dir; uint64_t offset = 0, length = 0;
+            bool parsed = (bool)(iss >> fname >> offset >> length);
+            bool uploads = parsed && (iss >> dir) && dir == "uploads";
+            if (!safe_filename(fname)) { ok = co_await sock.send_line("ERR BadName"); continue; }
+            if (uploads && !is_repl_user(*conf, *account)) { ok = co_await sock.send_line("ERR NotAllowed"); continue; }
+            Storage::Opened file;
+            bool found = false;
+            co_await IoAwaiter{sock.loop(), owner_io(fname), [&] { found = storage.open_file(fname, uploads, file); }};
+            if (!found) { ok = co_await sock.send_line("ERR NotFound"); continue; }
+            FdGuard in(file.fd);
+            if (!parsed || offset > file.size || length > file.size - offset) {
+                ok = co_await sock.send_line("ERR BadRange");
+                continue;
+            }
+            if (!try_acquire(usage->transfers, account->max_transfers)) {
+                ok = co_await sock.send_line("ERR TooManyTransfers");
+                continue;
+            }
+            CounterGuard transfer(&usage->transfers);
+            co_await sock.send_line("OK");
+            sock.loop().wheel().cancel(deadline);
+            ok = co_await send_file_encrypted(sock, file, limiter, offset, length);
+        }
+        else if (cmd == "STAT") {
+            // "STAT <name> [uploads]": "OK <size> <mtime_ns> <hash> <owner|->
+            // <shard> <file|packed>", hash 0 when not known. Uploads are
+            // private: others' look like missing files, except to --repl-user
+            std::string fname, dir;
+            iss >> fname >> dir;
+            if (!safe_filename(fname)) { ok = co_await sock.send_line("ERR BadName"); continue; }
+            bool uploads = dir == "uploads";
+            MetaStore::Record r;
+            bool found = false;
+            co_await IoAwaiter{sock.loop(), owner_io(fname), [&] { found = file_info(fname, uploads, r); }};
+            // the usage table knows the owner of every upload, --meta or not
+            if (found && uploads && r.owner.empty()) r.owner = usage_table.owner(fname);
+            if (found && uploads && r.owner != account->name && !is_repl_user(*conf, *account)) found = false;
+            if (!found) { ok = co_await sock.send_line("ERR NotFound"); continue; }
+            std::string reply = "OK " + std::to_string(r.size) + " " + std::to_string(r.mtime) + " " +
+                                std::to_string(r.hash) + " " + (r.owner.empty() ? "-" : r.owner) + " " +
+                                std::to_string(r.shard) + (r.packed ? " packed" : " file");
+            ok = co_await sock.send_line(reply);
+        }
+        else if (cmd == "SWARM") {
+            ok = co_await swarm_command(sock, iss, peer, *conf, session_id);
+        }
+        else if (cmd == "PUSH") {
+            ok = co_await push_command(sock, iss, *conf, session_id);
+        }
+        else if (cmd == "REPL") {
+            ok = co_await repl_command(sock, iss, *conf, *account);
+        }
+        else if (cmd == "CLUSTER") {
+            ok = co_await cluster_command(sock, iss, *conf, *account, usage, limiter, deadline);
+        }
+        else if (cmd == "GETFD") {
+            // same-host fast path: the client gets a read-only descriptor and
+            // copies (or maps) the file itself; nothing crosses the socket
+            std::string fname; iss >> fname;
+            if (!safe_filename(fname)) { ok = co_await sock.send_line("ERR BadName"); continue; }
+            if (!local) { ok = co_await sock.send_line("ERR NotLocal"); continue; }
+            int fd = -1;
+            struct stat st{};
+            co_await IoAwaiter{sock.loop(), owner_io(fname), [&] {
+                std::string path = storage.find(fname, false);
+                fd = path.empty() ? -1 : open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+                if (fd >= 0 && (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))) { close(fd); fd = -1; }
+            }};
+            if (fd < 0) { ok = co_await sock.send_line("ERR NotFound"); continue; }
+            FdGuard in(fd);
+            // counted like a GET while it is handed over; the copy itself is
+            // the client's, so no rate limit applies to it
+            if (!try_acquire(usage->transfers, account->max_transfers)) {
+                ok = co_await sock.send_line("ERR TooManyTransfers");
+                continue;
+            }
+            CounterGuard transfer(&usage->transfers);
+            std::string reply = "OK " + std::to_string((uint64_t)st.st_size);
+            ok = co_await sock.send_line_fd(reply, fd);
+            std::cout << "Passed " << fname << " (" << st.st_size << " bytes) to " << peer << " as a descriptor\n";
         }
         else if (cmd == "PUT") {
+            // "PUT <name> [size]": with the size, quota is checked up front
             std::string fname; iss >> fname;
-            if (!safe_filename(fname)) { send_line(cfd, "ERR BadName"); continue; }
-            std::string path = UPLOAD_DIR + "/" + fname;
-            send_line(cfd, "OK");
-            if (!recv_file_encrypted(cfd, path)) { break; }
+            uint64_t announced = 0;
+            bool has_size = (bool)(iss >> announced);
+            if (!safe_filename(fname)) { ok = co_await sock.send_line("ERR BadName"); continue; }
+            // a follower only takes changes from its leader
+            if (!conf->follow.empty()) { ok = co_await sock.send_line("ERR ReadOnly"); continue; }
+            auto mem = membership.load();
+            if (!mem->owns(fname)) {
+                std::string reply = "ERR WrongNode " + mem->owner(fname);
+                ok = co_await sock.send_line(reply);
+                continue;
+            }
+            if (has_size && conf->max_file && announced > conf->max_file) { ok = co_await sock.send_line("ERR TooLarge"); continue; }
+            if (!try_acquire(usage->transfers, account->max_transfers)) {
+                ok = co_await sock.send_line("ERR TooManyTransfers");
+                continue;
+            }
+            CounterGuard transfer(&usage->transfers);
+            QuotaHold hold(usage, account->quota);
+            if (has_size && !hold.cover(announced)) { ok = co_await sock.send_line("ERR QuotaExceeded"); continue; }
+
+            // receive into a temp file so a failed upload never replaces
+            // (or is billed like) a complete one
+            IoQueue* io = nullptr;
+            std::string path = storage.place(fname, true, &io);
+            if (conf->pack_small && has_size && announced <= conf->pack_small) {
+                // small: into memory, then appended to a pack in one write
+                std::string data;
+                co_await sock.send_line("OK");
+                sock.loop().wheel().cancel(deadline);
+                ok = co_await recv_file_encrypted(sock, path, io, limiter, hold, &data, announced);
+                bool stored = false;
+                int64_t mtime = 0;   // now
+                if (ok) co_await IoAwaiter{sock.loop(), io, [&] {
+                    stored = storage.put_packed(fname, data, mtime);
+                    if (stored) record_change(true, fname, packed_record(fname, data, mtime, account->name));
+                }};
+                if (stored) {
+                    usage_table.commit_upload(usage, fname, hold.held);
+                    hold.held = 0;
+                }
+                continue;
+            }
+            std::string part = path + ".part" + std::to_string(part_seq.fetch_add(1));
+            co_await sock.send_line("OK");
+            sock.loop().wheel().cancel(deadline);
+            ok = co_await recv_file_encrypted(sock, part, io, limiter, hold);
+            bool stored = false;
+            if (ok) co_await IoAwaiter{sock.loop(), io, [&] {
+                stored = std::rename(part.c_str(), path.c_str()) == 0;
+                if (stored) {
+                    storage.drop_packed(fname);
+                    record_change(true, path, fname, account->name);
+                }
+            }};
+            if (stored) {
+                usage_table.commit_upload(usage, fname, hold.held);
+                hold.held = 0;
+            } else {
+                co_await IoAwaiter{sock.loop(), io, [&] { unlink(part.c_str()); }};
+            }
         }
         else if (cmd == "QUIT") {
-            send_line(cfd, "BYE");
+            co_await sock.send_line("BYE");
             break;
         }
         else {
-            send_line(cfd, "ERR UnknownCmd");
+            ok = co_await sock.send_line("ERR UnknownCmd");
         }
     }
 
+    if (session_id) {
+        swarm_tracker.leave_all(session_id);
+        push_unsubscribe(session_id);
+    }
+    sock.close();
+    --active_sessions;
+    --admitted_sessions;
+    std::cout << "Client disconnected (" << session_stats() << ").\n";
+}
+
+// ---- admission control ----
+
+// Reject a connection that is over capacity with a one-line reply instead of
+// leaving it in the listen backlog.
+static void reject_busy(int cfd) {
+    send_line(cfd, "BUSY retry-after " + std::to_string(options()->retry_after));
     close(cfd);
-    std::cout << "Client disconnected.\n";
+    std::cout << "Rejected client: server busy (" << admitted_sessions.load() << " sessions).\n";
 }
 
-int main() {
-    std::signal(SIGINT, handle_sigint);
-    if (!ensure_dirs()) {
-        std::cerr << "Failed to ensure directories.\n";
-        return 1;
+static bool admit() {
+    if (admitted_sessions.fetch_add(1) < options()->max_sessions) return true;
+    --admitted_sessions;
+    return false;
+}
+
+// ---- async mode: sessions as coroutines on one or more event loops ----
+aio::Task<void> accept_loop(aio::EventLoop& loop, aio::AsyncSocket& listener) {
+    while (!draining) {
+        sockaddr_storage cli{};
+        socklen_t len = sizeof(cli);
+        int cfd = co_await listener.accept(&cli, &len);
+        if (cfd < 0 && draining) break;
+        if (cfd < 0) { perror("accept"); co_await loop.sleep_for(std::chrono::milliseconds(100)); continue; }
+        if (!admit()) { reject_busy(cfd); continue; }
+        if (cli.ss_family != AF_UNIX) {
+            int one = 1;
+            setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        }
+        loop.spawn(handle_client(aio::AsyncSocket(loop, cfd), sockaddr_name(cli), cli.ss_family == AF_UNIX));
+    }
+}
+
+// UDP streams handed to this reactor by the transport thread. Their fds are
+// AF_UNIX socketpairs, but the client is remote: no GETFD.
+aio::Task<void> udp_inbox_loop(aio::EventLoop& loop, Reactor& self) {
+    aio::AsyncSocket inbox(loop, self.inbox_fd);   // closes it on the way out
+    while (true) {
+        uint64_t n;
+        while (read(self.inbox_fd, &n, sizeof(n)) > 0) {}
+        std::vector<std::pair<int, sockaddr_storage>> streams;
+        {
+            std::lock_guard<std::mutex> lk(self.inbox_mu);
+            streams.swap(self.inbox);
+        }
+        for (auto& [fd, peer] : streams)
+            loop.spawn(handle_client(aio::AsyncSocket(loop, fd), "udp:" + sockaddr_name(peer), false));
+        if (draining) break;
+        bool ready = co_await loop.readable(self.inbox_fd);
+        if (!ready) break;
+    }
+    std::lock_guard<std::mutex> lk(self.inbox_mu);
+    self.inbox_fd = -1;   // a stream arriving from now on is turned away
+}
+
+// Transport thread: pass a new UDP stream to the next reactor.
+static std::atomic<unsigned> next_udp_reactor{0};
+static void dispatch_udp_stream(int fd, const sockaddr_storage& peer);
+static void start_udp_servers();
+
+// Each reactor accepts from its own dups of every listening socket.
+static void run_reactor(unsigned id, std::vector<int> lfds) {
+    reactor_id = id;
+    aio::EventLoop loop;
+    // the quantum follows the buffer size at startup; DRR stays fair (if a
+    // little coarser) when a reload changes the buffer size later
+    FairScheduler sched(loop, transfer_buffer_size(*options()), FAIR_ROUND_BUDGET);
+    fair_sched = &sched;   // is_bulk() checks --fair per transfer
+    std::vector<aio::AsyncSocket> listeners;
+    listeners.reserve(lfds.size());   // accept loops hold references
+    for (int fd : lfds) listeners.emplace_back(loop, fd);
+    Reactor self(loop, lfds);
+    if (!udp_fds.empty()) self.inbox_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    ReactorRegistration reg(self);
+    for (auto& l : listeners) loop.spawn(accept_loop(loop, l));
+    if (self.inbox_fd >= 0) loop.spawn(udp_inbox_loop(loop, self));
+    if (id == 0) start_udp_servers();
+    loop.run();   // returns once drained: accept loops stopped, sessions done
+}
+
+// ---- pool mode: fixed workers fed through a bounded queue ----
+struct PendingClient {
+    int fd = -1;
+    sockaddr_storage peer{};
+    bool udp = false;
+    std::chrono::steady_clock::time_point accepted;
+};
+
+// queue wait times, reported with every dequeued client
+struct QueueWaitStats {
+    std::mutex mu;
+    uint64_t count = 0;
+    double total_ms = 0;
+    double max_ms = 0;
+
+    std::string record(double ms) {
+        std::lock_guard<std::mutex> lk(mu);
+        ++count;
+        total_ms += ms;
+        max_ms = std::max(max_ms, ms);
+        std::ostringstream oss;
+        oss << "waited " << ms << " ms in queue (avg " << total_ms / count
+            << " ms, max " << max_ms << " ms over " << count << ")";
+        return oss.str();
     }
+};
 
-    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (listen_fd < 0) { perror("socket"); return 1; }
+static QueueWaitStats queue_waits;
 
-    int opt = 1;
-    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+// Each worker runs one session at a time on its own event loop.
+static void pool_worker(BoundedQueue<PendingClient>& queue, unsigned id) {
+    reactor_id = id;
+    aio::EventLoop loop;
+    Reactor self(loop, {});
+    ReactorRegistration reg(self);
+    while (auto pc = queue.pop()) {
+        auto waited = std::chrono::steady_clock::now() - pc->accepted;
+        double ms = std::chrono::duration<double, std::milli>(waited).count();
+        std::string peer = (pc->udp ? "udp:" : "") + sockaddr_name(pc->peer);
+        std::cout << "Worker picked up " << peer << ": " << queue_waits.record(ms) << "\n";
+        bool local = !pc->udp && pc->peer.ss_family == AF_UNIX;
+        loop.spawn(handle_client(aio::AsyncSocket(loop, pc->fd), peer, local));
+        loop.run();
+    }
+}
 
-    sockaddr_in addr{};
-    addr.sin_family = AF_INET;
-    addr.sin_addr.s_addr = INADDR_ANY;
-    addr.sin_port = htons(PORT);
+static int pool_wake_fd = -1;   // eventfd, interrupts the pool acceptor on drain
+static std::mutex pool_queue_mu;
+static BoundedQueue<PendingClient>* pool_queue = nullptr;   // while run_pool() runs
+
+static void dispatch_udp_stream(int fd, const sockaddr_storage& peer) {
+    if (draining || !admit()) { reject_busy(fd); return; }
+    {
+        std::lock_guard<std::mutex> lk(pool_queue_mu);
+        if (pool_queue) {
+            PendingClient pc{fd, peer, true, std::chrono::steady_clock::now()};
+            if (!pool_queue->try_push(pc)) { --admitted_sessions; reject_busy(fd); }
+            return;
+        }
+    }
+    std::lock_guard<std::mutex> lk(reactors_mu);
+    for (size_t tries = 0; tries < reactors.size(); ++tries) {
+        Reactor* r = reactors[next_udp_reactor++ % reactors.size()];
+        std::lock_guard<std::mutex> ilk(r->inbox_mu);
+        if (r->inbox_fd < 0) continue;   // stopped, or a pool worker
+        r->inbox.emplace_back(fd, peer);
+        uint64_t one = 1;
+        if (write(r->inbox_fd, &one, sizeof(one)) < 0) perror("write");
+        return;
+    }
+    --admitted_sessions;
+    reject_busy(fd);
+}
 
-    if (bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) < 0) { perror("bind"); return 1; }
-    if (listen(listen_fd, 8) < 0) { perror("listen"); return 1; }
+// One transport thread per udp: endpoint; started once sessions can be run.
+static void start_udp_servers() {
+    udp::FecConfig fec;
+    udp::parse_fec(options()->udp_fec, fec);   // checked by apply_option()
+    for (int fd : udp_fds) udp_servers.push_back(std::make_unique<udp::Server>(fd, dispatch_udp_stream, fec));
+}
 
-    std::cout << "Server listening on port " << PORT << "...\n";
+static void run_pool(const std::vector<int>& lfds) {
+    auto conf = options();
+    BoundedQueue<PendingClient> queue(conf->queue_size);
+    std::vector<std::thread> workers;
+    for (int i = 0; i < conf->workers; ++i) workers.emplace_back(pool_worker, std::ref(queue), (unsigned)i);
+    {
+        std::lock_guard<std::mutex> lk(pool_queue_mu);
+        pool_queue = &queue;
+    }
+    start_udp_servers();
 
+    // the listeners may be non-blocking (taken over from an async server),
+    // so wait in poll() and treat EAGAIN as a lost race
+    std::vector<pollfd> p;
+    for (int fd : lfds) p.push_back({fd, POLLIN, 0});
+    p.push_back({pool_wake_fd, POLLIN, 0});
+    while (!draining) {
+        if (poll(p.data(), p.size(), -1) < 0 && errno != EINTR) { perror("poll"); break; }
+        if (draining) break;
+        for (size_t i = 0; i + 1 < p.size(); ++i) {
+            if (!(p[i].revents & POLLIN)) continue;
+            PendingClient pc;
+            socklen_t len = sizeof(pc.peer);
+            pc.fd = accept4(p[i].fd, (sockaddr*)&pc.peer, &len, SOCK_CLOEXEC);
+            if (pc.fd < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) continue;
+            if (pc.fd < 0) { perror("accept"); continue; }
+            pc.accepted = std::chrono::steady_clock::now();
+            if (!admit()) { reject_busy(pc.fd); continue; }
+            if (pc.peer.ss_family != AF_UNIX) {
+                int one = 1;
+                setsockopt(pc.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            }
+            int cfd = pc.fd;
+            if (!queue.try_push(pc)) { --admitted_sessions; reject_busy(cfd); }
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lk(pool_queue_mu);
+        pool_queue = nullptr;
+    }
+    queue.close();   // queued clients are still served (and see the drain)
+    for (auto& w : workers) w.join();
+}
+
+// ---- shutdown and hot upgrade ----
+static bool handed_over = false;   // listener now belongs to a newer server
+static int takeover_conn = -1;     // new server: connection to the old one
+
+static void begin_drain() {
+    draining = true;
+    std::cout << "Draining " << active_sessions.load() << " sessions (up to "
+              << options()->drain_timeout << " s)...\n";
+    for (auto& u : udp_servers) u->stop_accepting();
+    std::lock_guard<std::mutex> lk(reactors_mu);
+    for (Reactor* r : reactors) {
+        r->loop->post([r] {
+            for (int fd : r->listen_fds) r->loop->cancel(fd);
+            if (r->inbox_fd >= 0) r->loop->cancel(r->inbox_fd);
+            r->loop->wheel().schedule(r->grace, DRAIN_IDLE_GRACE);
+        });
+    }
+    uint64_t one = 1;
+    if (pool_wake_fd >= 0 && write(pool_wake_fd, &one, sizeof(one)) < 0) perror("write");
+}
+
+// Old server: hand every listening socket to the new binary connected on c,
+// then drain once it reports READY. The usage file is saved first so the new
+// server starts from current quotas. UDP sockets go along too, but their
+// sessions end here: connection state lives in this process only.
+static bool hand_over(int c) {
+    usage_table.save(options()->usage_file);
+    std::vector<int> fds = listen_fds;
+    fds.insert(fds.end(), udp_fds.begin(), udp_fds.end());
+    if (!send_fds(c, fds, "LISTENERS " + std::to_string(fds.size()))) {
+        perror("send_fds");
+        return false;
+    }
+    pollfd p{c, POLLIN, 0};
+    char buf[8] = {};
+    if (poll(&p, 1, 10000) <= 0 || recv(c, buf, sizeof(buf) - 1, 0) != 5 || std::string(buf) != "READY") {
+        std::cerr << "Upgrade aborted: new server did not report READY\n";
+        return false;
+    }
+    for (auto& u : udp_servers) u->close_all();
+    std::cout << "Listeners handed over to the new server\n";
+    return true;
+}
+
+// New server: take the listening sockets from the server at path.
+static bool take_over_listeners(const std::string& path) {
+    takeover_conn = connect_unix(path);
+    if (takeover_conn < 0) { perror(("connect " + path).c_str()); return false; }
+    std::vector<int> fds;
+    std::string msg;
+    if (!recv_fds(takeover_conn, fds, msg) || msg != "LISTENERS " + std::to_string(fds.size())) {
+        std::cerr << "Takeover from " << path << " failed\n";
+        for (int fd : fds) close(fd);
+        return false;
+    }
+    std::cout << "Took over " << fds.size() << " listener(s) from " << path << "\n";
+    listen_fds = fds;
+    return true;
+}
+
+static void finish_shutdown() {
+    usage_table.save(options()->usage_file);
+    if (follower) follower->stop();
+    if (handoff) handoff->stop();
+    if (handed_over) return;   // the new server owns the socket paths and the stores now
+    if (!storage.checkpoint()) std::cerr << "Storage: a pack index snapshot failed; the journal is kept\n";
+    auto conf = options();
+    if (!conf->upgrade_socket.empty()) unlink(conf->upgrade_socket.c_str());
+    for (auto& path : listen_paths) unlink(path.c_str());
+}
+
+// ---- configuration reload ----
+static std::string config_path;   // --config, or DEFAULT_CONFIG if it exists
+static bool config_required = false;
+static OptionList cli_flags;      // re-applied on top of the file on every reload
+
+// SIGHUP: read the file again and publish the result. Running sessions keep
+// the snapshot they started with; the global rate limit changes at once.
+static void reload_config() {
+    ServerOptions next;
+    std::string err;
+    if (!load_options(config_path, config_required, cli_flags, next, err)) {
+        std::cerr << "Reload failed, keeping the current settings: " << err << "\n";
+        return;
+    }
+    for (auto& key : keep_startup_options(next, *options()))
+        std::cout << "Reload: " << key << " only changes on restart\n";
+    global_bucket->set_rate(next.rate_global);
+    udp::FecConfig fec;
+    udp::parse_fec(next.udp_fec, fec);
+    for (auto& u : udp_servers) u->set_fec(fec);   // new UDP connections
+    update_cluster(next);
+    check_users_file(next.users_file);
+    live_options.store(std::make_shared<const ServerOptions>(std::move(next)));
+    std::cout << "Configuration reloaded from " << config_path << "\n";
+}
+
+// Runs on its own thread: SIGINT/SIGTERM (via signalfd) start a drain, a
+// second signal or the drain deadline ends the process; SIGHUP reloads the
+// configuration; a connection on the upgrade socket hands the listener over
+// and then drains.
+static void control_loop(sigset_t sigs, int upgrade_fd) {
+    int sfd = signalfd(-1, &sigs, SFD_CLOEXEC);
+    if (sfd < 0) { perror("signalfd"); return; }
+    auto deadline = std::chrono::steady_clock::time_point::max();
     while (true) {
-        sockaddr_in cli{};
-        socklen_t len = sizeof(cli);
-        int cfd = accept(listen_fd, (sockaddr*)&cli, &len);
-        if (cfd < 0) { perror("accept"); continue; }
-        // Simple sequential handling (one client at a time).
-        handle_client(cfd, cli);
+        int timeout = -1;
+        if (draining) {
+            auto left = std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+            timeout = (int)std::max<int64_t>(0, left.count());
+        }
+        pollfd p[2] = {{sfd, POLLIN, 0}, {upgrade_fd, POLLIN, 0}};
+        int n = poll(p, upgrade_fd >= 0 ? 2 : 1, timeout);
+        if (n < 0 && errno != EINTR) { perror("poll"); return; }
+        if (n == 0 && draining) {
+            std::cout << "Drain timeout: closing " << active_sessions.load() << " sessions\n";
+            finish_shutdown();
+            std::_Exit(0);
+        }
+        if (n > 0 && (p[0].revents & POLLIN)) {
+            signalfd_siginfo si{};
+            if (read(sfd, &si, sizeof(si)) != sizeof(si)) continue;
+            if (si.ssi_signo == SIGHUP) { reload_config(); continue; }
+            if (draining) {
+                std::cout << "\nSecond signal: exiting now\n";
+                finish_shutdown();
+                std::_Exit(0);
+            }
+            std::cout << "\n" << strsignal((int)si.ssi_signo) << ": shutting down\n";
+            int drain_timeout = options()->drain_timeout;
+            if (drain_timeout == 0) { finish_shutdown(); std::_Exit(0); }
+            deadline = std::chrono::steady_clock::now() + std::chrono::seconds(drain_timeout);
+            begin_drain();
+        }
+        if (n > 0 && upgrade_fd >= 0 && (p[1].revents & POLLIN)) {
+            int c = accept4(upgrade_fd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (c < 0) continue;
+            if (!draining && hand_over(c)) {
+                // the path now belongs to the new server's upgrade socket,
+                // and the pack and metadata stores to the new server
+                handed_over = true;
+                storage.release();
+                close(upgrade_fd);
+                upgrade_fd = -1;
+                deadline = std::chrono::steady_clock::now() + std::chrono::seconds(options()->drain_timeout);
+                begin_drain();
+            }
+            close(c);
+        }
     }
 }
+
+static void usage(const char* prog) {
+    std::cerr << "Usage: " << prog << " [--config PATH] [--key value | --key=value]...\n"
+              << options_help()
+              << "Every flag can also be set in the config file as \"key = value\". RATE and SIZE\n"
+                 "take an optional K/M/G suffix, e.g. 10M; 0 disables a timeout or --min-rate.\n";
+    std::exit(1);
+}
+
+// Opens the storage (after a hot upgrade, once the old server has released
+// it) and starts its background passes.
+static bool start_storage(const ServerOptions& opts, bool takeover) {
+    if (!ensure_dirs(opts, takeover ? STORE_LOCK_WAIT_S : 0)) {
+        std::cerr << "Failed to ensure directories.\n";
+        return false;
+    }
+    if (storage.shards().size() > 1) {
+        std::cout << "Storage: " << storage.shards().size() << " shards\n";
+        // files left where an earlier set of shards put them are still found
+        // (at the cost of a few stats) until this moves them to their owners
+        std::thread([] {
+            size_t moved = storage.rebalance();
+            if (moved) std::cout << "Storage: moved " << moved << " files to their shards\n";
+        }).detach();
+    }
+    // replaced and handed-off packed uploads leave garbage in their packs
+    std::thread([] {
+        while (true) {
+            std::this_thread::sleep_for(COMPACT_INTERVAL);
+            uint64_t reclaimed = storage.compact();
+            if (reclaimed) std::cout << "Storage: compacted packs, " << reclaimed << " bytes reclaimed\n";
+        }
+    }).detach();
+    if (storage.meta()) {
+        // files changed while the server was down, or behind its back; LIST
+        // and STAT use the directories until the first pass has finished.
+        // After a clean shutdown the store already has every change the
+        // server made, so the first pass waits for --meta-rescan
+        bool trusted = storage.meta()->complete() && storage.meta()->clean();
+        std::cout << "Metadata: "
+                  << (trusted ? "serving from the store (clean shutdown, no rescan)"
+                      : storage.meta()->complete() ? "serving from the store" : "building the store")
+                  << "\n";
+        // after a hot upgrade, once more when the old server is done: what
+        // it stored while draining went to the directories only
+        int catch_up = takeover ? options()->drain_timeout + 1 : 0;
+        std::thread([trusted, catch_up] {
+            for (bool first = true;; first = false) {
+                if (!first || !trusted) {
+                    auto t0 = std::chrono::steady_clock::now();
+                    size_t changed = storage.sync_meta();
+                    auto ms =
+                        std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0);
+                    if (first || changed)
+                        std::cout << "Metadata: rescan found " << changed << " changes in " << ms.count() << " ms\n";
+                }
+                if (first && catch_up) {
+                    std::this_thread::sleep_for(std::chrono::seconds(catch_up));
+                    continue;
+                }
+                for (int waited = 0; options()->meta_rescan == 0 || waited < options()->meta_rescan; ++waited)
+                    std::this_thread::sleep_for(std::chrono::seconds(1));
+            }
+        }).detach();
+    }
+
+    return true;
+}
+
+int main(int argc, char** argv) {
+    if (!parse_command_line(argc, argv, config_path, cli_flags)) usage(argv[0]);
+    config_required = !config_path.empty();
+    if (!config_required) config_path = DEFAULT_CONFIG;
+    ServerOptions startup;
+    std::string err;
+    if (!load_options(config_path, config_required, cli_flags, startup, err)) {
+        std::cerr << err << "\n";
+        usage(argv[0]);
+    }
+    live_options.store(std::make_shared<const ServerOptions>(startup));
+    const ServerOptions& opts = startup;   // restart-only settings below
+    check_users_file(opts.users_file);
+
+    std::signal(SIGPIPE, SIG_IGN);
+    // SIGINT/SIGTERM/SIGHUP are read by the control thread; block them before
+    // any other thread starts so every thread inherits the mask
+    sigset_t sigs;
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGTERM);
+    sigaddset(&sigs, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &sigs, nullptr);
+    // a hot upgrade opens the stores once the old server has let go of them
+    if (opts.takeover.empty() && !start_storage(opts, false)) return 1;
+
+    if (!opts.takeover.empty()) {
+        if (!take_over_listeners(opts.takeover)) return 1;
+    } else {
+        std::vector<std::string> endpoints = opts.listen;
+        if (endpoints.empty()) endpoints.push_back(std::to_string(opts.port));
+        for (auto& ep : endpoints) {
+            int fd = listen_endpoint(ep);
+            if (fd < 0) { perror(("listen " + ep).c_str()); return 1; }
+            listen_fds.push_back(fd);
+            std::cout << "Listening on " << ep << "\n";
+        }
+    }
+
+    // UDP sockets (also when taken over) go to the transport, not accept()
+    std::vector<int> stream_fds;
+    for (int fd : listen_fds) {
+        int type = 0;
+        socklen_t tlen = sizeof(type);
+        getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &tlen);
+        (type == SOCK_DGRAM ? udp_fds : stream_fds).push_back(fd);
+    }
+    listen_fds = stream_fds;
+
+    // remembered now: the reactors close their listeners when they stop
+    for (int fd : listen_fds) {
+        sockaddr_un addr{};
+        socklen_t len = sizeof(addr);
+        if (getsockname(fd, (sockaddr*)&addr, &len) == 0 && addr.sun_family == AF_UNIX && addr.sun_path[0])
+            listen_paths.push_back(addr.sun_path);
+    }
+
+    std::cout << "Server running with " << listen_fds.size() + udp_fds.size() << " listener(s) (" << opts.mode << " mode, max "
+              << opts.max_sessions << " sessions)...\n";
+
+    usage_table.load(opts.usage_file);
+    usage_table.start_autosave(opts.usage_file, std::chrono::seconds(10));
+
+    global_bucket->set_rate(opts.rate_global);
+    if (opts.cipher_workers > 0) cipher_pool = std::make_unique<WorkStealingPool>(opts.cipher_workers);
+    std::cout << "Buffers per session: " << opts.max_line << " B command, "
+              << transfer_buffer_size(opts) << " B transfer (only while one runs)\n";
+
+    int upgrade_fd = -1;
+    if (!opts.upgrade_socket.empty()) {
+        upgrade_fd = listen_unix(opts.upgrade_socket);
+        if (upgrade_fd < 0) { perror(("listen " + opts.upgrade_socket).c_str()); return 1; }
+    }
+    pool_wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+    // the old server stops accepting once we report in, and then releases
+    // the stores; connections wait in the listen backlog until they are open
+    if (takeover_conn >= 0) {
+        send_all(takeover_conn, "READY", 5);
+        close(takeover_conn);
+        if (!start_storage(opts, true)) return 1;
+    }
+    if (!opts.follow.empty()) start_follower(opts);
+    update_cluster(opts);
+    std::thread(control_loop, sigs, upgrade_fd).detach();
+
+    if (opts.mode == "pool") {
+        run_pool(listen_fds);
+    } else {
+        // Sessions run as coroutines on --reactors event loops; each loop
+        // accepts from its own dups of the listening sockets.
+        std::vector<std::thread> threads;
+        for (int i = 1; i < opts.reactors; ++i) {
+            std::vector<int> dups;
+            for (int fd : listen_fds) dups.push_back(fcntl(fd, F_DUPFD_CLOEXEC, 0));
+            threads.emplace_back(run_reactor, (unsigned)i, dups);
+        }
+        run_reactor(0, listen_fds);
+        for (auto& t : threads) t.join();
+    }
+
+    std::cout << "Server drained, exiting.\n";
+    finish_shutdown();
+    return 0;
+}
@@ -0,0 +1,467 @@
+// storage.cpp (C++17)
+// Sharded file storage and per-device I/O queues (see storage.hpp).
+#include "storage.hpp"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <queue>
+#include <thread>
+#include <tuple>
+
+// ---- IoQueue ----
+
+IoQueue::IoQueue(int threads) {
+    for (int i = 0; i < std::max(threads, 1); ++i) {
+        threads_.emplace_back([this] {
+            std::unique_lock<std::mutex> lock(mu_);
+            while (true) {
+                cv_.wait(lock, [this] { return stop_ || !jobs_.empty(); });
+                if (jobs_.empty()) return;   // stopping, nothing left
+                auto job = std::move(jobs_.front());
+                jobs_.pop_front();
+                lock.unlock();
+                job();
+                lock.lock();
+            }
+        });
+    }
+}
+
+IoQueue::~IoQueue() {
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    for (auto& t : threads_) t.join();
+}
+
+void IoQueue::submit(std::function<void()> job) {
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        jobs_.push_back(std::move(job));
+    }
+    cv_.notify_one();
+}
+
+bool is_partial_upload(const std::string& name) {
+    auto p = name.rfind(".part");
+    if (p == std::string::npos || p + 5 == name.size()) return false;
+    return std::all_of(name.begin() + (long)p + 5, name.end(), [](char c) { return c >= '0' && c <= '9'; });
+}
+
+// ---- Storage ----
+
+static bool make_dir(const std::string& dir, std::string& err) {
+    if (mkdir(dir.c_str(), 0755) == 0 || errno == EEXIST) return true;
+    err = "cannot create " + dir + ": " + std::strerror(errno);
+    return false;
+}
+
+// An exclusive lock on dir/.lock, retried for up to wait seconds; -1 (err
+// set) if another process keeps it.
+static int lock_dir(const std::string& dir, int wait, std::string& err) {
+    std::string path = dir + "/.lock";
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        err = "cannot open " + path + ": " + std::strerror(errno);
+        return -1;
+    }
+    for (int tries = 0;; ++tries) {
+        if (flock(fd, LOCK_EX | LOCK_NB) == 0) return fd;
+        if (errno != EWOULDBLOCK || tries >= wait * 10) break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    err = errno == EWOULDBLOCK ? dir + " is in use by another server" : "cannot lock " + path + ": " + std::strerror(errno);
+    ::close(fd);
+    return -1;
+}
+
+bool Storage::open(const std::vector<Shard>& shards, int io_threads, int lock_wait, std::string& err) {
+    std::vector<std::string> ids;
+    std::map<dev_t, IoQueue*> by_device;
+    shards_.clear();
+    queues_.clear();
+    packs_.clear();
+    for (Shard s : shards) {
+        if (!make_dir(s.root, err) || !make_dir(s.upload, err)) return false;
+        struct stat st{};
+        if (stat(s.root.c_str(), &st) != 0) {
+            err = "cannot stat " + s.root + ": " + std::strerror(errno);
+            return false;
+        }
+        s.io = nullptr;
+        if (io_threads > 0) {
+            IoQueue*& q = by_device[st.st_dev];
+            if (!q) {
+                queues_.push_back(std::make_unique<IoQueue>(io_threads));
+                q = queues_.back().get();
+            }
+            s.io = q;
+        }
+        int lock = lock_dir(s.upload, lock_wait, err);
+        if (lock < 0) return false;
+        locks_.push_back(lock);
+        packs_.push_back(std::make_unique<PackStore>());
+        if (!packs_.back()->open(s.upload + "/.packs", err)) return false;
+        s.packs = packs_.back().get();
+        ids.push_back(s.root);
+        shards_.push_back(s);
+    }
+    if (shards_.empty()) {
+        err = "no storage directories";
+        return false;
+    }
+    ring_ = HashRing(ids);
+    return true;
+}
+
+static bool is_file(const std::string& path) {
+    struct stat st{};
+    return stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+}
+
+std::string Storage::find(const std::string& name, bool upload, IoQueue** io) const {
+    size_t own = owner(name);
+    for (size_t k = 0; k < shards_.size(); ++k) {
+        const Shard& s = shards_[(own + k) % shards_.size()];
+        std::string path = (upload ? s.upload : s.root) + "/" + name;
+        if (!is_file(path)) continue;
+        if (io) *io = s.io;
+        return path;
+    }
+    return "";
+}
+
+std::string Storage::place(const std::string& name, bool upload, IoQueue** io) const {
+    const Shard& s = shards_[owner(name)];
+    if (io) *io = s.io;
+    return (upload ? s.upload : s.root) + "/" + name;
+}
+
+bool Storage::open_file(const std::string& name, bool upload, Opened& out) const {
+    size_t own = owner(name);
+    for (size_t k = 0; k < shards_.size(); ++k) {
+        size_t i = (own + k) % shards_.size();
+        const Shard& s = shards_[i];
+        out = Opened{};
+        out.shard = i;
+        out.io = s.io;
+        int fd = ::open(((upload ? s.upload : s.root) + "/" + name).c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st{};
+        if (fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+            out.fd = fd;
+            out.size = (uint64_t)st.st_size;
+            out.mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+            return true;
+        }
+        if (fd >= 0) ::close(fd);
+        PackStore::Entry e;
+        if (upload && (fd = s.packs->open_entry(name, e)) >= 0) {
+            out.fd = fd;
+            out.offset = e.offset;
+            out.size = e.size;
+            out.mtime = e.mtime;
+            out.packed = true;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Storage::put_packed(const std::string& name, const std::string& data, int64_t& mtime) const {
+    const Shard& s = shards_[owner(name)];
+    if (mtime == 0) {
+        timespec now{};
+        clock_gettime(CLOCK_REALTIME, &now);
+        mtime = (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+    }
+    if (!released_ && s.packs->put(name, data.data(), data.size(), mtime)) {
+        ::unlink((s.upload + "/" + name).c_str());   // an earlier, bigger version
+        return true;
+    }
+    if (!released_) return false;
+    // the packs belong to the new server now
+    static std::atomic<unsigned> seq{0};
+    std::string path = s.upload + "/" + name, tmp = s.upload + "/." + name + ".tmp" + std::to_string(seq++);
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return false;
+    timespec times[2] = {{0, UTIME_OMIT}, {(time_t)(mtime / 1000000000), (long)(mtime % 1000000000)}};
+    bool ok = ::write(fd, data.data(), data.size()) == (ssize_t)data.size() && ::futimens(fd, times) == 0;
+    ::close(fd);
+    if (ok && std::rename(tmp.c_str(), path.c_str()) == 0) return true;
+    ::unlink(tmp.c_str());
+    return false;
+}
+
+void Storage::drop_packed(const std::string& name) const {
+    shards_[owner(name)].packs->remove(name);
+}
+
+uint64_t Storage::compact() const {
+    std::lock_guard<std::mutex> lock(compact_mu_);
+    if (released_) return 0;
+    uint64_t reclaimed = 0;
+    for (auto& s : shards_) reclaimed += s.packs->compact();
+    if (meta_) meta_->compact();
+    return reclaimed;
+}
+
+bool Storage::checkpoint() const {
+    if (released_) return true;
+    bool ok = true;
+    for (auto& s : shards_) ok = s.packs->checkpoint() && ok;
+    if (meta_) meta_->shutdown();
+    return ok;
+}
+
+void Storage::release() {
+    std::lock_guard<std::mutex> lock(compact_mu_);
+    released_ = true;
+    for (auto& p : packs_) p->release();
+    if (meta_) meta_->release();
+    for (int fd : locks_) ::close(fd);
+    locks_.clear();
+}
+
+bool Storage::open_meta(std::string& err) {
+    meta_ = std::make_unique<MetaStore>();
+    if (meta_->open(shards_[0].upload + "/.meta", err)) return true;
+    meta_.reset();
+    return false;
+}
+
+// Regular, visible files of dir (uploads in progress left out).
+static std::vector<std::string> dir_files(const std::string& dir) {
+    std::vector<std::string> out;
+    DIR* d = opendir(dir.c_str());
+    if (!d) return out;
+    while (dirent* de = readdir(d)) {
+        std::string n = de->d_name;
+        if (n[0] == '.' || is_partial_upload(n)) continue;
+        if (de->d_type == DT_REG || (de->d_type == DT_UNKNOWN && is_file(dir + "/" + n))) out.push_back(n);
+    }
+    closedir(d);
+    return out;
+}
+
+std::vector<std::string> Storage::list_shard(size_t i) const {
+    auto names = dir_files(shards_[i].root);
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+std::vector<std::string> Storage::merge_lists(std::vector<std::vector<std::string>>& parts) {
+    if (parts.size() == 1) return std::move(parts[0]);
+
+    // k-way merge; a name in two shards (not yet rebalanced) is listed once
+    using Head = std::tuple<const std::string*, size_t, size_t>;   // name, shard, index
+    auto later = [](const Head& a, const Head& b) { return *std::get<0>(a) > *std::get<0>(b); };
+    std::priority_queue<Head, std::vector<Head>, decltype(later)> heads(later);
+    size_t total = 0;
+    for (size_t i = 0; i < parts.size(); ++i) {
+        total += parts[i].size();
+        if (!parts[i].empty()) heads.emplace(&parts[i][0], i, 0);
+    }
+    std::vector<std::string> out;
+    out.reserve(total);
+    while (!heads.empty()) {
+        auto [name, shard, idx] = heads.top();
+        heads.pop();
+        if (out.empty() || out.back() != *name) out.push_back(*name);
+        if (idx + 1 < parts[shard].size()) heads.emplace(&parts[shard][idx + 1], shard, idx + 1);
+    }
+    return out;
+}
+
+std::vector<std::string> Storage::list() const {
+    std::vector<std::vector<std::string>> parts(shards_.size());
+    for (size_t i = 0; i < shards_.size(); ++i) parts[i] = list_shard(i);
+    return merge_lists(parts);
+}
+
+// Renames src to dst unless dst exists (errno EEXIST): rebalance() runs
+// while PUTs land, and a file that appears at dst is newer than src.
+static bool move_new(const std::string& src, const std::string& dst) {
+    if (renameat2(AT_FDCWD, src.c_str(), AT_FDCWD, dst.c_str(), RENAME_NOREPLACE) == 0) return true;
+    if (errno != EINVAL && errno != ENOSYS) return false;
+    // no RENAME_NOREPLACE on this filesystem: link() never replaces either
+    if (::link(src.c_str(), dst.c_str()) != 0) return false;
+    ::unlink(src.c_str());
+    return true;
+}
+
+// Copy src to dst across filesystems, keeping its mtime; dst appears whole,
+// and only if it does not exist yet (move_new()).
+static bool copy_file(const std::string& src, const std::string& dst) {
+    std::string tmp = dst.substr(0, dst.rfind('/') + 1) + ".move-" + dst.substr(dst.rfind('/') + 1) + ".part";
+    int in = ::open(src.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in < 0) return false;
+    int out = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    bool ok = out >= 0;
+    std::vector<char> buf(1 << 20);
+    while (ok) {
+        ssize_t n = ::read(in, buf.data(), buf.size());
+        if (n == 0) break;
+        ok = n > 0 && ::write(out, buf.data(), (size_t)n) == n;
+    }
+    struct stat st{};
+    if (ok && fstat(in, &st) == 0) {
+        timespec times[2] = {st.st_atim, st.st_mtim};
+        futimens(out, times);
+    }
+    ok = ok && fsync(out) == 0;
+    ::close(in);
+    if (out >= 0) ::close(out);
+    if (ok && move_new(tmp, dst)) return true;
+    int err = errno;
+    ::unlink(tmp.c_str());
+    errno = err;
+    return false;
+}
+
+// name now sits in its owner's shard.
+void Storage::relocate(bool upload, const std::string& name, bool packed) const {
+    MetaStore::Record r;
+    if (!meta_ || !meta_->get(upload, name, r)) return;
+    r.shard = (uint32_t)owner(name);
+    r.packed = packed;
+    meta_->put(upload, name, r);
+}
+
+size_t Storage::rebalance() const {
+    size_t moved = 0;
+    for (size_t i = 0; i < shards_.size(); ++i) {
+        for (bool upload : {false, true}) {
+            const std::string& dir = upload ? shards_[i].upload : shards_[i].root;
+            for (auto& name : dir_files(dir)) {
+                size_t own = owner(name);
+                if (own == i) continue;
+                std::string src = dir + "/" + name;
+                std::string dst = place(name, upload);
+                if (is_file(dst)) {
+                    ::unlink(src.c_str());   // shadowed by the owner's copy anyway
+                    continue;
+                }
+                if (move_new(src, dst) || (errno == EXDEV && copy_file(src, dst) && ::unlink(src.c_str()) == 0)) {
+                    ++moved;
+                    relocate(upload, name, false);
+                } else if (errno == EEXIST) {
+                    ::unlink(src.c_str());   // a PUT got there first; the newer copy wins
+                }
+            }
+        }
+        // packed uploads move from pack to pack
+        for (auto& [name, e] : shards_[i].packs->list()) {
+            const Shard& own = shards_[owner(name)];
+            if (&own == &shards_[i]) continue;
+            PackStore::Entry have;
+            if (is_file(own.upload + "/" + name) || own.packs->get(name, have)) {
+                shards_[i].packs->remove(name, e.mtime);
+                continue;
+            }
+            PackStore::Entry at;
+            int fd = shards_[i].packs->open_entry(name, at);
+            if (fd < 0) continue;
+            std::string data(at.size, '\0');
+            ssize_t got = ::pread(fd, &data[0], data.size(), (off_t)at.offset);
+            ::close(fd);
+            // not over a version a PUT packed there meanwhile
+            if (got == (ssize_t)data.size() && own.packs->put(name, data.data(), data.size(), at.mtime, false) &&
+                shards_[i].packs->remove(name, at.mtime)) {
+                ++moved;
+                relocate(true, name, true);
+            }
+        }
+    }
+    return moved;
+}
+
+// What the directories hold for one namespace, as metadata records; where a
+// name is in several shards, the copy open_file() would read.
+static void scan_dirs(const Storage& st, bool upload, std::map<std::string, MetaStore::Record>& out) {
+    auto& shards = st.shards();
+    for (size_t i = 0; i < shards.size(); ++i) {
+        const std::string& dir = upload ? shards[i].upload : shards[i].root;
+        auto take = [&](const std::string& name, const MetaStore::Record& r) {
+            auto it = out.find(name);
+            if (it == out.end()) out.emplace(name, r);
+            else if (st.owner(name) == i && it->second.shard != i) it->second = r;
+        };
+        for (auto& name : dir_files(dir)) {
+            struct stat sb{};
+            if (stat((dir + "/" + name).c_str(), &sb) != 0) continue;
+            MetaStore::Record r;
+            r.size = (uint64_t)sb.st_size;
+            r.mtime = (int64_t)sb.st_mtim.tv_sec * 1000000000 + sb.st_mtim.tv_nsec;
+            r.shard = (uint32_t)i;
+            take(name, r);
+        }
+        if (!upload) continue;
+        for (auto& [name, e] : shards[i].packs->list()) {
+            if (out.count(name) && out[name].shard == i) continue;   // the loose file is read first
+            MetaStore::Record r;
+            r.size = e.size;
+            r.mtime = e.mtime;
+            r.shard = (uint32_t)i;
+            r.packed = true;
+            take(name, r);
+        }
+    }
+}
+
+static bool same_file(const MetaStore::Record& a, const MetaStore::Record& b) {
+    return a.size == b.size && a.mtime == b.mtime && a.shard == b.shard && a.packed == b.packed;
+}
+
+// One name the scan found out of date: looked at again, since the server may
+// have changed it (and its entry) since the scan read the directory.
+bool Storage::refresh_meta(bool upload, const std::string& name) const {
+    Opened f;
+    bool exists = open_file(name, upload, f);
+    if (f.fd >= 0) ::close(f.fd);
+    MetaStore::Record have;
+    bool known = meta_->get(upload, name, have);
+    if (!exists) return known && meta_->remove(upload, name);
+    MetaStore::Record now;
+    now.size = f.size;
+    now.mtime = f.mtime;
+    now.shard = (uint32_t)f.shard;
+    now.packed = f.packed;
+    if (known && same_file(have, now)) return false;
+    if (known) now.owner = have.owner;
+    if (known && have.size == now.size && have.mtime == now.mtime) now.hash = have.hash;
+    return meta_->put(upload, name, now);
+}
+
+size_t Storage::sync_meta() const {
+    if (!meta_) return 0;
+    size_t changed = 0;
+    for (bool upload : {false, true}) {
+        std::map<std::string, MetaStore::Record> disk;
+        scan_dirs(*this, upload, disk);
+        auto have = meta_->scan(upload);
+        auto h = have.begin();
+        for (auto& [name, r] : disk) {
+            for (; h != have.end() && h->first < name; ++h) changed += refresh_meta(upload, h->first);
+            bool known = h != have.end() && h->first == name;
+            if (!known || !same_file(h->second, r)) changed += refresh_meta(upload, name);
+            if (known) ++h;
+        }
+        for (; h != have.end(); ++h) changed += refresh_meta(upload, h->first);
+    }
+    meta_->mark_complete();
+    return changed;
+}
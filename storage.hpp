@@ -0,0 +1,152 @@
+// storage.hpp (C++17)
+// Where the server's files live: one or more shards, each a directory for
+// the files LIST/GET serve and one for what PUT stores, typically one shard
+// per disk. A file name belongs to one shard by consistent hashing
+// (hash_ring.hpp), so adding a shard moves only about 1/N of the files.
+//
+// Shards on the same device share an IoQueue: a few threads that do the
+// blocking reads and writes of transfers for that device, so a slow or busy
+// disk stalls only the transfers that touch it, not the event loops or the
+// other disks.
+//
+// Each shard's upload directory may also hold a pack store (pack_store.hpp)
+// for small uploads; readers reach both through open_file(). With
+// open_meta(), the metadata of every file is also kept in a MetaStore
+// (meta_store.hpp) in the first shard's upload/.meta, which the server
+// updates on every change it makes and sync_meta() reconciles with the
+// directories.
+//
+// Only one process may write those stores: open() takes a lock on every
+// upload directory (upload/.lock), held until release() or exit.
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "hash_ring.hpp"
+#include "meta_store.hpp"
+#include "pack_store.hpp"
+
+class IoQueue {
+public:
+    explicit IoQueue(int threads);
+    ~IoQueue();
+
+    void submit(std::function<void()> job);
+
+private:
+    std::mutex mu_;
+    std::condition_variable cv_;
+    std::deque<std::function<void()>> jobs_;
+    bool stop_ = false;
+    std::vector<std::thread> threads_;
+};
+
+// "name.part17": a PUT still being received.
+bool is_partial_upload(const std::string& name);
+
+class Storage {
+public:
+    struct Shard {
+        std::string root;       // served by LIST/GET
+        std::string upload;     // PUT
+        IoQueue* io = nullptr;  // of root's device; nullptr = I/O inline
+        PackStore* packs = nullptr;   // small uploads, in upload/.packs
+    };
+
+    // A file opened for reading: the whole of a file, or the range of a pack
+    // that holds a small upload.
+    struct Opened {
+        int fd = -1;          // the caller closes it
+        uint64_t offset = 0;
+        uint64_t size = 0;
+        int64_t mtime = 0;    // ns
+        bool packed = false;
+        size_t shard = 0;
+        IoQueue* io = nullptr;
+    };
+
+    // Creates the directories and one queue of io_threads per device
+    // (0 = no queues), waiting up to lock_wait seconds for another process
+    // to let go of an upload directory. False with err set on failure.
+    bool open(const std::vector<Shard>& shards, int io_threads, int lock_wait, std::string& err);
+
+    const std::vector<Shard>& shards() const { return shards_; }
+    size_t owner(const std::string& name) const { return ring_.owner(name); }
+
+    // Path of an existing file: in its owner's shard, else in another one
+    // (stored there before a shard was added); "" if there is none. io, if
+    // given, is set to the queue of the shard it was found in.
+    std::string find(const std::string& name, bool upload, IoQueue** io = nullptr) const;
+
+    // Path a new version of name is written to: always its owner's shard.
+    std::string place(const std::string& name, bool upload, IoQueue** io = nullptr) const;
+
+    // Opens name wherever it is, like find() but packed uploads included;
+    // false if there is none.
+    bool open_file(const std::string& name, bool upload, Opened& out) const;
+
+    // A small upload into its owner's pack store, replacing a file of that
+    // name there (after release(), a file of its own); an mtime of 0 is set
+    // to now. Blocking disk I/O.
+    bool put_packed(const std::string& name, const std::string& data, int64_t& mtime) const;
+    // After a file replaced name in its owner's upload directory.
+    void drop_packed(const std::string& name) const;
+
+    // Compacts every pack store (and the metadata store); returns the pack
+    // bytes reclaimed.
+    uint64_t compact() const;
+
+    // On a clean shutdown: every pack index written out as a snapshot and
+    // the metadata store marked clean, so the next start replays no journal
+    // and need not rescan the directories. False if a snapshot failed.
+    bool checkpoint() const;
+
+    // Hot upgrade: hands the pack and metadata stores to the new server.
+    // Waits for a running compact(), then every store refuses changes and
+    // the locks go; small uploads become plain files from here on.
+    void release();
+
+    // Opens the metadata store; after open(). False with err set on failure.
+    bool open_meta(std::string& err);
+    MetaStore* meta() const { return meta_.get(); }   // nullptr without open_meta()
+
+    // Brings the metadata store in line with the directories: files added,
+    // changed or deleted behind the server's back (or while it was down).
+    // Marks the store complete; returns the number of entries changed.
+    size_t sync_meta() const;
+
+    // Sorted names of the files in every root directory (hidden files left
+    // out): list_shard() of each shard, then merge_lists(). Blocking; an
+    // event loop runs list_shard() on each shard's queue instead.
+    std::vector<std::string> list() const;
+    std::vector<std::string> list_shard(size_t i) const;
+    // Merges sorted per-shard lists, a name in several of them once.
+    static std::vector<std::string> merge_lists(std::vector<std::vector<std::string>>& parts);
+
+    // Moves files (packed uploads included) that sit outside their owner's
+    // shard (after shards were added or removed) to it; a copy the owner
+    // already has wins. Returns the number of files moved.
+    size_t rebalance() const;
+
+private:
+    void relocate(bool upload, const std::string& name, bool packed) const;
+    bool refresh_meta(bool upload, const std::string& name) const;
+
+    std::vector<Shard> shards_;
+    std::vector<std::unique_ptr<IoQueue>> queues_;
+    std::vector<std::unique_ptr<PackStore>> packs_;
+    std::unique_ptr<MetaStore> meta_;
+    HashRing ring_;
+    std::vector<int> locks_;          // flock()ed upload/.lock of each shard
+    mutable std::mutex compact_mu_;   // compact() against release()
+    std::atomic<bool> released_{false};
+};
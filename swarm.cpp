@@ -0,0 +1,292 @@
+// swarm.cpp (C++17)
+// Swarm download and chunk seeding (see swarm.hpp).
+#include "swarm.hpp"
+
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "endpoint.hpp"
+#include "protocol.hpp"
+
+namespace swarm {
+
+using namespace proto;
+
+uint64_t chunk_hash(const char* data, size_t n) {
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < n; ++i) {
+        h ^= (uint8_t)data[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static void set_timeout(int fd, int seconds) {
+    timeval tv{seconds, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+// Read exactly n bytes at off; false on a short file.
+static bool pread_all(int fd, char* buf, size_t n, uint64_t off) {
+    while (n > 0) {
+        ssize_t r = ::pread(fd, buf, n, (off_t)off);
+        if (r <= 0) return false;
+        buf += r;
+        n -= (size_t)r;
+        off += (uint64_t)r;
+    }
+    return true;
+}
+
+// "OK", the size, then the XORed bytes: the reply to GETRANGE
+static bool recv_range(int fd, std::vector<char>& buf, uint64_t len) {
+    std::string resp;
+    uint64_t size_be = 0;
+    if (!recv_line(fd, resp) || resp != "OK") return false;
+    if (!recv_all(fd, &size_be, sizeof(size_be)) || be64_to_host(size_be) != len) return false;
+    if (!recv_all(fd, buf.data(), (size_t)len)) return false;
+    xor_in_place(buf.data(), (size_t)len);
+    return true;
+}
+
+// ---- Seeder ----
+
+struct Seeder::State {
+    struct Share {
+        std::string path;
+        uint64_t size = 0, chunk = 0;
+        std::vector<bool> have;
+    };
+    int fd = -1;
+    int port = 0;
+    std::mutex mu;
+    std::unordered_map<std::string, Share> shares;
+    std::atomic<uint64_t> served{0};
+    std::atomic<bool> stop{false};
+    std::thread acceptor;
+
+    // path and length of a chunk we hold that starts at off, or false
+    bool lookup(const std::string& name, uint64_t off, uint64_t len, std::string& path) {
+        std::lock_guard<std::mutex> lock(mu);
+        auto it = shares.find(name);
+        if (it == shares.end()) return false;
+        const Share& s = it->second;
+        if (off % s.chunk || off >= s.size || len != std::min(s.chunk, s.size - off)) return false;
+        if (!s.have[(size_t)(off / s.chunk)]) return false;
+        path = s.path;
+        return true;
+    }
+};
+
+static void serve_peer(std::shared_ptr<Seeder::State> st, int c) {
+    set_timeout(c, 30);
+    std::string line, path;
+    std::vector<char> buf;
+    while (recv_line(c, line, 4096)) {
+        std::istringstream iss(line);
+        std::string cmd, name;
+        uint64_t off = 0, len = 0;
+        iss >> cmd >> name >> off >> len;
+        if (cmd != "GETRANGE" || !st->lookup(name, off, len, path)) {
+            if (!send_line(c, "ERR NotFound")) break;
+            continue;
+        }
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        buf.resize((size_t)len);
+        bool ok = fd >= 0 && pread_all(fd, buf.data(), buf.size(), off);
+        if (fd >= 0) ::close(fd);
+        if (!ok) {
+            if (!send_line(c, "ERR NotFound")) break;
+            continue;
+        }
+        xor_in_place(buf.data(), buf.size());
+        uint64_t size_be = host_to_be64(len);
+        if (!send_line(c, "OK") || !send_all(c, &size_be, sizeof(size_be)) || !send_all(c, buf.data(), buf.size()))
+            break;
+        ++st->served;
+    }
+    ::close(c);
+}
+
+Seeder::Seeder() : st_(std::make_shared<State>()) {}
+
+Seeder::~Seeder() {
+    st_->stop = true;
+    if (st_->acceptor.joinable()) st_->acceptor.join();
+    if (st_->fd >= 0) ::close(st_->fd);
+}
+
+bool Seeder::start(int port) {
+    // all addresses: dual-stack IPv6, or IPv4 where there is no IPv6
+    int fd = ::socket(AF_INET6, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int zero = 0, one = 1;
+    if (fd >= 0) {
+        setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero));
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in6 a{};
+        a.sin6_family = AF_INET6;
+        a.sin6_addr = in6addr_any;
+        a.sin6_port = htons((uint16_t)port);
+        if (::bind(fd, (sockaddr*)&a, sizeof(a)) < 0) { ::close(fd); fd = -1; }
+    }
+    if (fd < 0) {
+        fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) return false;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in a{};
+        a.sin_family = AF_INET;
+        a.sin_addr.s_addr = htonl(INADDR_ANY);
+        a.sin_port = htons((uint16_t)port);
+        if (::bind(fd, (sockaddr*)&a, sizeof(a)) < 0) { int e = errno; ::close(fd); errno = e; return false; }
+    }
+    if (::listen(fd, SOMAXCONN) < 0) { int e = errno; ::close(fd); errno = e; return false; }
+    sockaddr_storage ss{};
+    socklen_t len = sizeof(ss);
+    getsockname(fd, (sockaddr*)&ss, &len);
+    st_->port = ntohs(ss.ss_family == AF_INET6 ? ((sockaddr_in6*)&ss)->sin6_port : ((sockaddr_in*)&ss)->sin_port);
+    st_->fd = fd;
+    st_->acceptor = std::thread([st = st_] {
+        while (!st->stop) {
+            pollfd p{st->fd, POLLIN, 0};
+            if (poll(&p, 1, 200) <= 0) continue;
+            int c = ::accept4(st->fd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (c >= 0) std::thread(serve_peer, st, c).detach();
+        }
+    });
+    return true;
+}
+
+int Seeder::port() const { return st_->port; }
+
+void Seeder::share(const std::string& name, const std::string& path, uint64_t size, uint64_t chunk) {
+    std::lock_guard<std::mutex> lock(st_->mu);
+    auto& s = st_->shares[name];
+    s.path = path;
+    s.size = size;
+    s.chunk = chunk;
+    s.have.assign((size_t)((size + chunk - 1) / chunk), false);
+}
+
+void Seeder::mark(const std::string& name, uint32_t index) {
+    std::lock_guard<std::mutex> lock(st_->mu);
+    auto it = st_->shares.find(name);
+    if (it != st_->shares.end() && index < it->second.have.size()) it->second.have[index] = true;
+}
+
+uint64_t Seeder::chunks_served() const { return st_->served; }
+
+// ---- download ----
+
+// One chunk from another client; false if it is unreachable or refuses.
+static bool fetch_from_peer(const std::string& host, int port, const std::string& name, uint64_t off, uint64_t len,
+                            std::vector<char>& buf) {
+    int fd = connect_endpoint(host, port);
+    if (fd < 0) return false;
+    set_timeout(fd, 10);
+    bool ok = send_line(fd, "GETRANGE " + name + " " + std::to_string(off) + " " + std::to_string(len)) &&
+              recv_range(fd, buf, len);
+    ::close(fd);
+    return ok;
+}
+
+bool download(int server_fd, const std::string& name, const std::string& path, Seeder& seeder, int parallel,
+              const std::string& host, Stats& stats, std::string& err) {
+    std::string resp;
+    std::string join = "SWARM JOIN " + name + " " + std::to_string(seeder.port());
+    if (!host.empty()) join += " " + host;
+    if (!send_line(server_fd, join) || !recv_line(server_fd, resp)) { err = "connection lost"; return false; }
+    uint64_t size = 0, chunk = 0;
+    std::istringstream hdr(resp);
+    std::string ok;
+    if (!(hdr >> ok >> size >> chunk) || ok != "OK" || chunk == 0) { err = resp; return false; }
+
+    int out = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (out < 0 || ::ftruncate(out, (off_t)size) < 0) {
+        err = "cannot write " + path;
+        if (out >= 0) ::close(out);
+        return false;
+    }
+    seeder.share(name, path, size, chunk);
+
+    // the server connection carries one request and reply at a time; chunks
+    // from the server are fetched on it too, chunks from peers outside the lock
+    std::mutex ctl;
+    bool failed = false;
+    auto fail = [&](const std::string& why) { if (!failed) { failed = true; err = why; } };
+    auto worker = [&] {
+        std::vector<char> buf((size_t)chunk);
+        while (true) {
+            std::string reply, kind, src;
+            uint32_t index = 0;
+            std::string hash_hex;
+            int port = 0;
+            bool got = false;
+            {
+                std::lock_guard<std::mutex> lock(ctl);
+                if (failed) return;
+                if (!send_line(server_fd, "SWARM NEXT " + name) || !recv_line(server_fd, reply)) {
+                    fail("connection lost");
+                    return;
+                }
+                std::istringstream iss(reply);
+                iss >> kind >> index >> hash_hex >> src >> port;
+                if (kind == "DONE") return;
+                if (kind != "WAIT" && (kind != "CHUNK" || src.empty())) { fail(reply); return; }
+                if (kind == "CHUNK" && src == "seed") {
+                    uint64_t off = (uint64_t)index * chunk;
+                    uint64_t len = std::min(chunk, size - off);
+                    if (!send_line(server_fd, "GETRANGE " + name + " " + std::to_string(off) + " " + std::to_string(len))) {
+                        fail("connection lost");
+                        return;
+                    }
+                    got = recv_range(server_fd, buf, len);
+                    if (!got) { fail("GETRANGE failed"); return; }
+                }
+            }
+            if (kind == "WAIT") {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                continue;
+            }
+            uint64_t off = (uint64_t)index * chunk;
+            uint64_t len = std::min(chunk, size - off);
+            if (src != "seed") got = fetch_from_peer(src, port, name, off, len, buf);
+            got = got && std::strtoull(hash_hex.c_str(), nullptr, 16) == chunk_hash(buf.data(), (size_t)len);
+            ssize_t w = got ? ::pwrite(out, buf.data(), (size_t)len, (off_t)off) : -1;
+            got = got && w == (ssize_t)len;
+            if (got) seeder.mark(name, index);   // before the tracker sends anyone here
+            std::lock_guard<std::mutex> lock(ctl);
+            if (failed) return;
+            if (!send_line(server_fd, std::string(got ? "SWARM HAVE " : "SWARM MISS ") + name + " " + std::to_string(index)) ||
+                !recv_line(server_fd, reply)) {
+                fail("connection lost");
+                return;
+            }
+            if (!got) { ++stats.retried; continue; }
+            ++(src == "seed" ? stats.from_server : stats.from_peers);
+        }
+    };
+    std::vector<std::thread> workers;
+    for (int i = 0; i < std::max(parallel, 1); ++i) workers.emplace_back(worker);
+    for (auto& t : workers) t.join();
+    ::close(out);
+    return !failed;
+}
+
+} // namespace swarm
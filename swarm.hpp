@@ -0,0 +1,67 @@
+// swarm.hpp (C++17)
+// Client side of swarm downloads. Part of libfileshare.
+//
+// A swarm download asks the server (the tracker, swarm_tracker.hpp) where to
+// get each chunk of a file: from another client of the same swarm, or from
+// the server itself. While it runs, and for as long as the Seeder lives
+// afterwards, the client serves the chunks it holds to the others, so a file
+// wanted by many clients leaves the server about once.
+//
+// Wire protocol, on the authenticated server connection:
+//   SWARM JOIN <name> <port> [host]  -> OK <size> <chunk>   (serve at host:port;
+//                                       host defaults to our address as the
+//                                       server sees it)
+//   SWARM NEXT <name>   -> CHUNK <index> <hash> seed | CHUNK <index> <hash> <host> <port>
+//                          | WAIT | DONE
+//   SWARM HAVE <name> <index> / SWARM MISS <name> <index>   -> OK
+//   SWARM LEAVE <name>  -> OK
+//   GETRANGE <name> <offset> <length>   -> OK, then the file framing of protocol.hpp
+// and between clients (no AUTH) only GETRANGE, for a whole chunk it holds.
+// <hash> is chunk_hash() of the plain chunk in hex; a chunk that does not
+// match is fetched again elsewhere.
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace swarm {
+
+// FNV-1a, 64 bit: catches corrupt or stale chunks, not a malicious peer.
+uint64_t chunk_hash(const char* data, size_t n);
+
+// Serves chunks of the files it was told about on a TCP port of all
+// addresses, on background threads.
+class Seeder {
+public:
+    Seeder();
+    ~Seeder();
+    Seeder(const Seeder&) = delete;
+    Seeder& operator=(const Seeder&) = delete;
+
+    // Listen on port (0 = any free one); false with errno on failure.
+    bool start(int port = 0);
+    int port() const;
+
+    // path holds (or will hold) name; chunks become servable once marked.
+    void share(const std::string& name, const std::string& path, uint64_t size, uint64_t chunk);
+    void mark(const std::string& name, uint32_t index);
+    uint64_t chunks_served() const;
+
+    struct State;
+
+private:
+    std::shared_ptr<State> st_;
+};
+
+struct Stats {
+    uint32_t from_server = 0, from_peers = 0, retried = 0;
+};
+
+// Download name to path over server_fd (an authenticated session) with
+// `parallel` chunk fetches at once, sharing the file through seeder. False
+// with err set on failure; "ERR SwarmOff" when the server has no swarm mode.
+bool download(int server_fd, const std::string& name, const std::string& path, Seeder& seeder, int parallel,
+              const std::string& host, Stats& stats, std::string& err);
+
+} // namespace swarm
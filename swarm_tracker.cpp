@@ -0,0 +1,198 @@
+// swarm_tracker.cpp (C++17)
+// Chunk bookkeeping for swarm downloads (see swarm_tracker.hpp).
+#include "swarm_tracker.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+uint64_t SwarmTracker::join(uint64_t session, const std::string& name, uint64_t size, int64_t mtime,
+                            uint64_t chunk, const std::string& host, int port) {
+    std::lock_guard<std::mutex> lock(mu_);
+    auto it = swarms_.find(name);
+    if (it != swarms_.end() && (it->second.size != size || it->second.mtime != mtime)) {
+        // the file was replaced: what the peers hold is stale
+        std::cout << "Swarm for " << name << " restarted: file changed\n";
+        swarms_.erase(it);
+        it = swarms_.end();
+    }
+    if (it == swarms_.end()) {
+        Swarm s;
+        s.size = size;
+        s.mtime = mtime;
+        s.chunk = chunk;
+        s.generation = next_generation_++;
+        size_t n = (size_t)((size + chunk - 1) / chunk);
+        s.holders.resize(n);
+        s.seeding.assign(n, false);
+        s.hash_known.assign(n, false);
+        s.hash.assign(n, 0);
+        it = swarms_.emplace(name, std::move(s)).first;
+    }
+    Swarm& s = it->second;
+    if (s.peers.count(session)) remove_peer(name, s, session);   // joined again
+    Peer& p = s.peers[session];
+    p.host = host;
+    p.port = port;
+    p.have.assign(s.holders.size(), false);
+    return s.chunk;
+}
+
+bool SwarmTracker::next(uint64_t session, const std::string& name, Assignment& a) {
+    std::lock_guard<std::mutex> lock(mu_);
+    auto it = swarms_.find(name);
+    if (it == swarms_.end()) return false;
+    Swarm& s = it->second;
+    auto pit = s.peers.find(session);
+    if (pit == s.peers.end()) return false;
+    Peer& me = pit->second;
+
+    // rarest chunk a peer can serve now, else a chunk only the server can
+    // give that nobody is fetching from it yet; start at a random chunk so
+    // peers do not all go for the same ones
+    size_t n = s.holders.size();
+    size_t start = n ? std::uniform_int_distribution<size_t>(0, n - 1)(rng_) : 0;
+    bool missing = false;
+    size_t best = n, best_count = SIZE_MAX, from_seed = n;
+    uint64_t best_source = 0;
+    for (size_t k = 0; k < n; ++k) {
+        size_t i = (start + k) % n;
+        if (me.have[i] || me.pending.count((uint32_t)i)) continue;
+        missing = true;
+        auto& h = s.holders[i];
+        if (h.empty()) {
+            if (!s.seeding[i] && from_seed == n) from_seed = i;
+            continue;
+        }
+        if (h.size() >= best_count) continue;
+        uint64_t source = 0;
+        int load = MAX_PEER_UPLOADS;
+        for (uint64_t id : h) {
+            int u = s.peers[id].uploads;
+            if (u < load) { load = u; source = id; }
+        }
+        if (!source) continue;
+        best = i;
+        best_count = h.size();
+        best_source = source;
+    }
+
+    a = Assignment{};
+    a.generation = s.generation;
+    if (best < n) {
+        Peer& src = s.peers[best_source];
+        ++src.uploads;
+        me.pending[(uint32_t)best] = best_source;
+        a.kind = Assignment::CHUNK;
+        a.index = (uint32_t)best;
+        a.seed = false;
+        a.host = src.host;
+        a.port = src.port;
+    } else if (from_seed < n) {
+        s.seeding[from_seed] = true;
+        me.pending[(uint32_t)from_seed] = 0;
+        a.kind = Assignment::CHUNK;
+        a.index = (uint32_t)from_seed;
+    } else {
+        a.kind = missing || !me.pending.empty() ? Assignment::WAIT : Assignment::DONE;
+        return true;
+    }
+    a.offset = (uint64_t)a.index * s.chunk;
+    a.length = std::min(s.chunk, s.size - a.offset);
+    a.hash_known = s.hash_known[a.index];
+    a.hash = s.hash[a.index];
+    return true;
+}
+
+// The transfer of index from source (0 = server) is over, either way.
+void SwarmTracker::end_pending(Swarm& s, uint32_t index, uint64_t source) {
+    if (!source) {
+        s.seeding[index] = false;
+        return;
+    }
+    auto it = s.peers.find(source);
+    if (it != s.peers.end() && it->second.uploads > 0) --it->second.uploads;
+}
+
+bool SwarmTracker::have(uint64_t session, const std::string& name, uint32_t index) {
+    std::lock_guard<std::mutex> lock(mu_);
+    auto it = swarms_.find(name);
+    if (it == swarms_.end()) return false;
+    Swarm& s = it->second;
+    auto pit = s.peers.find(session);
+    if (pit == s.peers.end()) return false;
+    Peer& me = pit->second;
+    auto pend = me.pending.find(index);
+    if (pend == me.pending.end()) return false;
+    uint64_t source = pend->second;
+    me.pending.erase(pend);
+    end_pending(s, index, source);
+    me.have[index] = true;
+    s.holders[index].push_back(session);
+    ++(source ? s.from_peers : s.from_server);
+    return true;
+}
+
+bool SwarmTracker::miss(uint64_t session, const std::string& name, uint32_t index) {
+    std::lock_guard<std::mutex> lock(mu_);
+    auto it = swarms_.find(name);
+    if (it == swarms_.end()) return false;
+    Swarm& s = it->second;
+    auto pit = s.peers.find(session);
+    if (pit == s.peers.end()) return false;
+    Peer& me = pit->second;
+    auto pend = me.pending.find(index);
+    if (pend == me.pending.end()) return false;
+    uint64_t source = pend->second;
+    me.pending.erase(pend);
+    end_pending(s, index, source);
+    if (source) {
+        // unreachable or sent bad data: stop offering it for this chunk
+        auto& h = s.holders[index];
+        h.erase(std::remove(h.begin(), h.end(), source), h.end());
+        auto src = s.peers.find(source);
+        if (src != s.peers.end()) src->second.have[index] = false;
+    }
+    return true;
+}
+
+void SwarmTracker::set_hash(const std::string& name, uint64_t generation, uint32_t index, uint64_t hash) {
+    std::lock_guard<std::mutex> lock(mu_);
+    auto it = swarms_.find(name);
+    if (it == swarms_.end() || it->second.generation != generation || index >= it->second.hash.size()) return;
+    it->second.hash[index] = hash;
+    it->second.hash_known[index] = true;
+}
+
+void SwarmTracker::remove_peer(const std::string& name, Swarm& s, uint64_t session) {
+    auto pit = s.peers.find(session);
+    if (pit == s.peers.end()) return;
+    Peer& me = pit->second;
+    for (auto& [index, source] : me.pending) end_pending(s, index, source);
+    for (size_t i = 0; i < me.have.size(); ++i) {
+        if (!me.have[i]) continue;
+        auto& h = s.holders[i];
+        h.erase(std::remove(h.begin(), h.end(), session), h.end());
+    }
+    s.peers.erase(pit);
+    if (s.peers.empty()) {
+        std::cout << "Swarm for " << name << " finished: " << s.from_server << " chunks from the server, "
+                  << s.from_peers << " between peers\n";
+    }
+}
+
+void SwarmTracker::leave(uint64_t session, const std::string& name) {
+    std::lock_guard<std::mutex> lock(mu_);
+    auto it = swarms_.find(name);
+    if (it == swarms_.end()) return;
+    remove_peer(name, it->second, session);
+    if (it->second.peers.empty()) swarms_.erase(it);
+}
+
+void SwarmTracker::leave_all(uint64_t session) {
+    std::lock_guard<std::mutex> lock(mu_);
+    for (auto it = swarms_.begin(); it != swarms_.end();) {
+        remove_peer(it->first, it->second, session);
+        if (it->second.peers.empty()) it = swarms_.erase(it);
+        else ++it;
+    }
+}
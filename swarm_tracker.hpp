@@ -0,0 +1,87 @@
+// swarm_tracker.hpp (C++17)
+// Tracker for swarm downloads: which sessions hold which chunks of a file, and
+// where each one should fetch its next chunk from.
+//
+// A client that joins a file's swarm serves the chunks it already has to the
+// others (swarm.hpp) and asks the tracker for one chunk at a time. The tracker
+// prefers the rarest chunk some peer can serve right now (each peer uploads at
+// most MAX_PEER_UPLOADS chunks at once), and only hands out the server itself
+// as the source for chunks no peer has and nobody is fetching from it already,
+// so every chunk leaves the server about once however many clients join. One
+// instance is shared by all reactors behind a mutex.
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class SwarmTracker {
+public:
+    static constexpr int MAX_PEER_UPLOADS = 4;
+
+    struct Assignment {
+        enum Kind { CHUNK, WAIT, DONE } kind = DONE;
+        uint32_t index = 0;
+        uint64_t offset = 0, length = 0;   // the chunk's bytes in the file
+        bool seed = true;          // fetch from the server; else from host:port
+        std::string host;
+        int port = 0;
+        bool hash_known = false;   // false: hash the chunk and call set_hash()
+        uint64_t hash = 0;
+        uint64_t generation = 0;   // for set_hash()
+    };
+
+    // Adds session (numbered from 1 by the caller) to the swarm of name (size
+    // bytes, modified at mtime) as a peer serving at host:port. A changed size or mtime starts a new swarm.
+    // Returns the swarm's chunk size (chunk for a new swarm).
+    uint64_t join(uint64_t session, const std::string& name, uint64_t size, int64_t mtime, uint64_t chunk,
+                  const std::string& host, int port);
+
+    // Next chunk for session, or WAIT (all missing chunks are being fetched
+    // or their holders are busy) or DONE. False if session has not joined.
+    bool next(uint64_t session, const std::string& name, Assignment& a);
+
+    // The client verified and stored chunk index (have), or could not get it
+    // from the assigned source (miss; that source is not offered again for
+    // it). False for a chunk that was not assigned to session.
+    bool have(uint64_t session, const std::string& name, uint32_t index);
+    bool miss(uint64_t session, const std::string& name, uint32_t index);
+
+    void set_hash(const std::string& name, uint64_t generation, uint32_t index, uint64_t hash);
+
+    // Leave one swarm, or all of them (session ended).
+    void leave(uint64_t session, const std::string& name);
+    void leave_all(uint64_t session);
+
+private:
+    struct Peer {
+        std::string host;
+        int port = 0;
+        std::vector<bool> have;
+        std::unordered_map<uint32_t, uint64_t> pending;   // chunk -> source session, 0 = server
+        int uploads = 0;                                  // chunks others fetch from us now
+    };
+    struct Swarm {
+        uint64_t size = 0;
+        int64_t mtime = 0;
+        uint64_t chunk = 0;
+        uint64_t generation = 0;
+        std::vector<std::vector<uint64_t>> holders;   // per chunk
+        std::vector<bool> seeding;                    // being fetched from the server
+        std::vector<bool> hash_known;
+        std::vector<uint64_t> hash;
+        std::unordered_map<uint64_t, Peer> peers;
+        uint64_t from_server = 0, from_peers = 0;     // chunks delivered
+    };
+
+    void end_pending(Swarm& s, uint32_t index, uint64_t source);
+    void remove_peer(const std::string& name, Swarm& s, uint64_t session);
+
+    std::mutex mu_;
+    std::unordered_map<std::string, Swarm> swarms_;
+    uint64_t next_generation_ = 1;
+    std::mt19937 rng_{std::random_device{}()};
+};
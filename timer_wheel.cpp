@@ -0,0 +1,92 @@
+// timer_wheel.cpp (C++17)
+// Implementation of the hierarchical timer wheel (see timer_wheel.hpp).
+#include "timer_wheel.hpp"
+
+namespace aio {
+
+TimerWheel::TimerWheel(Clock::duration tick)
+    : origin_(Clock::now()), tick_(tick > Clock::duration::zero() ? tick : std::chrono::milliseconds(1)) {}
+
+TimerWheel::~TimerWheel() {
+    // leave surviving timers disarmed rather than pointing at a dead wheel
+    for (auto& level : slots_)
+        for (Timer*& head : level)
+            while (head) unlink(*head);
+}
+
+void TimerWheel::schedule(Timer& t, Clock::duration delay) {
+    if (t.wheel_) unlink(t);
+    int64_t ticks = (delay.count() + tick_.count() - 1) / tick_.count();
+    t.expires_ = now_ + (ticks < 1 ? 1 : (uint64_t)ticks);   // next tick at the earliest
+    t.wheel_ = this;
+    ++count_;
+    insert(t);
+}
+
+void TimerWheel::cancel(Timer& t) {
+    if (t.wheel_ == this) unlink(t);
+}
+
+// The level is picked from the distance to the deadline, the slot from the
+// deadline's bits at that level; a level-n slot is emptied into the levels
+// below when the wheel enters the block of ticks it stands for. Deadlines
+// beyond the top level park in its farthest slot and are re-filed from there.
+void TimerWheel::insert(Timer& t) {
+    const uint64_t range = 1ull << (BITS * LEVELS);
+    uint64_t delta = t.expires_ > now_ ? t.expires_ - now_ : 0;
+    uint64_t at = delta < range ? t.expires_ : now_ + range - 1;
+    int level = 0;
+    while (level < LEVELS - 1 && delta >= (1ull << (BITS * (level + 1)))) ++level;
+    t.level_ = (uint8_t)level;
+    t.slot_ = (uint8_t)((at >> (BITS * level)) & MASK);
+    Timer*& head = slots_[level][t.slot_];
+    t.prev_ = nullptr;
+    t.next_ = head;
+    if (head) head->prev_ = &t;
+    head = &t;
+}
+
+void TimerWheel::unlink(Timer& t) {
+    if (t.prev_) t.prev_->next_ = t.next_;
+    else slots_[t.level_][t.slot_] = t.next_;
+    if (t.next_) t.next_->prev_ = t.prev_;
+    t.prev_ = t.next_ = nullptr;
+    t.wheel_ = nullptr;
+    --count_;
+}
+
+void TimerWheel::cascade(int level) {
+    Timer* t = slots_[level][(now_ >> (BITS * level)) & MASK];
+    slots_[level][(now_ >> (BITS * level)) & MASK] = nullptr;
+    while (t) {
+        Timer* next = t->next_;
+        insert(*t);
+        t = next;
+    }
+}
+
+void TimerWheel::advance(Clock::time_point now) {
+    if (now < origin_) return;
+    uint64_t target = (uint64_t)((now - origin_) / tick_);
+    while (now_ < target) {
+        ++now_;
+        // entering a new block of a higher level: spread its slot downwards
+        for (int level = 1; level < LEVELS; ++level) {
+            if ((now_ & ((1ull << (BITS * level)) - 1)) != 0) break;
+            cascade(level);
+        }
+        if (count_ == 0) {
+            // nothing armed: skip ahead instead of walking empty slots
+            now_ = target;
+            break;
+        }
+        Timer*& head = slots_[0][now_ & MASK];
+        while (head) {
+            Timer& t = *head;
+            unlink(t);
+            t.fn_();   // may re-arm t or touch other timers
+        }
+    }
+}
+
+} // namespace aio
@@ -0,0 +1,81 @@
+// timer_wheel.hpp (C++17)
+// Hierarchical timer wheel for per-connection deadlines.
+//
+// Four levels of 64 slots; level 0 advances one slot per tick and each higher
+// level covers 64 slots of the one below, so with the default 100 ms tick
+// the wheel spans about 19 days (longer deadlines wait in the top level).
+// Arming, re-arming and cancelling are O(1) list operations; a timer is moved
+// down a level at most three times before it fires. Timers are intrusive: the owner keeps the Timer (e.g. in a
+// coroutine frame) and destroying it cancels it.
+//
+// Not thread-safe; every EventLoop owns one (EventLoop::wheel()).
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <utility>
+
+namespace aio {
+
+class TimerWheel {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    class Timer {
+    public:
+        explicit Timer(std::function<void()> fn) : fn_(std::move(fn)) {}
+        ~Timer() { if (wheel_) wheel_->cancel(*this); }
+        Timer(const Timer&) = delete;
+        Timer& operator=(const Timer&) = delete;
+
+        bool armed() const { return wheel_ != nullptr; }
+
+    private:
+        friend class TimerWheel;
+        std::function<void()> fn_;   // runs on the loop thread when the timer fires
+        TimerWheel* wheel_ = nullptr;
+        Timer* prev_ = nullptr;
+        Timer* next_ = nullptr;
+        uint64_t expires_ = 0;       // tick
+        uint8_t level_ = 0;
+        uint8_t slot_ = 0;
+    };
+
+    explicit TimerWheel(Clock::duration tick = std::chrono::milliseconds(100));
+    ~TimerWheel();
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+    // (Re)arm t to fire after `delay`, rounded up to whole ticks.
+    void schedule(Timer& t, Clock::duration delay);
+    void cancel(Timer& t);
+
+    // Fire every timer that is due at `now`. A callback may re-arm or cancel
+    // any timer, including its own.
+    void advance(Clock::time_point now);
+
+    bool empty() const { return count_ == 0; }
+    size_t size() const { return count_; }
+    // When advance() has work next; only meaningful while !empty().
+    Clock::time_point next_tick() const { return origin_ + tick_ * (now_ + 1); }
+
+private:
+    static const int LEVELS = 4;
+    static const int BITS = 6;
+    static const uint64_t SLOTS = 1u << BITS;
+    static const uint64_t MASK = SLOTS - 1;
+
+    void insert(Timer& t);
+    void unlink(Timer& t);
+    void cascade(int level);
+
+    Clock::time_point origin_;
+    Clock::duration tick_;
+    uint64_t now_ = 0;   // ticks since origin_ already processed
+    size_t count_ = 0;
+    Timer* slots_[LEVELS][SLOTS] = {};
+};
+
+} // namespace aio
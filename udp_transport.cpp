@@ -0,0 +1,1280 @@
+// udp_transport.cpp (C++17)
+// Reliable UDP streams (see udp_transport.hpp).
+//
+// Packet layout (big endian): type u8, connection id u32, packet number u64
+// (0 for HELLO/HELLO_OK/ACK/CLOSE/FEC, which are never retransmitted), then
+//   DATA      stream id u32, offset u64, length u16, fin u8, bytes
+//   ACK       ack delay u32 (us), n u8, n x (first pn u64, last pn u64)
+//             from the highest down, m u8, m x (stream id u32, max offset u64)
+//   HELLO     version u8, FEC choice u8 (0 = none), k u8, r u8
+//   HELLO_OK  k u8, r u8: the server's FEC toward this client
+//   FEC       first pn u64, k u8, r u8, index u8, repair shard
+// Client streams have odd ids; a stream id the server has not seen yet opens
+// a stream.
+//
+// An FEC group is k consecutive DATA/PING packet numbers. Each packet's shard
+// is its type byte and everything after the header, zero padded to the
+// longest one in the group (the repair shard length). The receiver keeps recent shards and rebuilds what a group lost once
+// enough repair shards arrive; rebuilt packets are acked like any other.
+#include "udp_transport.hpp"
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <future>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "fec.hpp"
+
+namespace udp {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+using namespace std::chrono_literals;
+
+constexpr uint8_t VERSION = 1;
+constexpr size_t MAX_PAYLOAD = 1200;                 // stream bytes per packet
+constexpr size_t HEADER = 1 + 4 + 8;
+constexpr size_t DATA_HEADER = 4 + 8 + 2 + 1;
+constexpr size_t MSS = HEADER + DATA_HEADER + MAX_PAYLOAD;
+constexpr uint64_t STREAM_WINDOW = 4 << 20;          // receive window per stream
+constexpr size_t SEND_BUFFER = 4 << 20;              // unacked bytes per stream
+constexpr uint64_t PACKET_THRESHOLD = 3;
+constexpr size_t MAX_ACK_RANGES = 32;
+constexpr uint32_t MAX_NEW_STREAMS = 256;            // opened by one packet
+constexpr auto MAX_ACK_DELAY = 5ms;
+constexpr auto INITIAL_RTT = 100ms;
+constexpr auto HELLO_INTERVAL = 250ms;
+constexpr auto HANDSHAKE_TIMEOUT = 5s;
+constexpr auto IDLE_TIMEOUT = 30s;
+constexpr auto KEEPALIVE = 5s;
+constexpr auto LINGER = 2s;                          // client: unused connection stays up
+constexpr int SOCKET_BUFFER = 4 << 20;
+constexpr size_t SHARD = 1 + DATA_HEADER + MAX_PAYLOAD;   // FEC unit
+constexpr uint64_t FEC_WINDOW = 1024;                    // packets kept for repair
+
+enum Type : uint8_t { HELLO = 1, HELLO_OK = 2, DATA = 3, ACK = 4, PING = 5, CLOSE = 6, FEC = 7 };
+
+void put8(std::string& b, uint8_t v) { b.push_back((char)v); }
+void put16(std::string& b, uint16_t v) { for (int i = 1; i >= 0; --i) b.push_back((char)(v >> (8 * i))); }
+void put32(std::string& b, uint32_t v) { for (int i = 3; i >= 0; --i) b.push_back((char)(v >> (8 * i))); }
+void put64(std::string& b, uint64_t v) { for (int i = 7; i >= 0; --i) b.push_back((char)(v >> (8 * i))); }
+
+// Bounds-checked big-endian reader over one datagram.
+struct Reader {
+    const unsigned char* p;
+    size_t left;
+    bool ok = true;
+
+    uint64_t get(size_t n) {
+        if (left < n) { ok = false; left = 0; return 0; }
+        uint64_t v = 0;
+        for (size_t i = 0; i < n; ++i) v = (v << 8) | p[i];
+        p += n;
+        left -= n;
+        return v;
+    }
+};
+
+// Disjoint [start, end) ranges: acked stream bytes, received packet numbers.
+class RangeSet {
+public:
+    void add(uint64_t s, uint64_t e) {
+        if (s >= e) return;
+        auto it = r_.upper_bound(s);
+        if (it != r_.begin()) {
+            auto prev = std::prev(it);
+            if (prev->second >= s) {
+                s = prev->first;
+                e = std::max(e, prev->second);
+                r_.erase(prev);
+            }
+        }
+        while (it != r_.end() && it->first <= e) {
+            e = std::max(e, it->second);
+            it = r_.erase(it);
+        }
+        r_.emplace(s, e);
+    }
+    bool contains(uint64_t s, uint64_t e) const {
+        auto it = r_.upper_bound(s);
+        if (it == r_.begin()) return false;
+        --it;
+        return it->first <= s && it->second >= e;
+    }
+    // End of the range covering x, or x itself.
+    uint64_t covered_until(uint64_t x) const {
+        auto it = r_.upper_bound(x);
+        if (it == r_.begin()) return x;
+        --it;
+        return it->second > x ? it->second : x;
+    }
+    void drop_below(uint64_t x) {
+        while (!r_.empty() && r_.begin()->second <= x) r_.erase(r_.begin());
+    }
+    const std::map<uint64_t, uint64_t>& ranges() const { return r_; }
+
+private:
+    std::map<uint64_t, uint64_t> r_;
+};
+
+struct Stream {
+    uint32_t id = 0;
+    int fd = -1;                  // transport's end of the socketpair
+    bool can_read = true;         // edge-triggered readiness of fd
+    bool can_write = true;
+
+    // local fd -> peer
+    std::string sbuf;             // unacked data; sbuf[shead] is offset sbase
+    size_t shead = 0;
+    uint64_t sbase = 0;
+    uint64_t snext = 0;           // first offset never sent
+    uint64_t peer_max = STREAM_WINDOW;
+    RangeSet acked;
+    std::deque<std::pair<uint64_t, uint64_t>> retx;   // lost [start, end)
+    bool retx_fin = false;
+    bool local_eof = false;
+    bool fin_sent = false;
+    bool fin_acked = false;
+
+    // peer -> local fd
+    uint64_t rnext = 0;           // next in-order offset
+    std::map<uint64_t, std::string> ooo;   // arrived ahead of rnext
+    std::string rbuf;             // in order, not yet written to fd
+    size_t rhead = 0;
+    uint64_t consumed = 0;        // written to fd
+    uint64_t advertised = STREAM_WINDOW;
+    bool window_dirty = false;
+    bool sink_closed = false;     // the session closed its end; data is dropped
+    bool peer_fin = false;
+    uint64_t fin_off = 0;
+    bool fin_delivered = false;
+
+    uint64_t send_end() const { return sbase + (sbuf.size() - shead); }
+    bool done() const { return fin_acked && sbase == send_end() && fin_delivered; }
+};
+
+struct SentPacket {
+    Clock::time_point time;
+    size_t bytes = 0;
+    bool has_data = false;        // PING otherwise
+    uint32_t sid = 0;
+    uint64_t off = 0;
+    uint32_t len = 0;
+    bool fin = false;
+    // FEC: last packet of the closed group and when its repair went out;
+    // loss detection counts from there (0 = not protected)
+    uint64_t group_end = 0;
+    Clock::time_point group_closed;
+};
+
+struct FecGroup {
+    int k = 0;
+    int r = 0;
+    std::vector<std::string> repair;   // by index; empty = not received
+};
+
+struct Conn {
+    uint32_t id = 0;
+    int udp_fd = -1;
+    bool client = false;          // client connections own a connected udp_fd
+    sockaddr_storage peer{};
+    socklen_t peer_len = 0;
+    bool established = false;
+    bool dead = false;
+    Clock::time_point created, last_recv, last_send, hello_sent, idle_since;
+    std::map<uint32_t, std::unique_ptr<Stream>> streams;
+    uint32_t next_sid = 1;
+    uint32_t max_peer_sid = 0;
+    size_t rr = 0;                // round robin position among streams
+
+    // sending
+    uint64_t next_pn = 1;
+    std::map<uint64_t, SentPacket> sent;
+    uint64_t largest_acked = 0;
+    size_t inflight = 0;
+    double cwnd = 10 * MSS;
+    double ssthresh = std::numeric_limits<double>::max();
+    uint64_t recovery_pn = 0;     // packets below this were sent before the last loss
+    Clock::duration srtt = INITIAL_RTT, rttvar = INITIAL_RTT / 2, latest_rtt = INITIAL_RTT;
+    bool has_rtt = false;
+    int pto_count = 0;
+    Clock::time_point last_eliciting;
+    Clock::time_point loss_time;  // next time-threshold loss check, or epoch
+    int probes = 0;               // packets a probe timeout may send beyond cwnd
+    bool ping_due = false;
+    double pace_credit = 16 * MSS;
+    Clock::time_point pace_last;
+    FecConfig fec;                // what we send with
+    uint64_t fec_first = 0;       // open group: first packet number
+    std::vector<std::string> fec_shards;
+
+    // receiving
+    RangeSet rcvd;
+    uint64_t largest_rcvd = 0;
+    Clock::time_point largest_rcvd_time;
+    int unacked = 0;
+    bool ack_now = false;
+    Clock::time_point ack_deadline;   // epoch = none
+    bool peer_fec = false;        // the peer sends repair packets
+    std::map<uint64_t, std::string> recent;    // shards of received packets
+    std::map<uint64_t, FecGroup> groups;       // by first packet number
+    uint64_t recovered = 0;
+};
+
+bool same_addr(const sockaddr_storage& a, const sockaddr_storage& b) {
+    if (a.ss_family != b.ss_family) return false;
+    if (a.ss_family == AF_INET) {
+        auto& x = (const sockaddr_in&)a;
+        auto& y = (const sockaddr_in&)b;
+        return x.sin_port == y.sin_port && x.sin_addr.s_addr == y.sin_addr.s_addr;
+    }
+    if (a.ss_family == AF_INET6) {
+        auto& x = (const sockaddr_in6&)a;
+        auto& y = (const sockaddr_in6&)b;
+        return x.sin6_port == y.sin6_port && std::memcmp(&x.sin6_addr, &y.sin6_addr, sizeof(x.sin6_addr)) == 0;
+    }
+    return false;
+}
+
+bool valid_fec(const FecConfig& f) {
+    return f.k >= 1 && f.k <= MAX_FEC_GROUP && f.r >= 1 && f.r <= MAX_FEC_GROUP;
+}
+
+void set_nonblocking(int fd) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+}
+
+} // namespace
+
+// One thread running every connection of a server socket, or every client
+// connection of the process.
+class Engine {
+public:
+    // server
+    Engine(int udp_fd, Server::StreamHandler on_stream, const FecConfig& fec)
+        : handler_(std::move(on_stream)), server_fd_(udp_fd), fec_(fec) {
+        init();
+        tune_socket(udp_fd);
+        watch(udp_fd);
+        thread_ = std::thread([this] { run(); });
+    }
+    // client
+    Engine() {
+        init();
+        FecConfig fec;
+        if (const char* env = std::getenv("FILESHARE_UDP_FEC"); env && parse_fec(env, fec)) {
+            fec_ = fec;
+            fec_chosen_ = true;
+        }
+        thread_ = std::thread([this] { run(); });
+    }
+    ~Engine() {
+        post([this] {
+            for (auto& [id, c] : conns_) close_conn(*c, true);
+            reap();
+            stop_ = true;
+        });
+        thread_.join();
+        if (server_fd_ >= 0) ::close(server_fd_);
+        ::close(wake_fd_);
+        ::close(ep_);
+    }
+
+    void post(std::function<void()> fn) {
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            tasks_.push_back(std::move(fn));
+        }
+        uint64_t one = 1;
+        if (::write(wake_fd_, &one, sizeof(one)) < 0) { /* counter already set */ }
+    }
+
+    // client: a stream on a (possibly new) connection to addr
+    int open_stream(const sockaddr_storage& addr, socklen_t len) {
+        auto done = std::make_shared<std::promise<int>>();
+        auto result = done->get_future();
+        post([this, addr, len, done] { done->set_value(new_client_stream(addr, len)); });
+        return result.get();
+    }
+
+    void stop_accepting() { accepting_ = false; }
+
+    // server: default for new connections; client: our choice for new ones
+    void set_fec(const FecConfig& fec) {
+        post([this, fec] {
+            fec_ = fec;
+            fec_chosen_ = true;
+        });
+    }
+
+    void close_all() {
+        accepting_ = false;
+        post([this] {
+            for (auto& [id, c] : conns_) close_conn(*c, true);
+            reap();
+            if (server_fd_ >= 0) {
+                epoll_ctl(ep_, EPOLL_CTL_DEL, server_fd_, nullptr);
+                ::close(server_fd_);
+                server_fd_ = -1;
+            }
+        });
+    }
+
+private:
+    void init() {
+        ep_ = epoll_create1(EPOLL_CLOEXEC);
+        wake_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        watch(wake_fd_);
+        if (const char* loss = std::getenv("FILESHARE_UDP_LOSS")) loss_ = std::atof(loss);
+    }
+
+    static void tune_socket(int fd) {
+        set_nonblocking(fd);
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &SOCKET_BUFFER, sizeof(SOCKET_BUFFER));   // best effort
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &SOCKET_BUFFER, sizeof(SOCKET_BUFFER));
+    }
+
+    void watch(int fd, uint32_t events = EPOLLIN) {
+        epoll_event ev{};
+        ev.events = events;
+        ev.data.fd = fd;
+        epoll_ctl(ep_, EPOLL_CTL_ADD, fd, &ev);
+    }
+
+    // ---- event loop ----
+    void run() {
+        while (!stop_) {
+            auto now = Clock::now();
+            int timeout = -1;
+            auto next = next_deadline(now);
+            if (next != Clock::time_point::max()) {
+                auto ms = std::chrono::ceil<std::chrono::milliseconds>(next - now).count();
+                timeout = (int)std::clamp<int64_t>(ms, 0, 60000);
+            }
+            epoll_event evs[64];
+            int n = epoll_wait(ep_, evs, 64, timeout);
+            for (int i = 0; i < n; ++i) {
+                int fd = evs[i].data.fd;
+                if (fd == wake_fd_) {
+                    uint64_t v;
+                    while (::read(wake_fd_, &v, sizeof(v)) > 0) {}
+                    run_tasks();
+                } else if (fd == server_fd_ || client_udp_.count(fd)) {
+                    read_datagrams(fd);
+                } else if (auto it = locals_.find(fd); it != locals_.end()) {
+                    if (evs[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) it->second.second->can_read = true;
+                    if (evs[i].events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) it->second.second->can_write = true;
+                }
+            }
+            now = Clock::now();
+            for (auto& [id, c] : conns_) service(*c, now);
+            reap();
+        }
+    }
+
+    void run_tasks() {
+        std::vector<std::function<void()>> tasks;
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            tasks.swap(tasks_);
+        }
+        for (auto& t : tasks) t();
+    }
+
+    Clock::time_point next_deadline(Clock::time_point now) {
+        auto next = Clock::time_point::max();
+        auto at = [&](Clock::time_point t) { if (t != Clock::time_point{}) next = std::min(next, t); };
+        for (auto& [id, c] : conns_) {
+            if (c->client && !c->established) {
+                at(c->hello_sent + HELLO_INTERVAL);
+                at(c->created + HANDSHAKE_TIMEOUT);
+                continue;
+            }
+            at(c->ack_deadline);
+            at(c->loss_time);
+            if (!c->sent.empty()) at(pto_time(*c));
+            at(c->last_recv + IDLE_TIMEOUT);
+            if (c->client && !c->streams.empty()) at(c->last_send + KEEPALIVE);
+            if (c->sent.empty() && flow_blocked(*c)) at(blocked_probe_time(*c));
+            if (c->client && c->streams.empty()) at(c->idle_since + LINGER);
+            if (has_data_to_send(*c) && c->inflight + MSS <= c->cwnd) at(pace_ready(*c, now));
+        }
+        return next;
+    }
+
+    // ---- datagrams in ----
+    void read_datagrams(int fd) {
+        unsigned char buf[2048];
+        for (int i = 0; i < 1024; ++i) {
+            sockaddr_storage from{};
+            socklen_t flen = sizeof(from);
+            ssize_t n = ::recvfrom(fd, buf, sizeof(buf), 0, (sockaddr*)&from, &flen);
+            if (n < 0) break;   // EAGAIN, or an ICMP error on a client socket
+            if (loss_ > 0 && std::uniform_real_distribution<double>(0, 1)(rng_) < loss_) continue;
+            handle_packet(fd, from, flen, buf, (size_t)n);
+        }
+    }
+
+    void handle_packet(int fd, const sockaddr_storage& from, socklen_t flen, const unsigned char* p, size_t n) {
+        Reader r{p, n};
+        uint8_t type = (uint8_t)r.get(1);
+        uint32_t id = (uint32_t)r.get(4);
+        uint64_t pn = r.get(8);
+        if (!r.ok) return;
+        auto now = Clock::now();
+
+        auto it = conns_.find(id);
+        Conn* c = it == conns_.end() ? nullptr : it->second.get();
+        if (fd == server_fd_) {
+            if (type == HELLO) {
+                if (!c && accepting_) {
+                    c = new_server_conn(id, from, flen, now);
+                    c->fec = fec_;
+                    r.get(1);   // version
+                    bool chosen = r.get(1) != 0;
+                    FecConfig want{(int)r.get(1), (int)r.get(1)};
+                    if (r.ok && chosen && (want.r == 0 || valid_fec(want))) c->fec = want;
+                }
+                if (c && same_addr(c->peer, from)) send_hello_ok(*c);
+                return;
+            }
+            if (!c || !same_addr(c->peer, from)) {
+                // unknown connection (e.g. from before a restart): tell the peer
+                if (type != CLOSE) send_close(fd, from, flen, id);
+                return;
+            }
+        } else if (!c || c->udp_fd != fd) {
+            return;
+        }
+        if (c->dead) return;
+        c->last_recv = now;
+
+        switch (type) {
+        case HELLO_OK:
+            if (c->client && !c->established) {
+                c->established = true;
+                update_rtt(*c, now - c->hello_sent, 0us);
+                // without a choice of our own, send like the server does
+                FecConfig theirs{(int)r.get(1), (int)r.get(1)};
+                if (!fec_chosen_ && r.ok && valid_fec(theirs)) c->fec = theirs;
+            }
+            break;
+        case DATA:
+        case PING:
+            if (!note_packet(*c, pn, now)) break;   // duplicate
+            if (c->peer_fec) keep_shard(*c, pn, type, r);
+            if (type == DATA) on_data(*c, r);
+            if (c->peer_fec) try_repair_around(*c, pn, now);
+            break;
+        case FEC:
+            on_fec(*c, r, now);
+            break;
+        case ACK:
+            on_ack(*c, r, now);
+            break;
+        case CLOSE:
+            close_conn(*c, false);
+            break;
+        default:
+            break;
+        }
+    }
+
+    // Record an ack-eliciting packet; false if it was seen before.
+    bool note_packet(Conn& c, uint64_t pn, Clock::time_point now) {
+        if (c.rcvd.contains(pn, pn + 1)) {
+            c.ack_now = true;   // our ACK was probably lost
+            return false;
+        }
+        if (pn != c.largest_rcvd + 1) c.ack_now = true;   // gap: report it at once
+        c.rcvd.add(pn, pn + 1);
+        if (pn > c.largest_rcvd) {
+            c.largest_rcvd = pn;
+            c.largest_rcvd_time = now;
+        }
+        if (c.largest_rcvd > 65536) c.rcvd.drop_below(c.largest_rcvd - 65536);
+        if (++c.unacked >= 2) c.ack_now = true;
+        else if (c.ack_deadline == Clock::time_point{}) c.ack_deadline = now + MAX_ACK_DELAY;
+        return true;
+    }
+
+    // ---- forward error correction, receiving ----
+    static void keep_shard(Conn& c, uint64_t pn, uint8_t type, const Reader& r) {
+        std::string shard(1, (char)type);
+        shard.append((const char*)r.p, std::min(r.left, SHARD - 1));
+        c.recent[pn] = std::move(shard);
+        while (!c.recent.empty() && c.recent.begin()->first + FEC_WINDOW < c.largest_rcvd)
+            c.recent.erase(c.recent.begin());
+    }
+
+    void on_fec(Conn& c, Reader& r, Clock::time_point now) {
+        uint64_t first = r.get(8);
+        FecConfig g{(int)r.get(1), (int)r.get(1)};
+        int index = (int)r.get(1);
+        if (!r.ok || !valid_fec(g) || index >= g.r || r.left == 0 || first == 0) return;
+        if (first + g.k + FEC_WINDOW < c.largest_rcvd) return;   // too old
+        c.peer_fec = true;
+        auto& group = c.groups[first];
+        if (group.k == 0) {
+            group.k = g.k;
+            group.r = g.r;
+            group.repair.resize(g.r);
+        }
+        if (group.k != g.k || group.r != g.r) return;
+        group.repair[index].assign((const char*)r.p, std::min(r.left, SHARD));
+        try_repair(c, first, now);
+        while (!c.groups.empty() && c.groups.begin()->first + FEC_WINDOW < c.largest_rcvd)
+            c.groups.erase(c.groups.begin());
+    }
+
+    // A late packet may complete the group it belongs to.
+    void try_repair_around(Conn& c, uint64_t pn, Clock::time_point now) {
+        auto it = c.groups.upper_bound(pn);
+        if (it == c.groups.begin()) return;
+        --it;
+        if (pn < it->first + (uint64_t)it->second.k) try_repair(c, it->first, now);
+    }
+
+    // Rebuild the group's missing packets if enough shards are here, and
+    // process them as if they had arrived.
+    void try_repair(Conn& c, uint64_t first, Clock::time_point now) {
+        auto git = c.groups.find(first);
+        FecGroup& g = git->second;
+        std::vector<std::string> bufs(g.k + g.r);
+        std::vector<uint8_t*> ptrs(g.k + g.r);
+        bool present[fec::MAX_SHARDS];
+        int erased = 0, repairs = 0;
+        bool lost = false;
+        for (int i = 0; i < g.k; ++i) {
+            uint64_t pn = first + i;
+            if (!c.rcvd.contains(pn, pn + 1)) lost = true;
+            auto it = c.recent.find(pn);
+            present[i] = it != c.recent.end();
+            if (present[i]) bufs[i] = it->second;
+            else ++erased;
+        }
+        if (!lost) { c.groups.erase(git); return; }
+        size_t len = 0;
+        for (int j = 0; j < g.r; ++j) {
+            present[g.k + j] = !g.repair[j].empty();
+            if (!present[g.k + j]) continue;
+            if (len && g.repair[j].size() != len) { c.groups.erase(git); return; }   // not one group
+            len = g.repair[j].size();
+            bufs[g.k + j] = g.repair[j];
+            ++repairs;
+        }
+        if (erased > repairs) return;   // wait for more
+        for (int i = 0; i < g.k + g.r; ++i) {
+            if (bufs[i].size() > len) { c.groups.erase(git); return; }
+            bufs[i].resize(len, '\0');
+            ptrs[i] = (uint8_t*)bufs[i].data();
+        }
+        if (!fec::reconstruct(g.k, g.r, len, ptrs.data(), present)) return;
+        int k = g.k;
+        c.groups.erase(git);
+        for (int i = 0; i < k; ++i) {
+            uint64_t pn = first + i;
+            if (present[i] || !note_packet(c, pn, now)) continue;
+            ++c.recovered;
+            uint8_t type = (uint8_t)bufs[i][0];
+            Reader r{(const unsigned char*)bufs[i].data() + 1, len - 1};
+            c.recent[pn] = bufs[i];
+            if (type == DATA) on_data(c, r);
+        }
+    }
+
+    void on_data(Conn& c, Reader& r) {
+        uint32_t sid = (uint32_t)r.get(4);
+        uint64_t off = r.get(8);
+        size_t len = (size_t)r.get(2);
+        bool fin = r.get(1) != 0;
+        if (!r.ok || r.left < len) return;
+        Stream* s = find_stream(c, sid);
+        if (!s) {
+            // a new client stream opens a session, and so does every lower id
+            // not seen yet (its first packet was lost or overtaken); anything
+            // else belongs to a stream that is already finished
+            if (c.client || sid % 2 == 0 || sid <= c.max_peer_sid) return;
+            if (sid - c.max_peer_sid > 2 * MAX_NEW_STREAMS) return;
+            for (uint32_t id = c.max_peer_sid + (c.max_peer_sid % 2 ? 2 : 1); id <= sid; id += 2) {
+                s = new_stream(c, id, nullptr);
+                if (!s) return;
+            }
+            c.max_peer_sid = sid;
+        }
+        std::string data((const char*)r.p, len);
+        uint64_t end = off + len;
+        if (end > s->advertised) return;   // beyond our window: a broken peer
+        if (fin) {
+            s->peer_fin = true;
+            s->fin_off = end;
+        }
+        if (end <= s->rnext) return;
+        if (off > s->rnext) {
+            auto& slot = s->ooo[off];
+            if (data.size() > slot.size()) slot = std::move(data);
+            return;
+        }
+        append_in_order(*s, data, off);
+        while (!s->ooo.empty() && s->ooo.begin()->first <= s->rnext) {
+            auto node = s->ooo.extract(s->ooo.begin());
+            if (node.key() + node.mapped().size() > s->rnext) append_in_order(*s, node.mapped(), node.key());
+        }
+    }
+
+    static void append_in_order(Stream& s, const std::string& data, uint64_t off) {
+        size_t skip = (size_t)(s.rnext - off);
+        if (s.sink_closed) s.consumed += data.size() - skip;
+        else s.rbuf.append(data, skip, std::string::npos);
+        s.rnext = off + data.size();
+    }
+
+    void on_ack(Conn& c, Reader& r, Clock::time_point now) {
+        auto ack_delay = std::chrono::microseconds(r.get(4));
+        size_t nranges = (size_t)r.get(1);
+        uint64_t largest = 0;
+        bool largest_newly_acked = false;
+        Clock::time_point largest_sent_time;
+        for (size_t i = 0; i < nranges && r.ok; ++i) {
+            uint64_t lo = r.get(8), hi = r.get(8);
+            if (!r.ok || lo > hi) return;
+            largest = std::max(largest, hi);
+            for (auto it = c.sent.lower_bound(lo); it != c.sent.end() && it->first <= hi;) {
+                if (it->first == largest) {
+                    largest_newly_acked = true;
+                    largest_sent_time = it->second.time;
+                }
+                on_packet_acked(c, it->first, it->second);
+                it = c.sent.erase(it);
+            }
+        }
+        size_t nwin = (size_t)r.get(1);
+        for (size_t i = 0; i < nwin && r.ok; ++i) {
+            uint32_t sid = (uint32_t)r.get(4);
+            uint64_t max = r.get(8);
+            if (Stream* s = find_stream(c, sid)) s->peer_max = std::max(s->peer_max, max);
+        }
+        if (largest > c.largest_acked) c.largest_acked = largest;
+        if (largest_newly_acked) {
+            update_rtt(c, now - largest_sent_time, ack_delay);
+            c.pto_count = 0;
+        }
+        detect_loss(c, now);
+    }
+
+    void on_packet_acked(Conn& c, uint64_t pn, const SentPacket& p) {
+        c.inflight -= std::min(c.inflight, p.bytes);
+        if (pn >= c.recovery_pn) {
+            // NewReno: slow start, then one MSS per window
+            if (c.cwnd < c.ssthresh) c.cwnd += (double)p.bytes;
+            else c.cwnd += (double)MSS * (double)p.bytes / c.cwnd;
+        }
+        if (!p.has_data) return;
+        Stream* s = find_stream(c, p.sid);
+        if (!s) return;
+        s->acked.add(p.off, p.off + p.len);
+        if (p.fin) s->fin_acked = true;
+        uint64_t base = s->acked.covered_until(s->sbase);
+        if (base > s->sbase) {
+            s->shead += (size_t)(base - s->sbase);
+            s->sbase = base;
+            s->acked.drop_below(base);
+            if (s->shead >= 65536 && s->shead * 2 >= s->sbuf.size()) {
+                s->sbuf.erase(0, s->shead);
+                s->shead = 0;
+            }
+        }
+    }
+
+    static void update_rtt(Conn& c, Clock::duration sample, Clock::duration ack_delay) {
+        c.latest_rtt = sample;
+        if (!c.has_rtt) {
+            c.has_rtt = true;
+            c.srtt = sample;
+            c.rttvar = sample / 2;
+            return;
+        }
+        if (sample > ack_delay + 1ms) sample -= std::min<Clock::duration>(ack_delay, MAX_ACK_DELAY);
+        auto diff = c.srtt > sample ? c.srtt - sample : sample - c.srtt;
+        c.rttvar = (3 * c.rttvar + diff) / 4;
+        c.srtt = (7 * c.srtt + sample) / 8;
+    }
+
+    static Clock::duration loss_delay(const Conn& c) {
+        auto d = std::max(c.srtt, c.latest_rtt) * 9 / 8;
+        return std::max<Clock::duration>(d, 1ms);
+    }
+
+    static Clock::time_point pto_time(const Conn& c) {
+        auto pto = c.srtt + std::max<Clock::duration>(4 * c.rttvar, 1ms) + MAX_ACK_DELAY;
+        return c.last_eliciting + pto * (1 << std::min(c.pto_count, 6));
+    }
+
+    void detect_loss(Conn& c, Clock::time_point now) {
+        auto delay = loss_delay(c);
+        c.loss_time = {};
+        bool congestion = false;
+        for (auto it = c.sent.begin(); it != c.sent.end() && it->first < c.largest_acked;) {
+            // a packet under FEC is only missing once its repair had a chance
+            uint64_t last = it->first;
+            auto sent_at = it->second.time;
+            if (it->second.group_end) {
+                last = it->second.group_end;
+                sent_at = it->second.group_closed;
+            } else if (!c.fec_shards.empty() && it->first >= c.fec_first) {
+                ++it;   // its group is still open
+                continue;
+            }
+            if (last + PACKET_THRESHOLD <= c.largest_acked || sent_at + delay <= now) {
+                if (it->first >= c.recovery_pn) congestion = true;
+                requeue(c, it->second);
+                it = c.sent.erase(it);
+            } else {
+                auto t = sent_at + delay;
+                if (c.loss_time == Clock::time_point{} || t < c.loss_time) c.loss_time = t;
+                ++it;
+            }
+        }
+        if (congestion) {
+            // one reduction per round trip: later losses of packets sent
+            // before this point belong to the same event
+            c.recovery_pn = c.next_pn;
+            c.cwnd = std::max(c.cwnd / 2, 2.0 * MSS);
+            c.ssthresh = c.cwnd;
+        }
+    }
+
+    void requeue(Conn& c, const SentPacket& p) {
+        c.inflight -= std::min(c.inflight, p.bytes);
+        if (!p.has_data) return;
+        Stream* s = find_stream(c, p.sid);
+        if (!s) return;
+        if (p.len) s->retx.emplace_back(p.off, p.off + p.len);
+        if (p.fin) s->retx_fin = true;
+    }
+
+    // ---- connections and streams ----
+    Conn* new_server_conn(uint32_t id, const sockaddr_storage& from, socklen_t flen, Clock::time_point now) {
+        auto c = std::make_unique<Conn>();
+        c->id = id;
+        c->udp_fd = server_fd_;
+        c->peer = from;
+        c->peer_len = flen;
+        c->established = true;
+        c->created = c->last_recv = c->last_send = c->pace_last = now;
+        Conn* raw = c.get();
+        conns_[id] = std::move(c);
+        return raw;
+    }
+
+    int new_client_stream(const sockaddr_storage& addr, socklen_t len) {
+        Conn* c = nullptr;
+        for (auto& [id, conn] : conns_) {
+            if (conn->client && !conn->dead && same_addr(conn->peer, addr)) { c = conn.get(); break; }
+        }
+        if (!c) {
+            int fd = ::socket(addr.ss_family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+            if (fd < 0) return -1;
+            if (::connect(fd, (const sockaddr*)&addr, len) < 0) { ::close(fd); return -1; }
+            tune_socket(fd);
+            watch(fd);
+            client_udp_.insert({fd, 0});
+            auto conn = std::make_unique<Conn>();
+            uint32_t id;
+            do id = (uint32_t)rng_(); while (id == 0 || conns_.count(id));
+            conn->id = id;
+            conn->udp_fd = fd;
+            conn->client = true;
+            if (fec_chosen_) conn->fec = fec_;
+            conn->peer = addr;
+            conn->peer_len = len;
+            auto now = Clock::now();
+            conn->created = conn->last_recv = conn->last_send = conn->pace_last = now;
+            c = conn.get();
+            conns_[id] = std::move(conn);
+            send_hello(*c, now);
+        }
+        int app_fd = -1;
+        Stream* s = new_stream(*c, c->next_sid, &app_fd);
+        if (!s) return -1;
+        c->next_sid += 2;
+        return app_fd;
+    }
+
+    // app_fd set: the caller takes the other end (client); otherwise it goes
+    // to the stream handler (server).
+    Stream* new_stream(Conn& c, uint32_t sid, int* app_fd) {
+        int sv[2];
+        if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) return nullptr;
+        set_nonblocking(sv[0]);
+        auto s = std::make_unique<Stream>();
+        s->id = sid;
+        s->fd = sv[0];
+        Stream* raw = s.get();
+        c.streams[sid] = std::move(s);
+        locals_[sv[0]] = {&c, raw};
+        watch(sv[0], EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET);
+        if (app_fd) *app_fd = sv[1];
+        else if (accepting_ && handler_) handler_(sv[1], c.peer);
+        else ::close(sv[1]);   // draining: the client sees the stream end at once
+        return raw;
+    }
+
+    static Stream* find_stream(Conn& c, uint32_t sid) {
+        auto it = c.streams.find(sid);
+        return it == c.streams.end() ? nullptr : it->second.get();
+    }
+
+    void drop_stream(Conn& c, std::map<uint32_t, std::unique_ptr<Stream>>::iterator it) {
+        locals_.erase(it->second->fd);
+        ::close(it->second->fd);   // also leaves the epoll set
+        c.streams.erase(it);
+    }
+
+    void close_conn(Conn& c, bool tell_peer) {
+        if (c.dead) return;
+        if (tell_peer) send_control(c, CLOSE);
+        while (!c.streams.empty()) drop_stream(c, c.streams.begin());
+        c.dead = true;
+    }
+
+    void reap() {
+        for (auto it = conns_.begin(); it != conns_.end();) {
+            if (!it->second->dead) { ++it; continue; }
+            if (it->second->client) {
+                client_udp_.erase(it->second->udp_fd);
+                ::close(it->second->udp_fd);
+            }
+            it = conns_.erase(it);
+        }
+    }
+
+    // ---- per-connection work after every wakeup ----
+    void service(Conn& c, Clock::time_point now) {
+        if (c.dead) return;
+        if (c.client && !c.established) {
+            if (now - c.created >= HANDSHAKE_TIMEOUT) { close_conn(c, false); return; }
+            if (now - c.hello_sent >= HELLO_INTERVAL) send_hello(c, now);
+        }
+        if (now - c.last_recv >= IDLE_TIMEOUT) { close_conn(c, true); return; }
+        for (auto& [sid, s] : c.streams) pump_local(*s);
+
+        if (c.loss_time != Clock::time_point{} && now >= c.loss_time) detect_loss(c, now);
+        if (!c.sent.empty() && now >= pto_time(c)) on_pto(c);
+        if (c.client && c.established && !c.streams.empty() && now - c.last_send >= KEEPALIVE) c.ping_due = true;
+        if (c.sent.empty() && flow_blocked(c) && now >= blocked_probe_time(c)) c.ping_due = true;
+
+        bool windows = std::any_of(c.streams.begin(), c.streams.end(),
+                                   [](auto& kv) { return kv.second->window_dirty; });
+        if (c.ack_now || windows || (c.ack_deadline != Clock::time_point{} && now >= c.ack_deadline))
+            send_ack(c, now);
+        if (c.established) send_data(c, now);
+
+        for (auto it = c.streams.begin(); it != c.streams.end();) {
+            if (it->second->done()) {
+                auto next = std::next(it);
+                drop_stream(c, it);
+                it = next;
+            } else {
+                ++it;
+            }
+        }
+        if (c.client && c.streams.empty()) {
+            if (c.idle_since == Clock::time_point{}) c.idle_since = now;
+            else if (now - c.idle_since >= LINGER) close_conn(c, true);
+        } else {
+            c.idle_since = {};
+        }
+    }
+
+    // Move bytes between the socketpair and the stream buffers.
+    static void pump_local(Stream& s) {
+        char buf[65536];
+        while (s.can_read && !s.local_eof && s.sbuf.size() - s.shead < SEND_BUFFER) {
+            size_t room = std::min(sizeof(buf), SEND_BUFFER - (s.sbuf.size() - s.shead));
+            ssize_t n = ::read(s.fd, buf, room);
+            if (n > 0) { s.sbuf.append(buf, (size_t)n); continue; }
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) { s.can_read = false; break; }
+            s.local_eof = true;   // EOF, or the session is gone
+        }
+        while (s.can_write && s.rhead < s.rbuf.size() && !s.sink_closed) {
+            ssize_t n = ::send(s.fd, s.rbuf.data() + s.rhead, s.rbuf.size() - s.rhead, MSG_NOSIGNAL);
+            if (n > 0) { s.rhead += (size_t)n; s.consumed += (uint64_t)n; continue; }
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) { s.can_write = false; break; }
+            // the session closed its end: nobody reads the rest
+            s.sink_closed = true;
+            s.consumed += s.rbuf.size() - s.rhead;
+            s.rhead = s.rbuf.size();
+        }
+        if (s.rhead == s.rbuf.size()) {
+            s.rbuf.clear();
+            s.rhead = 0;
+        }
+        if (s.peer_fin && s.rnext == s.fin_off && s.rbuf.empty() && !s.fin_delivered) {
+            ::shutdown(s.fd, SHUT_WR);
+            s.fin_delivered = true;
+        }
+        if (s.consumed + STREAM_WINDOW >= s.advertised + STREAM_WINDOW / 4) {
+            s.advertised = s.consumed + STREAM_WINDOW;
+            s.window_dirty = true;
+        }
+    }
+
+    void on_pto(Conn& c) {
+        // nothing acknowledged for too long: resend the oldest packet's data
+        // (or a PING) without shrinking the window, and back off
+        ++c.pto_count;
+        auto oldest = c.sent.begin();
+        requeue(c, oldest->second);
+        if (!oldest->second.has_data) c.ping_due = true;
+        c.sent.erase(oldest);
+        c.probes = 2;
+        c.loss_time = {};
+    }
+
+    // Data waits for the peer's window and nothing is in flight to bring an
+    // ACK with a newer one: a PING asks for it.
+    static bool flow_blocked(const Conn& c) {
+        for (auto& [sid, s] : c.streams)
+            if (s->snext < s->send_end() && s->snext >= s->peer_max) return true;
+        return false;
+    }
+    static Clock::time_point blocked_probe_time(const Conn& c) {
+        auto pto = c.srtt + std::max<Clock::duration>(4 * c.rttvar, 1ms) + MAX_ACK_DELAY;
+        return c.last_eliciting + std::max<Clock::duration>(pto, 50ms);
+    }
+
+    static bool has_data_to_send(const Conn& c) {
+        for (auto& [sid, s] : c.streams) {
+            if (!s->retx.empty() || s->retx_fin) return true;
+            if (s->snext < s->send_end() && s->snext < s->peer_max) return true;
+            if (s->local_eof && !s->fin_sent && s->snext == s->send_end()) return true;
+        }
+        return false;
+    }
+
+    // Pacing: about 1.25 windows per RTT, with bursts of up to 16 packets
+    // (or 2 ms worth, since the loop sleeps in whole milliseconds).
+    static double pace_rate(const Conn& c) {
+        double rtt = std::chrono::duration<double>(c.srtt).count();
+        return rtt > 0 ? 1.25 * c.cwnd / rtt : 0;
+    }
+    static void pace_refill(Conn& c, Clock::time_point now) {
+        double rate = pace_rate(c);
+        double elapsed = std::chrono::duration<double>(now - c.pace_last).count();
+        c.pace_last = now;
+        double cap = std::max(16.0 * MSS, rate * 0.002);
+        c.pace_credit = std::min(cap, c.pace_credit + elapsed * rate);
+    }
+    static Clock::time_point pace_ready(Conn& c, Clock::time_point now) {
+        pace_refill(c, now);
+        if (c.pace_credit >= MSS) return now;
+        double rate = pace_rate(c);
+        if (rate <= 0) return now;
+        auto wait = std::chrono::duration<double>((MSS - c.pace_credit) / rate);
+        return now + std::chrono::duration_cast<Clock::duration>(wait);
+    }
+
+    void send_data(Conn& c, Clock::time_point now) {
+        if (c.ping_due) {
+            std::string pkt;
+            header(pkt, PING, c.id, c.next_pn);
+            transmit(c, pkt, SentPacket{}, now);
+            c.ping_due = false;
+        }
+        pace_refill(c, now);
+        size_t nstreams = c.streams.size();
+        size_t idle_rounds = 0;
+        while (nstreams > 0 && idle_rounds < nstreams) {
+            if (c.probes == 0 && (c.inflight + MSS > c.cwnd || c.pace_credit < MSS)) break;
+            auto it = c.streams.begin();
+            std::advance(it, c.rr++ % nstreams);
+            if (send_stream_packet(c, *it->second, now)) {
+                idle_rounds = 0;
+                if (c.probes > 0) --c.probes;
+            } else {
+                ++idle_rounds;
+            }
+        }
+        // out of data or window: protect what went out now rather than wait
+        // for k packets (which could need acks that only the repair brings)
+        if (!c.fec_shards.empty() && (!has_data_to_send(c) || c.inflight + MSS > c.cwnd))
+            close_fec_group(c, now);
+    }
+
+    // ---- forward error correction, sending ----
+    void add_to_fec_group(Conn& c, uint64_t pn, const std::string& pkt, Clock::time_point now) {
+        if (c.fec_shards.empty()) c.fec_first = pn;
+        std::string shard(pkt, 0, 1);
+        shard.append(pkt, HEADER, std::string::npos);
+        c.fec_shards.push_back(std::move(shard));
+        if ((int)c.fec_shards.size() == c.fec.k) close_fec_group(c, now);
+    }
+
+    void close_fec_group(Conn& c, Clock::time_point now) {
+        int k = (int)c.fec_shards.size();
+        int r = c.fec.r;
+        size_t len = 0;
+        for (auto& shard : c.fec_shards) len = std::max(len, shard.size());
+        std::vector<const uint8_t*> data(k);
+        for (int i = 0; i < k; ++i) {
+            c.fec_shards[i].resize(len, '\0');
+            data[i] = (const uint8_t*)c.fec_shards[i].data();
+        }
+        std::vector<std::string> repair(r, std::string(len, '\0'));
+        std::vector<uint8_t*> out(r);
+        for (int j = 0; j < r; ++j) out[j] = (uint8_t*)repair[j].data();
+        fec::encode(k, r, len, data.data(), out.data());
+        for (int j = 0; j < r; ++j) {
+            std::string pkt;
+            pkt.reserve(HEADER + 11 + len);
+            header(pkt, FEC, c.id, 0);
+            put64(pkt, c.fec_first);
+            put8(pkt, (uint8_t)k);
+            put8(pkt, (uint8_t)r);
+            put8(pkt, (uint8_t)j);
+            pkt += repair[j];
+            c.pace_credit -= (double)pkt.size();
+            send_raw(c, pkt);
+        }
+        uint64_t end = c.fec_first + k - 1;
+        for (auto it = c.sent.lower_bound(c.fec_first); it != c.sent.end() && it->first <= end; ++it) {
+            it->second.group_end = end;
+            it->second.group_closed = now;
+        }
+        c.fec_shards.clear();
+    }
+
+    // One DATA packet for s (lost data first); false if s has nothing to send.
+    bool send_stream_packet(Conn& c, Stream& s, Clock::time_point now) {
+        uint64_t fin_at = s.local_eof ? s.send_end() : std::numeric_limits<uint64_t>::max();
+        uint64_t off = 0;
+        size_t len = 0;
+        bool found = false;
+        while (!s.retx.empty()) {
+            auto& [start, end] = s.retx.front();
+            start = std::max(start, s.sbase);
+            if (start >= end) { s.retx.pop_front(); continue; }
+            len = (size_t)std::min<uint64_t>(end - start, MAX_PAYLOAD);
+            if (s.acked.contains(start, start + len)) { start += len; continue; }
+            off = start;
+            start += len;
+            found = true;
+            break;
+        }
+        if (!found && s.snext < s.send_end() && s.snext < s.peer_max) {
+            off = s.snext;
+            len = (size_t)std::min<uint64_t>({MAX_PAYLOAD, s.send_end() - s.snext, s.peer_max - s.snext});
+            s.snext += len;
+            found = true;
+        }
+        if (!found && s.retx_fin && s.fin_sent) {
+            off = fin_at;
+            found = true;
+        }
+        if (!found && s.local_eof && !s.fin_sent && s.snext == s.send_end()) {
+            off = s.snext;
+            found = true;
+        }
+        if (!found) return false;
+        bool fin = off + len == fin_at;
+        if (fin) {
+            s.fin_sent = true;
+            s.retx_fin = false;
+        }
+
+        std::string pkt;
+        pkt.reserve(MSS);
+        header(pkt, DATA, c.id, c.next_pn);
+        put32(pkt, s.id);
+        put64(pkt, off);
+        put16(pkt, (uint16_t)len);
+        put8(pkt, fin ? 1 : 0);
+        pkt.append(s.sbuf, s.shead + (size_t)(off - s.sbase), len);
+        SentPacket sp;
+        sp.has_data = true;
+        sp.sid = s.id;
+        sp.off = off;
+        sp.len = (uint32_t)len;
+        sp.fin = fin;
+        transmit(c, pkt, sp, now);
+        return true;
+    }
+
+    // Send an ack-eliciting packet and track it until it is acked or lost.
+    void transmit(Conn& c, const std::string& pkt, SentPacket sp, Clock::time_point now) {
+        sp.time = now;
+        sp.bytes = pkt.size();
+        uint64_t pn = c.next_pn++;
+        c.sent[pn] = sp;
+        if (c.fec.enabled()) add_to_fec_group(c, pn, pkt, now);
+        c.inflight += pkt.size();
+        c.pace_credit -= (double)pkt.size();
+        c.last_eliciting = now;
+        send_raw(c, pkt);   // a full socket buffer is just another loss
+    }
+
+    void send_ack(Conn& c, Clock::time_point now) {
+        std::string pkt;
+        header(pkt, ACK, c.id, 0);
+        auto delay = std::chrono::duration_cast<std::chrono::microseconds>(now - c.largest_rcvd_time);
+        put32(pkt, c.largest_rcvd ? (uint32_t)std::min<int64_t>(delay.count(), UINT32_MAX) : 0);
+        auto& ranges = c.rcvd.ranges();
+        size_t n = std::min(ranges.size(), MAX_ACK_RANGES);
+        put8(pkt, (uint8_t)n);
+        auto it = ranges.rbegin();
+        for (size_t i = 0; i < n; ++i, ++it) {
+            put64(pkt, it->first);
+            put64(pkt, it->second - 1);
+        }
+        size_t count_at = pkt.size();
+        put8(pkt, 0);
+        // ACKs are not retransmitted, so every one repeats the open windows
+        // (changed ones first): a lost update must not leave the peer blocked
+        uint8_t nwin = 0;
+        for (int pass = 0; pass < 2; ++pass) {
+            for (auto& [sid, s] : c.streams) {
+                if (nwin == 64 || s->window_dirty != (pass == 0) || s->peer_fin) continue;
+                put32(pkt, sid);
+                put64(pkt, s->advertised);
+                s->window_dirty = false;
+                ++nwin;
+            }
+        }
+        pkt[count_at] = (char)nwin;
+        send_raw(c, pkt);
+        c.unacked = 0;
+        c.ack_now = false;
+        c.ack_deadline = {};
+    }
+
+    void send_hello(Conn& c, Clock::time_point now) {
+        std::string pkt;
+        header(pkt, HELLO, c.id, 0);
+        put8(pkt, VERSION);
+        put8(pkt, fec_chosen_ ? 1 : 0);
+        put8(pkt, (uint8_t)fec_.k);
+        put8(pkt, (uint8_t)fec_.r);
+        send_raw(c, pkt);
+        c.hello_sent = now;
+    }
+
+    void send_hello_ok(Conn& c) {
+        std::string pkt;
+        header(pkt, HELLO_OK, c.id, 0);
+        put8(pkt, (uint8_t)c.fec.k);
+        put8(pkt, (uint8_t)c.fec.r);
+        send_raw(c, pkt);
+    }
+
+    void send_control(Conn& c, Type type) {
+        std::string pkt;
+        header(pkt, type, c.id, 0);
+        send_raw(c, pkt);
+    }
+
+    void send_close(int fd, const sockaddr_storage& to, socklen_t len, uint32_t id) {
+        std::string pkt;
+        header(pkt, CLOSE, id, 0);
+        ::sendto(fd, pkt.data(), pkt.size(), 0, (const sockaddr*)&to, len);
+    }
+
+    static void header(std::string& pkt, Type type, uint32_t id, uint64_t pn) {
+        put8(pkt, type);
+        put32(pkt, id);
+        put64(pkt, pn);
+    }
+
+    void send_raw(Conn& c, const std::string& pkt) {
+        if (c.client) ::send(c.udp_fd, pkt.data(), pkt.size(), 0);
+        else ::sendto(c.udp_fd, pkt.data(), pkt.size(), 0, (const sockaddr*)&c.peer, c.peer_len);
+        c.last_send = Clock::now();
+    }
+
+    Server::StreamHandler handler_;
+    int server_fd_ = -1;
+    int ep_ = -1;
+    int wake_fd_ = -1;
+    std::thread thread_;
+    std::mutex mu_;
+    std::vector<std::function<void()>> tasks_;
+    bool stop_ = false;                          // transport thread only
+    std::atomic<bool> accepting_{true};
+    std::unordered_map<uint32_t, std::unique_ptr<Conn>> conns_;
+    std::unordered_map<int, int> client_udp_;    // client sockets (value unused)
+    std::unordered_map<int, std::pair<Conn*, Stream*>> locals_;   // socketpair ends
+    double loss_ = 0;
+    FecConfig fec_;              // server: default; client: our choice
+    bool fec_chosen_ = false;    // client: fec_ was set (env or set_client_fec)
+    std::mt19937 rng_{std::random_device{}()};
+};
+
+bool parse_fec(const std::string& s, FecConfig& out) {
+    if (s == "off" || s == "0") {
+        out = FecConfig{};
+        return true;
+    }
+    auto plus = s.find('+');
+    if (plus == std::string::npos || plus == 0 || plus + 1 == s.size() ||
+        s.find_first_not_of("0123456789+") != std::string::npos || s.size() > 7) return false;
+    FecConfig f{std::stoi(s.substr(0, plus)), std::stoi(s.substr(plus + 1))};
+    if (f.r != 0 && !valid_fec(f)) return false;
+    out = f.r == 0 ? FecConfig{} : f;
+    return true;
+}
+
+// one transport thread for all client streams
+static Engine& client_engine() {
+    static Engine engine;
+    return engine;
+}
+
+void set_client_fec(const FecConfig& fec) { client_engine().set_fec(fec); }
+
+int open_stream(const std::string& host, int port) {
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags = AI_ADDRCONFIG | AI_NUMERICSERV;
+    addrinfo* res = nullptr;
+    int rc = getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &res);
+    if (rc != 0) { errno = rc == EAI_SYSTEM ? errno : EHOSTUNREACH; return -1; }
+    sockaddr_storage addr{};
+    std::memcpy(&addr, res->ai_addr, res->ai_addrlen);
+    socklen_t len = res->ai_addrlen;
+    freeaddrinfo(res);
+    return client_engine().open_stream(addr, len);
+}
+
+Server::Server(int udp_fd, StreamHandler on_stream, const FecConfig& fec)
+    : engine_(std::make_unique<Engine>(udp_fd, std::move(on_stream), fec)) {}
+
+Server::~Server() = default;
+
+void Server::set_fec(const FecConfig& fec) { engine_->set_fec(fec); }
+
+void Server::stop_accepting() { engine_->stop_accepting(); }
+
+void Server::close_all() { engine_->close_all(); }
+
+} // namespace udp
@@ -0,0 +1,90 @@
+// udp_transport.hpp (C++17)
+// Reliable streams over UDP for lossy, high-latency links. Part of libfileshare.
+//
+// A UDP connection carries any number of independent byte streams, and each
+// stream is one ordinary session: the same AUTH/LIST/GET/PUT lines and file
+// framing as over TCP. The transport bridges every stream to an AF_UNIX
+// socketpair, so both ends keep working with plain fds:
+//   - client: udp::open_stream() returns a connected fd; streams to the same
+//     server share one connection and its congestion window
+//   - server: udp::Server passes each new stream to a callback as an fd
+//
+// Reliability is QUIC (RFC 9000/9002) in miniature:
+//   - packet numbers are never reused, and lost stream data goes out again in
+//     new packets
+//   - ACKs carry up to 32 ranges, so one ACK can report many gaps
+//   - loss is declared after 3 later packets or 9/8 RTT, with a probe timeout
+//     behind that
+//   - a paced NewReno window limits the bytes in flight, and each stream has
+//     a 4 MiB flow control window
+// A lost packet only stalls its own stream. Optional forward error correction
+// adds r Reed-Solomon repair packets (fec.hpp) after every k packets, so up to
+// r losses in such a group are rebuilt by the receiver instead of costing a
+// retransmission round trip (or a smaller window). There is no encryption (same as
+// the TCP protocol), no path MTU discovery (payloads are 1200 bytes) and no
+// connection migration.
+//
+// For tests, FILESHARE_UDP_LOSS=0.05 in the environment drops that fraction
+// of the datagrams a process receives. FILESHARE_UDP_FEC=16+4 sets the client
+// side's FEC (see set_client_fec).
+#pragma once
+
+#include <sys/socket.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace udp {
+
+class Engine;
+
+// k data packets per group, r repair packets; r = 0 means no FEC.
+struct FecConfig {
+    int k = 0;
+    int r = 0;
+    bool enabled() const { return k > 0 && r > 0; }
+};
+inline constexpr int MAX_FEC_GROUP = 64;   // limit for k and for r
+
+// "off" or "K+R" (e.g. "16+4", up to 64+64); false if malformed.
+bool parse_fec(const std::string& s, FecConfig& out);
+
+// Client: FEC for connections opened from now on, in both directions (the
+// server sends with the same settings). Without a call, FILESHARE_UDP_FEC is
+// used, and otherwise the server's default.
+void set_client_fec(const FecConfig& fec);
+
+// Client: a new stream to the server at host:port (name or address). The
+// handshake runs in the background on a transport thread shared by the
+// process; if the server never answers, the fd reports EOF. -1 with errno
+// when the name does not resolve.
+int open_stream(const std::string& host, int port);
+
+class Server {
+public:
+    // Runs on the transport thread for every new stream, with the session's
+    // end of the socketpair (blocking, close-on-exec; the callee owns it) and
+    // the client's address.
+    using StreamHandler = std::function<void(int fd, const sockaddr_storage& peer)>;
+
+    // Serve on a bound UDP socket (listen_endpoint("udp:...")); takes the fd.
+    // fec applies to clients that do not choose their own.
+    Server(int udp_fd, StreamHandler on_stream, const FecConfig& fec = {});
+    ~Server();   // closes every connection
+    Server(const Server&) = delete;
+    Server& operator=(const Server&) = delete;
+
+    // New default FEC, for connections from now on.
+    void set_fec(const FecConfig& fec);
+    // Drain: streams opened from now on are closed at once.
+    void stop_accepting();
+    // Hot upgrade: end every connection and stop reading the socket, which now
+    // belongs to the new server.
+    void close_all();
+
+private:
+    std::unique_ptr<Engine> engine_;
+};
+
+} // namespace udp
@@ -0,0 +1,128 @@
+// user_limits.cpp (C++17)
+// Lock-free per-user usage table (see user_limits.hpp).
+#include "user_limits.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+
+bool try_acquire(std::atomic<int>& c, int max) {
+    int cur = c.load();
+    do {
+        if (max > 0 && cur >= max) return false;
+    } while (!c.compare_exchange_weak(cur, cur + 1));
+    return true;
+}
+
+UsageTable::UsageTable(size_t capacity)
+    : slots_(new UserUsage[capacity ? capacity : 1]), capacity_(capacity ? capacity : 1) {}
+
+UsageTable::~UsageTable() {
+    stop_ = true;
+    if (saver_.joinable()) saver_.join();
+}
+
+UserUsage* UsageTable::get(const std::string& user) {
+    if (user.empty() || user.size() >= sizeof(UserUsage::name)) return nullptr;
+    size_t start = std::hash<std::string>{}(user) % capacity_;
+    // open addressing; slots are never released, so a probe can stop at the
+    // first free slot
+    for (size_t i = 0; i < capacity_; ++i) {
+        UserUsage& s = slots_[(start + i) % capacity_];
+        int st = s.state.load(std::memory_order_acquire);
+        if (st == 0) {
+            int expected = 0;
+            if (s.state.compare_exchange_strong(expected, 1, std::memory_order_acq_rel)) {
+                std::memcpy(s.name, user.c_str(), user.size() + 1);
+                s.state.store(2, std::memory_order_release);
+                return &s;
+            }
+            st = expected;
+        }
+        while (st == 1) st = s.state.load(std::memory_order_acquire);   // claim in progress
+        if (user == s.name) return &s;
+    }
+    return nullptr;
+}
+
+bool UsageTable::reserve(UserUsage* u, uint64_t bytes, uint64_t quota) {
+    uint64_t cur = u->stored.load();
+    do {
+        if (quota > 0 && cur + bytes > quota) return false;
+    } while (!u->stored.compare_exchange_weak(cur, cur + bytes));
+    return true;
+}
+
+void UsageTable::release(UserUsage* u, uint64_t bytes) {
+    u->stored.fetch_sub(bytes);
+}
+
+void UsageTable::commit_upload(UserUsage* u, const std::string& file, uint64_t size) {
+    std::lock_guard<std::mutex> lk(mu_);
+    auto it = owners_.find(file);
+    if (it != owners_.end()) {
+        it->second.user->stored.fetch_sub(it->second.size);
+        it->second = Owner{u, size};
+    } else {
+        owners_.emplace(file, Owner{u, size});
+    }
+    dirty_ = true;
+}
+
+std::string UsageTable::owner(const std::string& file) {
+    std::lock_guard<std::mutex> lk(mu_);
+    auto it = owners_.find(file);
+    return it == owners_.end() ? "" : it->second.user->name;
+}
+
+bool UsageTable::load(const std::string& path) {
+    std::ifstream in(path);
+    if (!in) return false;
+    std::lock_guard<std::mutex> lk(mu_);
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream iss(line);
+        std::string owner, file;
+        uint64_t size = 0;
+        if (!std::getline(iss, owner, '\t') || !(iss >> size) || !iss.ignore(1) ||
+            !std::getline(iss, file) || file.empty()) continue;
+        UserUsage* u = get(owner);
+        if (!u) continue;
+        u->stored.fetch_add(size);
+        owners_[file] = Owner{u, size};
+    }
+    return true;
+}
+
+bool UsageTable::save(const std::string& path) {
+    std::ostringstream oss;
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        for (auto& [file, o] : owners_) oss << o.user->name << '\t' << o.size << '\t' << file << '\n';
+        dirty_ = false;
+    }
+    std::string tmp = path + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::trunc);
+        if (!out) return false;
+        out << oss.str();
+        if (!out.flush()) return false;
+    }
+    return std::rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+void UsageTable::start_autosave(const std::string& path, std::chrono::seconds every) {
+    saver_ = std::thread([this, path, every] {
+        auto next = std::chrono::steady_clock::now() + every;
+        while (!stop_) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+            if (std::chrono::steady_clock::now() < next) continue;
+            next += every;
+            if (dirty_ && !save(path)) std::cerr << "Failed to save " << path << "\n";
+        }
+        if (dirty_) save(path);
+    });
+}
@@ -0,0 +1,86 @@
+// user_limits.hpp (C++17)
+// Per-user usage accounting for the limits in users.txt (sessions=,
+// transfers=, quota=). The table is allocated once at startup and slots are
+// claimed with a CAS, so looking a user up and bumping counters never takes a
+// lock. Only committing a finished upload (ownership bookkeeping) and the
+// periodic save touch a mutex.
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+
+struct UserUsage {
+    std::atomic<int> state{0};            // 0 free, 1 being claimed, 2 in use
+    char name[64] = {};
+    std::atomic<int> sessions{0};
+    std::atomic<int> transfers{0};
+    std::atomic<uint64_t> stored{0};      // bytes in UPLOAD_DIR, incl. running PUTs
+};
+
+// Increment c unless it already reached max (0 = unlimited).
+bool try_acquire(std::atomic<int>& c, int max);
+
+// Decrements the counter when the scope (or coroutine) ends.
+class CounterGuard {
+public:
+    CounterGuard() = default;
+    explicit CounterGuard(std::atomic<int>* c) : c_(c) {}
+    CounterGuard(CounterGuard&& o) noexcept : c_(o.c_) { o.c_ = nullptr; }
+    CounterGuard& operator=(CounterGuard&& o) noexcept { std::swap(c_, o.c_); return *this; }
+    CounterGuard(const CounterGuard&) = delete;
+    CounterGuard& operator=(const CounterGuard&) = delete;
+    ~CounterGuard() { if (c_) c_->fetch_sub(1); }
+
+private:
+    std::atomic<int>* c_ = nullptr;
+};
+
+class UsageTable {
+public:
+    explicit UsageTable(size_t capacity = 4096);
+    ~UsageTable();
+
+    // Slot for user, claimed on first use; nullptr if the table is full or
+    // the name does not fit.
+    UserUsage* get(const std::string& user);
+
+    // Reserve bytes of quota before an upload (0 = unlimited), give them back
+    // when it fails.
+    bool reserve(UserUsage* u, uint64_t bytes, uint64_t quota);
+    void release(UserUsage* u, uint64_t bytes);
+
+    // A PUT of `size` reserved bytes finished as `file`; the previous version
+    // of the file (if any) no longer counts against its owner.
+    void commit_upload(UserUsage* u, const std::string& file, uint64_t size);
+    // Who uploaded file, packed or not; "" if no upload is recorded.
+    std::string owner(const std::string& file);
+
+    // usage file: one "owner<TAB>size<TAB>file" line per upload
+    bool load(const std::string& path);
+    bool save(const std::string& path);
+    // Save every `every` from a background thread while anything changed.
+    void start_autosave(const std::string& path, std::chrono::seconds every);
+
+private:
+    struct Owner {
+        UserUsage* user;
+        uint64_t size;
+    };
+
+    std::unique_ptr<UserUsage[]> slots_;
+    size_t capacity_;
+
+    std::mutex mu_;                                   // guards owners_
+    std::unordered_map<std::string, Owner> owners_;
+    std::atomic<bool> dirty_{false};
+
+    std::atomic<bool> stop_{false};
+    std::thread saver_;
+};
@@ -0,0 +1,84 @@
+// users.cpp (C++17)
+// users.txt parsing (see users.hpp).
+#include "users.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include "rate_limit.hpp"
+
+static const char* const OPTION_KEYS[] = {"rate", "sessions", "transfers", "quota"};
+
+// True when s is a list of known key=value options (an empty list too);
+// applies them to u when given.
+static bool parse_options(const std::string& s, UserInfo* u) {
+    std::istringstream opts(s);
+    std::string kv;
+    while (std::getline(opts, kv, ',')) {
+        auto eq = kv.find('=');
+        if (eq == std::string::npos) return false;
+        std::string key = kv.substr(0, eq), val = kv.substr(eq + 1);
+        if (std::find(std::begin(OPTION_KEYS), std::end(OPTION_KEYS), key) == std::end(OPTION_KEYS)) return false;
+        if (!u) continue;
+        if (key == "rate") u->rate = parse_rate(val);
+        else if (key == "sessions") u->max_sessions = std::max(0, std::atoi(val.c_str()));
+        else if (key == "transfers") u->max_transfers = std::max(0, std::atoi(val.c_str()));
+        else if (key == "quota") u->quota = parse_rate(val);
+    }
+    return true;
+}
+
+// Splits "user:pass[:options]". The last field is the options only when it
+// parses as an option list; otherwise it belongs to the password, so
+// passwords with ':' in them keep working.
+static bool split_line(const std::string& line, std::string& user, std::string& pass, std::string& opts) {
+    auto pos = line.find(':');
+    if (pos == std::string::npos) return false;
+    user = line.substr(0, pos);
+    pass = line.substr(pos + 1);
+    opts.clear();
+    auto last = pass.rfind(':');
+    if (last != std::string::npos && parse_options(pass.substr(last + 1), nullptr)) {
+        opts = pass.substr(last + 1);
+        pass.resize(last);
+    }
+    return true;
+}
+
+std::optional<UserInfo> check_auth(const std::string& users_file,
+                                   const std::string& user, const std::string& pass) {
+    std::ifstream in(users_file);
+    if (!in) return std::nullopt;
+    std::string line, u, p, opts;
+    while (std::getline(in, line)) {
+        if (!split_line(line, u, p, opts) || u != user || p != pass) continue;
+        UserInfo info;
+        info.name = u;
+        parse_options(opts, &info);
+        return info;
+    }
+    return std::nullopt;
+}
+
+void check_users_file(const std::string& users_file) {
+    std::ifstream in(users_file);
+    if (!in) {
+        std::cerr << "Warning: cannot read " << users_file << "\n";
+        return;
+    }
+    std::string line, u, p, opts;
+    for (int n = 1; std::getline(in, line); ++n) {
+        // skip lines with options, or with an empty option list (trailing ':')
+        if (!split_line(line, u, p, opts) || !opts.empty() || line.back() == ':') continue;
+        // a last field that looks like options but does not parse is read
+        // as part of the password, which is rarely what was meant
+        auto last = p.rfind(':');
+        if (last == std::string::npos || p.find('=', last) == std::string::npos) continue;
+        std::cerr << "Warning: " << users_file << ":" << n << ": \"" << p.substr(last + 1)
+                  << "\" is not a list of known options (rate, sessions, transfers, quota);"
+                  << " it is read as part of " << u << "'s password\n";
+    }
+}
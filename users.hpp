@@ -0,0 +1,32 @@
+// users.hpp (C++17)
+// Accounts from users.txt. One account per line:
+//   user:pass[:key=value,key=value...]
+// The last field is the options only if every item is a known key=value;
+// otherwise it is part of the password. A password that itself ends in
+// something like ":rate=1M" needs an empty option list after it ("user:pw:").
+// Known keys:
+//   rate=10M      bandwidth cap for all of the user's transfers together (bytes/s)
+//   sessions=N    concurrent logins
+//   transfers=N   concurrent GET/PUTs over all of the user's sessions
+//   quota=1G      bytes the user may keep in the uploads directory
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+
+struct UserInfo {
+    std::string name;
+    uint64_t rate = 0;       // bytes per second, 0 = unlimited
+    int max_sessions = 0;    // 0 = unlimited
+    int max_transfers = 0;   // 0 = unlimited
+    uint64_t quota = 0;      // bytes, 0 = unlimited
+};
+
+// Returns the account when user/pass match a line of users_file.
+std::optional<UserInfo> check_auth(const std::string& users_file,
+                                   const std::string& user, const std::string& pass);
+
+// Warns on stderr about lines whose last field looks like options but is not
+// a valid option list (and so is read as part of the password).
+void check_users_file(const std::string& users_file);
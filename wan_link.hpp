@@ -0,0 +1,65 @@
+// wan_link.hpp (C++17)
+// The link model of the benchmark tools: one direction of an emulated WAN
+// path with a delay, jitter, a bandwidth bottleneck with a bounded queue in
+// front of it, and random loss. wan_proxy applies it to TCP segments and UDP
+// datagrams; fec_bench's built-in proxy to the UDP transport's datagrams.
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <random>
+
+namespace wan {
+
+using Clock = std::chrono::steady_clock;
+using std::chrono::microseconds;
+
+struct Impairment {
+    microseconds delay{0};       // one way
+    microseconds jitter{0};      // delay varies by up to this much either way
+    uint64_t rate = 0;           // bytes/s each way, 0 = unlimited
+    double loss = 0;             // per packet (TCP: per segment)
+    microseconds loss_delay{-1}; // TCP: how late a lost segment arrives; -1 = one round trip
+    size_t queue = 1 << 20;      // bytes that may wait for the bottleneck
+    size_t window = 64 << 20;    // TCP: bytes held per direction at most
+    uint32_t seed = 1;
+};
+
+// Link state of one direction: when the bottleneck is next free, and the
+// random source for jitter and loss.
+struct Link {
+    const Impairment& imp;
+    Clock::time_point free_at{};
+    std::mt19937 rng;
+    std::uniform_real_distribution<double> unit{0, 1};
+
+    Link(const Impairment& i, uint32_t seed) : imp(i), rng(seed) {}
+
+    // Bytes still waiting for the bottleneck at now.
+    double backlog(Clock::time_point now) const {
+        if (!imp.rate || free_at <= now) return 0;
+        return std::chrono::duration<double>(free_at - now).count() * (double)imp.rate;
+    }
+
+    // Arrival time of an n-byte packet offered at now; false if the queue in
+    // front of the bottleneck is full (a tail drop).
+    bool schedule(size_t n, Clock::time_point now, Clock::time_point& due) {
+        if (free_at < now) free_at = now;
+        if (imp.rate) {
+            if (backlog(now) + (double)n > (double)imp.queue) return false;
+            free_at += std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>((double)n / (double)imp.rate));
+        }
+        due = free_at + imp.delay;
+        if (imp.jitter.count() > 0) {
+            auto j = (unit(rng) * 2 - 1) * (double)imp.jitter.count();
+            due += microseconds((int64_t)j);
+            if (due < free_at) due = free_at;
+        }
+        return true;
+    }
+
+    bool lost() { return imp.loss > 0 && unit(rng) < imp.loss; }
+};
+
+} // namespace wan
@@ -0,0 +1,313 @@
+// wan_proxy.cpp (C++17)
+// WAN emulator for benchmarks: forwards connections (or datagrams) from a local
+// endpoint to the server, adding latency, jitter, a bandwidth cap and loss in
+// both directions, so transfers can be measured on loopback as if over a
+// slow or lossy link. Randomness comes from --seed, so runs repeat exactly.
+// Usage: ./wan_proxy <listen> <host> <port> [--delay MS] [--jitter MS]
+//            [--rate RATE] [--loss P] [--loss-delay MS] [--queue SIZE]
+//            [--window SIZE] [--seed N]
+// listen is an endpoint as in --listen (e.g. 9000, 127.0.0.1:9000); udp:PORT
+// forwards datagrams for the UDP transport instead of TCP connections.
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "endpoint.hpp"
+#include "rate_limit.hpp"
+#include "wan_link.hpp"
+
+using Clock = std::chrono::steady_clock;
+using std::chrono::microseconds;
+
+namespace {
+
+using wan::Impairment;
+using wan::Link;
+
+Impairment imp;
+std::string target_host, target_port;
+
+constexpr size_t SEGMENT = 1448;   // TCP payload per emulated packet
+
+void set_nonblocking(int fd) { fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK); }
+
+int connect_target(int socktype) {
+    addrinfo hints{};
+    hints.ai_socktype = socktype;
+    addrinfo* res = nullptr;
+    if (getaddrinfo(target_host.c_str(), target_port.c_str(), &hints, &res) != 0) return -1;
+    int fd = -1;
+    for (addrinfo* a = res; a && fd < 0; a = a->ai_next) {
+        fd = ::socket(a->ai_family, a->ai_socktype | SOCK_CLOEXEC, a->ai_protocol);
+        if (fd >= 0 && ::connect(fd, a->ai_addr, a->ai_addrlen) < 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+// ---- TCP: a byte stream cannot lose data, so a "lost" segment arrives late,
+// as it would after a retransmission, and holds back everything behind it.
+
+struct Segment {
+    Clock::time_point due;
+    std::string bytes;
+    size_t off = 0;
+};
+
+struct Direction {
+    int from, to;
+    Link link;
+    std::deque<Segment> q;
+    size_t queued = 0;
+    bool eof = false, shut = false;
+    Clock::time_point last_due{};
+    uint64_t bytes = 0;
+
+    Direction(int f, int t, uint32_t seed) : from(f), to(t), link(imp, seed) {}
+
+    // Like a sender, stop while the bottleneck queue is full.
+    bool want_read(Clock::time_point now) const {
+        return !eof && queued < imp.window && link.backlog(now) < (double)imp.queue;
+    }
+
+    // False on a read error.
+    bool read_some() {
+        char buf[16384];
+        ssize_t n = ::read(from, buf, sizeof(buf));
+        if (n == 0) eof = true;
+        if (n < 0) return errno == EAGAIN || errno == EINTR;
+        auto now = Clock::now();
+        for (ssize_t off = 0; off < n; off += (ssize_t)SEGMENT) {
+            size_t len = std::min<size_t>(SEGMENT, (size_t)(n - off));
+            Clock::time_point due;
+            link.schedule(len, link.free_at > now ? link.free_at : now, due);   // never a tail drop: read waits instead
+            if (link.lost()) {
+                auto extra = imp.loss_delay.count() >= 0 ? imp.loss_delay : 2 * imp.delay + microseconds(1000);
+                due += extra;
+            }
+            due = std::max(due, last_due);   // in order, like TCP delivers it
+            last_due = due;
+            q.push_back({due, std::string(buf + off, len)});
+            queued += len;
+        }
+        return true;
+    }
+
+    // False on a write error.
+    bool write_due(Clock::time_point now) {
+        while (!q.empty() && q.front().due <= now) {
+            Segment& s = q.front();
+            ssize_t n = ::send(to, s.bytes.data() + s.off, s.bytes.size() - s.off, MSG_NOSIGNAL);
+            if (n < 0) return errno == EAGAIN || errno == EINTR;
+            s.off += (size_t)n;
+            bytes += (uint64_t)n;
+            if (s.off < s.bytes.size()) return true;
+            queued -= s.bytes.size();
+            q.pop_front();
+        }
+        if (eof && q.empty() && !shut) {
+            ::shutdown(to, SHUT_WR);
+            shut = true;
+        }
+        return true;
+    }
+};
+
+void relay_tcp(int client, int id) {
+    int server = connect_target(SOCK_STREAM);
+    if (server < 0) {
+        std::cerr << "conn " << id << ": cannot connect to " << target_host << ":" << target_port << "\n";
+        ::close(client);
+        return;
+    }
+    set_nonblocking(client);
+    set_nonblocking(server);
+    Direction up(client, server, imp.seed + 2 * (uint32_t)id), down(server, client, imp.seed + 2 * (uint32_t)id + 1);
+    Direction* dirs[2] = {&up, &down};
+    auto start = Clock::now();
+    bool ok = true;
+    while (ok && !(up.shut && down.shut)) {
+        auto now = Clock::now();
+        pollfd p[2] = {{client, 0, 0}, {server, 0, 0}};
+        int timeout = 1000;
+        for (Direction* d : dirs) {
+            pollfd& in = d->from == client ? p[0] : p[1];
+            pollfd& out = d->to == client ? p[0] : p[1];
+            if (d->want_read(now)) {
+                in.events |= POLLIN;
+            } else if (!d->eof && imp.rate) {   // wake when the bottleneck has room again
+                auto room = d->link.free_at - std::chrono::duration_cast<Clock::duration>(
+                                                  std::chrono::duration<double>((double)imp.queue / (double)imp.rate));
+                auto wait = std::chrono::ceil<std::chrono::milliseconds>(room - now).count();
+                timeout = std::min<int>(timeout, (int)std::max<int64_t>(wait, 0));
+            }
+            if (d->q.empty()) continue;
+            if (d->q.front().due <= now) out.events |= POLLOUT;
+            else {
+                auto wait = std::chrono::ceil<std::chrono::milliseconds>(d->q.front().due - now).count();
+                timeout = std::min<int>(timeout, (int)wait);
+            }
+        }
+        // POLLHUP is reported even when not asked for: a socket closed at both
+        // ends while segments are still delayed would wake poll at once, every pass
+        for (pollfd& x : p)
+            if (!x.events) x.fd = -1;
+        if (poll(p, 2, timeout) < 0 && errno != EINTR) break;
+        for (Direction* d : dirs) {
+            pollfd& in = d->from == client ? p[0] : p[1];
+            if (!d->eof && (in.revents & (POLLIN | POLLHUP | POLLERR))) ok = ok && d->read_some();
+            ok = ok && d->write_due(Clock::now());
+        }
+    }
+    double secs = std::chrono::duration<double>(Clock::now() - start).count();
+    std::cout << "conn " << id << ": " << up.bytes << " bytes up, " << down.bytes << " bytes down in "
+              << secs << " s" << (ok ? "" : " (reset)") << std::endl;
+    ::close(client);
+    ::close(server);
+}
+
+int run_tcp(int lfd) {
+    for (int id = 1;; ++id) {
+        int c = ::accept4(lfd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (c < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            perror("accept");
+            return 1;
+        }
+        std::thread(relay_tcp, c, id).detach();
+    }
+}
+
+// ---- UDP: datagrams are really dropped, and jitter may reorder them.
+
+struct Peer {
+    sockaddr_storage addr{};
+    socklen_t len = 0;
+    int fd = -1;   // connected to the server
+    Link up, down;
+
+    Peer(uint32_t seed) : up(imp, seed), down(imp, seed + 1) {}
+};
+
+struct Pending {
+    int fd;
+    Peer* to_client;   // null: send on fd (towards the server)
+    std::string bytes;
+};
+
+int run_udp(int front) {
+    set_nonblocking(front);
+    std::map<std::string, Peer*> peers;   // by client address bytes
+    std::vector<Peer*> by_index;
+    std::multimap<Clock::time_point, Pending> due;
+    char buf[65536];
+    while (true) {
+        int timeout = 1000;
+        if (!due.empty()) {
+            auto wait = std::chrono::ceil<std::chrono::milliseconds>(due.begin()->first - Clock::now()).count();
+            timeout = (int)std::clamp<int64_t>(wait, 0, 1000);
+        }
+        std::vector<pollfd> p{{front, POLLIN, 0}};
+        for (Peer* peer : by_index) p.push_back({peer->fd, POLLIN, 0});
+        if (poll(p.data(), p.size(), timeout) < 0 && errno != EINTR) return 1;
+        auto now = Clock::now();
+        for (size_t i = 0; i < p.size(); ++i) {
+            if (!(p[i].revents & POLLIN)) continue;
+            while (true) {
+                sockaddr_storage from{};
+                socklen_t flen = sizeof(from);
+                ssize_t n = ::recvfrom(p[i].fd, buf, sizeof(buf), MSG_DONTWAIT, (sockaddr*)&from, &flen);
+                if (n < 0) break;
+                Peer* peer;
+                if (i == 0) {
+                    std::string key((const char*)&from, flen);
+                    auto it = peers.find(key);
+                    if (it == peers.end()) {
+                        int fd = connect_target(SOCK_DGRAM);
+                        if (fd < 0) break;
+                        set_nonblocking(fd);
+                        peer = new Peer(imp.seed + 2 * (uint32_t)by_index.size());
+                        peer->addr = from;
+                        peer->len = flen;
+                        peer->fd = fd;
+                        peers[key] = peer;
+                        by_index.push_back(peer);
+                        std::cout << "peer " << by_index.size() << ": " << proto::sockaddr_name(from) << std::endl;
+                    } else {
+                        peer = it->second;
+                    }
+                } else {
+                    peer = by_index[i - 1];
+                }
+                Link& link = i == 0 ? peer->up : peer->down;
+                Clock::time_point when;
+                if (link.lost() || !link.schedule((size_t)n, now, when)) continue;
+                due.emplace(when, Pending{i == 0 ? peer->fd : front, i == 0 ? nullptr : peer, std::string(buf, (size_t)n)});
+            }
+        }
+        now = Clock::now();
+        while (!due.empty() && due.begin()->first <= now) {
+            Pending& d = due.begin()->second;
+            if (d.to_client) ::sendto(d.fd, d.bytes.data(), d.bytes.size(), 0, (sockaddr*)&d.to_client->addr, d.to_client->len);
+            else ::send(d.fd, d.bytes.data(), d.bytes.size(), 0);
+            due.erase(due.begin());
+        }
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    if (argc < 4) {
+        std::cerr << "Usage: " << argv[0] << " <listen> <host> <port> [--delay MS] [--jitter MS] [--rate RATE]"
+                  << " [--loss P] [--loss-delay MS] [--queue SIZE] [--window SIZE] [--seed N]\n";
+        return 1;
+    }
+    target_host = argv[2];
+    target_port = argv[3];
+    auto ms = [](const char* s) { return microseconds((int64_t)(std::stod(s) * 1000)); };
+    for (int i = 4; i < argc; i += 2) {
+        std::string flag = argv[i];
+        if (i + 1 >= argc) { std::cerr << flag << " needs a value\n"; return 1; }
+        const char* v = argv[i + 1];
+        if (flag == "--delay") imp.delay = ms(v);
+        else if (flag == "--jitter") imp.jitter = ms(v);
+        else if (flag == "--rate") imp.rate = parse_rate(v);
+        else if (flag == "--loss") imp.loss = std::stod(v);
+        else if (flag == "--loss-delay") imp.loss_delay = ms(v);
+        else if (flag == "--queue") imp.queue = parse_rate(v);
+        else if (flag == "--window") imp.window = parse_rate(v);
+        else if (flag == "--seed") imp.seed = (uint32_t)std::stoul(v);
+        else { std::cerr << "Unknown flag " << flag << "\n"; return 1; }
+        if ((flag == "--rate" && !imp.rate) || (flag == "--queue" && !imp.queue) ||
+            (flag == "--window" && !imp.window) || imp.loss < 0 || imp.loss > 1) {
+            std::cerr << "Bad value for " << flag << ": " << v << "\n";
+            return 1;
+        }
+    }
+
+    proto::Endpoint ep;
+    if (!proto::parse_endpoint(argv[1], ep)) { std::cerr << "Bad listen endpoint " << argv[1] << "\n"; return 1; }
+    int lfd = proto::listen_endpoint(argv[1]);
+    if (lfd < 0) { perror(argv[1]); return 1; }
+    std::cout << "Forwarding " << argv[1] << " to " << target_host << ":" << target_port << " (delay " << imp.delay.count() / 1000.0 << " ms, jitter " << imp.jitter.count() / 1000.0 << " ms, rate "
+              << (imp.rate ? std::to_string(imp.rate) + " B/s" : "unlimited") << ", loss " << imp.loss << ", seed "
+              << imp.seed << ")" << std::endl;
+    return ep.is_udp ? run_udp(lfd) : run_tcp(lfd);
+}
@@ -0,0 +1,75 @@
+// work_stealing.cpp (C++17)
+// Implementation of the work-stealing thread pool (see work_stealing.hpp).
+#include "work_stealing.hpp"
+
+#include <chrono>
+
+WorkStealingPool::WorkStealingPool(unsigned threads) {
+    if (threads == 0) threads = 1;
+    for (unsigned i = 0; i < threads; ++i) workers_.push_back(std::make_unique<Worker>());
+    for (unsigned i = 0; i < threads; ++i) threads_.emplace_back(&WorkStealingPool::run, this, i);
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    {
+        std::lock_guard<std::mutex> lk(sleep_mu_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+    for (auto& t : threads_) t.join();
+}
+
+void WorkStealingPool::submit(Job job, unsigned home) {
+    Worker& w = *workers_[home % workers_.size()];
+    {
+        std::lock_guard<std::mutex> lk(w.mu);
+        w.jobs.push_back(std::move(job));
+    }
+    pending_.fetch_add(1);
+    {
+        // pairs with the predicate check in run() so the wakeup is not lost
+        std::lock_guard<std::mutex> lk(sleep_mu_);
+    }
+    wake_.notify_one();
+}
+
+bool WorkStealingPool::pop_own(unsigned self, Job& out) {
+    Worker& w = *workers_[self];
+    std::lock_guard<std::mutex> lk(w.mu);
+    if (w.jobs.empty()) return false;
+    out = std::move(w.jobs.back());
+    w.jobs.pop_back();
+    return true;
+}
+
+bool WorkStealingPool::steal(unsigned self, Job& out) {
+    size_t n = workers_.size();
+    for (size_t k = 1; k < n; ++k) {
+        Worker& victim = *workers_[(self + k) % n];
+        std::unique_lock<std::mutex> lk(victim.mu, std::try_to_lock);
+        if (!lk.owns_lock() || victim.jobs.empty()) continue;
+        out = std::move(victim.jobs.front());
+        victim.jobs.pop_front();
+        steals_.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+    return false;
+}
+
+void WorkStealingPool::run(unsigned self) {
+    Job job;
+    while (true) {
+        if (pop_own(self, job) || steal(self, job)) {
+            pending_.fetch_sub(1);
+            job();
+            job = nullptr;
+            continue;
+        }
+        std::unique_lock<std::mutex> lk(sleep_mu_);
+        if (stop_) return;
+        // jobs may be left only behind a victim lock we failed to take; recheck soon
+        wake_.wait_for(lk, std::chrono::milliseconds(10),
+                       [this] { return stop_ || pending_.load() > 0; });
+        if (stop_) return;
+    }
+}
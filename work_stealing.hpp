@@ -0,0 +1,51 @@
+// work_stealing.hpp (C++17)
+// Thread pool with one job deque per worker. A worker pops its own deque from
+// the back (LIFO, cache friendly) and, when it runs dry, steals from the front
+// of the others, so a burst of chunk jobs submitted to one worker spreads over
+// every core.
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class WorkStealingPool {
+public:
+    using Job = std::function<void()>;
+
+    explicit WorkStealingPool(unsigned threads);
+    ~WorkStealingPool();
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    // Queue a job on worker `home % size()` (callers use their reactor index so
+    // unrelated connections start on different deques). Thread-safe.
+    void submit(Job job, unsigned home);
+
+    unsigned size() const { return (unsigned)workers_.size(); }
+    uint64_t steals() const { return steals_.load(std::memory_order_relaxed); }
+
+private:
+    struct Worker {
+        std::mutex mu;
+        std::deque<Job> jobs;
+    };
+
+    void run(unsigned self);
+    bool pop_own(unsigned self, Job& out);
+    bool steal(unsigned self, Job& out);
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::vector<std::thread> threads_;
+    std::atomic<size_t> pending_{0};
+    std::atomic<bool> stop_{false};
+    std::atomic<uint64_t> steals_{0};
+    std::mutex sleep_mu_;
+    std::condition_variable wake_;
+};